@@ -177,10 +177,11 @@ struct MyApp : App {
       // but here it needs to be done manually
       mesh.vao().bind();
       if (mesh.indices().size()) {
-        // when using index buffer, remember to bind it too
+        // when using index buffer, remember to bind it too. Small meshes
+        // use 16 bit indices, so draw with the mesh's index type
         mesh.indexBuffer().bind();
         glDrawElementsInstanced(GL_TRIANGLES, mesh.indices().size(),
-                                GL_UNSIGNED_INT, 0, positions.size());
+                                mesh.indexType(), 0, positions.size());
       } else {
         glDrawArraysInstanced(GL_TRIANGLES, 0, mesh.vertices().size(),
                               positions.size());
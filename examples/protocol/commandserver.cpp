@@ -11,14 +11,20 @@ class MyServer : public CommandServer {
 public:
   void initiateConversation() {
     std::cout << "Server requesting order" << std::endl;
-    for (auto listener : mServerConnections) {
+    std::vector<std::shared_ptr<Socket>> listeners;
+    {
+      // Connections are added and removed by the server thread
+      std::unique_lock<std::mutex> lk(mConnectionsLock);
+      listeners = mServerConnections;
+    }
+    for (auto listener : listeners) {
       std::cout << "Sending command to " << listener->address() << ":"
                 << listener->port() << std::endl;
       unsigned char message[8] = {0, 0};
 
       message[0] = ASK_CLIENT_FOR_ORDER;
-      if (listener->send((const char *)message, 2) == 2) {
-      } else {
+      // Messages are queued and framed, so don't write to the socket directly
+      if (!sendMessage(message, 2, listener.get())) {
         std::cerr << "ERROR sending command" << std::endl;
       }
     }
@@ -44,7 +50,7 @@ public:
 
       uint8_t message[7] = {TELL_SERVER_ORDER, 'w', 'a', 't', 'e', 'r', 0};
 
-      if (!(mSocket.send((const char *)message, 7) == 7)) {
+      if (!sendMessage(message, 7)) {
         std::cerr << "ERROR sending reply" << std::endl;
         return false;
       }
@@ -0,0 +1,51 @@
+#include "al/math/al_Random.hpp"
+#include "al/protocol/al_FrameBarrier.hpp"
+
+#include <cstdio>
+
+using namespace al;
+
+// Run several instances of this program. The first one becomes the primary
+// and the others renderers that wait for each other at every frame. Each
+// instance simulates a different amount of drawing time.
+
+int main() {
+  FrameBarrierServer server;
+  FrameBarrierClient client;
+  bool isPrimary = server.start(34460, "localhost");
+  if (!isPrimary && !client.start(34460, "localhost")) {
+    std::cerr << "ERROR starting frame barrier" << std::endl;
+    return -1;
+  }
+  std::cout << (isPrimary ? "Primary" : "Renderer") << " started" << std::endl;
+
+  rnd::Random<> random;
+  al_sec drawTime = isPrimary ? 0.005 : 0.002 + 0.01 * random.uniform();
+  for (int i = 0; i < 600; i++) {
+    al_sleep(drawTime);
+    al_sec syncTime;
+    if (isPrimary) {
+      server.sync();
+      syncTime = al_steady_time();
+    } else {
+      client.sync();
+      syncTime = al_steady_time();
+    }
+    if (i % 60 == 0) {
+      // Printing the release time shows how far apart the renderers are
+      uint32_t frame = isPrimary ? server.frame() : client.frame();
+      printf("frame %u released at %.4f\n", frame, syncTime);
+    }
+  }
+
+  auto stats = isPrimary ? server.stats() : client.stats();
+  printf("Mean wait %.3f ms max %.3f ms timeouts %llu\n",
+         stats.meanWait() * 1000.0, stats.maxWait * 1000.0,
+         (unsigned long long)stats.timeouts);
+  if (isPrimary) {
+    server.stop();
+  } else {
+    client.stop();
+  }
+  return 0;
+}
@@ -102,6 +102,21 @@ public:
 	// operating systems.
 	void SetAllowReuse( bool allowReuse );
 
+	// Number of router hops for multicast datagrams sent from this socket.
+	// Sets IP_MULTICAST_TTL.
+	void SetMulticastTTL( int ttl );
+
+	// Deliver multicast datagrams sent from this socket to listeners
+	// on the same host. Sets IP_MULTICAST_LOOP.
+	void SetMulticastLoopback( bool loopback );
+
+	// Receive datagrams sent to a multicast group. The group endpoint's
+	// port is ignored. interfaceAddress selects the network interface,
+	// IpEndpointName::ANY_ADDRESS lets the system choose.
+	// Sets IP_ADD_MEMBERSHIP. Throws std::runtime_error on failure.
+	void JoinMulticastGroup( const IpEndpointName& group,
+			unsigned long interfaceAddress = IpEndpointName::ANY_ADDRESS );
+
 
 	// The socket is created in an unbound, unconnected state
 	// such a socket can only be used to send to an arbitrary
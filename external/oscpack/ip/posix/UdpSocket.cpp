@@ -143,6 +143,30 @@ public:
 #endif
 	}
 
+	void SetMulticastTTL( int ttl )
+	{
+		unsigned char value = (unsigned char)ttl;
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof(value));
+	}
+
+	void SetMulticastLoopback( bool loopback )
+	{
+		unsigned char value = (loopback) ? 1 : 0;
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_LOOP, &value, sizeof(value));
+	}
+
+	void JoinMulticastGroup( const IpEndpointName& group, unsigned long interfaceAddress )
+	{
+		struct ip_mreq request;
+		std::memset( &request, 0, sizeof(request) );
+		request.imr_multiaddr.s_addr = htonl( group.address );
+		request.imr_interface.s_addr = htonl( interfaceAddress == IpEndpointName::ANY_ADDRESS
+				? INADDR_ANY : interfaceAddress );
+		if (setsockopt(socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) < 0) {
+			throw std::runtime_error("unable to join multicast group\n");
+		}
+	}
+
 	IpEndpointName LocalEndpointFor( const IpEndpointName& remoteEndpoint ) const
 	{
 		assert( isBound_ );
@@ -223,6 +247,12 @@ public:
             throw std::runtime_error("unable to bind udp socket\n");
         }
 
+        // Large receive buffer so bursts of fragments (e.g. distributed state)
+        // are not dropped while the listener thread is busy. The kernel caps
+        // this at its configured maximum.
+        int receiveBufferSize = 4 * 1024 * 1024;
+        setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &receiveBufferSize, sizeof(receiveBufferSize));
+
 		isBound_ = true;
 	}
 
@@ -269,6 +299,21 @@ void UdpSocket::SetAllowReuse( bool allowReuse )
     impl_->SetAllowReuse( allowReuse );
 }
 
+void UdpSocket::SetMulticastTTL( int ttl )
+{
+    impl_->SetMulticastTTL( ttl );
+}
+
+void UdpSocket::SetMulticastLoopback( bool loopback )
+{
+    impl_->SetMulticastLoopback( loopback );
+}
+
+void UdpSocket::JoinMulticastGroup( const IpEndpointName& group, unsigned long interfaceAddress )
+{
+    impl_->JoinMulticastGroup( group, interfaceAddress );
+}
+
 IpEndpointName UdpSocket::LocalEndpointFor( const IpEndpointName& remoteEndpoint ) const
 {
 	return impl_->LocalEndpointFor( remoteEndpoint );
@@ -440,8 +485,19 @@ public:
                 timerQueue_.push_back( std::make_pair( currentTimeMs + i->initialDelayMs, *i ) );
             std::sort( timerQueue_.begin(), timerQueue_.end(), CompareScheduledTimerCalls );
 
-            const int MAX_BUFFER_SIZE = 4098;
+            // allolib: allow datagrams up to the UDP maximum payload
+            const int MAX_BUFFER_SIZE = 65536;
+#ifdef __linux__
+            // allolib: on Linux, drain up to RECV_BATCH_SIZE datagrams per
+            // wakeup with a single recvmmsg() call
+            const int RECV_BATCH_SIZE = 16;
+            data = new char[ MAX_BUFFER_SIZE * RECV_BATCH_SIZE ];
+            struct mmsghdr batchHeaders[ RECV_BATCH_SIZE ];
+            struct iovec batchIovecs[ RECV_BATCH_SIZE ];
+            struct sockaddr_in batchAddresses[ RECV_BATCH_SIZE ];
+#else
             data = new char[ MAX_BUFFER_SIZE ];
+#endif
             IpEndpointName remoteEndpoint;
 
             struct timeval timeout;
@@ -489,13 +545,37 @@ public:
                         i != socketListeners_.end(); ++i ){
 
                     if( FD_ISSET( i->second->impl_->Socket(), &tempfds ) ){
-
+#ifdef __linux__
+                        for( int m = 0; m < RECV_BATCH_SIZE; ++m ){
+                            batchIovecs[m].iov_base = data + m * MAX_BUFFER_SIZE;
+                            batchIovecs[m].iov_len = MAX_BUFFER_SIZE;
+                            std::memset( &batchHeaders[m], 0, sizeof(batchHeaders[m]) );
+                            batchHeaders[m].msg_hdr.msg_iov = &batchIovecs[m];
+                            batchHeaders[m].msg_hdr.msg_iovlen = 1;
+                            batchHeaders[m].msg_hdr.msg_name = &batchAddresses[m];
+                            batchHeaders[m].msg_hdr.msg_namelen = sizeof(batchAddresses[m]);
+                        }
+                        int received = recvmmsg( i->second->impl_->Socket(),
+                                batchHeaders, RECV_BATCH_SIZE, MSG_DONTWAIT, 0 );
+                        for( int m = 0; m < received; ++m ){
+                            if( batchHeaders[m].msg_len > 0 ){
+                                remoteEndpoint = IpEndpointNameFromSockaddr( batchAddresses[m] );
+                                i->first->ProcessPacket( data + m * MAX_BUFFER_SIZE,
+                                        (int)batchHeaders[m].msg_len, remoteEndpoint );
+                                if( break_ )
+                                    break;
+                            }
+                        }
+                        if( break_ )
+                            break;
+#else
                         std::size_t size = i->second->ReceiveFrom( remoteEndpoint, data, MAX_BUFFER_SIZE );
                         if( size > 0 ){
                             i->first->ProcessPacket( data, (int)size, remoteEndpoint );
                             if( break_ )
                                 break;
                         }
+#endif
                     }
                 }
 
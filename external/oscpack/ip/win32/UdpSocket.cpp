@@ -36,6 +36,7 @@
 */
 
 #include <winsock2.h>   // this must come first to prevent errors with MSVC7
+#include <ws2tcpip.h>   // for ip_mreq
 #include <windows.h>
 #include <mmsystem.h>   // for timeGetTime()
 
@@ -137,6 +138,30 @@ public:
 		setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &reuseAddr, sizeof(reuseAddr));
 	}
 
+	void SetMulticastTTL( int ttl )
+	{
+		DWORD value = (DWORD)ttl;
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_TTL, (const char*)&value, sizeof(value));
+	}
+
+	void SetMulticastLoopback( bool loopback )
+	{
+		DWORD value = (loopback) ? 1 : 0;
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_LOOP, (const char*)&value, sizeof(value));
+	}
+
+	void JoinMulticastGroup( const IpEndpointName& group, unsigned long interfaceAddress )
+	{
+		struct ip_mreq request;
+		std::memset( &request, 0, sizeof(request) );
+		request.imr_multiaddr.s_addr = htonl( group.address );
+		request.imr_interface.s_addr = htonl( interfaceAddress == IpEndpointName::ANY_ADDRESS
+				? INADDR_ANY : interfaceAddress );
+		if (setsockopt(socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char*)&request, sizeof(request)) == SOCKET_ERROR) {
+			throw std::runtime_error("unable to join multicast group\n");
+		}
+	}
+
 	IpEndpointName LocalEndpointFor( const IpEndpointName& remoteEndpoint ) const
 	{
 		assert( isBound_ );
@@ -262,6 +287,21 @@ void UdpSocket::SetAllowReuse( bool allowReuse )
     impl_->SetAllowReuse( allowReuse );
 }
 
+void UdpSocket::SetMulticastTTL( int ttl )
+{
+    impl_->SetMulticastTTL( ttl );
+}
+
+void UdpSocket::SetMulticastLoopback( bool loopback )
+{
+    impl_->SetMulticastLoopback( loopback );
+}
+
+void UdpSocket::JoinMulticastGroup( const IpEndpointName& group, unsigned long interfaceAddress )
+{
+    impl_->JoinMulticastGroup( group, interfaceAddress );
+}
+
 IpEndpointName UdpSocket::LocalEndpointFor( const IpEndpointName& remoteEndpoint ) const
 {
 	return impl_->LocalEndpointFor( remoteEndpoint );
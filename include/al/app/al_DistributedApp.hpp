@@ -14,6 +14,7 @@
 #include "al/app/al_StateDistributionDomain.hpp"
 #include "al/io/al_Socket.hpp"
 #include "al/io/al_Toml.hpp"
+#include "al/protocol/al_FrameBarrier.hpp"
 #include "al/scene/al_DistributedScene.hpp"
 #include "al/scene/al_DynamicScene.hpp"
 
@@ -84,6 +85,20 @@ public:
 
   void registerDynamicScene(DynamicScene &scene);
 
+  /**
+   * @brief hold buffer swaps until all renderers have drawn their frame
+   * @param enable enable the barrier
+   * @param timeout longest wait for a slow renderer, in seconds
+   *
+   * Must be called before start(). It can also be enabled by setting
+   * frameBarrier = true in distributed_app.toml. Renderers connect to the
+   * primary at primaryHost from the configuration file, or at localhost.
+   */
+  void setFrameBarrier(bool enable, double timeout = 0.05);
+
+  /// Time spent waiting for other renderers before swapping buffers
+  FrameBarrierStats frameBarrierStats();
+
   Graphics &graphics() override;
   Window &defaultWindow() override;
   Viewpoint &view() override;
@@ -102,6 +117,14 @@ private:
 
   std::map<std::string, std::string> mRoleMap;
   bool mFoundHost = false;
+
+  bool startFrameBarrier();
+
+  bool mFrameBarrierEnabled{false};
+  double mFrameBarrierTimeout{0.05};
+  std::string mPrimaryHost{"localhost"};
+  std::unique_ptr<FrameBarrierServer> mFrameBarrierServer;
+  std::unique_ptr<FrameBarrierClient> mFrameBarrierClient;
 };
 
 /**
@@ -154,6 +177,9 @@ public:
         auto sender =
             distDomain->addStateSender("state", distDomain->statePtr());
         sender->configure(10101, "state", additionalConfig["broadcastAddress"]);
+        if (additionalConfig["multicastGroup"].size() > 0) {
+          sender->setMulticast(additionalConfig["multicastGroup"]);
+        }
       } else {
         std::cout << "Not enabling state sending for primary." << std::endl;
       }
@@ -162,6 +188,9 @@ public:
       auto receiver =
           distDomain->addStateReceiver("state", distDomain->statePtr());
       receiver->configure(10101);
+      if (additionalConfig["multicastGroup"].size() > 0) {
+        receiver->setMulticastGroup(additionalConfig["multicastGroup"]);
+      }
     }
     DistributedApp::start();
   }
@@ -0,0 +1,118 @@
+#ifndef PARAMETERDISPATCHDOMAIN_H
+#define PARAMETERDISPATCHDOMAIN_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "al/app/al_ComputationDomain.hpp"
+#include "al/ui/al_Parameter.hpp"
+
+namespace al {
+
+/**
+ * @brief Delivers parameter change callbacks in batches on a domain's tick
+ * @ingroup App
+ *
+ * Registered parameters no longer call their change callbacks from the
+ * setter. Instead they mark themselves as changed in a lock-free set and
+ * this domain calls the callbacks once per tick with the latest value, no
+ * matter how many times the parameter was set in between. Add it as a
+ * subdomain of the domain whose thread should run the callbacks:
+ *
+ * @code
+    auto dispatcher =
+        graphicsDomain()->newSubDomain<ParameterDispatchDomain>(true);
+    dispatcher->registerParameter(color);
+ * @endcode
+ *
+ * The execution time of each callback is recorded and can be queried with
+ * stats().
+ *
+ * Parameters may be destroyed before the dispatcher, as is usual for
+ * parameters that are members of an App, but not while it is delivering
+ * their callbacks. cleanup() returns all parameters to synchronous
+ * callbacks.
+ */
+class ParameterDispatchDomain : public SynchronousDomain {
+public:
+  /// Statistics for a registered parameter
+  struct Stats {
+    std::string address;
+    uint64_t changes; ///< Number of value changes
+    uint64_t deliveries; ///< Number of times callbacks were called
+    std::vector<ParameterCallbackTiming> callbackTimings;
+  };
+
+  virtual ~ParameterDispatchDomain();
+
+  virtual bool tick() override;
+
+  virtual bool cleanup(ComputationDomain *parent = nullptr) override;
+
+  /**
+   * @brief deliver callbacks for parameters changed since the last call
+   * @return number of parameters delivered
+   *
+   * This is called by tick(), but can also be called directly when not using
+   * this class as a subdomain.
+   */
+  size_t dispatch();
+
+  /**
+   * @brief route a parameter's change callbacks through this dispatcher
+   *
+   * The parameter is switched to asynchronous callbacks.
+   */
+  template <class ParameterType>
+  void registerParameter(ParameterWrapper<ParameterType> &param) {
+    auto entry = std::make_shared<ParameterDispatchEntry>();
+    entry->parameter = &param;
+    entry->pendingHead = &mPending;
+    entry->deliver = [&param](ParameterDispatchEntry &e) {
+      param.processChange(e);
+    };
+    std::unique_lock<std::mutex> lk(mEntriesLock);
+    param.setDispatchEntry(entry);
+    mEntries.push_back({entry, [&param]() { param.setDispatchEntry(nullptr); }});
+  }
+
+  /**
+   * @brief return the parameter to synchronous callbacks
+   *
+   * Pending changes are delivered first, so this should be called from the
+   * thread that runs the dispatcher or while it is not running.
+   */
+  void unregisterParameter(ParameterMeta &param);
+
+  /**
+   * @brief statistics for all registered parameters
+   *
+   * Callback timings are written by the dispatching thread. Query from that
+   * thread for exact values.
+   */
+  std::vector<Stats> stats();
+
+  void printStats();
+
+private:
+  // Return all live parameters to synchronous callbacks. mEntriesLock must
+  // be held.
+  void detachAll();
+
+  struct Registration {
+    std::shared_ptr<ParameterDispatchEntry> entry;
+    std::function<void()> detach;
+  };
+
+  std::atomic<ParameterDispatchEntry *> mPending{nullptr};
+  std::mutex mEntriesLock;
+  std::vector<Registration> mEntries;
+  std::vector<ParameterDispatchEntry *> mBatch;
+};
+
+} // namespace al
+
+#endif // PARAMETERDISPATCHDOMAIN_H
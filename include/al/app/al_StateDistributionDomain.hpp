@@ -1,16 +1,21 @@
 #ifndef STATEDISTRIBUTIONDOMAIN_H
 #define STATEDISTRIBUTIONDOMAIN_H
 
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <functional>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <stack>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "al/app/al_SimulationDomain.hpp"
+#include "al/protocol/al_Compression.hpp"
 #include "al/protocol/al_OSC.hpp"
 #include "al/spatial/al_Pose.hpp"
 
@@ -20,6 +25,344 @@ struct DefaultState {
   Pose pose;
 };
 
+/**
+ * @brief Counters for fragmented state transport
+ * @ingroup App
+ */
+struct StateTransportStats {
+  uint64_t framesReceived{0};    ///< Frames reassembled completely
+  uint64_t framesIncomplete{0};  ///< Frames dropped with missing fragments
+  uint64_t framesMissed{0};      ///< Frames of which no fragment arrived
+  uint64_t fragmentsReceived{0}; ///< Fragments accepted
+  uint64_t fragmentsLost{0};     ///< Fragments missing from dropped frames
+  uint64_t fragmentsRejected{0}; ///< Late, duplicate or malformed fragments
+};
+
+/**
+ * @brief Flags describing how a distributed state frame is encoded
+ * @ingroup App
+ */
+enum StateEncoding : uint32_t {
+  STATE_ENCODING_RAW = 0,            ///< The state's bytes
+  STATE_ENCODING_DELTA = 1 << 0,     ///< StateDeltaEncoder frame
+  STATE_ENCODING_COMPRESSED = 1 << 1 ///< Compressor block, applied last
+};
+
+/**
+ * @brief Encodes state as changes relative to periodic keyframes
+ * @ingroup App
+ *
+ * The state is compared block by block against the last keyframe and only
+ * the blocks that differ are sent. As every delta refers to the keyframe and
+ * not to the previous frame, losing a delta only affects that frame. A full
+ * keyframe is sent every keyframeInterval frames, or earlier when a delta
+ * would not be smaller than the state.
+ *
+ * Encoded frame layout, all fields 32 bit in host byte order:
+ * type (0 keyframe, 1 delta), keyframe number, state size, block size, then
+ * the state for keyframes or a list of runs for deltas. A run is its first
+ * block, its block count and the blocks' data.
+ */
+class StateDeltaEncoder {
+public:
+  /**
+   * @param blockSize comparison granularity in bytes. 64 matches a cache line
+   * @param keyframeInterval number of frames between keyframes
+   */
+  void configure(uint32_t blockSize = 64, uint32_t keyframeInterval = 30);
+
+  /**
+   * @brief encode a state frame
+   * @return the encoded frame, valid until the next call
+   */
+  const std::vector<unsigned char> &encode(const void *state, size_t size);
+
+  /// Request a keyframe for the next frame, e.g. when a receiver joins
+  void forceKeyframe() { mForceKeyframe = true; }
+
+  bool lastWasKeyframe() const { return mLastWasKeyframe; }
+
+  uint64_t bytesIn() const { return mBytesIn; }
+  uint64_t bytesOut() const { return mBytesOut; }
+
+private:
+  void encodeKeyframe(const unsigned char *state, size_t size);
+
+  std::vector<unsigned char> mKeyframe;
+  std::vector<unsigned char> mOutput;
+  uint32_t mBlockSize{64};
+  uint32_t mKeyframeInterval{30};
+  uint32_t mKeyframeNumber{0};
+  uint32_t mFramesSinceKeyframe{0};
+  bool mForceKeyframe{true};
+  bool mLastWasKeyframe{false};
+  uint64_t mBytesIn{0};
+  uint64_t mBytesOut{0};
+};
+
+/**
+ * @brief Applies frames produced by StateDeltaEncoder
+ * @ingroup App
+ *
+ * Deltas are applied in place: blocks changed by the previous delta are
+ * restored from the keyframe and the new delta's blocks are written, so the
+ * cost is proportional to the number of changed blocks. The state passed to
+ * decode() must therefore be the same memory on every call. Deltas that
+ * refer to a keyframe that was not received are skipped.
+ */
+class StateDeltaDecoder {
+public:
+  /**
+   * @brief decode a frame into state
+   * @return true if state now holds the frame's content
+   */
+  bool decode(const unsigned char *frame, size_t frameSize, void *state,
+              size_t size);
+
+  /// Deltas skipped because their keyframe was missing
+  uint64_t deltasSkipped() const { return mDeltasSkipped; }
+
+private:
+  std::vector<unsigned char> mKeyframe;
+  // Block ranges written by the last delta, as (first block, count) pairs
+  std::vector<std::pair<uint32_t, uint32_t>> mAppliedRuns;
+  uint32_t mKeyframeNumber{0};
+  uint32_t mBlockSize{0};
+  bool mHasKeyframe{false};
+  uint64_t mDeltasSkipped{0};
+};
+
+/**
+ * @brief Splits frames of data into OSC messages that fit a UDP datagram
+ * @ingroup App
+ *
+ * Each fragment is sent as an "/_statef" message carrying the stream id, the
+ * session, the frame number, the fragment index and count, the byte offset,
+ * the total frame size, the frame's encoding and the fragment data as a blob.
+ * The session is a random number that tells receivers when a restarted
+ * sender numbers its frames from the start again.
+ */
+class StateFragmentSender {
+public:
+  /**
+   * @param id stream id
+   * @param packetSize maximum size of a datagram, including OSC overhead
+   */
+  void configure(const std::string &id, uint16_t packetSize);
+
+  /**
+   * @brief send data as a new frame
+   * @param encoding StateEncoding flags describing how data is encoded
+   * @return number of fragments sent
+   */
+  size_t send(osc::Send &sender, const void *data, size_t size,
+              uint32_t encoding = 0);
+
+  /// Number of the last frame sent
+  uint32_t frame() const { return mFrame; }
+
+  /// Random number identifying this sender's frames, set by configure()
+  uint32_t session() const { return mSession; }
+
+  /// Bytes of frame data carried by each fragment
+  size_t payloadSize() const { return mPayloadSize; }
+
+private:
+  std::string mId;
+  size_t mPayloadSize{1024};
+  uint32_t mSession{0};
+  uint32_t mFrame{0};
+  std::unique_ptr<osc::Packet> mPacket;
+};
+
+/**
+ * @brief Reassembles frames sent by StateFragmentSender
+ * @ingroup App
+ *
+ * Only the most recent frame is assembled. When a fragment of a newer frame
+ * arrives before the current frame is complete, the current frame is
+ * dropped and counted as incomplete. Fragments of older frames are rejected.
+ * A fragment from a new session starts over from its frame, so a restarted
+ * sender is received at once.
+ */
+class StateFragmentAssembler {
+public:
+  /**
+   * @brief add a received fragment
+   * @return true if this fragment completed a frame. The frame can then be
+   * read from data()
+   */
+  bool addFragment(uint32_t session, uint32_t frame, uint32_t index,
+                   uint32_t count, uint32_t offset, uint32_t totalSize,
+                   uint32_t encoding, const void *data, size_t size);
+
+  /**
+   * @brief add a fragment from an "/_statef" message, after the id has been
+   * read from it
+   */
+  bool addFragment(osc::Message &m);
+
+  /**
+   * @brief set the largest frame accepted
+   *
+   * Frame sizes come from the network, so headers announcing larger frames
+   * are rejected instead of allocated.
+   */
+  void maxSize(size_t size) { mMaxSize = size; }
+  size_t maxSize() const { return mMaxSize; }
+
+  /// Data of the last completed frame
+  const unsigned char *data() const { return mData.data(); }
+  size_t size() const { return mData.size(); }
+
+  /// Number of the last completed frame
+  uint32_t frame() const { return mFrame; }
+
+  /// StateEncoding flags of the last completed frame
+  uint32_t encoding() const { return mEncoding; }
+
+  const StateTransportStats &stats() const { return mStats; }
+
+private:
+  void dropCurrent();
+
+  std::vector<unsigned char> mData;
+  std::vector<bool> mReceived;
+  uint32_t mSession{0};
+  uint32_t mPreviousSession{0};
+  uint32_t mFrame{0};
+  uint32_t mFragmentCount{0};
+  uint32_t mFragmentsPending{0};
+  uint32_t mEncoding{0};
+  size_t mMaxSize{size_t(16) << 20};
+  bool mStarted{false};
+  bool mComplete{false};
+  StateTransportStats mStats;
+};
+
+/**
+ * @brief Hands frames of data from one writer thread to one reader thread
+ * @ingroup App
+ *
+ * The writer fills the back buffer and publishes it, which swaps it with the
+ * middle buffer. The reader takes the middle buffer when it holds a frame it
+ * has not seen. Neither side ever waits for the other: the reader always
+ * gets the newest complete frame and frames it did not take are dropped.
+ */
+class StateTripleBuffer {
+public:
+  StateTripleBuffer() = default;
+  StateTripleBuffer(const StateTripleBuffer &) = delete;
+  StateTripleBuffer &operator=(const StateTripleBuffer &) = delete;
+
+  /// Allocate buffers. Not thread safe, call before use
+  void resize(size_t size);
+  size_t size() const { return mSize; }
+
+  /// Buffer the writer fills before calling publish()
+  unsigned char *back() { return mBuffers[mBack].get(); }
+
+  /// Publish the back buffer tagged with a frame number (writer thread)
+  void publish(uint32_t frame);
+
+  /**
+   * @brief take the newest published frame (reader thread)
+   * @return true if a frame that was not taken before is now in front()
+   */
+  bool acquire();
+
+  const unsigned char *front() const { return mBuffers[mFront].get(); }
+  uint32_t frontFrame() const { return mFrames[mFront]; }
+
+private:
+  // Index of the middle buffer, with kFresh set when it was not acquired yet
+  static const uint32_t kFresh = 4;
+
+  std::unique_ptr<unsigned char[]> mBuffers[3];
+  uint32_t mFrames[3]{0, 0, 0};
+  size_t mSize{0};
+  uint32_t mBack{0};   // Owned by the writer
+  uint32_t mFront{2};  // Owned by the reader
+  std::atomic<uint32_t> mMiddle{1};
+};
+
+/**
+ * @brief StateTripleBuffer in POSIX shared memory, for processes on one host
+ * @ingroup App
+ *
+ * The writer process creates a named region holding the three buffers and
+ * their indices, and readers map it by name. Publishing and acquiring swap
+ * buffers with an atomic compare and swap on the indices, so frames cross the
+ * process boundary without system calls and without being copied through
+ * sockets. There is one reader per region. Not available on Windows.
+ */
+class StateSharedMemory {
+public:
+  StateSharedMemory() = default;
+  StateSharedMemory(const StateSharedMemory &) = delete;
+  StateSharedMemory &operator=(const StateSharedMemory &) = delete;
+  ~StateSharedMemory() { close(); }
+
+  /**
+   * @brief create the region or map an existing one of the same size (writer)
+   * @param name region name, e.g. "/al_state"
+   * @param size buffer size in bytes
+   */
+  bool create(const std::string &name, size_t size);
+
+  /**
+   * @brief map a region created by the writer (reader)
+   * @return false if the region does not exist yet or its size differs
+   */
+  bool open(const std::string &name, size_t size);
+
+  /// Unmap the region, and remove its name if this side created it
+  void close();
+
+  bool isOpen() const { return mHeader != nullptr; }
+  size_t size() const { return mSize; }
+
+  /**
+   * @brief true if the writer has removed the region (reader)
+   *
+   * A restarted writer creates a new region under the same name, so the
+   * reader must close() and open() again to receive its frames.
+   */
+  bool writerClosed() const;
+
+  /// Buffer the writer fills before calling publish()
+  unsigned char *back() { return buffer(mBack); }
+
+  /// Publish the back buffer tagged with a frame number (writer)
+  void publish(uint32_t frame);
+
+  /**
+   * @brief take the newest published frame (reader)
+   * @return true if a frame that was not taken before is now in front()
+   */
+  bool acquire();
+
+  const unsigned char *front() const { return buffer(mFront); }
+  uint32_t frontFrame() const;
+
+  /// Region name used by the state domains for a state id
+  static std::string regionName(const std::string &id);
+
+private:
+  struct Header;
+
+  unsigned char *buffer(uint32_t index) const;
+  bool map(const std::string &name, size_t size, bool create);
+
+  Header *mHeader{nullptr};
+  size_t mSize{0};
+  size_t mMappedSize{0};
+  uint32_t mBack{0};
+  uint32_t mFront{2};
+  std::string mName;
+  bool mOwner{false};
+};
+
 template <class TSharedState> class StateReceiveDomain;
 
 template <class TSharedState> class StateSendDomain;
@@ -68,14 +411,52 @@ public:
   bool tick() override {
     tickSubdomains(true);
 
-    assert(mState); // State must have been set at this point
-    mRecvLock.lock();
-    if (newMessages > 0) {
-      mQueuedStates = newMessages;
-      std::memcpy(mState.get(), buf.get(), sizeof(TSharedState));
-      newMessages = 0;
+    assert(mState || !mCopyState); // State must have been set at this point
+    if (mSharedMemory) {
+      // A restarted writer creates a new region, drop the old one's frames
+      if (mSharedBuffers.writerClosed()) {
+        mSharedBuffers.close();
+        mPending = false;
+        mReceived = false;
+      }
+      // The writer may start after the reader
+      if (!mSharedBuffers.isOpen()) {
+        mSharedBuffers.open(sharedMemoryName(), sizeof(TSharedState));
+      }
+      if (mSharedBuffers.isOpen() && mSharedBuffers.acquire()) {
+        mQueuedStates = 1;
+        mPending = true;
+      }
+    } else if (mBuffers.acquire()) {
+      mQueuedStates = newMessages.exchange(0);
+      mPending = true;
+    }
+    if (mPending) {
+      uint32_t frame = mSharedMemory ? mSharedBuffers.frontFrame()
+                                     : mBuffers.frontFrame();
+      if (!mCopyState) {
+        // The front buffer is read in place through receivedState()
+        mReceived = true;
+        mFrame = frame;
+        mPending = false;
+      } else if (!mFrameMatching || mTargetFrame == 0 ||
+                 int32_t(frame - mTargetFrame) >= 0) {
+        // With frame matching, states older than the target are held back.
+        // The copy keeps the shown state while newer frames replace the
+        // front buffer.
+        if (mFrameMatching && mTargetFrame != 0 && frame != mTargetFrame &&
+            int32_t(mFrame - mTargetFrame) < 0) {
+          mFramesMismatched++;
+        }
+        mRecvLock.lock();
+        std::memcpy(mState.get(),
+                    mSharedMemory ? mSharedBuffers.front() : mBuffers.front(),
+                    sizeof(TSharedState));
+        mRecvLock.unlock();
+        mFrame = frame;
+        mPending = false;
+      }
     }
-    mRecvLock.unlock();
     tickSubdomains(false);
     return true;
   }
@@ -83,6 +464,8 @@ public:
   bool cleanup(ComputationDomain *parent = nullptr) override {
     cleanupSubdomains(true);
     mRecv = nullptr;
+    mKeyframeRequestSend = nullptr;
+    mSharedBuffers.close();
     mState = nullptr;
 
     //    std::cerr << "Not using Cuttlebone. Ignoring" << std::endl;
@@ -98,44 +481,209 @@ public:
     mPacketSize = packetSize;
   }
 
+  /**
+   * @brief receive state sent to a multicast group, e.g. "239.255.0.1"
+   *
+   * Must be called before init(). The socket is still bound to the
+   * configured address, which should be "0.0.0.0".
+   */
+  void setMulticastGroup(std::string group) { mMulticastGroup = group; }
+
+  /**
+   * @brief port of the sender that delta encoded frames are requested from
+   *
+   * A receiver that cannot apply a delta, because it joined after the
+   * keyframe or lost it, asks the sender for a keyframe on this port. 0, the
+   * default, is the state port + 1. Must match the sender's
+   * StateSendDomain::setKeyframeRequestPort().
+   */
+  void setKeyframeRequestPort(uint16_t port) { mKeyframeRequestPort = port; }
+  uint16_t keyframeRequestPort() const {
+    return mKeyframeRequestPort != 0 ? mKeyframeRequestPort
+                                     : uint16_t(mPort + 1);
+  }
+
+  /**
+   * @brief receive state through shared memory from a sender on this machine
+   * @param enable use shared memory instead of the network
+   * @param name region name. Derived from the id when empty
+   *
+   * Must match the sender's StateSendDomain::setSharedMemory() and be called
+   * before init(). Only the newest state is kept, the stats() counters are
+   * not updated.
+   */
+  void setSharedMemory(bool enable, std::string name = "") {
+    mSharedMemory = enable;
+    mSharedMemoryName = name;
+  }
+
   std::shared_ptr<TSharedState> state() { return mState; }
 
   void setStatePointer(std::shared_ptr<TSharedState> ptr) { mState = ptr; }
 
+  /**
+   * @brief lock the state against updates from tick()
+   *
+   * The network thread never takes this lock, it is only needed when the
+   * state is read from a thread other than the one calling tick().
+   */
   void lockState() { mRecvLock.lock(); }
   void unlockState() { mRecvLock.unlock(); }
   int newStates() { return mQueuedStates; }
 
+  /**
+   * @brief copy each new state into state()
+   *
+   * Enabled by default. tick() copies a state once when it takes it, so
+   * state() stays valid while newer frames arrive, can be read from other
+   * threads under lockState() and can be shared with setStatePointer().
+   * Disable it before init() to read large states in place through
+   * receivedState() instead. Frame matching needs the copy and is not
+   * applied then.
+   */
+  void setCopyState(bool enable) { mCopyState = enable; }
+
+  /**
+   * @brief state last taken by tick(), in the receive buffer
+   *
+   * Only set with setCopyState(false), nullptr until a state has arrived.
+   * Valid until the next tick() and only to be read from the thread calling
+   * tick().
+   */
+  const TSharedState *receivedState() const {
+    if (!mReceived) {
+      return nullptr;
+    }
+    return reinterpret_cast<const TSharedState *>(
+        mSharedMemory ? mSharedBuffers.front() : mBuffers.front());
+  }
+
+  /// Sender's frame number of the state last copied by tick()
+  uint32_t frame() const { return mFrame; }
+
+  /**
+   * @brief only show the frame set with setTargetFrame()
+   *
+   * When enabled, tick() keeps the current state until a frame at least as
+   * new as the target frame has arrived. Renderers that are given the same
+   * target, e.g. the primary's frame() distributed with the frame barrier,
+   * then show the same simulation frame. If the target frame itself was
+   * dropped a newer frame is shown and counted by framesMismatched().
+   */
+  void setFrameMatching(bool enable) { mFrameMatching = enable; }
+
+  /// Frame to show when frame matching is enabled. 0 shows the newest frame
+  void setTargetFrame(uint32_t frame) { mTargetFrame = frame; }
+
+  /// Frames shown in place of a target frame that was not received
+  uint64_t framesMismatched() const { return mFramesMismatched; }
+
   std::string id() const { return mId; }
 
   void setId(const std::string &id) { mId = id; }
 
+  /**
+   * @brief transport statistics
+   *
+   * The counters are updated by the network thread, so values may be
+   * slightly out of date.
+   */
+  StateTransportStats stats() { return mAssembler.stats(); }
+
+  /**
+   * @brief statistics for decompressing received frames
+   *
+   * Updated by the network thread like stats().
+   */
+  CompressionStats compressionStats() {
+    return mDecompressor.decompressStats();
+  }
+
 protected:
   std::shared_ptr<TSharedState> mState;
   int mQueuedStates{1};
+  uint32_t mFrame{0};
+  uint32_t mTargetFrame{0};
+  bool mFrameMatching{false};
+  bool mPending{false};
+  bool mCopyState{true};
+  bool mReceived{false}; // receivedState() holds a state
+  uint64_t mFramesMismatched{0};
   std::string mAddress{"localhost"};
+  std::string mMulticastGroup;
   uint16_t mPort = 10100;
   uint16_t mPacketSize = 1400;
 
 private:
+  std::string sharedMemoryName() {
+    return mSharedMemoryName.size() > 0 ? mSharedMemoryName
+                                        : StateSharedMemory::regionName(mId);
+  }
+
   std::string mId;
+  bool mSharedMemory{false};
+  std::string mSharedMemoryName;
+  StateSharedMemory mSharedBuffers;
 
   class Handler : public osc::PacketHandler {
   public:
     StateReceiveDomain *mOscDomain;
     void onMessage(osc::Message &m) override {
       //      m.print();
-      if (m.addressPattern() == "/_state" && m.typeTags() == "sb") {
+      if (m.addressPattern() == "/_statef" && m.typeTags() == "siiiiiiib") {
+        std::string id;
+        m >> id;
+        if (id == mOscDomain->mId &&
+            mOscDomain->mAssembler.addFragment(m)) {
+          auto &assembler = mOscDomain->mAssembler;
+          auto &buffers = mOscDomain->mBuffers;
+          const unsigned char *data = assembler.data();
+          size_t size = assembler.size();
+          if (assembler.encoding() & STATE_ENCODING_COMPRESSED) {
+            auto &decompressed = mOscDomain->mDecompressed;
+            // A decompressed frame is at most a keyframe, which is within
+            // the assembler's limit
+            if (!mOscDomain->mDecompressor.decompress(
+                    data, size, decompressed, assembler.maxSize())) {
+              std::cerr << "ERROR: could not decompress state" << std::endl;
+              return;
+            }
+            data = decompressed.data();
+            size = decompressed.size();
+          }
+          if (assembler.encoding() & STATE_ENCODING_DELTA) {
+            // Deltas are applied to the previous frame, which the back
+            // buffer does not hold
+            auto &decoded = mOscDomain->mDecoded;
+            auto &decoder = mOscDomain->mDeltaDecoder;
+            decoded.resize(sizeof(TSharedState));
+            uint64_t skipped = decoder.deltasSkipped();
+            if (decoder.decode(data, size, decoded.data(),
+                               sizeof(TSharedState))) {
+              memcpy(buffers.back(), decoded.data(), sizeof(TSharedState));
+              mOscDomain->publish(assembler.frame());
+            } else if (decoder.deltasSkipped() != skipped) {
+              // Joined after the keyframe, or lost it
+              mOscDomain->requestKeyframe(m.senderAddress());
+            }
+          } else if (size == sizeof(TSharedState)) {
+            memcpy(buffers.back(), data, sizeof(TSharedState));
+            mOscDomain->publish(assembler.frame());
+          } else {
+            std::cerr << "ERROR: received state size mismatch" << std::endl;
+          }
+        }
+      } else if (m.addressPattern() == "/_state" && m.typeTags() == "sb") {
         std::string id;
         m >> id;
         if (id == mOscDomain->mId) {
           osc::Blob inBlob;
           m >> inBlob;
           if (sizeof(TSharedState) == inBlob.size) {
-            mOscDomain->mRecvLock.lock();
-            memcpy(mOscDomain->buf.get(), inBlob.data, sizeof(TSharedState));
-            mOscDomain->newMessages++;
-            mOscDomain->mRecvLock.unlock();
+            memcpy(mOscDomain->mBuffers.back(), inBlob.data,
+                   sizeof(TSharedState));
+            // Legacy messages carry no frame number
+            mOscDomain->publish(++mOscDomain->mLegacyFrame);
           } else {
             std::cerr << "ERROR: received state size mismatch" << std::endl;
           }
@@ -144,9 +692,44 @@ private:
     }
   } mHandler;
 
-  std::unique_ptr<unsigned char[]> buf;
+  // Called from the network thread
+  void publish(uint32_t frame) {
+    mBuffers.publish(frame);
+    newMessages++;
+  }
 
-  uint16_t newMessages = 0;
+  // Called from the network thread when a delta could not be applied
+  void requestKeyframe(const std::string &senderAddress) {
+    // Deltas keep arriving until the keyframe does, one request covers them
+    al_sec now = al_steady_time();
+    if (senderAddress.empty() || now - mLastKeyframeRequest < 0.1) {
+      return;
+    }
+    mLastKeyframeRequest = now;
+    if (!mKeyframeRequestSend ||
+        mKeyframeRequestSend->address() != senderAddress) {
+      mKeyframeRequestSend = std::make_unique<osc::Send>();
+      if (!mKeyframeRequestSend->open(keyframeRequestPort(),
+                                      senderAddress.c_str())) {
+        mKeyframeRequestSend = nullptr;
+        return;
+      }
+    }
+    mKeyframeRequestSend->send("/_statek", mId);
+  }
+
+  StateTripleBuffer mBuffers;
+  StateFragmentAssembler mAssembler;
+  StateDeltaDecoder mDeltaDecoder;
+  std::vector<unsigned char> mDecoded;
+  Compressor mDecompressor;
+  std::vector<unsigned char> mDecompressed;
+  uint32_t mLegacyFrame{0};
+  uint16_t mKeyframeRequestPort{0};
+  std::unique_ptr<osc::Send> mKeyframeRequestSend;
+  al_sec mLastKeyframeRequest{-1.0};
+
+  std::atomic<uint16_t> newMessages{0};
   std::mutex mRecvLock;
   std::unique_ptr<osc::Recv> mRecv;
 };
@@ -156,12 +739,27 @@ bool StateReceiveDomain<TSharedState>::init(ComputationDomain *parent) {
   initializeSubdomains(true);
   assert(parent != nullptr);
 
-  buf = std::make_unique<unsigned char[]>(sizeof(TSharedState));
+  if (mSharedMemory) {
+    // Opened in tick() if the sender has not created the region yet
+    mSharedBuffers.open(sharedMemoryName(), sizeof(TSharedState));
+    initializeSubdomains(false);
+    return true;
+  }
+  mBuffers.resize(sizeof(TSharedState));
+  // The largest frame is a keyframe, the state with its header, and
+  // compression never makes a frame larger
+  mAssembler.maxSize(sizeof(TSharedState) + 64);
   mRecv = std::make_unique<osc::Recv>();
   if (!mRecv || !mRecv->open(mPort, mAddress.c_str())) {
     std::cerr << "Error opening server" << std::endl;
     return false;
   }
+  if (mMulticastGroup.size() > 0 &&
+      !mRecv->joinMulticastGroup(mMulticastGroup.c_str())) {
+    std::cerr << "Error joining multicast group " << mMulticastGroup
+              << std::endl;
+    return false;
+  }
   mHandler.mOscDomain = this;
   mRecv->handler(mHandler);
   if (!mRecv->start()) {
@@ -179,9 +777,10 @@ class StateSendDomain : public SynchronousDomain {
 public:
   bool init(ComputationDomain *parent = nullptr) override {
     initializeSubdomains(true);
-
+    mFragmentSender.configure(mId, mPacketSize);
+    bool ret = mSharedMemory ? openSharedMemory() : openSocket();
     initializeSubdomains(false);
-    return true;
+    return ret;
   }
 
   bool tick() override {
@@ -193,11 +792,42 @@ public:
     //    osc::Blob b(&mState, sizeof(mState));
     //    mSend->send("/_state", b);
 
+    if (mSharedMemory) {
+      if (!mSharedBuffers.isOpen() && !openSharedMemory()) {
+        tickSubdomains(false);
+        return false;
+      }
+      mStateLock.lock();
+      std::memcpy(mSharedBuffers.back(), mState.get(), sizeof(TSharedState));
+      mSharedBuffers.publish(++mSharedFrame);
+      mStateLock.unlock();
+      tickSubdomains(false);
+      return true;
+    }
+    if (!mSend && !openSocket()) {
+      tickSubdomains(false);
+      return false;
+    }
     mStateLock.lock();
-    osc::Blob b(mState.get(), sizeof(TSharedState));
-    osc::Send s(mPort, mAddress.c_str());
-    //    std::cout << mAddress << ":" << mPort << std::endl;
-    s.send("/_state", mId, b);
+    const void *data = mState.get();
+    size_t size = sizeof(TSharedState);
+    uint32_t encoding = STATE_ENCODING_RAW;
+    if (mDeltaEncoding) {
+      if (mKeyframeRequested.exchange(false)) {
+        mDeltaEncoder.forceKeyframe();
+      }
+      auto &frame = mDeltaEncoder.encode(mState.get(), sizeof(TSharedState));
+      data = frame.data();
+      size = frame.size();
+      encoding |= STATE_ENCODING_DELTA;
+    }
+    // Frames that do not compress are sent as they are
+    if (mCompression && mCompressor.compress(data, size, mCompressed)) {
+      data = mCompressed.data();
+      size = mCompressed.size();
+      encoding |= STATE_ENCODING_COMPRESSED;
+    }
+    mFragmentSender.send(*mSend, data, size, encoding);
 
     mStateLock.unlock();
 
@@ -208,6 +838,9 @@ public:
   bool cleanup(ComputationDomain *parent = nullptr) override {
     cleanupSubdomains(true);
     mState = nullptr;
+    mSend = nullptr;
+    mKeyframeRequests = nullptr;
+    mSharedBuffers.close();
     //    std::cerr << "Not using Cuttlebone. Ignoring" << std::endl;
     cleanupSubdomains(false);
     return true;
@@ -220,6 +853,41 @@ public:
     mId = id;
     mAddress = address;
     mPacketSize = packetSize;
+    mFragmentSender.configure(mId, mPacketSize);
+    mSend = nullptr; // Reopen on next tick
+  }
+
+  /**
+   * @brief send to a multicast group instead of a unicast or broadcast address
+   * @param group multicast group address, e.g. "239.255.0.1"
+   * @param ttl number of router hops. 1 keeps packets on the local network
+   * @param loopback deliver packets to receivers on this machine too
+   *
+   * Receivers must join the group with
+   * StateReceiveDomain::setMulticastGroup().
+   */
+  void setMulticast(std::string group, int ttl = 1, bool loopback = true) {
+    mAddress = group;
+    mMulticast = true;
+    mMulticastTTL = ttl;
+    mMulticastLoopback = loopback;
+    mSend = nullptr;
+  }
+
+  /**
+   * @brief send state through shared memory to a receiver on this machine
+   * @param enable use shared memory instead of the network
+   * @param name region name. Derived from the id when empty
+   *
+   * Each tick copies the state once into a region shared with the receiving
+   * process, which takes the newest state without any system call. Delta
+   * encoding and compression are not used. The region is removed in
+   * cleanup(). Call before init().
+   */
+  void setSharedMemory(bool enable, std::string name = "") {
+    mSharedMemory = enable;
+    mSharedMemoryName = name;
+    mSharedBuffers.close();
   }
 
   std::shared_ptr<TSharedState> state() { return mState; }
@@ -237,9 +905,71 @@ public:
 
   std::string id() const { return mId; }
 
-  void setId(const std::string &id) { mId = id; }
+  void setId(const std::string &id) {
+    mId = id;
+    mFragmentSender.configure(mId, mPacketSize);
+  }
 
-  void setAddress(std::string address) { mAddress = address; };
+  void setAddress(std::string address) {
+    mAddress = address;
+    mSend = nullptr;
+  };
+
+  /**
+   * @brief send only the parts of the state that changed
+   * @param enable enable delta encoding
+   * @param keyframeInterval number of frames between full keyframes
+   * @param blockSize comparison granularity in bytes
+   *
+   * Receivers detect the encoding automatically. Receivers that join
+   * between keyframes ask for one on keyframeRequestPort(), and the next
+   * frame is then sent as a keyframe. Call before init().
+   */
+  void setDeltaEncoding(bool enable, uint32_t keyframeInterval = 30,
+                        uint32_t blockSize = 64) {
+    mDeltaEncoding = enable;
+    mDeltaEncoder.configure(blockSize, keyframeInterval);
+  }
+
+  /**
+   * @brief port on which receivers ask for a keyframe
+   *
+   * 0, the default, is the state port + 1. Must match
+   * StateReceiveDomain::setKeyframeRequestPort(). Call before init().
+   */
+  void setKeyframeRequestPort(uint16_t port) {
+    mKeyframeRequestPort = port;
+    mSend = nullptr;
+  }
+  uint16_t keyframeRequestPort() const {
+    return mKeyframeRequestPort != 0 ? mKeyframeRequestPort
+                                     : uint16_t(mPort + 1);
+  }
+
+  /**
+   * @brief compress frames before sending
+   * @param enable enable compression
+   * @param codec compression algorithm
+   * @param elementSize size of the values in the state, used to shuffle bytes
+   * before compressing. 4 suits states made of floats and ints
+   *
+   * Compression is applied after delta encoding. Receivers detect it
+   * automatically.
+   */
+  void setCompression(bool enable,
+                      CompressionCodec codec = CompressionCodec::SHUFFLE_LZ,
+                      uint8_t elementSize = 4) {
+    mStateLock.lock();
+    mCompression = enable;
+    mCompressor.configure(codec, elementSize);
+    mStateLock.unlock();
+  }
+
+  /// Compression ratio and time spent compressing
+  CompressionStats compressionStats() {
+    std::unique_lock<std::mutex> lk(mStateLock);
+    return mCompressor.compressStats();
+  }
 
 protected:
   std::shared_ptr<TSharedState> mState;
@@ -250,7 +980,75 @@ protected:
   uint16_t mPacketSize = 1400;
 
 private:
+  // The socket is opened once and kept for all ticks
+  bool openSocket() {
+    mSend = std::make_unique<osc::Send>();
+    if (!mSend->open(mPort, mAddress.c_str())) {
+      std::cerr << "Error opening state sender " << mAddress << ":" << mPort
+                << std::endl;
+      mSend = nullptr;
+      return false;
+    }
+    if (mMulticast) {
+      mSend->multicastTTL(mMulticastTTL);
+      mSend->multicastLoopback(mMulticastLoopback);
+    }
+    mKeyframeRequests = nullptr;
+    if (mDeltaEncoding) {
+      // Requests come from any receiver. Without them, receivers that join
+      // wait for the next periodic keyframe.
+      mKeyframeRequests = std::make_unique<osc::Recv>();
+      mKeyframeHandler.mDomain = this;
+      if (!mKeyframeRequests->open(keyframeRequestPort(), "0.0.0.0")) {
+        std::cerr << "Error opening keyframe request port "
+                  << keyframeRequestPort() << std::endl;
+        mKeyframeRequests = nullptr;
+      } else {
+        mKeyframeRequests->handler(mKeyframeHandler);
+        mKeyframeRequests->start();
+      }
+    }
+    return true;
+  }
+
+  class KeyframeRequestHandler : public osc::PacketHandler {
+  public:
+    StateSendDomain *mDomain;
+    void onMessage(osc::Message &m) override {
+      if (m.addressPattern() == "/_statek" && m.typeTags() == "s") {
+        std::string id;
+        m >> id;
+        if (id == mDomain->mId) {
+          mDomain->mKeyframeRequested = true;
+        }
+      }
+    }
+  } mKeyframeHandler;
+
+  bool openSharedMemory() {
+    std::string name = mSharedMemoryName.size() > 0
+                           ? mSharedMemoryName
+                           : StateSharedMemory::regionName(mId);
+    return mSharedBuffers.create(name, sizeof(TSharedState));
+  }
+
   std::unique_ptr<osc::Send> mSend;
+  bool mMulticast{false};
+  int mMulticastTTL{1};
+  bool mMulticastLoopback{true};
+  StateFragmentSender mFragmentSender;
+  StateDeltaEncoder mDeltaEncoder;
+  bool mDeltaEncoding{false};
+  uint16_t mKeyframeRequestPort{0};
+  std::unique_ptr<osc::Recv> mKeyframeRequests;
+  std::atomic<bool> mKeyframeRequested{false};
+  Compressor mCompressor;
+  std::vector<unsigned char> mCompressed;
+  bool mCompression{false};
+  bool mSharedMemory{false};
+  std::string mSharedMemoryName;
+  StateSharedMemory mSharedBuffers;
+  uint32_t mSharedFrame{0};
 
   std::string mId = "";
 };
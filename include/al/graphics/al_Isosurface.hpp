@@ -65,6 +65,9 @@
 
 #include "al/graphics/al_Mesh.hpp"
 #include "al/types/al_Buffer.hpp"
+#include <algorithm>
+#include <functional>
+#include <limits>
 #include <map>
 #include <unordered_map>
 #include <vector>
@@ -172,6 +175,56 @@ public:
     return *this;
   }
 
+  /// Set number of threads used by generate(), 0 for one per core
+
+  /// The field is split along z into slabs that are extracted in parallel
+  /// and merged in order, so the mesh is identical to the one made by a
+  /// single thread. Extraction uses one thread when a vertex action is set.
+  ///
+  Isosurface &threads(int n) {
+    mThreads = n;
+    return *this;
+  }
+
+  /// Get number of threads used by generate(), 0 for one per core
+  int threads() const { return mThreads; }
+
+  /// Set edge length in cells of the bricks used to skip empty regions
+
+  /// The minimum and maximum field value of each brick is found first, and
+  /// bricks that cannot contain the isolevel are skipped. This makes
+  /// extraction of sparse surfaces in large fields much faster.
+  ///
+  Isosurface &brickSize(int n);
+
+  /// Get edge length in cells of bricks
+  int brickSize() const { return mBrickSize; }
+
+  /// Mark field points in [x0,x1) x [y0,y1) x [z0,z1) as changed
+
+  /// The bricks whose surface depends on these points are extracted again
+  /// on the next call to update().
+  ///
+  void markDirty(int x0, int y0, int z0, int x1, int y1, int z1);
+
+  /// Mark all field points as changed
+  void markDirty();
+
+  /// Update isosurface from scalar field, extracting only changed bricks
+
+  /// The first call, and calls after the field dimensions, cell lengths,
+  /// isolevel, brick size or normal settings changed, extract all bricks.
+  /// Later calls only extract the bricks marked with markDirty() and
+  /// overwrite their part of the mesh, so the work is proportional to the
+  /// changed part of the surface.
+  ///
+  /// Each brick has its own vertices, so vertices on the faces between
+  /// bricks appear twice. Normals are interpolated from the field gradient
+  /// so that they agree across bricks. Parts of the buffers not used by any
+  /// brick hold degenerate triangles. Vertex actions are not called.
+  ///
+  template <class T> void update(const T *scalarField);
+
   /// Begin cell-at-a-time mode
   void begin();
 
@@ -263,6 +316,29 @@ protected:
   bool mComputeNormals; // whether to compute normals
   bool mNormalize;      // whether to normalize normals
   bool mInBox;
+  int mThreads;         // threads used by generate(), 0 for one per core
+
+  // Range of field values in a brick of cells, and the brick's part of the
+  // mesh made by update()
+  struct Brick {
+    float min, max;
+    bool dirty;
+    unsigned vertexStart, vertexCapacity;
+    unsigned indexStart, indexCapacity;
+  };
+
+  std::vector<Brick> mBricks;
+  int mBrickSize;
+  int mNB[3]; // number of bricks in x, y, and z directions
+
+  // Settings of the mesh made by update(), which is rebuilt if they change
+  bool mUpdated;
+  float mUpdateLevel;
+  int mUpdateNF[3];
+  double mUpdateL[3];
+  int mUpdateBrickSize;
+  bool mUpdateNormals;
+  size_t mUnusedIndices; // Index buffer space of bricks that were moved
 
   EdgeVertex calcIntersection(int nX, int nY, int nZ, int nEdgeNo,
                               const float *vals) const;
@@ -270,26 +346,84 @@ protected:
                      const float *vals);
 
   void compressTriangles();
+
+  // Parallel extraction. Slabs are ranges of cells along z, each extracted
+  // into its own vertex and index buffers
+  struct Slab;
+  typedef std::function<void(Slab &slab, int zBegin, int zEnd)> SlabExtractor;
+
+  int slabThreads() const;
+  void generateSlabs(const SlabExtractor &extract);
+  void addSlabCell(Slab &slab, int ix, int iy, int iz,
+                   const float *vals) const;
+  int addSlabVertex(Slab &slab, int ix, int iy, int iz, int cellID,
+                    int edgeNo, const float *vals) const;
+
+  // Calls f(x, y, z, values8) for cells with z in [zBegin, zEnd), from the
+  // highest z down, skipping bricks that cannot contain the surface
+  template <class T, class F>
+  void forEachCell(const T *scalarField, int zBegin, int zEnd, F &&f) const;
+
+  // Bricks
+  struct BrickMesh;
+  typedef std::function<void(int brick, float *values)> BrickLoader;
+
+  void resizeBricks();
+  bool brickActive(const Brick &b) const {
+    return !(b.max < mIsolevel) && !(b.min >= mIsolevel);
+  }
+  void runParallel(int count, const std::function<void(int)> &task) const;
+  template <class T> void findBrickRanges(const T *scalarField);
+  template <class T>
+  void loadBrick(const T *scalarField, int brick, float *values) const;
+  void updateBricks(const BrickLoader &load);
+  void extractBrick(int brick, const float *values, BrickMesh &mesh) const;
+  void storeBrick(Brick &brick, const BrickMesh &mesh);
 };
 
 // Implementation ______________________________________________________________
 
 template <class T> void Isosurface::generate(const T *vals) {
+  mUpdated = false;
+  findBrickRanges(vals);
+
+  if (slabThreads() > 1) {
+    generateSlabs([&](Slab &slab, int zBegin, int zEnd) {
+      forEachCell(vals, zBegin, zEnd,
+                  [&](int x, int y, int z, const float *v8) {
+                    addSlabCell(slab, x, y, z, v8);
+                  });
+    });
+    return;
+  }
+
   inBox(true);
   begin();
 
+  // support transparency (assumes higher indices are farther away)
+  forEachCell(vals, 0, mNF[2] - 1, [&](int x, int y, int z, const float *v8) {
+    int i3[] = {x, y, z};
+    addCell(i3, v8);
+  });
+
+  end();
+}
+
+template <class T, class F>
+void Isosurface::forEachCell(const T *vals, int zBegin, int zEnd,
+                             F &&f) const {
   int Nx = mNF[0];
   int Nxy = Nx * mNF[1];
 
   // iterate through cubes (not field points)
-  // for(int z=0; z < mNF[2]-1; ++z){
-  // support transparency (assumes higher indices are farther away)
-  for (int z = mNF[2] - 2; z >= 0; --z) {
+  for (int z = zEnd - 1; z >= zBegin; --z) {
     int z0 = z * Nxy;
     int z1 = (z + 1) * Nxy;
     for (int y = 0; y < mNF[1] - 1; ++y) {
       int y0 = y * Nx;
       int y1 = (y + 1) * Nx;
+      const Brick *bricks =
+          &mBricks[mNB[0] * (y / mBrickSize + mNB[1] * (z / mBrickSize))];
 
       int z0y0 = z0 + y0;
       int z0y1 = z0 + y1;
@@ -302,19 +436,80 @@ template <class T> void Isosurface::generate(const T *vals) {
       int z1y1_1 = z1y1 + 1;
 
       for (int x = 0; x < mNF[0] - 1; ++x) {
+        if (x % mBrickSize == 0 && !brickActive(bricks[x / mBrickSize])) {
+          x += mBrickSize - 1;
+          continue;
+        }
         float v8[] = {float(vals[z0y0 + x]), float(vals[z0y0_1 + x]),
                       float(vals[z0y1 + x]), float(vals[z0y1_1 + x]),
                       float(vals[z1y0 + x]), float(vals[z1y0_1 + x]),
                       float(vals[z1y1 + x]), float(vals[z1y1_1 + x])};
 
-        int i3[] = {x, y, z};
-
-        addCell(i3, v8);
+        f(x, y, z, v8);
       }
     }
   }
+}
 
-  end();
+template <class T> void Isosurface::update(const T *vals) {
+  updateBricks(
+      [&](int brick, float *values) { loadBrick(vals, brick, values); });
+}
+
+template <class T> void Isosurface::findBrickRanges(const T *vals) {
+  resizeBricks();
+  int Nx = mNF[0];
+  int Nxy = Nx * mNF[1];
+  runParallel(mNB[2], [&](int bz) {
+    for (int by = 0; by < mNB[1]; ++by) {
+      for (int bx = 0; bx < mNB[0]; ++bx) {
+        // Field points at the corners of the brick's cells
+        int x0 = bx * mBrickSize, x1 = std::min(x0 + mBrickSize, mNF[0] - 1);
+        int y0 = by * mBrickSize, y1 = std::min(y0 + mBrickSize, mNF[1] - 1);
+        int z0 = bz * mBrickSize, z1 = std::min(z0 + mBrickSize, mNF[2] - 1);
+        float lo = std::numeric_limits<float>::infinity();
+        float hi = -lo;
+        for (int z = z0; z <= z1; ++z) {
+          for (int y = y0; y <= y1; ++y) {
+            const T *row = vals + z * Nxy + y * Nx;
+            for (int x = x0; x <= x1; ++x) {
+              float v = float(row[x]);
+              if (v < lo) lo = v;
+              // NaN is never below the isolevel, like a large value
+              if (v > hi)
+                hi = v;
+              else if (v != v)
+                hi = std::numeric_limits<float>::infinity();
+            }
+          }
+        }
+        Brick &brick = mBricks[bx + mNB[0] * (by + mNB[1] * bz)];
+        brick.min = lo;
+        brick.max = hi;
+      }
+    }
+  });
+}
+
+// Copies the field points of a brick's cells with a margin of one point for
+// gradients. Points outside the field are clamped to its faces.
+template <class T>
+void Isosurface::loadBrick(const T *vals, int brick, float *values) const {
+  int bx = brick % mNB[0];
+  int by = (brick / mNB[0]) % mNB[1];
+  int bz = brick / (mNB[0] * mNB[1]);
+  int n = mBrickSize + 3;
+  for (int k = 0; k < n; ++k) {
+    int z = std::max(0, std::min(bz * mBrickSize + k - 1, mNF[2] - 1));
+    for (int j = 0; j < n; ++j) {
+      int y = std::max(0, std::min(by * mBrickSize + j - 1, mNF[1] - 1));
+      const T *row = vals + posID(0, y, z);
+      for (int i = 0; i < n; ++i) {
+        int x = std::max(0, std::min(bx * mBrickSize + i - 1, mNF[0] - 1));
+        *values++ = float(row[x]);
+      }
+    }
+  }
 }
 
 } // namespace al
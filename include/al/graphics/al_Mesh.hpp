@@ -50,6 +50,7 @@
 #include "al/math/al_Mat.hpp"
 #include "al/math/al_Vec.hpp"
 #include "al/types/al_Color.hpp"
+#include <memory>
 #include <vector>
 
 namespace al {
@@ -109,8 +110,52 @@ public:
   // destructive edits to internal vertices:
 
   /// Generates indices for a set of vertices
+
+  /// Vertices with identical positions are merged, keeping the attributes
+  /// of the first. Works with or without indices, see weld().
   void compress();
 
+  /// Merge vertices with nearly equal positions and attributes
+
+  /// A vertex is merged into the first earlier vertex whose position is
+  /// within epsilon and whose normal, color and texture coordinates differ
+  /// by at most attributeEpsilon in each component. Attribute buffers are
+  /// compared if they have one element per vertex. The remaining vertices
+  /// keep their order. Existing indices are remapped, otherwise indices are
+  /// generated. Vertices are found with a spatial hash, so the cost grows
+  /// linearly with the number of vertices.
+  ///
+  /// @param[in] epsilon        distance below which positions are merged.
+  ///                           0 only merges equal positions
+  /// @param[in] attributeEpsilon  difference below which attributes match
+  /// @param[in] threads        number of threads, 0 for one per core. With
+  ///                           an epsilon of 0 vertices are matched in
+  ///                           parallel, otherwise only hashing and
+  ///                           copying are
+  /// \returns number of vertices removed
+  size_t weld(float epsilon = 0, float attributeEpsilon = 0, int threads = 1);
+
+  /// Reorder triangles and vertices for faster drawing
+
+  /// Triangles are reordered to reuse the vertex cache of the GPU with
+  /// Forsyth's algorithm. Groups of triangles that face outward are then
+  /// moved first, which reduces overdraw, as in Tipsify. Finally vertices
+  /// are numbered in order of first use so they are fetched sequentially.
+  /// The drawn triangles do not change. Triangle strips are converted to
+  /// triangles; meshes without indices are left unchanged, see compress().
+  ///
+  /// @param[in] cacheSize      number of vertices in the cache, up to 64
+  /// @param[in] overdrawThreshold  factor by which sorting for overdraw may
+  ///                           increase the cache miss ratio, 0 to disable
+  void optimize(int cacheSize = 16, float overdrawThreshold = 1.05f);
+
+  /// Average cache miss ratio (ACMR) of the triangles
+
+  /// Number of vertices transformed per triangle with a FIFO vertex cache
+  /// of the given size. It ranges from about 0.5 for large regular grids to
+  /// 3 when no vertices are shared.
+  float cacheMissRatio(int cacheSize = 16) const;
+
   /// Convert indices (if any) to flat vertex buffers
   void decompress();
 
@@ -170,7 +215,13 @@ public:
   /// @param[in] equalWeightPerFace  whether to use an equal weighting of
   ///                  face normals rather than a weighting
   ///                  based on face areas
-  void generateNormals(bool normalize = true, bool equalWeightPerFace = false);
+  /// @param[in] threads        number of threads, 0 for one per core. With
+  ///                  indices and more than one thread, each vertex gathers
+  ///                  the normals of its faces from a vertex to face table
+  ///                  that is kept until indices() is accessed for writing.
+  ///                  The result is the same for any number of threads
+  void generateNormals(bool normalize = true, bool equalWeightPerFace = false,
+                       int threads = 1);
 
   /// Invert direction of normals
   void invertNormals();
@@ -342,7 +393,13 @@ public:
   TexCoord1s &texCoord1s() { return mTexCoord1s; }
   TexCoord2s &texCoord2s() { return mTexCoord2s; }
   TexCoord3s &texCoord3s() { return mTexCoord3s; }
-  Indices &indices() { return mIndices; }
+  /// Index buffer that may be changed. Drops the vertex to face table of
+  /// generateNormals(), so keep no reference across generateNormals() calls
+  /// when changing indices through it.
+  Indices &indices() {
+    mNormalAdjacency.reset();
+    return mIndices;
+  }
 
   /// Save mesh to file
 
@@ -392,6 +449,10 @@ protected:
   Indices mIndices;
 
   Primitive mPrimitive;
+
+  // Vertex to face table of generateNormals(), shared by copies
+  struct NormalAdjacency;
+  std::shared_ptr<const NormalAdjacency> mNormalAdjacency;
 };
 
 template <class T>
@@ -0,0 +1,194 @@
+#ifndef INCLUDE_AL_MESHLOD_HPP
+#define INCLUDE_AL_MESHLOD_HPP
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012. The Regents of the University of California. All
+   rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+        File description:
+        Mesh simplification and levels of detail
+*/
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "al/graphics/al_Mesh.hpp"
+
+namespace al {
+
+/**
+ * @brief Simplifies triangle meshes using quadric error metrics
+ * @ingroup Graphics
+ *
+ * Edges are collapsed onto one of their vertices in order of the error they
+ * add, the mean squared distance to the planes of the original triangles
+ * around the vertex (Garland and Heckbert, "Surface simplification using
+ * quadric error metrics"). Remaining vertices keep their attributes.
+ * Vertices where attributes are discontinuous, such as texture seams, and
+ * non-manifold vertices are never moved.
+ *
+ * The mesh is simplified in passes. Each pass computes the error of all
+ * edges in parallel, then applies the cheapest collapses that do not share
+ * triangles.
+ */
+class MeshSimplifier {
+public:
+  /// Set number of triangles to simplify down to
+  MeshSimplifier &targetTriangles(size_t n) {
+    mTargetTriangles = n;
+    return *this;
+  }
+  size_t targetTriangles() const { return mTargetTriangles; }
+
+  /// Set largest distance the surface may move
+  MeshSimplifier &targetError(float distance) {
+    mTargetError = distance;
+    return *this;
+  }
+  float targetError() const { return mTargetError; }
+
+  /// Set whether vertices on open borders are kept in place
+
+  /// If not locked, border vertices only move along the border.
+  ///
+  MeshSimplifier &lockBoundary(bool lock) {
+    mLockBoundary = lock;
+    return *this;
+  }
+  bool lockBoundary() const { return mLockBoundary; }
+
+  /// Set weight of attribute differences in the error
+
+  /// The difference of the normals, colors and 2D texture coordinates of
+  /// the two vertices of an edge counts as this distance per unit.
+  ///
+  MeshSimplifier &attributeWeight(float w) {
+    mAttributeWeight = w;
+    return *this;
+  }
+  float attributeWeight() const { return mAttributeWeight; }
+
+  /// Set number of threads, 0 for one per core
+  MeshSimplifier &threads(int n) {
+    mThreads = n;
+    return *this;
+  }
+  int threads() const { return mThreads; }
+
+  /// Simplify a mesh in place
+
+  /// Triangle strips are converted to triangles and meshes without indices
+  /// are indexed with Mesh::weld(). Unused vertices are removed.
+  /// \returns the error of the simplified mesh as a distance
+  float simplify(Mesh &mesh) const;
+
+private:
+  size_t mTargetTriangles{0};
+  float mTargetError{std::numeric_limits<float>::max()};
+  bool mLockBoundary{true};
+  float mAttributeWeight{0.01f};
+  int mThreads{1};
+};
+
+/**
+ * @brief Meshes of one object with decreasing levels of detail
+ * @ingroup Graphics
+ *
+ * Level 0 is the original mesh and each following level is simplified from
+ * the previous one. select() gives the coarsest level whose error seen from
+ * a distance stays within a tolerance, for example with the
+ * PositionedVoice::listenerDistance() of a voice in a DynamicScene:
+ *
+ * @code
+ *   void onProcess(Graphics &g) override {
+ *     g.draw(lod.mesh(listenerDistance(), size()));
+ *   }
+ * @endcode
+ */
+class MeshLOD {
+public:
+  /// Generate levels of detail
+
+  /// Stops early if a mesh can not be simplified further.
+  ///
+  /// @param[in] mesh       mesh of level 0
+  /// @param[in] levels     number of levels including level 0
+  /// @param[in] ratio      triangles of each level relative to the previous
+  /// @param[in] simplifier settings for simplification, its target triangles
+  ///                       are set for each level
+  void generate(const Mesh &mesh, int levels = 4, float ratio = 0.5f,
+                MeshSimplifier simplifier = MeshSimplifier());
+
+  /// Get number of levels
+  int levels() const { return int(mLevels.size()); }
+
+  /// Get mesh of a level
+  Mesh &level(int i) { return mLevels[i]; }
+  const Mesh &level(int i) const { return mLevels[i]; }
+
+  /// Get error of a level as a distance, 0 for level 0
+  float error(int i) const { return mErrors[i]; }
+
+  /// Set largest error allowed as seen from the viewer, in radians
+
+  /// The default of 0.001 is about a pixel on a display 1000 pixels wide
+  /// with a field of view of 60 degrees.
+  ///
+  MeshLOD &tolerance(float radians) {
+    mTolerance = radians;
+    return *this;
+  }
+  float tolerance() const { return mTolerance; }
+
+  /// Get the coarsest level with an error within tolerance
+
+  /// @param[in] distance   distance of the mesh from the viewer
+  /// @param[in] scale      scale the mesh is drawn at
+  int select(float distance, float scale = 1) const;
+
+  /// Get the mesh of select()
+  Mesh &mesh(float distance, float scale = 1) {
+    return mLevels[select(distance, scale)];
+  }
+
+private:
+  std::vector<Mesh> mLevels;
+  std::vector<float> mErrors;
+  float mTolerance{0.001f};
+};
+
+} // namespace al
+
+#endif
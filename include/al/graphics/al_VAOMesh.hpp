@@ -8,9 +8,11 @@
 #include "al/graphics/al_Mesh.hpp"
 #include "al/graphics/al_VAO.hpp"
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 namespace al {
 
@@ -49,6 +51,8 @@ class VAOMesh : public Mesh {
                                      // mTexcoord1dAtt {ATTRIB_TEXCOORD_1D, 1}
     ;
     BufferObject indexBuffer;
+    unsigned int indexType = GL_UNSIGNED_INT;
+    std::vector<uint16_t> shortIndices;  // kept to avoid reallocating
   };
 
   std::shared_ptr<VAOWrapper> vaoWrapper;
@@ -66,6 +70,19 @@ class VAOMesh : public Mesh {
   MeshAttrib& texcoord2dAtt() { return vaoWrapper->texcoord2dAtt; }
   MeshAttrib& normalAtt() { return vaoWrapper->normalAtt; }
   BufferObject& indexBuffer() { return vaoWrapper->indexBuffer; }
+  /// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, to draw from indexBuffer()
+  unsigned int indexType() const { return vaoWrapper->indexType; }
+
+  /// Upload 16-bit indices for meshes with up to 65536 vertices
+
+  /// This halves the size of the index buffer. Off by default, as code that
+  /// draws from indexBuffer() itself may expect GL_UNSIGNED_INT; such code
+  /// must use indexType() when this is enabled. Takes effect on update().
+  VAOMesh& compactIndices(bool enable) {
+    mCompactIndices = enable;
+    return *this;
+  }
+  bool compactIndices() const { return mCompactIndices; }
 
   void update();
 
@@ -76,6 +93,9 @@ class VAOMesh : public Mesh {
   void updateAttrib(std::vector<T> const& data, MeshAttrib& att);
 
   void draw();
+
+ private:
+  bool mCompactIndices{false};
 };
 
 }  // namespace al
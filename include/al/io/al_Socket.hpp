@@ -46,6 +46,7 @@
 */
 
 #include <string>
+#include <vector>
 
 #include "al/system/al_Time.hpp"
 #include "al/types/al_ValueSource.hpp"
@@ -167,6 +168,17 @@ public:
   /// socket address pair of this connection.
   bool accept(Socket &sock);
 
+  /// Switch between blocking and non-blocking mode
+
+  /// In non-blocking mode recv(), send() and accept() return immediately.
+  /// When they fail, wouldBlock() tells whether the call should be repeated
+  /// once the socket is ready, which a SocketPoller can wait for.
+  bool setBlocking(bool blocking);
+
+  /// Whether the last failed call on this thread failed only because a
+  /// non-blocking socket was not ready
+  static bool wouldBlock();
+
   ValueSource *valueSource();
 
 protected:
@@ -174,6 +186,7 @@ protected:
   virtual bool onOpen() { return true; }
 
 private:
+  friend class SocketPoller;
   struct Impl;
   Impl *mImpl;
   ValueSource mValueSource;
@@ -232,6 +245,57 @@ protected:
   virtual bool onOpen();
 };
 
+/// Waits until any of several sockets is ready
+
+/// Lets a single thread serve many non-blocking sockets. Uses epoll on Linux
+/// and poll() on other platforms, where changes made while another thread
+/// is in wait() can take up to 10 ms to apply.
+///
+/// @ingroup IO
+class SocketPoller {
+public:
+  /// Bit masks for events
+  enum {
+    READ = 1 << 0,  /**< Data or a connection can be received */
+    WRITE = 1 << 1, /**< Data can be sent */
+    HANGUP = 1 << 2 /**< Connection closed or failed. Always reported */
+  };
+
+  struct Event {
+    Socket *socket;
+    int events;
+  };
+
+  SocketPoller();
+  ~SocketPoller();
+
+  /// Start watching socket for events, a combination of READ and WRITE
+  bool add(Socket &socket, int events);
+
+  /// Change the events watched for socket
+  bool modify(Socket &socket, int events);
+
+  /// Stop watching socket. Must be called before the socket is closed
+  bool remove(Socket &socket);
+
+  /// Wait for events
+
+  /// @param[out] events	Ready sockets and their events
+  /// @param[in] timeout	Seconds to wait, < 0 waits forever
+  /// \returns number of ready sockets, 0 on timeout or wakeUp()
+  size_t wait(std::vector<Event> &events, al_sec timeout);
+
+  /// Return from wait() in another thread without waiting for an event
+  void wakeUp();
+
+private:
+  SocketPoller(const SocketPoller &) = delete;
+  SocketPoller &operator=(const SocketPoller &) = delete;
+
+  struct Impl;
+  Impl *mImpl;
+};
+
 ///// \deprecated Use SocketClient
 // typedef SocketClient SocketSend;
 
@@ -42,6 +42,7 @@
   Lance Putnam, 2011, putnam.lance@gmail.com
 */
 
+#include "al/math/al_Mat.hpp"
 #include "al/math/al_Plane.hpp"
 #include "al/math/al_Vec.hpp"
 
@@ -105,6 +106,19 @@ class Frustum {
   /// thus returning a false positive.
   int testBox(const Vec<3, T>& xyz, const Vec<3, T>& dim) const;
 
+  /// Test whether spheres are outside frustum
+
+  /// The loop over the spheres has no branches, so that compilers can
+  /// vectorize it. Spheres with an infinite radius are never outside.
+  ///
+  /// @param[in]  x,y,z   centers of the spheres
+  /// @param[in]  radius  radii of the spheres
+  /// @param[in]  n       number of spheres
+  /// @param[out] inside  set to 0 for spheres outside, otherwise 1
+  template <class U>
+  void testSpheres(const U* x, const U* y, const U* z, const U* radius, int n,
+                   unsigned char* inside) const;
+
   /// Get axis-aligned bounding box
   template <class V>
   void boundingBox(Vec<3, V>& xyz, Vec<3, V>& dim) const;
@@ -120,6 +134,15 @@ class Frustum {
   ///
   void computePlanes();
 
+  /// Compute planes and corners from a projection matrix
+
+  /// The frustum is in the space that the matrix transforms into clip
+  /// space, so a projection times view matrix gives it in world space.
+  /// Planes are extracted as in Gribb and Hartmann, "Fast Extraction of
+  /// Viewing Frustum Planes from the World-View-Projection Matrix".
+  template <class U>
+  void fromMatrix(const Mat<4, U>& m);
+
  private:
   template <class Tf, class Tv>
   static Tv lerp(Tf f, const Tv& x, const Tv& y) {
@@ -143,6 +166,58 @@ void Frustum<T>::boundingBox(Vec<3, V>& xyz, Vec<3, V>& dim) const {
   dim = vmax - vmin;
 }
 
+template <class T>
+template <class U>
+void Frustum<T>::testSpheres(const U* x, const U* y, const U* z,
+                             const U* radius, int n,
+                             unsigned char* inside) const {
+  U a[6], b[6], c[6], d[6];
+  for (int j = 0; j < 6; ++j) {
+    a[j] = pl[j].normal()[0];
+    b[j] = pl[j].normal()[1];
+    c[j] = pl[j].normal()[2];
+    d[j] = pl[j].d();
+  }
+  for (int i = 0; i < n; ++i) {
+    // smallest distance from a plane, without branches
+    U distance = a[0] * x[i] + b[0] * y[i] + c[0] * z[i] + d[0];
+    for (int j = 1; j < 6; ++j) {
+      U dj = a[j] * x[i] + b[j] * y[i] + c[j] * z[i] + d[j];
+      distance = dj < distance ? dj : distance;
+    }
+    inside[i] = distance >= -radius[i];
+  }
+}
+
+template <class T>
+template <class U>
+void Frustum<T>::fromMatrix(const Mat<4, U>& m) {
+  // plane coefficients are sums and differences of rows
+  auto plane = [&](Plane<T>& p, int row, T sign) {
+    p.fromCoefficients(m(3, 0) + sign * m(row, 0), m(3, 1) + sign * m(row, 1),
+                       m(3, 2) + sign * m(row, 2), m(3, 3) + sign * m(row, 3));
+  };
+  plane(pl[LEFT], 0, 1);
+  plane(pl[RIGHT], 0, -1);
+  plane(pl[BOTTOM], 1, 1);
+  plane(pl[TOP], 1, -1);
+  plane(pl[NEARP], 2, 1);
+  plane(pl[FARP], 2, -1);
+
+  // each corner is where three planes meet
+  auto meet = [](const Plane<T>& p1, const Plane<T>& p2, const Plane<T>& p3) {
+    Vec<3, T> n23 = cross(p2.normal(), p3.normal());
+    Vec<3, T> n31 = cross(p3.normal(), p1.normal());
+    Vec<3, T> n12 = cross(p1.normal(), p2.normal());
+    return (n23 * p1.d() + n31 * p2.d() + n12 * p3.d()) /
+           -p1.normal().dot(n23);
+  };
+  for (int i = 0; i < 8; ++i) {
+    (&ntl)[i] = meet(pl[i & 1 ? RIGHT : LEFT], pl[i & 2 ? BOTTOM : TOP],
+                     pl[i & 4 ? FARP : NEARP]);
+  }
+}
+
 template <class T>
 void Frustum<T>::computePlanes() {
   pl[TOP].from3Points(ntr, ntl, ftl);
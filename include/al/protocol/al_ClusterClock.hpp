@@ -0,0 +1,194 @@
+#ifndef AL_CLUSTERCLOCK_HPP
+#define AL_CLUSTERCLOCK_HPP
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012. The Regents of the University of California. All
+   rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+        File description:
+        Clock shared by the nodes of a cluster
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <thread>
+
+#include "al/protocol/al_CommandConnection.hpp"
+#include "al/system/al_Time.hpp"
+
+namespace al {
+
+/**
+ * @brief Clock synchronization state of a ClusterClockClient
+ * @ingroup Protocol
+ */
+struct ClusterClockStats {
+  uint64_t samples{0};   ///< Replies received from the primary
+  double roundTrip{0.0}; ///< Shortest recent round trip in seconds
+  double offset{0.0};    ///< Cluster time minus local time in seconds
+  double drift{0.0};     ///< Rate difference to the primary clock
+};
+
+/**
+ * @brief Time shared by all nodes of a cluster
+ * @ingroup Protocol
+ *
+ * Cluster time is the steady clock of the primary, see ClusterClockServer.
+ * Replicas estimate it with ClusterClockClient. Use now() to schedule
+ * events and pass a ClusterClock to SynthSequencer::setClock(),
+ * PresetSequencer::setClock() or DistributedScene::setClock() so all nodes
+ * play in sync. now() does not
+ * block or allocate, so it can be called from the audio thread.
+ */
+class ClusterClock {
+public:
+  virtual ~ClusterClock() {}
+
+  /// Current cluster time in seconds
+  al_sec now() { return toCluster(localTime()); }
+
+  /// Convert a time from localTime() to cluster time
+  virtual al_sec toCluster(al_sec local) = 0;
+
+  /// Convert cluster time to the equivalent localTime()
+  virtual al_sec toLocal(al_sec cluster) = 0;
+
+  /// true once the cluster time is known
+  virtual bool synchronized() = 0;
+
+  /// The local clock, al_steady_time() by default
+  virtual al_sec localTime() { return al_steady_time(); }
+};
+
+/**
+ * @brief Primary clock of the cluster
+ * @ingroup Protocol
+ *
+ * Answers the time requests of ClusterClockClient. Its cluster time is its
+ * local time.
+ */
+class ClusterClockServer : public CommandServer, public ClusterClock {
+public:
+  ClusterClockServer();
+  ~ClusterClockServer();
+
+  bool start(uint16_t serverPort = 34470,
+             const char *serverAddr = "0.0.0.0") override;
+
+  al_sec toCluster(al_sec local) override { return local; }
+  al_sec toLocal(al_sec cluster) override { return cluster; }
+  bool synchronized() override { return true; }
+
+  bool processIncomingMessage(Message &message, Socket *src) override;
+};
+
+/**
+ * @brief Estimates the cluster time from the primary
+ * @ingroup Protocol
+ *
+ * Sends time requests to the ClusterClockServer in the manner of NTP. Each
+ * reply gives the clock offset and the round trip time. Replies delayed by
+ * the network are discarded, and a line fitted over the remaining recent
+ * offsets gives both the offset and the drift of the local clock, so the
+ * estimate stays accurate between requests.
+ */
+class ClusterClockClient : public CommandClient, public ClusterClock {
+public:
+  ClusterClockClient();
+  ~ClusterClockClient();
+
+  bool start(uint16_t serverPort = 34470,
+             const char *serverAddr = "localhost") override;
+  void stop() override;
+
+  /// Seconds between time requests once synchronized
+  void setSyncInterval(double seconds) { mSyncInterval = seconds; }
+
+  al_sec toCluster(al_sec local) override;
+  al_sec toLocal(al_sec cluster) override;
+  bool synchronized() override { return mSynchronized; }
+
+  /**
+   * @brief wait until the first estimate is available
+   * @return false if not synchronized within the timeout
+   */
+  bool waitForSync(double timeout = 2.0);
+
+  ClusterClockStats stats();
+
+  bool processIncomingMessage(Message &message, Socket *src) override;
+
+private:
+  struct Sample {
+    al_sec time;   // Local time halfway through the request
+    double offset; // Cluster minus local time
+    double delay;  // Round trip without the primary's processing time
+  };
+
+  // Offset at reference, changing at drift
+  struct Estimate {
+    al_sec reference;
+    double offset;
+    double drift;
+  };
+
+  void sendRequest();
+  void addSample(const Sample &sample);
+  void publish(const Estimate &estimate);
+  Estimate estimate() const;
+
+  std::unique_ptr<std::thread> mSyncThread;
+  std::atomic<bool> mSyncRunning{false};
+  double mSyncInterval{0.5};
+
+  // Only used in the connection thread
+  std::deque<Sample> mSamples;
+
+  // Current estimate, published by the connection thread as a sequence
+  // lock: the version is odd while it is written, and readers retry instead
+  // of waiting, so the audio thread never blocks on the connection thread
+  std::atomic<uint32_t> mEstimateVersion{0};
+  std::atomic<al_sec> mReference{0.0};
+  std::atomic<double> mOffset{0.0};
+  std::atomic<double> mDrift{0.0};
+  std::atomic<double> mRoundTrip{0.0};
+  std::atomic<uint64_t> mSampleCount{0};
+  std::atomic<bool> mSynchronized{false};
+};
+
+} // namespace al
+
+#endif // AL_CLUSTERCLOCK_HPP
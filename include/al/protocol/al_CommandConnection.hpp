@@ -46,8 +46,10 @@
         Keehong Youn, 2017, younkeehong@gmail.com
 */
 
+#include <atomic>
 #include <cinttypes>
 #include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <map>
 #include <memory>
@@ -56,6 +58,7 @@
 #include <vector>
 
 #include "al/io/al_Socket.hpp"
+#include "al/protocol/al_Compression.hpp"
 #include "al/types/al_SingleRWRingBuffer.hpp"
 #include "al/types/al_ValueSource.hpp"
 
@@ -147,9 +150,20 @@ public:
     PING,
     PONG,
     COMMAND_QUIT,
+    COMPRESSED,
     COMMAND_LAST_INTERNAL = 32,
   } InternalCommands;
 
+  /// Features agreed on during the handshake
+  typedef enum {
+    CAPABILITY_COMPRESSION = 1 << 0,
+    /// Messages are prefixed with their size as a 32 bit integer
+    CAPABILITY_FRAMING = 1 << 1
+  } Capabilities;
+
+  /// Largest message accepted from a peer that uses framing
+  static const size_t kMaxMessageSize = 64 * 1024 * 1024;
+
   virtual bool start(uint16_t port, const char *addr) = 0;
   virtual void stop();
 
@@ -184,9 +198,72 @@ public:
 
   void setVerbose(bool verbose) { mVerbose = verbose; }
 
+  /**
+   * @brief compress outgoing messages of threshold bytes or more
+   * @param enable enable compression
+   * @param codec compression algorithm
+   * @param threshold smaller messages are always sent as they are
+   *
+   * Must be called before start(). Compression is only used with peers that
+   * enabled it too, which is agreed on during the handshake, so compressing
+   * and non-compressing peers can be mixed. Compressed messages arrive in
+   * processIncomingMessage() already decompressed.
+   */
+  void setCompression(bool enable,
+                      CompressionCodec codec = CompressionCodec::LZ,
+                      size_t threshold = 256);
+
+  /// Compression ratio and time spent compressing sent messages
+  CompressionStats compressionStats();
+
+  /// Time spent decompressing received messages
+  CompressionStats decompressionStats();
+
 protected:
   virtual void onConnection(Socket *newConnection){};
 
+  /// Called on the server when a connection closes, before its socket is
+  /// closed
+  virtual void onDisconnection(Socket *connection){};
+
+  uint8_t capabilities() {
+    return (mCompression ? CAPABILITY_COMPRESSION : 0) | CAPABILITY_FRAMING;
+  }
+
+  /**
+   * @brief prepare a message for sending to a peer
+   * @param out bytes to write to the socket
+   *
+   * The message is compressed and framed if the peer supports it.
+   */
+  void encodeMessage(const uint8_t *message, size_t length,
+                     uint8_t peerCapabilities, std::vector<uint8_t> &out);
+
+  /**
+   * @brief send a message, compressed if the peer supports it
+   *
+   * Blocks until the whole message has been written to the socket.
+   */
+  bool sendTo(Socket &socket, const uint8_t *message, size_t length,
+              uint8_t peerCapabilities);
+
+  /**
+   * @brief decompress message if needed and pass it to
+   * processIncomingMessage()
+   *
+   * Ping requests are answered here.
+   */
+  bool processMessage(Message &message, Socket *src);
+
+  /**
+   * @brief process all complete messages in bytes received from a peer
+   * @param received received bytes. Processed bytes are removed, the start
+   * of an incomplete message is left for the next call
+   * @return false if the peer sent a message too large to accept
+   */
+  bool processReceived(std::vector<uint8_t> &received,
+                       uint8_t peerCapabilities, Socket *src);
+
   uint16_t mVersion = 0,
            mRevision = 0; // Subclasses must set these to ensure compatibility
 
@@ -194,16 +271,39 @@ protected:
   BarrierState mState{BarrierState::NONE};
   std::mutex mConnectionsLock;
 
-  bool mRunning{false};
+  std::atomic<bool> mRunning{false};
   std::vector<std::unique_ptr<std::thread>> mConnectionThreads;
   std::vector<std::unique_ptr<std::thread>> mDataThreads;
-  std::vector<std::shared_ptr<al::Socket>>
-      mServerConnections; // Only available on server.
+  // Only available on server. Only use sendMessage() to write to these, as
+  // messages are queued and framed
+  std::vector<std::shared_ptr<al::Socket>> mServerConnections;
   std::vector<std::pair<uint16_t, uint16_t>> mConnectionVersions;
+  // Capabilities shared with each server connection or with the server
+  std::vector<uint8_t> mConnectionCapabilities;
+  uint8_t mServerCapabilities{0};
   al::Socket mSocket; // Bootstrap socket for server, main socket for client.
   bool mVerbose{false};
+
+  bool mCompression{false};
+  size_t mCompressionThreshold{256};
+  std::mutex mCompressorLock;
+  Compressor mCompressor{CompressionCodec::LZ, 1};
+  std::vector<unsigned char> mCompressed;
+  std::mutex mDecompressorLock;
+  Compressor mDecompressor;
 };
 
+/**
+ * @brief Accepts connections from CommandClient and exchanges messages
+ * with them
+ *
+ * A single thread serves all connections with non-blocking sockets, and
+ * processIncomingMessage() is called from that thread, so it should not
+ * block. sendMessage() can be called from any thread: messages are queued
+ * for each connection and written when the socket is ready. If a client
+ * does not keep up and its queue grows past the send queue limit, further
+ * messages to it are dropped and sendMessage() returns false.
+ */
 class CommandServer : public CommandConnection {
 public:
   bool start(uint16_t serverPort = 34450,
@@ -240,9 +340,55 @@ public:
   bool sendMessage(uint8_t *message, size_t length, Socket *dst = nullptr,
                    ValueSource *src = nullptr) override;
 
+  /// Largest number of bytes waiting to be sent to a single client
+  void setSendQueueLimit(size_t bytes) { mSendQueueLimit = bytes; }
+
+  /// Bytes waiting to be sent to all clients
+  size_t queuedBytes();
+
+  /// Messages dropped because a send queue was full
+  uint64_t droppedMessages() { return mDroppedMessages; }
+
 protected:
 private:
-  std::unique_ptr<std::thread> mBootstrapServerThread;
+  struct Connection {
+    std::vector<uint8_t> received;
+    std::deque<std::vector<uint8_t>> sendQueue;
+    size_t sendOffset{0}; // Bytes of the first queued message already sent
+    size_t queuedBytes{0};
+    bool writeWatched{false};
+    bool failed{false};
+    bool overflowing{false};
+  };
+
+  // Connection whose handshake has not been received completely
+  struct PendingConnection {
+    std::shared_ptr<Socket> socket;
+    std::vector<uint8_t> received;
+    // Time at which a 5 byte handshake is taken as one from a client that
+    // does not send capabilities. 0 until 5 bytes have been received.
+    al_sec legacyDeadline{0};
+  };
+
+  void runReactor();
+  void acceptConnections();
+  void handshake(size_t pendingIndex);
+  void completeHandshake(size_t pendingIndex);
+  void receive(size_t index);
+  void closeConnection(size_t index);
+  // Must be called with mConnectionsLock held
+  bool queueMessage(size_t index, const uint8_t *message, size_t length,
+                    bool encode = true);
+  void flush(size_t index);
+  void flushLocked(size_t index);
+
+  std::unique_ptr<std::thread> mReactorThread;
+  SocketPoller mPoller;
+  std::vector<PendingConnection> mPendingConnections;
+  // Parallel to mServerConnections
+  std::vector<std::unique_ptr<Connection>> mConnectionStates;
+  size_t mSendQueueLimit{16 * 1024 * 1024};
+  std::atomic<uint64_t> mDroppedMessages{0};
 
   uint16_t mPortOffset = 12000;
 };
@@ -255,12 +401,17 @@ public:
   bool sendMessage(uint8_t *message, size_t length, Socket *dst = nullptr,
                    al::ValueSource *src = nullptr) override;
 
-  bool isConnected() { return mRunning && mSocket.opened(); }
+  bool isConnected() {
+    return mRunning && mSocket.opened() && !mDisconnected;
+  }
 
 protected:
   void clientHandlePing(Socket &client);
 
 private:
+  std::mutex mSendLock;
+  std::atomic<bool> mDisconnected{false};
+
   uint16_t mPortOffset = 12000;
 };
 
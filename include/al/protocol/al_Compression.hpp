@@ -0,0 +1,178 @@
+#ifndef INCLUDE_AL_COMPRESSION_HPP
+#define INCLUDE_AL_COMPRESSION_HPP
+
+/*  Allocore --
+  Multimedia / virtual environment application class library
+
+  Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+  Copyright (C) 2012. The Regents of the University of California.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    Neither the name of the University of California nor the names of its
+    contributors may be used to endorse or promote products derived from
+    this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+
+  File description:
+  Fast lossless compression for network payloads
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace al {
+
+/**
+ * @brief Worst case size of lzCompress() output for size bytes of input
+ */
+inline size_t lzCompressBound(size_t size) { return size + size / 255 + 16; }
+
+/**
+ * @brief Compress with a byte oriented LZ77 coder
+ * @return number of bytes written to out, 0 if capacity was too small
+ *
+ * The format follows the LZ4 block format: each sequence is a token holding
+ * literal and match lengths, the literals, a 16 bit offset and extra length
+ * bytes. It trades compression ratio for speed, so it can run on every
+ * frame.
+ */
+size_t lzCompress(const unsigned char *in, size_t size, unsigned char *out,
+                  size_t capacity);
+
+/**
+ * @brief Decompress lzCompress() output
+ * @return true if the input decoded to exactly size bytes
+ *
+ * All reads and writes are checked, so malformed input fails instead of
+ * overrunning out.
+ */
+bool lzDecompress(const unsigned char *in, size_t inSize, unsigned char *out,
+                  size_t size);
+
+/**
+ * @brief Group byte k of every element together
+ *
+ * Arrays of floats compress poorly because neighbouring bytes are unrelated.
+ * After shuffling, the exponent and high mantissa bytes of all elements are
+ * adjacent and form long runs. Bytes after the last whole element are
+ * copied unchanged.
+ */
+void byteShuffle(const unsigned char *in, unsigned char *out, size_t size,
+                 size_t elementSize);
+
+/// Reverse byteShuffle()
+void byteUnshuffle(const unsigned char *in, unsigned char *out, size_t size,
+                   size_t elementSize);
+
+/// Algorithms available to Compressor
+/// @ingroup Protocol
+enum class CompressionCodec : uint8_t {
+  NONE = 0,      ///< Data is stored as is
+  LZ = 1,        ///< lzCompress()
+  SHUFFLE_LZ = 2 ///< byteShuffle() followed by lzCompress()
+};
+
+/**
+ * @brief Counters for one direction of a Compressor
+ * @ingroup Protocol
+ */
+struct CompressionStats {
+  uint64_t blocks{0};      ///< Blocks processed
+  uint64_t blocksRaw{0};   ///< Blocks that did not compress and were not sent
+  uint64_t rawBytes{0};    ///< Uncompressed size of the blocks
+  uint64_t codedBytes{0};  ///< Compressed size of the blocks
+  double seconds{0.0};     ///< Time spent in the codec
+
+  /// Uncompressed size over compressed size
+  double ratio() const {
+    return codedBytes > 0 ? double(rawBytes) / double(codedBytes) : 1.0;
+  }
+};
+
+/**
+ * @brief Compresses blocks into a self describing format
+ * @ingroup Protocol
+ *
+ * Each block starts with an 8 byte header holding the codec, the element
+ * size used for shuffling and the uncompressed size, so the receiving side
+ * does not need to know how the sender was configured.
+ *
+ * A Compressor is not thread safe, use one per thread or stream.
+ */
+class Compressor {
+public:
+  static const size_t kHeaderSize = 8;
+
+  Compressor(CompressionCodec codec = CompressionCodec::SHUFFLE_LZ,
+             uint8_t elementSize = 4) {
+    configure(codec, elementSize);
+  }
+
+  /**
+   * @param codec algorithm for compress()
+   * @param elementSize size of the values in the data, e.g. 4 for floats
+   */
+  void configure(CompressionCodec codec, uint8_t elementSize = 4);
+
+  CompressionCodec codec() const { return mCodec; }
+
+  /**
+   * @brief compress data into out
+   * @return false if compressing would not make the data smaller. out is
+   * then undefined and the data should be sent uncompressed
+   */
+  bool compress(const void *data, size_t size, std::vector<unsigned char> &out);
+
+  /**
+   * @brief decompress a block produced by compress() into out
+   * @param maxSize largest uncompressed size accepted. The size is read from
+   * the block, so this bounds what untrusted input can allocate
+   * @return false if the block is malformed or would exceed maxSize
+   */
+  bool decompress(const void *block, size_t size,
+                  std::vector<unsigned char> &out, size_t maxSize);
+
+  /// Uncompressed size of a block, 0 if it has no valid header
+  static size_t decompressedSize(const void *block, size_t size);
+
+  const CompressionStats &compressStats() const { return mCompressStats; }
+  const CompressionStats &decompressStats() const { return mDecompressStats; }
+  void resetStats() {
+    mCompressStats = CompressionStats();
+    mDecompressStats = CompressionStats();
+  }
+
+private:
+  CompressionCodec mCodec{CompressionCodec::SHUFFLE_LZ};
+  uint8_t mElementSize{4};
+  std::vector<unsigned char> mShuffled;
+  CompressionStats mCompressStats;
+  CompressionStats mDecompressStats;
+};
+
+} // namespace al
+
+#endif // INCLUDE_AL_COMPRESSION_HPP
@@ -0,0 +1,194 @@
+#ifndef AL_FRAMEBARRIER_HPP
+#define AL_FRAMEBARRIER_HPP
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012. The Regents of the University of California. All
+   rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+        File description:
+        Barrier to present frames at the same time on several renderers
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "al/protocol/al_CommandConnection.hpp"
+
+namespace al {
+
+/**
+ * @brief Time spent waiting in a frame barrier
+ * @ingroup Protocol
+ */
+struct FrameBarrierStats {
+  uint64_t frames{0};   ///< Calls to sync()
+  uint64_t timeouts{0}; ///< Frames released by the timeout
+  double lastWait{0.0}; ///< Seconds waited in the last sync()
+  double maxWait{0.0};
+  double totalWait{0.0};
+
+  double meanWait() const { return frames > 0 ? totalWait / frames : 0.0; }
+};
+
+/**
+ * @brief Primary side of the frame barrier
+ * @ingroup Protocol
+ *
+ * Renderers connect with FrameBarrierClient over TCP to register. After
+ * that, each frame uses a single UDP datagram in each direction: every
+ * renderer reports that its frame is ready, and once all have reported the
+ * primary releases them at the same time. Call sync() after drawing and
+ * before swapping buffers.
+ *
+ * A renderer that does not report within the timeout does not block the
+ * others: its frame is released without it, and after a few missed frames
+ * it is no longer waited for until it reports again. A renderer whose
+ * connection closes is dropped, and one that registers again from the same
+ * address and port takes over its previous slot. The UDP port is the same
+ * as the TCP port.
+ */
+class FrameBarrierServer : public CommandServer {
+public:
+  FrameBarrierServer();
+  ~FrameBarrierServer();
+
+  bool start(uint16_t serverPort = 34460,
+             const char *serverAddr = "0.0.0.0") override;
+  void stop() override;
+
+  /**
+   * @brief wait until all renderers are ready and release them
+   * @return false if the frame was released because of the timeout
+   */
+  bool sync();
+
+  /// Number of the last frame released
+  uint32_t frame() const { return mFrame; }
+
+  /// Longest time sync() waits for renderers, in seconds
+  void setTimeout(double seconds) { mTimeout = seconds; }
+
+  /// Renderers currently waited for
+  size_t activeClients();
+
+  FrameBarrierStats stats();
+
+  bool processIncomingMessage(Message &message, Socket *src) override;
+
+protected:
+  void onDisconnection(Socket *connection) override;
+
+private:
+  // Slots of disconnected renderers have no socket and are reused, so ids
+  // stay below the number of renderers connected at once
+  struct BarrierClient {
+    std::shared_ptr<SocketClient> socket; // Release messages
+    Socket *connection{nullptr};          // Registration connection
+    uint32_t readyFrame{0};
+    uint16_t missedFrames{0};
+    bool active{true};
+  };
+
+  bool allReady(uint32_t frame);
+  void sendRelease(SocketClient &socket, uint32_t frame);
+
+  std::vector<BarrierClient> mClients;
+  std::mutex mBarrierLock;
+  std::condition_variable mReadyCondition;
+  // Sockets released by sync(), sent to after the lock is released
+  std::vector<std::shared_ptr<SocketClient>> mReleaseSockets;
+  SocketServer mUdpSocket;
+  std::unique_ptr<std::thread> mUdpThread;
+  std::atomic<bool> mUdpRunning{false};
+  uint32_t mFrame{0};
+  double mTimeout{0.05};
+  FrameBarrierStats mStats;
+};
+
+/**
+ * @brief Renderer side of the frame barrier
+ * @ingroup Protocol
+ *
+ * If the primary can't be reached, start() fails and sync() returns
+ * immediately, so applications keep running without the barrier.
+ */
+class FrameBarrierClient : public CommandClient {
+public:
+  FrameBarrierClient();
+  ~FrameBarrierClient();
+
+  bool start(uint16_t serverPort = 34460,
+             const char *serverAddr = "localhost") override;
+  void stop() override;
+
+  /**
+   * @brief report this frame ready and wait for the primary's release
+   * @return false if not connected or if the wait timed out
+   */
+  bool sync();
+
+  /// Number of the last frame released by the primary
+  uint32_t frame() const { return mFrame; }
+
+  /// Longest time sync() waits for the release, in seconds
+  void setTimeout(double seconds) { mTimeout = seconds; }
+
+  bool isRegistered() { return mRegistered; }
+
+  FrameBarrierStats stats() { return mStats; }
+
+  bool processIncomingMessage(Message &message, Socket *src) override;
+
+private:
+  void sendReady(uint32_t frame);
+
+  SocketServer mUdpSocket;
+  SocketClient mServerSocket;
+  std::mutex mRegisterLock;
+  std::condition_variable mRegisterCondition;
+  std::atomic<bool> mRegistered{false};
+  uint16_t mId{0};
+  uint32_t mFrame{0};
+  double mTimeout{0.05};
+  FrameBarrierStats mStats;
+};
+
+} // namespace al
+
+#endif // AL_FRAMEBARRIER_HPP
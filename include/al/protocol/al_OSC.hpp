@@ -213,6 +213,10 @@ protected:
 
 /// Inbound OSC message
 ///
+/// A message does not own the raw bytes it reads from. Messages passed to a
+/// PacketHandler point into the receive buffer and are only valid during the
+/// call to PacketHandler::onMessage().
+///
 /// @ingroup allocore
 class Message {
 public:
@@ -225,6 +229,9 @@ public:
           const char *senderAddr = nullptr);
   ~Message();
 
+  Message(const Message &) = delete;
+  Message &operator=(const Message &) = delete;
+
   /// Pretty-print message information
   void print() const;
 
@@ -256,8 +263,19 @@ public:
   Message &operator>>(Blob &v); ///< Extract next stream element as Blob
 
 protected:
+  friend class Recv;
+
+  // Empty message, to be pointed at received data with reset()
+  Message();
+
+  // Point message at new raw bytes. Address and type tag strings keep their
+  // capacity, so reusing a Message does not allocate once warmed up.
+  void reset(const char *message, int size, const TimeTag &timeTag,
+             const char *senderAddr);
+
   class Impl;
-  Impl *mImpl;
+  Impl *mImpl{nullptr}; // Constructed in place in mImplStorage
+  alignas(8) char mImplStorage[128];
   std::string mAddressPattern;
   std::string mTypeTags;
   TimeTag mTimeTag;
@@ -318,12 +336,21 @@ public:
   const std::string &address() const { return mAddress; }
   uint16_t port() const { return mPort; }
 
+  /// Set number of router hops for packets sent to a multicast address
+  void multicastTTL(int ttl);
+
+  /// Set whether multicast packets are also delivered to the sending host
+  void multicastLoopback(bool loopback);
+
   /// Send and clear current packet contents
   size_t send();
 
   /// Send a packet
   size_t send(const Packet &p);
 
+  /// Send already encoded OSC data, e.g. a bundle assembled elsewhere
+  size_t sendRaw(const char *data, size_t size);
+
   /// Send zero argument message immediately
   size_t send(const std::string &addr) {
     addMessage(addr);
@@ -416,17 +443,27 @@ public:
 
   bool isOpen() { return mOpen; }
 
+  /// Receive packets sent to a multicast group, e.g. "239.255.0.1"
+  /// Must be called after open(). The socket should be bound to "0.0.0.0"
+  /// or to the group address.
+  /// @param[in] group		multicast group address
+  /// @param[in] interfaceAddress	address of the network interface to
+  /// receive on. If empty, the system chooses.
+  bool joinMulticastGroup(const char *group,
+                          const char *interfaceAddress = "");
+
   const std::string &address() const { return mAddress; }
   uint16_t port() const { return mPort; }
 
   /// Whether background polling is activated
   bool background() const { return mBackground; }
 
-  /// Get current received packet data
-  const char *data() const { return &mBuffer[0]; }
+  /// Get current received packet data. Only valid while handlers are called
+  const char *data() const { return mCurrentPacket; }
 
-  /// Set size of internal buffer
-  void bufferSize(int n) { mBuffer.resize(n); }
+  /// \deprecated Does nothing, kept for compatibility. Received packets are
+  /// parsed in place, so there is no buffer to size.
+  void bufferSize(int /*n*/) {}
 
   /// Set packet handling routine
   Recv &handler(PacketHandler &v) {
@@ -454,18 +491,32 @@ public:
   /// Stop the background polling
   void stop();
 
+  /// Parse packet and pass each message to the handlers
+
+  /// Messages are read in place from packet, which must remain valid until
+  /// this function returns. No memory is allocated per message. Each handler
+  /// receives all the messages in the packet, in order, before the next
+  /// handler is called.
   void parse(const char *packet, int size, const char *senderAddr);
   void loop();
 
   static bool portAvailable(uint16_t port, const char *address = "");
 
+  /// Parse packet into a list of messages
+
+  /// The messages point into packet, which must outlive them. Prefer
+  /// parse(packet, size, senderAddr) with a handler, which does not allocate.
   static std::vector<std::shared_ptr<Message>>
   parse(const char *packet, int size, TimeTag timeTag = 1,
         const char *senderAddr = nullptr);
 
 protected:
+  void visit(PacketHandler *handler, const char *packet, int size,
+             TimeTag timeTag, const char *senderAddr);
+
   std::vector<PacketHandler *> mHandlers;
-  std::vector<char> mBuffer;
+  Message mMessage; // Reused for every message received
+  const char *mCurrentPacket{nullptr};
   al::Thread mThread;
   bool mBackground;
   std::string mAddress = "";
@@ -1,11 +1,39 @@
 #ifndef AL_DISTRIBUTEDSCENE_HPP
 #define AL_DISTRIBUTEDSCENE_HPP
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "al/protocol/al_OSC.hpp"
 #include "al/scene/al_DynamicScene.hpp"
+#include "al/system/al_Time.hpp"
+#include "al/types/al_SingleRWRingBuffer.hpp"
 #include "al/ui/al_ParameterServer.hpp"
 
 namespace al {
+
+class ClusterClock;
+
+/**
+ * @brief Counters for DistributedScene replication frames
+ * @ingroup Scene
+ */
+struct SceneReplicationStats {
+  uint64_t framesSent{0};
+  uint64_t bytesSent{0};
+  uint64_t eventsSent{0}; ///< Voice events and parameter changes sent
+  uint64_t framesReceived{0};
+  uint64_t framesLost{0};    ///< Gaps in the received frame sequence
+  uint64_t framesDropped{0}; ///< Frames received faster than applied
+  uint64_t framesLate{0};    ///< Frames received after their play time
+};
+
 /**
  * @brief The DistributedScene class
  * @ingroup Scene
@@ -13,6 +41,15 @@ namespace al {
  * This scene can be registered with a ParameterServer to replicate the scene
  * across the network. All events and internal parameters will be forwarded
  * to scene copies
+ *
+ * By default, replication uses binary frames: voice events and parameter
+ * changes are collected and sent together each time the time master
+ * processes voices, e.g. once per audio block with TIME_MASTER_AUDIO.
+ * Changes to a parameter within a frame are coalesced into one, and pose
+ * positions are sent as quantized deltas with periodic absolute values.
+ * Frames are encoded and sent by a thread of their own, so the time master
+ * does not wait for the network. Replicas apply each frame as a whole in
+ * their own time master context.
  */
 class DistributedScene : public DynamicScene, public osc::MessageConsumer {
 public:
@@ -22,19 +59,177 @@ public:
   DistributedScene(TimeMasterMode masterMode)
       : DistributedScene("scene", 0, masterMode) {}
 
+  ~DistributedScene();
+
   std::string name() { return mName; }
 
-  void registerNotifier(OSCNotifier &notifier) { mNotifier = &notifier; }
+  void registerNotifier(OSCNotifier &notifier);
 
   virtual void allNotesOff() override;
 
   virtual bool consumeMessage(osc::Message &m,
                               std::string rootOSCPath = "") override;
 
+  /**
+   * @brief Send binary frames instead of one OSC message per event
+   *
+   * Enabled by default. Disable for tools that listen for the individual
+   * OSC messages. Replicas accept both.
+   */
+  void setBinaryReplication(bool enable) { mBinaryReplication = enable; }
+
+  /**
+   * @brief Step size for pose positions sent as deltas
+   *
+   * Positions that moved by more than 32767 steps are sent as they are.
+   */
+  void setPositionResolution(float resolution) {
+    mPositionResolution = resolution;
+  }
+
+  /**
+   * @brief Play replicated events at the same time on all replicas
+   * @param clock cluster clock, or nullptr to apply frames as they arrive
+   * @param latency time from sending a frame to playing it on replicas
+   *
+   * Frames are stamped with the cluster time when sent. Replicas hold each
+   * frame until that time plus the latency, and with TIME_MASTER_AUDIO
+   * trigger its voices at the matching sample of the block. Set the same
+   * clock on the primary and the replicas, and a latency longer than the
+   * network delay, otherwise frames are applied late.
+   *
+   * The primary still plays its own voices when they are triggered, so it
+   * runs ahead of the replicas by the latency. Give the primary no audio
+   * output, or delay its output by the latency, if it must sound together
+   * with the replicas.
+   */
+  void setClock(ClusterClock *clock, double latency = 0.05) {
+    mClock = clock;
+    mLatency = latency;
+  }
+
+  SceneReplicationStats replicationStats();
+
 protected:
+  void processQueuedEvents() override;
+
 private:
+  struct QueuedParameter {
+    int id;
+    uint16_t index;
+    bool isPose;
+    float value;
+    Pose pose;
+  };
+
+  // Position reconstructed by the replica, tracked on both sides
+  struct PoseCoder {
+    Vec3f position;
+    uint16_t sentSinceKeyframe{0};
+  };
+
+  // A voice event, queued by any thread on an intrusive lock-free stack.
+  // Events come from a pool and keep their buffers when recycled.
+  struct QueuedEvent {
+    uint8_t type;
+    int32_t id;
+    int32_t offsetFrames;
+    std::string voiceName;
+    std::vector<uint8_t> fields; // Count and encoded trigger fields
+    QueuedEvent *next{nullptr};
+    uint32_t poolIndex{UINT32_MAX}; // UINT32_MAX if not from the pool
+    std::atomic<uint32_t> nextFree{0};
+  };
+
+  // Latest value of a parameter of a voice. Queued on a lock-free stack
+  // when it changes, unless it is queued already.
+  struct ParameterSlot {
+    SynthVoice *voice;
+    uint16_t index;
+    bool isPose;
+    std::atomic<int> id{-1};
+    std::atomic<float> value{0.0f};
+    ParameterValueSlots<Pose> pose{Pose()};
+    std::atomic<bool> queued{false};
+    ParameterSlot *next{nullptr};
+  };
+
+  void runSender();
+  void beginEvent(uint8_t type);
+  void queueFree(int id);
+  uint16_t voiceNameIndex(const std::string &name);
+  QueuedEvent *acquireEvent(uint8_t type, int id);
+  void releaseEvent(QueuedEvent *event);
+  void queueEvent(QueuedEvent *event);
+  ParameterSlot *addParameterSlot(SynthVoice *voice, uint16_t index,
+                                  bool isPose);
+  void queueParameter(ParameterSlot *slot, float value);
+  void queueParameter(ParameterSlot *slot, const Pose &pose);
+  void markQueued(ParameterSlot *slot);
+  // Moves what other threads queued into the next frames
+  void collectQueued();
+  void sendFrames(al_sec sendTime);
+  void sendFrame(std::vector<uint8_t> &frame, uint32_t events);
+  void encodePose(std::vector<uint8_t> &buffer, uint64_t key,
+                  const Pose &pose);
+  SynthVoice *findVoice(int id);
+  void applyFrame(const uint8_t *data, size_t size, int offsetFrames);
+
   OSCNotifier *mNotifier{nullptr};
   std::string mName;
+
+  bool mBinaryReplication{true};
+  float mPositionResolution{0.0001f};
+  ClusterClock *mClock{nullptr};
+  double mLatency{0.05};
+
+  // Queued by any thread without locking, collected by the sender
+  static const uint32_t kEventPoolSize = 1024;
+  std::unique_ptr<QueuedEvent[]> mEventPool;
+  std::atomic<uint64_t> mFreeEvents{0};
+  std::atomic<QueuedEvent *> mQueuedEvents{nullptr};
+  std::vector<QueuedEvent *> mCollectedEvents;
+  std::atomic<ParameterSlot *> mQueuedSlots{nullptr};
+  std::vector<std::unique_ptr<ParameterSlot>> mParameterSlots;
+
+  // Sender. Events are encoded when collected, parameters when sent
+  std::mutex mReplicationLock;
+  std::vector<uint8_t> mPendingEvents;
+  std::vector<size_t> mEventOffsets;
+  std::vector<std::string> mVoiceNames;
+  std::map<uint64_t, QueuedParameter> mQueuedParameters;
+  std::vector<int> mFreedIds;
+  std::map<uint64_t, PoseCoder> mSentPoses;
+  uint32_t mSequence{0};
+  std::vector<uint8_t> mFrame;
+  std::vector<uint8_t> mParameterBuffer;
+
+  // The time master requests a frame by writing its send time, and passes
+  // the ids of voices it frees. Each is written by one thread only.
+  std::atomic<bool> mReplicationPending{false};
+  SingleRWRingBuffer mFrameTimes{1 << 12};
+  SingleRWRingBuffer mFreedVoices{1 << 14};
+  std::unique_ptr<std::thread> mSendThread;
+  std::atomic<bool> mSending{false};
+  std::mutex mSendWakeLock;
+  std::condition_variable mSendWake;
+
+  // Replica. Frames are passed from the network thread
+  SingleRWRingBuffer mReceivedFrames{1 << 20};
+  std::vector<uint8_t> mApplyBuffer;
+  std::vector<std::string> mFrameNames;
+  std::vector<std::pair<int, SynthVoice *>> mFrameVoices;
+  std::map<uint64_t, Vec3f> mReceivedPositions;
+  uint32_t mLastSequence{0};
+  bool mHasSequence{false};
+
+  std::atomic<uint64_t> mFramesSent{0};
+  std::atomic<uint64_t> mBytesSent{0};
+  std::atomic<uint64_t> mEventsSent{0};
+  std::atomic<uint64_t> mFramesReceived{0};
+  std::atomic<uint64_t> mFramesLost{0};
+  std::atomic<uint64_t> mFramesDropped{0};
+  std::atomic<uint64_t> mFramesLate{0};
 };
 
 } // namespace al
@@ -86,6 +86,33 @@ public:
 
   std::vector<Vec3f> &audioOutOffsets() { return mAudioOutPositionOffsets; }
 
+  /**
+   * @brief Radius of a sphere around the voice's origin holding all it draws
+   *
+   * The radius is in the voice's units, before scaling by size().
+   * DynamicScene::render() skips voices whose sphere is outside the view
+   * frustum. Negative, the default, for voices that are never skipped.
+   */
+  float boundingRadius() { return mBoundingRadius; }
+  void boundingRadius(float radius) { mBoundingRadius = radius; }
+
+  /**
+   * @brief Whether the voice draws transparent geometry
+   *
+   * DynamicScene::render() draws transparent voices after the others, from
+   * the farthest to the nearest.
+   */
+  bool transparent() { return mTransparent; }
+  void transparent(bool transparent) { mTransparent = transparent; }
+
+  /**
+   * @brief Distance from the listener pose of the DynamicScene
+   *
+   * Updated before each graphics render, for example to select a level of
+   * detail with MeshLOD.
+   */
+  float listenerDistance() { return mListenerDistance; }
+
   /**
    * @brief Set the position offset for each of the audio outputs for this voice
    * @param offsets The size of offsets must be equal to the number of outputs
@@ -97,6 +124,9 @@ public:
   /**
    * @brief Override this function to apply transformations after the internal
    * transformations of the voice has been applied
+   *
+   * Called each frame before the pose is read, so it can also move the
+   * voice. Voices it transforms are not culled.
    */
   virtual void preProcess(Graphics & /*g*/) {}
 
@@ -162,6 +192,11 @@ protected:
   bool mUseDistAtten{true};
   bool mIsReplica{false}; // If voice is replica, it should not send its
                           // internal state but listen for changes.
+  float mListenerDistance{0};
+  float mBoundingRadius{-1};
+  bool mTransparent{false};
+
+  friend class DynamicScene;
 };
 
 struct UpdateThreadFuncData {
@@ -273,6 +308,9 @@ public:
 
   /**
    * @brief Enables/disables sorting by distance to listener on graphics render
+   *
+   * If enabled, all positioned voices are drawn from the farthest to the
+   * nearest. Otherwise only transparent voices are, after the others.
    */
   void sortDrawingByDistance(bool sort = true);
 
@@ -301,6 +339,20 @@ private:
   DistAtten<> mDistAtten;
 
   bool mSortDrawingByDistance{false};
+
+  // Voices to draw, gathered by render(Graphics &). Kept between frames so
+  // that rendering does not allocate.
+  struct DrawOrder {
+    float distance;
+    unsigned index;
+  };
+  std::vector<SynthVoice *> mDrawVoices; // Active voices in list order
+  std::vector<PositionedVoice *> mDrawPositioned; // nullptr if not positioned
+  std::vector<Matrix4f> mDrawMatrices; // Model matrix after preProcess()
+  std::vector<Pose> mDrawPoses;
+  std::vector<float> mDrawX, mDrawY, mDrawZ, mDrawRadius;
+  std::vector<unsigned char> mDrawVisible;
+  std::vector<DrawOrder> mDrawSorted;
   // For threaded simulation
   std::unique_ptr<ThreadPool> mWorkerThreads; // Update worker threads
   bool mThreadedUpdate{true};
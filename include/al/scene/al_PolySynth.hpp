@@ -802,6 +802,7 @@ public:
    * In other modes it is called in the render() function for the domain.
    */
   inline void processVoices() {
+    processQueuedEvents();
     if (mVoiceToInsertLock.try_lock()) {
       if (mVoicesToInsert) {
         // If lock acquired insert queued voices
@@ -938,6 +939,24 @@ public:
 protected:
   void startCpuClockThread();
 
+  /**
+   * @brief Stop the CPU clock thread
+   *
+   * Subclasses that override processQueuedEvents() must call this in their
+   * destructor, as the thread could otherwise call into a partly destroyed
+   * object.
+   */
+  void stopCpuClockThread();
+
+  /**
+   * @brief Called at the start of processVoices()
+   *
+   * This runs in the time master context before queued voices are
+   * inserted, so subclasses can apply events received from other threads
+   * there in sync with voice processing.
+   */
+  virtual void processQueuedEvents() {}
+
   inline void processGain(AudioIOData &io) {
     io.frame(0);
     if (mAudioGain != 1.0f) {
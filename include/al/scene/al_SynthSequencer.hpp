@@ -62,6 +62,8 @@
 
 namespace al {
 
+class ClusterClock;
+
 /**
 @brief SynthSequencerEvent class
 @ingroup Scene
@@ -255,6 +257,26 @@ public:
 
   bool playSequence(std::string sequenceName = "", float startTime = 0.0f);
 
+  /**
+   * @brief Start a sequence at a time of the clock set with setClock()
+   * @param clusterTime cluster time at which sequence time is startTime
+   *
+   * Sequencers on several nodes given the same cluster time play together.
+   */
+  bool playSequenceAt(double clusterTime, std::string sequenceName = "",
+                      float startTime = 0.0f);
+
+  /**
+   * @brief Follow a clock shared by the cluster
+   * @param clock cluster clock, or nullptr to use the time master only
+   *
+   * Sequence time then follows the cluster clock instead of counting audio
+   * blocks, graphics frames or CPU ticks, so nodes don't drift apart. With
+   * TIME_MASTER_AUDIO, time still advances by whole blocks so events keep
+   * their sample offsets, and is pulled gradually towards the clock.
+   */
+  void setClock(ClusterClock *clock) { mClock = clock; }
+
   void stopSequence();
   void setTime(float newTime);
 
@@ -339,6 +361,13 @@ private:
   std::shared_ptr<std::thread> mCpuThread;
 
   void processEvents(double blockStartTime, double fps);
+
+  // Sequence time from the cluster clock
+  double clockTime();
+
+  ClusterClock *mClock{nullptr};
+  double mClockStart{0.0}; // Cluster time at mClockStartTime
+  double mClockStartTime{0.0};
 };
 
 //  Implementations -------------
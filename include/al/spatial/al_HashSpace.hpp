@@ -2,6 +2,7 @@
 #define INCLUDE_AL_HASHSPACE_HPP
 
 #include <algorithm>
+#include <cstdint>
 #include <vector>
 
 #include "al/math/al_Vec.hpp"
@@ -214,6 +215,55 @@ public:
     Results mObjects;
   };
 
+  /// neighbor found by neighbors()
+  struct Neighbor {
+    uint32_t id;           ///< index of the neighboring object
+    float distanceSquared; ///< squared distance, taking wrapping into account
+  };
+
+  /**
+    Neighbors of all objects found by a batch query
+
+    Each query task appends its results to its own arena, and the arenas are
+    reused by the next query, so repeated queries do not allocate.
+@code
+    HashSpace::Neighbors neighbors;
+
+    space.update();
+    space.neighbors(neighbors, 4, 8, 0);
+    for (uint32_t id = 0; id < space.numObjects(); id++) {
+      for (const HashSpace::Neighbor &n : neighbors[id]) {
+        HashSpace::Object &o = space.object(n.id);
+        ...
+      }
+    }
+@endcode
+  @ingroup Spatial
+  */
+  class Neighbors {
+  public:
+    /// neighbors of one object, sorted by distance
+    struct Span {
+      const Neighbor *first;
+      uint32_t count;
+
+      uint32_t size() const { return count; }
+      const Neighbor &operator[](uint32_t i) const { return first[i]; }
+      const Neighbor *begin() const { return first; }
+      const Neighbor *end() const { return first + count; }
+    };
+
+    /// get the neighbors of an object:
+    const Span &operator[](uint32_t id) const { return mSpans[id]; }
+    /// get number of objects queried:
+    uint32_t size() const { return mSpans.size(); }
+
+  private:
+    friend class HashSpace;
+    std::vector<std::vector<Neighbor> > mArenas;
+    std::vector<Span> mSpans;
+  };
+
   /**
     Construct a HashSpace
     locations will range from [0..2^resolution)
@@ -252,6 +302,35 @@ public:
   /// the objectId can be reused later via move()
   HashSpace &remove(uint32_t objectId);
 
+  /**
+    Sort objects by voxel for batch queries
+
+    Copies the positions into arrays of floats ordered by voxel, with a
+    counting sort. Call this after moving objects and before neighbors();
+    objects moved after it are found at their old positions.
+
+    @param threads number of threads, 0 for one per core
+  */
+  void update(int threads = 1);
+
+  /**
+    Find the nearest neighbors of every object
+
+    Objects are queried in parallel in voxel order. Each query scans the rows
+    of voxels within the radius, whose objects are contiguous in the sorted
+    arrays. Unlike Query, the results are exact: the nearest maxResults
+    objects within maxRadius, sorted by distance. Removed objects have no
+    neighbors and are not found.
+
+    @param result receives the neighbors of each object
+    @param maxRadius finds objects if they are nearer this distance
+      the maximum permissible value of radius is maxRadius()
+    @param maxResults the maximum number of neighbors per object
+    @param threads number of threads, 0 for one per core
+  */
+  void neighbors(Neighbors &result, double maxRadius, uint32_t maxResults,
+                 int threads = 1) const;
+
   /// wrap an absolute position within the space:
   double wrap(double x) const { return wrap(x, dim()); }
   template <typename T> Vec<3, T> wrap(Vec<3, T> v) const {
@@ -324,6 +403,12 @@ protected:
   /// a baked array mapping distance to mVoxelIndices offsets
   std::vector<uint32_t> mDistanceToVoxelIndices;
   std::vector<uint32_t> mVoxelIndicesToDistance;
+
+  /// objects sorted by voxel by update(), as structure of arrays
+  std::vector<float> mSortedX, mSortedY, mSortedZ;
+  std::vector<uint32_t> mSortedIds;
+  /// offsets of each voxel into the sorted arrays
+  std::vector<uint32_t> mVoxelStarts;
 };
 
 // this is definitely not thread-safe.
@@ -484,6 +569,7 @@ inline HashSpace::Object *HashSpace::Query ::nearest(const HashSpace &space,
 inline void HashSpace ::numObjects(int numObjects) {
   mObjects.clear();
   mObjects.resize(numObjects);
+  mSortedIds.clear();
   // clear all voxels:
   for (unsigned i = 0; i < mVoxels.size(); i++) {
     mVoxels[i].mObjects = 0;
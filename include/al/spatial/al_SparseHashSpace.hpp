@@ -0,0 +1,270 @@
+#ifndef INCLUDE_AL_SPARSEHASHSPACE_HPP
+#define INCLUDE_AL_SPARSEHASHSPACE_HPP
+
+/*  Allocore --
+  Multimedia / virtual environment application class library
+
+  Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+  Copyright (C) 2012. The Regents of the University of California.
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    Redistributions in binary form must reproduce the above copyright
+    notice, this list of conditions and the following disclaimer in the
+    documentation and/or other materials provided with the distribution.
+
+    Neither the name of the University of California nor the names of its
+    contributors may be used to endorse or promote products derived from
+    this software without specific prior written permission.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+  ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+  POSSIBILITY OF SUCH DAMAGE.
+
+
+  File description:
+  SparseHashSpace finds neighboring objects in unbounded space, using a grid
+  of cells of which only the occupied ones are stored in a hash table
+*/
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "al/math/al_Vec.hpp"
+
+namespace al {
+
+/**
+ * @brief The SparseHashSpace class
+ * @ingroup Spatial
+ *
+ * SparseHashSpace detects neighboring objects like HashSpace, but in space
+ * that is not bounded and does not wrap around. Space is divided into cubic
+ * cells of a given size, and only the cells that hold objects are stored,
+ * in a hash table. Memory grows with the number of objects rather than with
+ * the volume, so it suits open worlds with sparse clusters of objects.
+ *
+ * Moving an object within its cell only updates its position, and moving it
+ * to another cell relinks it in constant time. Queries have no maximum
+ * radius. For best performance, the cell size should be about the radius of
+ * the most frequent queries.
+ */
+class SparseHashSpace {
+public:
+  /// container for registered spatial elements
+  struct Object {
+    Object()
+        : cell(invalidCell()), next(invalidCell()), prev(invalidCell()),
+          userdata(0) {}
+
+    Vec3d pos;
+    uint32_t cell;       ///< which cell it belongs to (or invalidCell())
+    uint32_t next, prev; ///< indices of neighbors in the same cell
+    union {              ///< a way to attach user-defined payloads:
+      uint32_t id;
+      void *userdata;
+    };
+  };
+
+  /**
+    Query functor
+    create and re-use a query functor to find neighbors
+@code
+    SparseHashSpace::Query query;
+
+    query.clear(); // do this if you want to re-use the query object
+    query(space, Vec3d(0, 0, 0), 10);
+    for (int i=0; i<query.size(); i++) {
+      Object * o = query[i];
+      ...
+    }
+@endcode
+  @ingroup Spatial
+  */
+  struct Query {
+    struct Result {
+      SparseHashSpace::Object *object;
+      double distanceSquared;
+
+      static bool compare(const Result &x, const Result &y) {
+        return x.distanceSquared < y.distanceSquared;
+      }
+
+      Result() : object(0), distanceSquared(0) {}
+      Result(Object *o, double d2) : object(o), distanceSquared(d2) {}
+    };
+
+    typedef std::vector<Result> Results;
+    typedef Results::iterator Iterator;
+
+    /**
+      Constructor
+      @param maxResults the maximum number of results to find
+    */
+    Query(uint32_t maxResults = 128) : mMaxResults(maxResults) {
+      mObjects.reserve(maxResults);
+    }
+
+    /**
+      The main method of the query object
+      finds the nearest neighbors of a given point, within given distances
+      the matches are sorted by distance
+
+      @param space the SparseHashSpace object to search in
+      @param center finds objects near to this point
+      @param obj finds objects near to this object
+      @param maxRadius finds objects if they are nearer this distance
+      @param minRadius finds objects if they are beyond this distance
+      @return the number of results found, none if the center is not finite
+    */
+    int operator()(const SparseHashSpace &space, const Vec3d center,
+                   double maxRadius, double minRadius = 0.);
+    int operator()(const SparseHashSpace &space, const Object *obj,
+                   double maxRadius, double minRadius = 0.);
+
+    /**
+      finds the nearest neighbors of the given point, up to maxResults()
+
+      @param space the SparseHashSpace object to search in
+      @param center finds objects near to this point
+      @param obj finds objects near to this object
+    */
+    int operator()(const SparseHashSpace &space, Vec3d center) {
+      return (*this)(space, center, HUGE_VAL);
+    }
+    int operator()(const SparseHashSpace &space, const Object *obj) {
+      return (*this)(space, obj, HUGE_VAL);
+    }
+
+    /**
+      finds nearest neighbor of an object
+    */
+    Object *nearest(const SparseHashSpace &space, const Object *obj);
+
+    /// get number of results:
+    unsigned size() const { return mObjects.size(); }
+    /// get each result:
+    Object *operator[](unsigned i) const { return mObjects[i].object; }
+    double distanceSquared(unsigned i) const {
+      return mObjects[i].distanceSquared;
+    }
+    double distance(unsigned i) const { return sqrt(distanceSquared(i)); }
+
+    /**
+      clear is separated from the main query operation,
+      to support aggregating queries in series
+      typically however you would want to clear() and then call the query.
+    */
+    Query &clear() {
+      mObjects.clear();
+      return *this;
+    }
+
+    /// set the maximum number of desired results
+    Query &maxResults(uint32_t i) {
+      mMaxResults = i;
+      return *this;
+    }
+    /// get the maximum number of desired results
+    uint32_t maxResults() const { return mMaxResults; }
+
+    /// std::vector interface:
+    Iterator begin() { return mObjects.begin(); }
+    Iterator end() { return mObjects.end(); }
+    Results &results() { return mObjects; }
+
+  protected:
+    int find(const SparseHashSpace &space, const Vec3d &center,
+             const Object *exclude, double maxRadius, double minRadius);
+
+    uint32_t mMaxResults;
+    Results mObjects;
+  };
+
+  /**
+    Construct a SparseHashSpace
+
+    @param cellSize the size of the cubic cells
+    @param numObjects set how many Object slots to initally allocate
+  */
+  SparseHashSpace(double cellSize = 1, uint32_t numObjects = 0);
+
+  /// the size of the cells:
+  double cellSize() const { return mCellSize; }
+
+  /// get/set the number of objects:
+  void numObjects(int numObjects);
+  uint32_t numObjects() const { return mObjects.size(); }
+
+  /// get the object at a given index:
+  Object &object(uint32_t i) { return mObjects[i]; }
+
+  /// get the number of cells holding objects:
+  uint32_t numCells() const { return mCells.size() - mFreeCells.size(); }
+
+  /// set the position of an object; a position with a coordinate that is
+  /// infinite or NaN removes the object, as it cannot be found by distance
+  SparseHashSpace &move(uint32_t objectId, double x, double y, double z) {
+    return move(objectId, Vec3d(x, y, z));
+  }
+  template <typename T>
+  SparseHashSpace &move(uint32_t objectId, Vec<3, T> pos) {
+    return move(objectId, Vec3d(pos));
+  }
+  SparseHashSpace &move(uint32_t objectId, const Vec3d &pos);
+
+  /// this removes the object from cells/queries, but does not destroy it
+  /// the objectId can be reused later via move()
+  SparseHashSpace &remove(uint32_t objectId);
+
+  /// an invalid cell or object index used to indicate non-membership
+  static uint32_t invalidCell() { return UINT32_MAX; }
+
+protected:
+  /// a grid cell holding a linked list of objects
+  struct Cell {
+    Vec3i coord;
+    uint32_t first; ///< index of the first object
+    uint32_t count;
+  };
+
+  // the integer coordinates of the cell holding a position
+  Vec3i cellCoord(const Vec3d &pos) const;
+  // the index of the cell at integer coordinates, or invalidCell()
+  uint32_t findCell(const Vec3i &coord) const;
+  uint32_t addCell(const Vec3i &coord);
+  void removeCell(uint32_t cell);
+  // the first slot of the hash table to probe for a cell
+  uint32_t slot(const Vec3i &coord) const;
+  void growTable();
+
+  double mCellSize;
+
+  /// the array of objects
+  std::vector<Object> mObjects;
+
+  /// the array of cells, reused through mFreeCells when emptied
+  std::vector<Cell> mCells;
+  std::vector<uint32_t> mFreeCells;
+
+  /// open addressing hash table of cell indices, with linear probing
+  std::vector<uint32_t> mTable;
+};
+
+} // namespace al
+
+#endif
@@ -54,13 +54,17 @@
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "al/math/al_Vec.hpp"
 #include "al/protocol/al_OSC.hpp"
 #include "al/spatial/al_Pose.hpp"
+#include "al/system/al_Time.hpp"
 #include "al/types/al_Color.hpp"
 #include "al/types/al_ValueSource.hpp"
+#include "al/ui/al_ParameterSmoother.hpp"
 
 namespace al {
 
@@ -236,6 +240,150 @@ private:
   void *mData;
 };
 
+/**
+ * @brief Selects the lock-free value path of ParameterWrapper
+ * @ingroup UI
+ *
+ * Types for which value is true are published through ParameterValueSlots
+ * instead of the mutex. This requires a type that can be copied member-wise
+ * and has no heap storage. Arithmetic types are excluded as Parameter,
+ * ParameterInt and ParameterBool store them directly. Specialize this for
+ * your own plain value types to opt them in.
+ */
+template <class T> struct ParameterIsLockFree {
+  static constexpr bool value = std::is_trivially_copyable<T>::value &&
+                                !std::is_arithmetic<T>::value &&
+                                !std::is_enum<T>::value;
+};
+
+// Vec and Pose declare copy constructors, but they only copy their elements
+template <int N, class T> struct ParameterIsLockFree<Vec<N, T>> {
+  static constexpr bool value = true;
+};
+
+template <> struct ParameterIsLockFree<Pose> {
+  static constexpr bool value = true;
+};
+
+/**
+ * @brief Multi-slot sequence lock for publishing a value between threads
+ * @ingroup UI
+ *
+ * Writers claim a free slot, copy the value into it and publish the slot
+ * index together with a version number. They never wait on readers. A
+ * writer only waits if more than kSlots - 1 writers store at the same time,
+ * until one of them has finished copying its value. Readers copy the
+ * published slot and validate the copy against the slot's sequence
+ * counter. load() gives up after a bounded number of attempts so it is
+ * wait-free; that only happens if the slots are overwritten kSlots times
+ * during a single copy.
+ */
+template <class T> class ParameterValueSlots {
+public:
+  static constexpr uint32_t kSlots = 4;
+
+  explicit ParameterValueSlots(const T &initial) {
+    for (auto &slot : mSlots) {
+      slot.value = initial;
+    }
+  }
+
+  /**
+   * @brief publish a new value
+   */
+  void store(const T &value) {
+    uint64_t version = mVersionCounter.fetch_add(1, std::memory_order_relaxed);
+    uint64_t published = mPublished.load(std::memory_order_relaxed);
+    uint32_t index = uint32_t(published + 1) % kSlots;
+    uint32_t sequence;
+    // Claim a slot that no other writer holds. The published slot is skipped
+    // so readers are not made to retry, unless another writer has published
+    // into the slot after it was claimed here.
+    while (true) {
+      if (index == published % kSlots) {
+        index = (index + 1) % kSlots;
+        published = mPublished.load(std::memory_order_relaxed);
+        continue;
+      }
+      Slot &slot = mSlots[index];
+      sequence = slot.sequence.load(std::memory_order_relaxed);
+      if ((sequence & 1) == 0 &&
+          slot.sequence.compare_exchange_weak(sequence, sequence + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+        break;
+      }
+      index = (index + 1) % kSlots;
+    }
+    Slot &slot = mSlots[index];
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.value = value;
+    slot.version.store(version, std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+
+    uint64_t tag = version * kSlots + index;
+    uint64_t current = mPublished.load(std::memory_order_relaxed);
+    while (current < tag &&
+           !mPublished.compare_exchange_weak(current, tag,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+    }
+  }
+
+  /**
+   * @brief copy the latest value into value
+   * @return false if no consistent copy could be made. value is not modified
+   */
+  bool load(T &value) const {
+    uint64_t version;
+    return load(value, version);
+  }
+
+  /**
+   * @brief copy the latest value and its version
+   *
+   * Versions increase monotonically with every store().
+   */
+  bool load(T &value, uint64_t &version) const {
+    for (uint32_t attempt = 0; attempt < kSlots; attempt++) {
+      uint64_t tag = mPublished.load(std::memory_order_acquire);
+      const Slot &slot = mSlots[tag % kSlots];
+      uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence & 1) {
+        continue;
+      }
+      T copy = slot.value;
+      uint64_t slotVersion = slot.version.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) == sequence &&
+          slotVersion == tag / kSlots) {
+        value = copy;
+        version = tag / kSlots;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * @brief version of the latest published value. 0 for the initial value
+   */
+  uint64_t version() const {
+    return mPublished.load(std::memory_order_acquire) / kSlots;
+  }
+
+private:
+  struct Slot {
+    std::atomic<uint32_t> sequence{0};
+    std::atomic<uint64_t> version{0};
+    T value;
+  };
+
+  Slot mSlots[kSlots];
+  std::atomic<uint64_t> mPublished{0};
+  std::atomic<uint64_t> mVersionCounter{1};
+};
+
 class Parameter;
 
 /**
@@ -361,6 +509,68 @@ protected:
   std::map<std::string, float> mHints; // Provide hints for behavior
 };
 
+/**
+ * @brief Execution time statistics for a change callback
+ * @ingroup UI
+ */
+struct ParameterCallbackTiming {
+  uint64_t calls{0};
+  al_sec totalTime{0.0};
+  al_sec maxTime{0.0};
+};
+
+/**
+ * @brief ValueSource of a change waiting for a ParameterDispatchDomain
+ * @ingroup UI
+ *
+ * Plain copy of ValueSource that can be published through
+ * ParameterValueSlots. IPv6 addresses fit in ipAddr.
+ */
+struct ParameterPendingSource {
+  char ipAddr[48] = {0};
+  uint16_t port{0};
+  bool hasSource{false};
+};
+
+/**
+ * @brief Links a parameter to a ParameterDispatchDomain
+ * @ingroup UI
+ *
+ * Parameters push their entry onto the dispatcher's pending stack when they
+ * change. An entry is only pushed if it is not already pending, so any number
+ * of writes between two dispatches results in a single delivery.
+ */
+struct ParameterDispatchEntry {
+  // Set to nullptr when the parameter is destroyed
+  std::atomic<ParameterMeta *> parameter{nullptr};
+  std::function<void(ParameterDispatchEntry &)> deliver;
+  std::atomic<ParameterDispatchEntry *> *pendingHead{nullptr};
+  ParameterDispatchEntry *next{nullptr};
+  std::atomic<bool> queued{false};
+
+  std::atomic<uint64_t> changes{0};
+  // Only accessed from the dispatching thread
+  uint64_t deliveries{0};
+  std::vector<ParameterCallbackTiming> callbackTimings;
+
+  /**
+   * @brief mark the parameter as changed. Lock-free, may be called from any
+   * thread
+   */
+  void markDirty() {
+    changes.fetch_add(1, std::memory_order_relaxed);
+    if (queued.exchange(true, std::memory_order_acq_rel)) {
+      return; // Coalesced with the pending notification
+    }
+    ParameterDispatchEntry *head = pendingHead->load(std::memory_order_relaxed);
+    do {
+      next = head;
+    } while (!pendingHead->compare_exchange_weak(head, this,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed));
+  }
+};
+
 /**
  * @brief The ParameterWrapper class provides a generic thread safe Parameter
  * class from the ParameterType template parameter
@@ -383,6 +593,10 @@ public:
    * function and doing try_lock() on the mutex to update a cached value in the
    * get() function. In the worst case this might incur some jitter when reading
    * the value.
+   *
+   * For types where ParameterIsLockFree is true (e.g. Vec3f, Vec4f, Pose and
+   * Color) values are instead published through ParameterValueSlots, so
+   * neither set() nor get() take the mutex.
    */
   ParameterWrapper(std::string parameterName, std::string group = "",
                    ParameterType defaultValue = ParameterType());
@@ -410,8 +624,11 @@ public:
       value = (*mProcessCallback)(value); //, mProcessUdata);
     }
 
-    runChangeCallbacksSynchronous(value, src);
+    bool deferred = runChangeCallbacksSynchronous(value, src);
     setLocking(value);
+    if (deferred) {
+      notifyDispatcher();
+    }
   }
 
   /**
@@ -451,8 +668,13 @@ public:
    * No callbacks are called.
    */
   inline void setLocking(ParameterType value) {
+    if (mValueSlots) {
+      mValueSlots->store(value);
+      return;
+    }
     mMutex->lock();
     mValue = value;
+    mVersion++;
     mMutex->unlock();
   }
 
@@ -465,6 +687,20 @@ public:
    */
   virtual ParameterType get();
 
+  /**
+   * @brief copy the value into a consumer owned snapshot if it has changed
+   * @param value the consumer's copy of the value
+   * @param version the version of value. Updated together with value
+   * @return true if value was updated
+   *
+   * Each consumer (e.g. the audio or graphics thread) keeps its own value and
+   * version, so it only copies the value when it has changed and is never
+   * affected by the cached value other threads see. This function never
+   * blocks; if the value can't be read without waiting it returns false and
+   * the snapshot is updated on a later call. See ParameterSnapshot.
+   */
+  bool updateSnapshot(ParameterType &value, uint64_t &version);
+
   /**
    * @brief Get previous value
    * @return
@@ -545,8 +781,19 @@ public:
    * whenever a value changes.
    *
    * @param cb
+   * @return handle to pass to removeChangeCallback()
    */
-  void registerChangeCallback(ParameterChangeCallback cb);
+  std::shared_ptr<ParameterChangeCallback>
+  registerChangeCallback(ParameterChangeCallback cb);
+
+  /**
+   * @brief remove a callback added with registerChangeCallback()
+   *
+   * Like registering a callback, this must not run while the parameter is
+   * being set or its changes are being dispatched.
+   */
+  void removeChangeCallback(
+      const std::shared_ptr<ParameterChangeCallback> &handle);
 
   void registerChangeCallback(ParameterChangeCallbackSrc cb);
 
@@ -577,19 +824,19 @@ public:
     }
   }
 
-  bool hasChange() { return mChanged; }
+  bool hasChange() { return mChanged.load(std::memory_order_acquire); }
 
   /**
    * @brief call change callbacks if value has changed since last call
    */
   bool processChange() {
-    if (!mChanged) {
+    if (!mChanged.load(std::memory_order_acquire)) {
       return false;
     }
-    if (mChanged && mCallbacks.size() > 0 && mCallbacks[0] == nullptr) {
+    if (mCallbacks.size() > 0 && mCallbacks[0] == nullptr) {
       auto callbackIt = mCallbacks.begin() + 1;
+      mChanged.store(false, std::memory_order_relaxed);
       ParameterType value = get();
-      mChanged = false;
       while (callbackIt != mCallbacks.end()) {
         (*(*callbackIt))(value);
         callbackIt++;
@@ -598,6 +845,34 @@ public:
     return true;
   }
 
+  /**
+   * @brief call change callbacks, recording their execution time in entry
+   *
+   * Used by ParameterDispatchDomain to deliver coalesced changes.
+   */
+  void processChange(ParameterDispatchEntry &entry);
+
+  /**
+   * @brief deliver changes through a dispatcher instead of synchronously
+   * @param entry entry created by ParameterDispatchDomain or nullptr to return
+   * to synchronous callbacks
+   *
+   * Use ParameterDispatchDomain::registerParameter() instead of calling this
+   * directly.
+   */
+  void setDispatchEntry(std::shared_ptr<ParameterDispatchEntry> entry) {
+    if (entry && !mPendingSource) {
+      mPendingSource =
+          std::make_unique<ParameterValueSlots<ParameterPendingSource>>(
+              ParameterPendingSource());
+    }
+    mDispatchEntry = entry;
+    bool synchronous = mCallbacks.size() == 0 || mCallbacks[0] != nullptr;
+    if (synchronous != (entry == nullptr)) {
+      setSynchronousCallbacks(entry == nullptr);
+    }
+  }
+
   std::vector<ParameterWrapper<ParameterType> *>
   operator<<(ParameterWrapper<ParameterType> &newParam) {
     std::vector<ParameterWrapper<ParameterType> *> paramList;
@@ -629,7 +904,18 @@ protected:
 
   ParameterType mDefault;
 
-  void runChangeCallbacksSynchronous(ParameterType &value, ValueSource *src);
+  // Returns true if the callbacks are deferred. The caller must then store
+  // the value and call notifyDispatcher().
+  bool runChangeCallbacksSynchronous(ParameterType &value, ValueSource *src);
+
+  // Publishes a deferred change. Must be called after the new value has been
+  // stored, so whoever clears mChanged reads the new value.
+  void notifyDispatcher() {
+    mChanged.store(true, std::memory_order_release);
+    if (mDispatchEntry) {
+      mDispatchEntry->markDirty();
+    }
+  }
 
   std::shared_ptr<ParameterProcessCallback> mProcessCallback;
   // void * mProcessUdata;
@@ -638,8 +924,22 @@ protected:
 private:
   // pointer to avoid having to explicitly declare copy/move
   std::unique_ptr<std::mutex> mMutex;
+  std::shared_ptr<ParameterDispatchEntry> mDispatchEntry;
+  // Only allocated when ParameterIsLockFree<ParameterType>
+  std::unique_ptr<ParameterValueSlots<ParameterType>> mValueSlots;
+  uint64_t mVersion{0}; // Protected by mMutex when mValueSlots is null
+
+  bool updateSnapshot(ParameterType &value, uint64_t &version, std::true_type);
+  bool updateSnapshot(ParameterType &value, uint64_t &version,
+                      std::false_type);
+
+  void initValueSlots(const ParameterType &value) {
+    if (ParameterIsLockFree<ParameterType>::value) {
+      mValueSlots = std::make_unique<ParameterValueSlots<ParameterType>>(value);
+    }
+  }
 
-  bool mChanged{false};
+  std::atomic<bool> mChanged{false};
 
 private:
   std::vector<std::shared_ptr<ParameterChangeCallback>> mCallbacks;
@@ -647,6 +947,47 @@ private:
 
   std::vector<std::shared_ptr<ParameterMetaChangeCallbackSrc>>
       mMetaCallbacksSrc;
+
+  // Source of the latest change waiting for a dispatcher. Published without
+  // locking so set() stays lock-free. Allocated by setDispatchEntry().
+  std::unique_ptr<ParameterValueSlots<ParameterPendingSource>> mPendingSource;
+};
+
+/**
+ * @brief Per-consumer copy of a parameter's value
+ * @ingroup UI
+ *
+ * Create one snapshot per reading thread and call update() once per block or
+ * frame. The value is only copied when the parameter has changed and
+ * reading it afterwards costs nothing:
+ * @code
+    ParameterSnapshot<Pose> headPose(trackedPose);
+    // In the audio callback
+    headPose.update();
+    Vec3d pos = headPose.get().pos();
+ * @endcode
+ */
+template <class ParameterType> class ParameterSnapshot {
+public:
+  ParameterSnapshot(ParameterWrapper<ParameterType> &param)
+      : mParameter(param), mValue(param.get()) {
+    update();
+  }
+
+  /**
+   * @brief fetch the parameter's value if it has changed. Never blocks.
+   * @return true if the value was updated
+   */
+  bool update() { return mParameter.updateSnapshot(mValue, mVersion); }
+
+  const ParameterType &get() const { return mValue; }
+
+  operator const ParameterType &() const { return mValue; }
+
+private:
+  ParameterWrapper<ParameterType> &mParameter;
+  ParameterType mValue;
+  uint64_t mVersion{~uint64_t(0)};
 };
 
 /**
@@ -706,7 +1047,8 @@ public:
       std::string parameterName, std::string Group, float defaultValue,
       std::string prefix, float min = -99999.0, float max = 99999.0);
 
-  Parameter(const al::Parameter &param) : ParameterWrapper<float>(param) {
+  Parameter(const al::Parameter &param)
+      : ParameterWrapper<float>(param), mSmoother(param.mSmoother) {
     mValue = param.mValue;
     setDefault(param.getDefault());
   }
@@ -780,7 +1122,41 @@ public:
     }
   }
 
+  /**
+   * @brief set smoothing for the values read through the block functions
+   * @param mode smoothing mode
+   * @param time smoothing time in seconds. For SmoothingMode::SLEW this is
+   * the time to move from min() to max()
+   * @param sampleRate audio sampling rate
+   *
+   * get() is not affected. Smoothing state belongs to the audio thread, so
+   * nextSample(), processBlock() and ramp() must be called from one thread
+   * only, once per sample or block.
+   */
+  void setSmoothing(SmoothingMode mode, float time, float sampleRate);
+
+  SmoothingMode smoothingMode() const { return mSmoother.mode(); }
+
+  /**
+   * @brief return the next smoothed value. Call once per sample.
+   */
+  float nextSample();
+
+  /**
+   * @brief write the smoothed values for the current block into buffer
+   */
+  void processBlock(float *buffer, size_t numFrames);
+
+  /**
+   * @brief advance smoothing by a block and return a linear ramp for it
+   *
+   * This avoids writing a buffer when the consumer can apply the ramp
+   * directly, and costs almost nothing once the value has settled.
+   */
+  ParameterRamp<float> ramp(size_t numFrames);
+
 private:
+  ParameterSmoother<float> mSmoother;
 };
 
 /// ParamaterInt
@@ -1054,7 +1430,8 @@ public:
 
   ParameterVec3(std::string parameterName, std::string Group = "",
                 al::Vec3f defaultValue = al::Vec3f())
-      : ParameterWrapper<al::Vec3f>(parameterName, Group, defaultValue) {}
+      : ParameterWrapper<al::Vec3f>(parameterName, Group, defaultValue),
+        mSmoother(defaultValue) {}
 
   ParameterVec3 operator=(const Vec3f vec) {
     this->set(vec);
@@ -1089,6 +1466,37 @@ public:
                 << std::endl;
     }
   }
+
+  /**
+   * @brief set smoothing for the values read through the block functions
+   *
+   * See Parameter::setSmoothing(). For SmoothingMode::SLEW time is the time
+   * needed to move a distance of 1.
+   */
+  void setSmoothing(SmoothingMode mode, float time, float sampleRate) {
+    mSmoother.configure(mode, time, sampleRate);
+    mSmoother.reset(get());
+  }
+
+  SmoothingMode smoothingMode() const { return mSmoother.mode(); }
+
+  Vec3f nextSample() {
+    mSmoother.setTarget(get());
+    return mSmoother.next();
+  }
+
+  void processBlock(Vec3f *buffer, size_t numFrames) {
+    mSmoother.setTarget(get());
+    mSmoother.process(buffer, numFrames);
+  }
+
+  ParameterRamp<Vec3f> ramp(size_t numFrames) {
+    mSmoother.setTarget(get());
+    return mSmoother.ramp(numFrames);
+  }
+
+private:
+  ParameterSmoother<Vec3f> mSmoother;
 };
 
 /// ParameterVec4
@@ -1440,6 +1848,10 @@ public:
 template <class ParameterType>
 ParameterWrapper<ParameterType>::~ParameterWrapper() {
   //  delete mMutex;
+  if (mDispatchEntry) {
+    // The dispatcher may outlive the parameter
+    mDispatchEntry->parameter.store(nullptr, std::memory_order_release);
+  }
 }
 
 template <class ParameterType>
@@ -1450,6 +1862,7 @@ ParameterWrapper<ParameterType>::ParameterWrapper(std::string parameterName,
   mValue = defaultValue;
   mValueCache = defaultValue;
   mMutex = std::make_unique<std::mutex>();
+  initValueSlots(defaultValue);
   setDefault(defaultValue);
   std::shared_ptr<ParameterChangeCallback> mAsyncCallback =
       std::make_shared<ParameterChangeCallback>(
@@ -1480,6 +1893,13 @@ ParameterWrapper<ParameterType>::ParameterWrapper(
   // mProcessUdata = param.mProcessUdata;
   mCallbacks = param.mCallbacks;
   mMutex = std::make_unique<std::mutex>();
+  if (param.mValueSlots) {
+    // load() only fails while param is being written continuously
+    while (!param.mValueSlots->load(mValue)) {
+      std::this_thread::yield();
+    }
+    initValueSlots(mValue);
+  }
   setDefault(param.getDefault());
   // mCallbackUdata = param.mCallbackUdata;
 }
@@ -1487,13 +1907,57 @@ ParameterWrapper<ParameterType>::ParameterWrapper(
 template <class ParameterType>
 ParameterType ParameterWrapper<ParameterType>::get() {
   ParameterType current = mValueCache;
-  if (mMutex->try_lock()) {
+  if (mValueSlots) {
+    mValueSlots->load(current);
+  } else if (mMutex->try_lock()) {
     current = mValue;
     mMutex->unlock();
   }
   return current;
 }
 
+template <class ParameterType>
+bool ParameterWrapper<ParameterType>::updateSnapshot(ParameterType &value,
+                                                     uint64_t &version) {
+  if (mValueSlots) {
+    if (mValueSlots->version() == version) {
+      return false;
+    }
+    return mValueSlots->load(value, version);
+  }
+  return updateSnapshot(value, version, std::is_arithmetic<ParameterType>());
+}
+
+template <class ParameterType>
+bool ParameterWrapper<ParameterType>::updateSnapshot(ParameterType &value,
+                                                     uint64_t &version,
+                                                     std::true_type) {
+  // Parameter and ParameterInt store mValue directly without counting versions
+  ParameterType current = get();
+  if (version != 0 || current != value) {
+    value = current;
+    version = 0;
+    return true;
+  }
+  return false;
+}
+
+template <class ParameterType>
+bool ParameterWrapper<ParameterType>::updateSnapshot(ParameterType &value,
+                                                     uint64_t &version,
+                                                     std::false_type) {
+  bool updated = false;
+  if (mMutex->try_lock()) {
+    if (mVersion != version) {
+      value = mValue;
+      version = mVersion;
+      updated = true;
+    }
+    mMutex->unlock();
+  }
+  return updated;
+}
+
 template <class ParameterType>
 ParameterType ParameterWrapper<ParameterType>::getPrevious() {
   return mValueCache;
@@ -1507,10 +1971,25 @@ void ParameterWrapper<ParameterType>::setProcessingCallback(
 }
 
 template <class ParameterType>
-void ParameterWrapper<ParameterType>::registerChangeCallback(
+std::shared_ptr<
+    typename ParameterWrapper<ParameterType>::ParameterChangeCallback>
+ParameterWrapper<ParameterType>::registerChangeCallback(
     ParameterChangeCallback cb) {
   mCallbacks.push_back(std::make_shared<ParameterChangeCallback>(cb));
   // mCallbackUdata.push_back(userData);
+  return mCallbacks.back();
+}
+
+template <class ParameterType>
+void ParameterWrapper<ParameterType>::removeChangeCallback(
+    const std::shared_ptr<ParameterChangeCallback> &handle) {
+  if (!handle) {
+    return;
+  }
+  auto it = std::find(mCallbacks.begin(), mCallbacks.end(), handle);
+  if (it != mCallbacks.end()) {
+    mCallbacks.erase(it);
+  }
 }
 
 template <class ParameterType>
@@ -1528,13 +2007,66 @@ void ParameterWrapper<ParameterType>::registerMetaChangeCallback(
 }
 
 template <class ParameterType>
-void ParameterWrapper<ParameterType>::runChangeCallbacksSynchronous(
+void ParameterWrapper<ParameterType>::processChange(
+    ParameterDispatchEntry &entry) {
+  if (!mChanged.exchange(false, std::memory_order_acquire)) {
+    return;
+  }
+  ParameterType value = get();
+  ParameterPendingSource pending;
+  ValueSource source;
+  bool hasSource = false;
+  if (mPendingSource) {
+    // load() only fails while the source is being written continuously
+    while (!mPendingSource->load(pending)) {
+      std::this_thread::yield();
+    }
+    hasSource = pending.hasSource;
+    if (hasSource) {
+      source.ipAddr = pending.ipAddr;
+      source.port = pending.port;
+    }
+  }
+  // The first callback is the nullptr marking asynchronous delivery, unless
+  // the dispatcher is flushing a parameter it has just detached
+  size_t first = mCallbacks.size() > 0 && !mCallbacks[0] ? 1 : 0;
+  if (entry.callbackTimings.size() + first < mCallbacks.size()) {
+    entry.callbackTimings.resize(mCallbacks.size() - first);
+  }
+  entry.deliveries++;
+  for (size_t i = first; i < mCallbacks.size(); i++) {
+    al_sec start = al_steady_time();
+    (*mCallbacks[i])(value);
+    al_sec elapsed = al_steady_time() - start;
+    auto &timing = entry.callbackTimings[i - first];
+    timing.calls++;
+    timing.totalTime += elapsed;
+    if (elapsed > timing.maxTime) {
+      timing.maxTime = elapsed;
+    }
+  }
+  for (auto cb : mCallbacksSrc) {
+    (*cb)(value, hasSource ? &source : nullptr);
+  }
+}
+
+template <class ParameterType>
+bool ParameterWrapper<ParameterType>::runChangeCallbacksSynchronous(
     ParameterType &value, ValueSource *src) {
   for (auto cb : mCallbacks) {
     if (cb == nullptr) {
       // If first callback if nullptr, callbacks must be processed async
-      mChanged = true;
-      return;
+      if (mPendingSource) {
+        // The dispatcher delivers the source callbacks too
+        ParameterPendingSource pending;
+        if (src) {
+          pending.hasSource = true;
+          pending.port = src->port;
+          src->ipAddr.copy(pending.ipAddr, sizeof(pending.ipAddr) - 1);
+        }
+        mPendingSource->store(pending);
+      }
+      return true;
     } else {
       (*cb)(value);
     }
@@ -1542,6 +2074,7 @@ void ParameterWrapper<ParameterType>::runChangeCallbacksSynchronous(
   for (auto cb : mCallbacksSrc) {
     (*cb)(value, src);
   }
+  return false;
 }
 
 } // namespace al
@@ -42,7 +42,11 @@
         Andrés Cabrera mantaraya36@gmail.com
 */
 
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
 #include <mutex>
+#include <thread>
 
 #include "al/protocol/al_OSC.hpp"
 #include "al/ui/al_Parameter.hpp"
@@ -91,22 +95,11 @@ public:
    * @brief addListener enables notifiying via OSC that a preset has changed
    * @param IPaddress The IP address of the listener
    * @param oscPort The network port so send the value changes on
+   *
+   * The listener's address is resolved once here. Notifications are sent
+   * from a separate thread, see setNotificationInterval().
    */
-  virtual void addListener(std::string IPaddress, uint16_t oscPort) {
-    auto newListenerSocket = new osc::Send;
-
-    if (newListenerSocket->open(oscPort, IPaddress.c_str())) {
-      mListenerLock.lock();
-      mOSCSenders.push_back(newListenerSocket);
-      mListenerLock.unlock();
-      //		std::cout << "Registered listener " << IPaddress << ":"
-      //<< oscPort<< std::endl;
-    } else {
-      delete newListenerSocket;
-      std::cerr << "ERROR: Could not register listener " << IPaddress << ":"
-                << oscPort << std::endl;
-    }
-  }
+  virtual void addListener(std::string IPaddress, uint16_t oscPort);
 
   /**
    * @brief Notify the listeners of value changes
@@ -119,6 +112,9 @@ public:
    * register to be notified when the data changes to only do notifications
    * then.
    *
+   * Notifications are queued without blocking and sent on the next tick of
+   * the notification thread. Multiple values for the same OSC address within
+   * a tick are coalesced so only the latest value is sent.
    */
   void notifyListeners(std::string OSCaddress, float value,
                        ValueSource *src = nullptr);
@@ -138,16 +134,49 @@ public:
   void notifyListeners(std::string OSCaddress, ParameterMeta *param,
                        ValueSource *src);
 
-  void send(osc::Packet &p) {
-    mListenerLock.lock();
-    for (osc::Send *sender : mOSCSenders) {
-      sender->send(p);
-      //      std::cout << "Notifying " << sender->address() << ":" <<
-      //      sender->port()
-      //                << std::endl;
-    }
-    mListenerLock.unlock();
+  /**
+   * @brief Queue a packet to be sent to all listeners
+   *
+   * Packets are never coalesced and are sent in order with value
+   * notifications.
+   */
+  void send(osc::Packet &p);
+
+  /**
+   * @brief Set period of the notification thread
+   * @param seconds period in seconds
+   *
+   * All notifications queued during a period are sent together, packed into
+   * as few OSC bundles as possible.
+   */
+  void setNotificationInterval(al_sec seconds) {
+    mNotificationInterval.store(seconds);
   }
+
+  /**
+   * @brief Set maximum size in bytes of the bundles sent to listeners
+   *
+   * This should be kept below the network's MTU. Single messages larger than
+   * this are sent on their own.
+   */
+  void setMaxPacketSize(size_t size) { mMaxPacketSize.store(size); }
+
+  /**
+   * @brief Number of notifications dropped because too many were queued
+   *
+   * Notifications come from a fixed pool so that queueing never allocates.
+   * When a burst exhausts it before the next flush, further notifications
+   * are dropped until the queued ones have been sent.
+   */
+  uint64_t droppedNotifications() const {
+    return mDroppedNotifications.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Send all queued notifications now.
+   */
+  void flushNotifications();
+
   void startHandshakeServer(std::string address = "0.0.0.0");
 
   void appendCommandHandler(osc::PacketHandler &handler) {
@@ -155,8 +184,48 @@ public:
   }
 
 protected:
+  // Encoded OSC data waiting to be sent. Notifications are pushed onto an
+  // intrusive lock-free stack so value changes never wait for the
+  // notification thread or the network. Nodes come from a fixed pool and
+  // keep their buffers when recycled, so queueing does not allocate once the
+  // buffers have grown.
+  struct Notification {
+    std::string address; // Empty for packets that must not be coalesced
+    std::vector<char> data;
+    bool hasSource{false};
+    ValueSource source;
+    Notification *next{nullptr};
+    uint32_t poolIndex{0};
+    std::atomic<uint32_t> nextFree{0};
+  };
+
+  template <class... Args>
+  void queueMessage(const std::string &OSCaddress, ValueSource *src,
+                    const Args &... args);
+  // OSC message encoding straight into a node's buffer
+  static char typeTag(float) { return 'f'; }
+  static char typeTag(int) { return 'i'; }
+  static char typeTag(const std::string &) { return 's'; }
+  static void appendPadded(std::vector<char> &data, const char *str,
+                           size_t len);
+  static void appendArgument(std::vector<char> &data, float value);
+  static void appendArgument(std::vector<char> &data, int value);
+  static void appendArgument(std::vector<char> &data,
+                             const std::string &value) {
+    appendPadded(data, value.c_str(), value.size());
+  }
+  void queueNotification(Notification *notification);
+  // nullptr when the pool is exhausted, the notification is then dropped
+  Notification *acquireNotification();
+  void releaseNotification(Notification *notification);
+
+  void startNotificationThread();
+  void stopNotificationThread();
+  bool isSource(const Notification &notification, size_t listenerIndex);
+
   std::mutex mListenerLock;
   std::vector<osc::Send *> mOSCSenders;
+  std::vector<std::string> mListenerIps; // Resolved addresses for mOSCSenders
   std::vector<std::pair<std::string, int>> mConnectedNodes;
 
   class HandshakeHandler : public osc::PacketHandler {
@@ -172,8 +241,54 @@ protected:
   std::mutex mNodeLock;
 
 private:
+  static const uint32_t kNotificationPoolSize = 1024;
+
+  // Free list of pool nodes: index + 1 of the first node (0 if empty) in
+  // the low 32 bits, and a tag that changes on every update in the high
+  // bits, so a node that was taken and returned meanwhile fails the swap
+  std::unique_ptr<Notification[]> mNotificationPool;
+  std::atomic<uint64_t> mFreeNotifications{0};
+  std::atomic<uint64_t> mDroppedNotifications{0};
+
+  std::atomic<bool> mHasListeners{false};
+  std::atomic<Notification *> mPendingNotifications{nullptr};
+  std::mutex mFlushLock;
+  std::unique_ptr<std::thread> mNotificationThread;
+  std::atomic<bool> mNotificationThreadRunning{false};
+  std::mutex mNotificationThreadLock;
+  std::condition_variable mNotificationThreadWake;
+  std::atomic<al_sec> mNotificationInterval{0.01};
+  std::atomic<size_t> mMaxPacketSize{1400};
 };
 
+template <class... Args>
+void OSCNotifier::queueMessage(const std::string &OSCaddress, ValueSource *src,
+                               const Args &... args) {
+  if (!mHasListeners.load(std::memory_order_acquire)) {
+    return; // Nobody to send to, and nothing would drain the queue
+  }
+  auto *notification = acquireNotification();
+  if (!notification) {
+    return;
+  }
+  notification->address = OSCaddress;
+  // Encode in place so a recycled node reuses its buffer
+  std::vector<char> &data = notification->data;
+  const char typeTags[] = {',', typeTag(args)...};
+  data.clear();
+  appendPadded(data, OSCaddress.c_str(), OSCaddress.size());
+  appendPadded(data, typeTags, sizeof(typeTags));
+  int expand[] = {0, (appendArgument(data, args), 0)...};
+  (void)expand;
+  if (src) {
+    notification->hasSource = true;
+    notification->source = *src;
+  } else {
+    notification->hasSource = false;
+  }
+  queueNotification(notification);
+}
+
 /**
  * @brief The ParameterServer class creates an OSC server to receive parameter
  * values
@@ -0,0 +1,290 @@
+#ifndef AL_PARAMETERSMOOTHER_H
+#define AL_PARAMETERSMOOTHER_H
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012-2015. The Regents of the University of California.
+        All rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+        File description:
+        Smoothing of control values at audio rate
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "al/math/al_Vec.hpp"
+
+namespace al {
+
+/// How a smoothed parameter moves towards a new value
+/// @ingroup UI
+enum class SmoothingMode {
+  NONE,        ///< Jump to the new value
+  LINEAR,      ///< Reach the new value in a fixed time
+  EXPONENTIAL, ///< One-pole filter with a fixed time constant
+  SLEW         ///< Move at a fixed rate
+};
+
+/**
+ * @brief Linear segment describing a block of smoothed values
+ * @ingroup UI
+ *
+ * Sample i of the block has the value start + increment * i. This allows
+ * consumers to apply the ramp in their own vectorized loops without reading
+ * a per-sample buffer.
+ */
+template <class T> struct ParameterRamp {
+  T start;
+  T increment;
+  size_t numFrames;
+
+  T operator[](size_t i) const { return start + increment * float(i); }
+
+  /// True if all values in the block are the same
+  bool constant() const { return increment == T(0); }
+};
+
+inline float smootherDistance(float v) { return std::fabs(v); }
+
+template <int N, class T> T smootherDistance(const Vec<N, T> &v) {
+  return v.mag();
+}
+
+/**
+ * @brief Smooths a control value towards a target at audio rate
+ * @ingroup UI
+ *
+ * T can be float or an al::Vec. The smoother holds state and must only be
+ * used from one thread, usually the audio thread. Once the target has been
+ * reached, process() and ramp() only copy the value, so keeping thousands of
+ * settled smoothers in a patch is cheap.
+ *
+ * For LINEAR the time is the duration of the ramp to each new target. For
+ * EXPONENTIAL it is the time constant of the filter. For SLEW it is the time
+ * needed to move across the given range.
+ */
+template <class T> class ParameterSmoother {
+public:
+  ParameterSmoother(T initial = T(0)) : mCurrent(initial), mTarget(initial) {}
+
+  /**
+   * @brief set smoothing mode and time
+   *
+   * Any transition in progress jumps to the target.
+   *
+   * @param mode smoothing mode
+   * @param time smoothing time in seconds
+   * @param sampleRate rate at which next() is called
+   * @param range range used to compute the rate for SLEW mode
+   */
+  void configure(SmoothingMode mode, float time, float sampleRate,
+                 float range = 1.0f) {
+    mMode = mode;
+    mTimeSamples = time * sampleRate;
+    if (mTimeSamples < 1.0f || mode == SmoothingMode::NONE) {
+      mMode = SmoothingMode::NONE;
+      mTimeSamples = 1.0f;
+    }
+    mCoefficient = std::exp(-1.0f / mTimeSamples);
+    mMaxStep = range / mTimeSamples;
+    // Finish any ramp in progress
+    reset(mTarget);
+  }
+
+  SmoothingMode mode() const { return mMode; }
+
+  /**
+   * @brief set the value to move towards
+   */
+  void setTarget(const T &target) {
+    if (target == mTarget) {
+      return;
+    }
+    mTarget = target;
+    if (mMode == SmoothingMode::NONE) {
+      mCurrent = target;
+    } else if (mMode == SmoothingMode::EXPONENTIAL) {
+      mOffset = mCurrent - mTarget;
+    } else if (mMode == SmoothingMode::LINEAR) {
+      mRemaining = size_t(mTimeSamples);
+      mIncrement = (mTarget - mCurrent) / float(mRemaining);
+    }
+  }
+
+  /**
+   * @brief jump to value without smoothing
+   */
+  void reset(const T &value) {
+    mCurrent = mTarget = value;
+    mRemaining = 0;
+    mIncrement = T(0);
+    mOffset = T(0);
+  }
+
+  const T &target() const { return mTarget; }
+  const T &current() const { return mCurrent; }
+
+  /// True if the current value has reached the target
+  bool settled() const { return mCurrent == mTarget; }
+
+  /**
+   * @brief advance one sample and return the new value
+   */
+  T next() {
+    if (settled()) {
+      return mCurrent;
+    }
+    switch (mMode) {
+    case SmoothingMode::LINEAR:
+      if (--mRemaining == 0) {
+        mCurrent = mTarget;
+      } else {
+        mCurrent += mIncrement;
+      }
+      break;
+    case SmoothingMode::EXPONENTIAL:
+      decay(mCoefficient);
+      break;
+    case SmoothingMode::SLEW:
+      moveBy(mMaxStep);
+      break;
+    case SmoothingMode::NONE:
+      mCurrent = mTarget;
+      break;
+    }
+    return mCurrent;
+  }
+
+  /**
+   * @brief fill buffer with the next numFrames smoothed values
+   */
+  void process(T *buffer, size_t numFrames) {
+    size_t i = 0;
+    if (mMode == SmoothingMode::LINEAR) {
+      // Write the ramp as an induction-free loop the compiler can vectorize
+      size_t rampFrames = std::min(numFrames, mRemaining);
+      if (rampFrames > 0) {
+        T start = mCurrent;
+        for (; i < rampFrames; i++) {
+          buffer[i] = start + mIncrement * float(i + 1);
+        }
+        mRemaining -= rampFrames;
+        mCurrent = mRemaining == 0 ? mTarget : buffer[rampFrames - 1];
+        buffer[rampFrames - 1] = mCurrent;
+      }
+    } else {
+      for (; i < numFrames && !settled(); i++) {
+        buffer[i] = next();
+      }
+    }
+    for (; i < numFrames; i++) {
+      buffer[i] = mCurrent;
+    }
+  }
+
+  /**
+   * @brief advance numFrames samples and return a linear segment for them
+   *
+   * The segment ends exactly at the value process() would reach. Within the
+   * block, exponential and slew curves and linear ramps that end mid-block
+   * are approximated by a straight line, which is inaudible for typical
+   * block sizes.
+   */
+  ParameterRamp<T> ramp(size_t numFrames) {
+    if (settled() || numFrames == 0) {
+      return {mCurrent, T(0), numFrames};
+    }
+    T start = mCurrent;
+    switch (mMode) {
+    case SmoothingMode::LINEAR:
+      if (numFrames >= mRemaining) {
+        mCurrent = mTarget;
+        mRemaining = 0;
+      } else {
+        mCurrent += mIncrement * float(numFrames);
+        mRemaining -= numFrames;
+      }
+      break;
+    case SmoothingMode::EXPONENTIAL:
+      decay(std::pow(mCoefficient, float(numFrames)));
+      break;
+    case SmoothingMode::SLEW:
+      moveBy(mMaxStep * float(numFrames));
+      break;
+    case SmoothingMode::NONE:
+      mCurrent = mTarget;
+      break;
+    }
+    T increment = (mCurrent - start) / float(numFrames);
+    return {start + increment, increment, numFrames};
+  }
+
+private:
+  void moveBy(float maxStep) {
+    T difference = mTarget - mCurrent;
+    float distance = smootherDistance(difference);
+    if (distance <= maxStep) {
+      mCurrent = mTarget;
+    } else {
+      mCurrent += difference * (maxStep / distance);
+    }
+  }
+
+  // The offset from the target decays instead of mCurrent, as mCurrent
+  // stops changing once a step is smaller than its float resolution, which
+  // is far from the target for large values and long times. mCurrent reaches
+  // the target exactly once the offset is below that resolution.
+  void decay(float factor) {
+    mOffset = mOffset * factor;
+    if (smootherDistance(mOffset) < 1e-6f) {
+      mOffset = T(0);
+    }
+    mCurrent = mTarget + mOffset;
+  }
+
+  SmoothingMode mMode{SmoothingMode::NONE};
+  T mCurrent;
+  T mTarget;
+  T mIncrement{T(0)};
+  T mOffset{T(0)}; // mCurrent - mTarget for EXPONENTIAL
+  size_t mRemaining{0};
+  float mTimeSamples{1.0f};
+  float mCoefficient{0.0f};
+  float mMaxStep{0.0f};
+};
+
+} // namespace al
+
+#endif // AL_PARAMETERSMOOTHER_H
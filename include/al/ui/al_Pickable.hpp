@@ -127,6 +127,45 @@ struct Pickable {
   Vec3f transformVecWorld(const Vec3f &v, float w = 1);
   /// transfrom a vector in world space to local space
   Vec3f transformVecLocal(const Vec3f &v, float w = 1);
+
+  /// model matrix from pose and scale, cached until either changes
+  const Matrix4d &modelMatrix() {
+    updateTransforms();
+    return mModel;
+  }
+  /// inverse of modelMatrix(), cached until pose or scale change
+  const Matrix4d &inverseModelMatrix() {
+    updateTransforms();
+    return mInverseModel;
+  }
+
+  /// bounding box of what intersect() tests, in local space
+
+  /// Return false if unbounded, which is the default. Rays that miss the
+  /// bounds skip intersect(), so override this together with intersect().
+  virtual bool localBounds(BoundingBoxData &b) { return false; }
+
+  /// update cached transforms and bounds, returns true if they changed
+  bool updateBounds();
+  /// whether localBounds() is bounded, as of the last updateBounds()
+  bool bounded() const { return mBounded; }
+  /// axis aligned bounding box in the parent's space, valid if bounded()
+  const BoundingBoxData &parentBounds() const { return mParentBounds; }
+  /// false if a ray in the parent's space can not hit this pickable
+  bool mayIntersect(const Rayd &r);
+
+protected:
+  /// update cached matrices if pose or scale changed, true if they did
+  bool updateTransforms();
+
+  ParameterSnapshot<Pose> mPoseSnapshot{pose};
+  ParameterSnapshot<Vec3f> mScaleSnapshot{scaleVec};
+  bool mTransformsValid = false;
+  Matrix4d mModel, mInverseModel;
+
+  bool mBoundsValid = false;
+  bool mBounded = false;
+  BoundingBoxData mLocalBounds, mParentBounds;
 };
 
 /// Bounding Box PickableMesh
@@ -151,8 +190,15 @@ struct PickableBB : Pickable {
   /// initialize bounding box;
   void set(Mesh &m);
 
+  /// test rays against the triangles of the mesh after the bounding box
+  bool testMesh = false;
+
   /// override base methods
   Hit intersect(Rayd r);
+  bool localBounds(BoundingBoxData &b) {
+    b.set(bb.min, bb.max);
+    return true;
+  }
   // bool contains(Vec3d v){ auto p = transformVecLocal(v); return
   // bb.contains(p); }
 
@@ -177,6 +223,9 @@ struct PickableBB : Pickable {
   /// intersect ray with bounding sphere
   float intersectBoundingSphere(Rayd ray);
 
+  /// intersect ray in local space with the triangles of mesh
+  double intersectMesh(Rayd localRay);
+
   /// calculate Axis aligned bounding box from mesh bounding box and current
   /// transforms
   void updateAABB();
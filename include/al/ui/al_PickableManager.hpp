@@ -2,6 +2,8 @@
 #ifndef __PICKABLEMANAGER_HPP__
 #define __PICKABLEMANAGER_HPP__
 
+#include <atomic>
+#include <memory>
 #include <vector>
 // #include <map>
 
@@ -14,17 +16,40 @@ namespace al {
 
 /// PickableManager
 /// @ingroup UI
+///
+/// Rays are tested against a bounding volume hierarchy of the bounds of the
+/// registered pickables (see Pickable::localBounds()), so only pickables
+/// whose bounds a ray crosses are intersected. The hierarchy is refit as
+/// pickables move and rebuilt once refitting has loosened it too much.
+/// Unbounded pickables are always intersected.
+///
+/// Moves are noticed through the change callbacks of the pose and scale
+/// parameters of registered pickables. Call boundsChanged() if bounds change
+/// in other ways, such as when a PickableBB is set to another mesh, or when
+/// a pose is changed with setNoCalls(), which does not call the callbacks.
+///
+/// The callbacks are removed when a pickable is unregistered or the manager
+/// is destroyed, so registered pickables must outlive the manager or be
+/// unregistered first.
 class PickableManager {
 public:
   PickableManager() {}
+  ~PickableManager();
 
   PickableManager &registerPickable(Pickable &p);
+  PickableManager &unregisterPickable(Pickable &p);
   PickableManager &operator<<(Pickable &p) { return registerPickable(p); }
   PickableManager &operator<<(Pickable *p) { return registerPickable(*p); }
 
   std::vector<Pickable *> pickables() { return mPickables; }
 
+  /// refit the hierarchy to the current bounds on the next intersection
+  void boundsChanged() { mBoundsChanged->store(true); }
+
+  /// nearest hit of the ray with the registered pickables
   Hit intersect(Rayd r);
+  /// nearest hit, testing every pickable without the hierarchy
+  Hit intersectAll(Rayd r);
 
   void event(PickEvent e);
 
@@ -42,7 +67,39 @@ public:
   Hit lastPick() { return mLastPick; }
 
 protected:
+  /// node of the bounding volume hierarchy
+  struct Node {
+    Vec3f min, max;
+    int parent;
+    int left, right;     ///< children, or -1 for a leaf
+    Pickable *pickable;  ///< pickable of a leaf
+  };
+
+  // refit the hierarchy to moved pickables, or rebuild it if needed
+  void updateHierarchy();
+  void buildHierarchy();
+  int buildNode(std::vector<int> &leaves, int begin, int end, int parent);
+  void fitNode(Node &n);
+  static float surfaceArea(const Node &n);
+
+  /// change callbacks added to a registered pickable
+  struct Callbacks {
+    std::shared_ptr<ParameterPose::ParameterChangeCallback> pose;
+    std::shared_ptr<ParameterVec3::ParameterChangeCallback> scale;
+  };
+
   std::vector<Pickable *> mPickables;
+  std::vector<Callbacks> mCallbacks;     ///< callbacks of each pickable
+  std::vector<Node> mNodes;
+  std::vector<int> mLeaves;              ///< leaf node of each pickable
+  std::vector<Pickable *> mUnbounded;    ///< pickables without bounds
+  std::vector<int> mStack;               ///< traversal stack
+  bool mHierarchyValid{false};
+  // set from parameter callbacks, which may outlive the manager
+  std::shared_ptr<std::atomic<bool>> mBoundsChanged{
+      std::make_shared<std::atomic<bool>>(false)};
+  float mBuildArea{0};  ///< surface area of all nodes when built
+  float mArea{0};       ///< surface area of all nodes when refit
   // std::map<int, Hit> mHover;
   // std::map<int, Hit> mSelect;
 
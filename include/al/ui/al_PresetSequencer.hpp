@@ -60,6 +60,7 @@ namespace al {
 
 class SequenceRecorder;
 class Composition;
+class ClusterClock;
 
 /**
  * @brief The PresetSequencer class allows triggering presets from a
@@ -321,6 +322,18 @@ class PresetSequencer : public osc::MessageConsumer {
 
   void setSequencerStepTime(double stepTime) { mGranularity = stepTime * 1e9; }
 
+  /**
+   * @brief Follow a clock shared by the cluster
+   * @param clock cluster clock, or nullptr to count step times
+   *
+   * With TIME_MASTER_CPU, sequence time then advances by the time elapsed on
+   * the cluster clock instead of by the step time, so the sleep jitter of the
+   * sequencer thread doesn't accumulate and nodes that start a sequence
+   * together don't drift apart. Starting at an agreed cluster time, as
+   * SynthSequencer::playSequenceAt() does, is not supported yet.
+   */
+  void setClock(ClusterClock *clock) { mClock = clock; }
+
  protected:
   virtual bool consumeMessage(osc::Message &m,
                               std::string rootOSCPath) override;
@@ -362,6 +375,7 @@ class PresetSequencer : public osc::MessageConsumer {
   double mStepTime;
 
   uint64_t mGranularity = 10e6;  // nanoseconds
+  ClusterClock *mClock{nullptr};
   bool mBeginCallbackEnabled;
   std::function<void(PresetSequencer *)> mBeginCallback;
   bool mEndCallbackEnabled;
@@ -1,5 +1,6 @@
 #include "al/app/al_DistributedApp.hpp"
 
+#include "al/graphics/al_OpenGL.hpp"
 #include "al/sphere/al_SphereUtils.hpp"
 
 #ifdef AL_WINDOWS
@@ -132,6 +133,16 @@ void DistributedApp::prepare() {
   } else {
     additionalConfig["broadcastAddress"] = "127.0.0.1";
   }
+  // State is sent to a multicast group instead if one is configured
+  if (mFoundHost && appConfig.hasKey<std::string>("multicastGroup")) {
+    additionalConfig["multicastGroup"] = appConfig.gets("multicastGroup");
+  }
+  if (appConfig.hasKey<bool>("frameBarrier")) {
+    mFrameBarrierEnabled = appConfig.getb("frameBarrier");
+  }
+  if (appConfig.hasKey<std::string>("primaryHost")) {
+    mPrimaryHost = appConfig.gets("primaryHost");
+  }
 
   osc::Recv testServer;
   // probe to check if first port available, this will determine if this
@@ -240,6 +251,24 @@ void DistributedApp::start() {
 
   onInit();
 
+  // Installed after onInit() so it runs after any postOnDraw set there
+  if (mFrameBarrierEnabled && startFrameBarrier()) {
+    auto &postOnDraw = hasCapability(CAP_OMNIRENDERING)
+                           ? omniRendering->postOnDraw
+                           : mDefaultWindowDomain->postOnDraw;
+    auto previousPostOnDraw = postOnDraw;
+    postOnDraw = [this, previousPostOnDraw]() {
+      previousPostOnDraw();
+      // Wait for the GPU so the barrier releases finished frames
+      glFinish();
+      if (mFrameBarrierServer) {
+        mFrameBarrierServer->sync();
+      } else {
+        mFrameBarrierClient->sync();
+      }
+    };
+  }
+
   for (auto &domain : mDomainList) {
     mRunningDomains.push(domain);
     if (!domain->start()) {
@@ -256,6 +285,14 @@ void DistributedApp::start() {
   }
 
   onExit();
+  if (mFrameBarrierServer) {
+    mFrameBarrierServer->stop();
+    mFrameBarrierServer = nullptr;
+  }
+  if (mFrameBarrierClient) {
+    mFrameBarrierClient->stop();
+    mFrameBarrierClient = nullptr;
+  }
   mDefaultWindowDomain = nullptr;
   for (auto &domain : mDomainList) {
     if (!domain->cleanup()) {
@@ -266,6 +303,46 @@ void DistributedApp::start() {
 
 std::string DistributedApp::name() { return al_get_hostname(); }
 
+void DistributedApp::setFrameBarrier(bool enable, double timeout) {
+  mFrameBarrierEnabled = enable;
+  mFrameBarrierTimeout = timeout;
+}
+
+FrameBarrierStats DistributedApp::frameBarrierStats() {
+  if (mFrameBarrierServer) {
+    return mFrameBarrierServer->stats();
+  } else if (mFrameBarrierClient) {
+    return mFrameBarrierClient->stats();
+  }
+  return FrameBarrierStats();
+}
+
+bool DistributedApp::startFrameBarrier() {
+  if (!hasCapability(CAP_OMNIRENDERING) && !mDefaultWindowDomain) {
+    return false;
+  }
+  if (isPrimary()) {
+    mFrameBarrierServer = std::make_unique<FrameBarrierServer>();
+    mFrameBarrierServer->setTimeout(mFrameBarrierTimeout);
+    if (!mFrameBarrierServer->start()) {
+      std::cerr << "ERROR starting frame barrier. Running without it."
+                << std::endl;
+      mFrameBarrierServer = nullptr;
+      return false;
+    }
+  } else {
+    mFrameBarrierClient = std::make_unique<FrameBarrierClient>();
+    mFrameBarrierClient->setTimeout(mFrameBarrierTimeout);
+    if (!mFrameBarrierClient->start(34460, mPrimaryHost.c_str())) {
+      std::cerr << "Frame barrier: primary not found at " << mPrimaryHost
+                << ". Running without barrier." << std::endl;
+      mFrameBarrierClient = nullptr;
+      return false;
+    }
+  }
+  return true;
+}
+
 void al::DistributedApp::registerDynamicScene(DynamicScene &scene) {
   if (dynamic_cast<DistributedScene *>(&scene)) {
     // If distributed scene, connect according to this app's role
@@ -0,0 +1,123 @@
+#include "al/app/al_ParameterDispatchDomain.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+using namespace al;
+
+ParameterDispatchDomain::~ParameterDispatchDomain() {
+  std::unique_lock<std::mutex> lk(mEntriesLock);
+  detachAll();
+}
+
+bool ParameterDispatchDomain::cleanup(ComputationDomain *parent) {
+  bool ret = cleanupSubdomains(true);
+  {
+    std::unique_lock<std::mutex> lk(mEntriesLock);
+    dispatch();
+    detachAll();
+    dispatch();
+    mEntries.clear();
+  }
+  ret &= cleanupSubdomains(false);
+  return ret;
+}
+
+void ParameterDispatchDomain::detachAll() {
+  for (auto &registration : mEntries) {
+    // Parameters that have been destroyed have cleared their entry
+    if (registration.entry->parameter.load(std::memory_order_acquire)) {
+      registration.detach();
+    }
+  }
+}
+
+bool ParameterDispatchDomain::tick() {
+  bool ret = tickSubdomains(true);
+  dispatch();
+  ret &= tickSubdomains(false);
+  return ret;
+}
+
+size_t ParameterDispatchDomain::dispatch() {
+  ParameterDispatchEntry *entry =
+      mPending.exchange(nullptr, std::memory_order_acquire);
+  if (!entry) {
+    return 0;
+  }
+  // The pending stack is in reverse order of the first change of each
+  // parameter. Deliver in change order.
+  mBatch.clear();
+  while (entry) {
+    mBatch.push_back(entry);
+    entry = entry->next;
+  }
+  for (auto it = mBatch.rbegin(); it != mBatch.rend(); it++) {
+    // Clear before delivering so changes made during delivery are queued
+    (*it)->queued.exchange(false, std::memory_order_acq_rel);
+    if ((*it)->parameter.load(std::memory_order_acquire)) {
+      (*it)->deliver(**it);
+    }
+  }
+  return mBatch.size();
+}
+
+void ParameterDispatchDomain::unregisterParameter(ParameterMeta &param) {
+  std::unique_lock<std::mutex> lk(mEntriesLock);
+  auto it = std::find_if(mEntries.begin(), mEntries.end(),
+                         [&param](const Registration &registration) {
+                           return registration.entry->parameter == &param;
+                         });
+  if (it == mEntries.end()) {
+    return;
+  }
+  // Deliver pending changes while the callbacks are still asynchronous,
+  // then flush changes made before detaching took effect, so the pending
+  // stack does not reference the entry once released
+  dispatch();
+  it->detach();
+  dispatch();
+  mEntries.erase(it);
+  // Release entries of destroyed parameters. They can no longer be queued.
+  mEntries.erase(
+      std::remove_if(mEntries.begin(), mEntries.end(),
+                     [](const Registration &registration) {
+                       return !registration.entry->parameter.load(
+                                  std::memory_order_acquire) &&
+                              !registration.entry->queued.load(
+                                  std::memory_order_acquire);
+                     }),
+      mEntries.end());
+}
+
+std::vector<ParameterDispatchDomain::Stats> ParameterDispatchDomain::stats() {
+  std::vector<Stats> allStats;
+  std::unique_lock<std::mutex> lk(mEntriesLock);
+  for (auto &registration : mEntries) {
+    auto &entry = *registration.entry;
+    ParameterMeta *parameter = entry.parameter.load(std::memory_order_acquire);
+    if (!parameter) {
+      continue;
+    }
+    allStats.push_back({parameter->getFullAddress(),
+                        entry.changes.load(std::memory_order_relaxed),
+                        entry.deliveries, entry.callbackTimings});
+  }
+  return allStats;
+}
+
+void ParameterDispatchDomain::printStats() {
+  for (auto &s : stats()) {
+    std::cout << s.address << " changes: " << s.changes
+              << " deliveries: " << s.deliveries << std::endl;
+    for (size_t i = 0; i < s.callbackTimings.size(); i++) {
+      auto &timing = s.callbackTimings[i];
+      if (timing.calls == 0) {
+        continue;
+      }
+      std::cout << "   callback " << i << " avg: "
+                << timing.totalTime * 1.0e6 / timing.calls
+                << " us max: " << timing.maxTime * 1.0e6 << " us" << std::endl;
+    }
+  }
+}
@@ -1,3 +1,575 @@
 #include "al/app/al_StateDistributionDomain.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+
+#ifndef AL_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace al;
+
+namespace {
+size_t oscStringSize(size_t length) { return (length + 4) & ~size_t(3); }
+
+const uint32_t kDeltaKeyframe = 0;
+const uint32_t kDeltaDelta = 1;
+const size_t kDeltaHeaderSize = 4 * sizeof(uint32_t);
+
+void appendWord(std::vector<unsigned char> &out, uint32_t value) {
+  size_t pos = out.size();
+  out.resize(pos + sizeof(uint32_t));
+  std::memcpy(out.data() + pos, &value, sizeof(uint32_t));
+}
+
+uint32_t readWord(const unsigned char *data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(uint32_t));
+  return value;
+}
+} // namespace
+
+// StateDeltaEncoder -----------------------------------------------------------
+
+void StateDeltaEncoder::configure(uint32_t blockSize,
+                                  uint32_t keyframeInterval) {
+  mBlockSize = std::max<uint32_t>(blockSize, 4);
+  mKeyframeInterval = std::max<uint32_t>(keyframeInterval, 1);
+  mForceKeyframe = true;
+}
+
+void StateDeltaEncoder::encodeKeyframe(const unsigned char *state,
+                                       size_t size) {
+  mKeyframeNumber++;
+  mFramesSinceKeyframe = 0;
+  mForceKeyframe = false;
+  mLastWasKeyframe = true;
+  mKeyframe.assign(state, state + size);
+  mOutput.clear();
+  appendWord(mOutput, kDeltaKeyframe);
+  appendWord(mOutput, mKeyframeNumber);
+  appendWord(mOutput, uint32_t(size));
+  appendWord(mOutput, mBlockSize);
+  mOutput.insert(mOutput.end(), state, state + size);
+}
+
+const std::vector<unsigned char> &StateDeltaEncoder::encode(const void *state,
+                                                            size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(state);
+  mBytesIn += size;
+  if (mForceKeyframe || mKeyframe.size() != size ||
+      ++mFramesSinceKeyframe >= mKeyframeInterval) {
+    encodeKeyframe(bytes, size);
+    mBytesOut += mOutput.size();
+    return mOutput;
+  }
+  mLastWasKeyframe = false;
+  mOutput.clear();
+  appendWord(mOutput, kDeltaDelta);
+  appendWord(mOutput, mKeyframeNumber);
+  appendWord(mOutput, uint32_t(size));
+  appendWord(mOutput, mBlockSize);
+
+  const uint32_t blockCount = uint32_t((size + mBlockSize - 1) / mBlockSize);
+  uint32_t block = 0;
+  while (block < blockCount) {
+    // Find the next run of changed blocks
+    while (block < blockCount) {
+      size_t offset = size_t(block) * mBlockSize;
+      size_t length = std::min<size_t>(mBlockSize, size - offset);
+      if (std::memcmp(bytes + offset, mKeyframe.data() + offset, length) !=
+          0) {
+        break;
+      }
+      block++;
+    }
+    if (block == blockCount) {
+      break;
+    }
+    uint32_t first = block;
+    while (block < blockCount) {
+      size_t offset = size_t(block) * mBlockSize;
+      size_t length = std::min<size_t>(mBlockSize, size - offset);
+      if (std::memcmp(bytes + offset, mKeyframe.data() + offset, length) ==
+          0) {
+        break;
+      }
+      block++;
+    }
+    size_t offset = size_t(first) * mBlockSize;
+    size_t end = std::min<size_t>(size_t(block) * mBlockSize, size);
+    appendWord(mOutput, first);
+    appendWord(mOutput, block - first);
+    mOutput.insert(mOutput.end(), bytes + offset, bytes + end);
+    if (mOutput.size() >= size) {
+      // Delta would not save anything, start a new keyframe instead
+      encodeKeyframe(bytes, size);
+      break;
+    }
+  }
+  mBytesOut += mOutput.size();
+  return mOutput;
+}
+
+// StateDeltaDecoder -----------------------------------------------------------
+
+bool StateDeltaDecoder::decode(const unsigned char *frame, size_t frameSize,
+                               void *state, size_t size) {
+  if (frameSize < kDeltaHeaderSize) {
+    return false;
+  }
+  unsigned char *out = static_cast<unsigned char *>(state);
+  uint32_t type = readWord(frame);
+  uint32_t keyframeNumber = readWord(frame + 4);
+  uint32_t stateSize = readWord(frame + 8);
+  uint32_t blockSize = readWord(frame + 12);
+  if (stateSize != size || blockSize == 0) {
+    std::cerr << "ERROR: received state size mismatch" << std::endl;
+    return false;
+  }
+  const unsigned char *data = frame + kDeltaHeaderSize;
+  const unsigned char *end = frame + frameSize;
+
+  if (type == kDeltaKeyframe) {
+    if (size_t(end - data) != size) {
+      return false;
+    }
+    mKeyframe.assign(data, end);
+    mKeyframeNumber = keyframeNumber;
+    mBlockSize = blockSize;
+    mHasKeyframe = true;
+    mAppliedRuns.clear();
+    std::memcpy(out, data, size);
+    return true;
+  }
+  if (type != kDeltaDelta || !mHasKeyframe ||
+      keyframeNumber != mKeyframeNumber || blockSize != mBlockSize) {
+    mDeltasSkipped++;
+    return false;
+  }
+  // Undo the previous delta
+  for (auto &run : mAppliedRuns) {
+    size_t offset = size_t(run.first) * mBlockSize;
+    size_t length = std::min<size_t>(size_t(run.second) * mBlockSize,
+                                     size - offset);
+    std::memcpy(out + offset, mKeyframe.data() + offset, length);
+  }
+  mAppliedRuns.clear();
+  while (end - data >= 8) {
+    uint32_t first = readWord(data);
+    uint32_t count = readWord(data + 4);
+    data += 8;
+    size_t offset = size_t(first) * mBlockSize;
+    if (offset >= size) {
+      break;
+    }
+    size_t length =
+        std::min<size_t>(size_t(count) * mBlockSize, size - offset);
+    if (size_t(end - data) < length) {
+      break;
+    }
+    std::memcpy(out + offset, data, length);
+    mAppliedRuns.push_back({first, count});
+    data += length;
+  }
+  return true;
+}
+
+// StateTripleBuffer -----------------------------------------------------------
+
+void StateTripleBuffer::resize(size_t size) {
+  for (auto &buffer : mBuffers) {
+    buffer = std::make_unique<unsigned char[]>(size);
+  }
+  mSize = size;
+  mBack = 0;
+  mMiddle = 1;
+  mFront = 2;
+}
+
+void StateTripleBuffer::publish(uint32_t frame) {
+  mFrames[mBack] = frame;
+  // Release makes the buffer contents visible to the reader's acquire
+  uint32_t previous =
+      mMiddle.exchange(mBack | kFresh, std::memory_order_acq_rel);
+  mBack = previous & ~kFresh;
+}
+
+bool StateTripleBuffer::acquire() {
+  if ((mMiddle.load(std::memory_order_relaxed) & kFresh) == 0) {
+    return false;
+  }
+  uint32_t previous = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+  mFront = previous & ~kFresh;
+  return true;
+}
+
+// StateSharedMemory -----------------------------------------------------------
+
+// Shared between processes. The indices are kept in the region so either side
+// can map it again after restarting.
+struct StateSharedMemory::Header {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint64_t size;
+  // Middle, back and front buffer indices and the fresh flag in one word,
+  // so that a side mapping the region while the other one publishes or
+  // acquires finds its index consistent with the others
+  std::atomic<uint32_t> indices;
+  uint32_t frames[3];
+  // Set when the writer removes the name, readers must map the region the
+  // name refers to from then on
+  std::atomic<uint32_t> closed;
+};
+
+namespace {
+const uint32_t kSharedMagic = 0x616c7374; // "alst"
+const uint32_t kSharedVersion = 3;
+// Two bits for each index
+const uint32_t kSharedMiddle = 0;
+const uint32_t kSharedBack = 2;
+const uint32_t kSharedFront = 4;
+const uint32_t kSharedFresh = 1 << 6;
+// Header and buffers start on cache lines
+const size_t kSharedAlign = 64;
+
+size_t sharedStride(size_t size) {
+  return (size + kSharedAlign - 1) & ~(kSharedAlign - 1);
+}
+
+size_t sharedRegionSize(size_t size) {
+  return kSharedAlign + 3 * sharedStride(size);
+}
+
+uint32_t sharedIndex(uint32_t indices, uint32_t shift) {
+  return (indices >> shift) & 3;
+}
+
+uint32_t sharedIndices(uint32_t middle, uint32_t back, uint32_t front) {
+  return middle << kSharedMiddle | back << kSharedBack | front << kSharedFront;
+}
+} // namespace
+
+unsigned char *StateSharedMemory::buffer(uint32_t index) const {
+  return reinterpret_cast<unsigned char *>(mHeader) + kSharedAlign +
+         index * sharedStride(mSize);
+}
+
+bool StateSharedMemory::create(const std::string &name, size_t size) {
+  return map(name, size, true);
+}
+
+bool StateSharedMemory::open(const std::string &name, size_t size) {
+  return map(name, size, false);
+}
+
+#ifdef AL_WINDOWS
+
+bool StateSharedMemory::map(const std::string &name, size_t size,
+                            bool create) {
+  std::cerr << "ERROR: shared memory state transport not available"
+            << std::endl;
+  return false;
+}
+
+void StateSharedMemory::close() {}
+
+#else
+
+bool StateSharedMemory::map(const std::string &name, size_t size,
+                            bool create) {
+  static_assert(sizeof(Header) <= kSharedAlign, "Header too large");
+  close();
+  size_t regionSize = sharedRegionSize(size);
+  int fd = shm_open(name.c_str(), create ? O_CREAT | O_RDWR : O_RDWR, 0600);
+  if (fd < 0) {
+    // Readers retry until the writer has created the region
+    if (create || errno != ENOENT) {
+      std::cerr << "ERROR: could not open shared memory " << name << ": "
+                << std::strerror(errno) << std::endl;
+    }
+    return false;
+  }
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    ::close(fd);
+    return false;
+  }
+  if (create && info.st_size != 0 && size_t(info.st_size) != regionSize) {
+    // Left by a writer with a different state. The name refers to a new
+    // region from now on, so readers still mapping this one are told.
+    if (size_t(info.st_size) >= sizeof(Header)) {
+      void *old = mmap(nullptr, sizeof(Header), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+      if (old != MAP_FAILED) {
+        Header *oldHeader = static_cast<Header *>(old);
+        if (oldHeader->magic.load(std::memory_order_acquire) ==
+                kSharedMagic &&
+            oldHeader->version == kSharedVersion) {
+          oldHeader->closed.store(1, std::memory_order_release);
+        }
+        munmap(old, sizeof(Header));
+      }
+    }
+    ::close(fd);
+    shm_unlink(name.c_str());
+    fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+      std::cerr << "ERROR: could not open shared memory " << name << ": "
+                << std::strerror(errno) << std::endl;
+      return false;
+    }
+    info.st_size = 0;
+  }
+  if (create && info.st_size == 0 && ftruncate(fd, off_t(regionSize)) != 0) {
+    std::cerr << "ERROR: could not size shared memory " << name << ": "
+              << std::strerror(errno) << std::endl;
+    ::close(fd);
+    return false;
+  }
+  if (!create && size_t(info.st_size) != regionSize) {
+    ::close(fd);
+    // An empty region is still being created by the writer
+    if (info.st_size != 0) {
+      std::cerr << "ERROR: shared memory " << name << " size mismatch"
+                << std::endl;
+    }
+    return false;
+  }
+  void *region =
+      mmap(nullptr, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // The mapping stays valid without the descriptor
+  ::close(fd);
+  if (region == MAP_FAILED) {
+    std::cerr << "ERROR: could not map shared memory " << name << ": "
+              << std::strerror(errno) << std::endl;
+    return false;
+  }
+
+  Header *header = static_cast<Header *>(region);
+  bool valid = header->magic.load(std::memory_order_acquire) == kSharedMagic &&
+               header->version == kSharedVersion && header->size == size;
+  if (create && !valid) {
+    header = new (region) Header();
+    header->version = kSharedVersion;
+    header->size = size;
+    header->indices = sharedIndices(1, 0, 2);
+    // Readers only use the region once the magic number is there
+    header->magic.store(kSharedMagic, std::memory_order_release);
+  } else if (!valid) {
+    munmap(region, regionSize);
+    return false;
+  }
+
+  if (create) {
+    header->closed.store(0, std::memory_order_release);
+  }
+  mHeader = header;
+  mSize = size;
+  mMappedSize = regionSize;
+  mName = name;
+  mOwner = create;
+  // Take up the index this side had, the other side may have moved on
+  uint32_t indices = header->indices.load(std::memory_order_acquire);
+  if (create) {
+    mBack = sharedIndex(indices, kSharedBack);
+  } else {
+    mFront = sharedIndex(indices, kSharedFront);
+  }
+  return true;
+}
+
+void StateSharedMemory::close() {
+  if (mHeader) {
+    if (mOwner) {
+      // A writer started later creates a new region under this name
+      mHeader->closed.store(1, std::memory_order_release);
+      shm_unlink(mName.c_str());
+    }
+    munmap(mHeader, mMappedSize);
+  }
+  mHeader = nullptr;
+  mSize = 0;
+  mMappedSize = 0;
+  mOwner = false;
+}
+
+#endif
+
+void StateSharedMemory::publish(uint32_t frame) {
+  mHeader->frames[mBack] = frame;
+  // Swaps the back and middle buffers. Only the reader changes the word
+  // meanwhile, so this rarely retries.
+  uint32_t indices = mHeader->indices.load(std::memory_order_relaxed);
+  uint32_t middle;
+  do {
+    middle = sharedIndex(indices, kSharedMiddle);
+  } while (!mHeader->indices.compare_exchange_weak(
+      indices,
+      sharedIndices(mBack, middle, sharedIndex(indices, kSharedFront)) |
+          kSharedFresh,
+      std::memory_order_acq_rel, std::memory_order_relaxed));
+  mBack = middle;
+}
+
+bool StateSharedMemory::acquire() {
+  // Swaps the middle and front buffers, as in publish()
+  uint32_t indices = mHeader->indices.load(std::memory_order_relaxed);
+  uint32_t middle;
+  do {
+    if ((indices & kSharedFresh) == 0) {
+      return false;
+    }
+    middle = sharedIndex(indices, kSharedMiddle);
+  } while (!mHeader->indices.compare_exchange_weak(
+      indices, sharedIndices(mFront, sharedIndex(indices, kSharedBack), middle),
+      std::memory_order_acq_rel, std::memory_order_relaxed));
+  mFront = middle;
+  return true;
+}
+
+bool StateSharedMemory::writerClosed() const {
+  return mHeader && mHeader->closed.load(std::memory_order_acquire) != 0;
+}
+
+uint32_t StateSharedMemory::frontFrame() const {
+  return mHeader->frames[mFront];
+}
+
+std::string StateSharedMemory::regionName(const std::string &id) {
+  std::string name = "/al_state_" + id;
+  std::replace(name.begin() + 1, name.end(), '/', '_');
+  return name;
+}
+
+// StateFragmentSender ---------------------------------------------------------
+
+void StateFragmentSender::configure(const std::string &id,
+                                    uint16_t packetSize) {
+  mId = id;
+  if (mSession == 0) {
+    // Differs from the sessions of earlier runs, which receivers may have
+    // seen
+    std::random_device random;
+    do {
+      mSession = random();
+    } while (mSession == 0);
+  }
+  // "/_statef" address, ",siiiiiiib" type tags, id, seven ints and blob size
+  size_t overhead = oscStringSize(8) + oscStringSize(10) +
+                    oscStringSize(id.size()) + 7 * 4 + 4;
+  mPayloadSize = packetSize > overhead + 64 ? packetSize - overhead : 64;
+  // Blob data is padded to 4 bytes
+  mPayloadSize &= ~size_t(3);
+  mPacket = std::make_unique<osc::Packet>(int(mPayloadSize + overhead + 4));
+}
+
+size_t StateFragmentSender::send(osc::Send &sender, const void *data,
+                                 size_t size, uint32_t encoding) {
+  if (!mPacket) {
+    configure(mId, 1400);
+  }
+  mFrame++;
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  size_t count = std::max<size_t>(1, (size + mPayloadSize - 1) / mPayloadSize);
+  for (size_t index = 0; index < count; index++) {
+    size_t offset = index * mPayloadSize;
+    size_t fragmentSize = std::min(mPayloadSize, size - offset);
+    mPacket->clear();
+    mPacket->beginMessage("/_statef");
+    *mPacket << mId << int(mSession) << int(mFrame) << int(index)
+             << int(count) << int(offset) << int(size) << int(encoding)
+             << osc::Blob(bytes + offset, fragmentSize);
+    mPacket->endMessage();
+    sender.send(*mPacket);
+  }
+  return count;
+}
+
+// StateFragmentAssembler ------------------------------------------------------
+
+void StateFragmentAssembler::dropCurrent() {
+  if (mStarted && !mComplete) {
+    mStats.framesIncomplete++;
+    mStats.fragmentsLost += mFragmentsPending;
+  }
+}
+
+bool StateFragmentAssembler::addFragment(uint32_t session, uint32_t frame,
+                                         uint32_t index, uint32_t count,
+                                         uint32_t offset, uint32_t totalSize,
+                                         uint32_t encoding, const void *data,
+                                         size_t size) {
+  // Fragments are never empty, so there are at most as many as bytes
+  if (totalSize > mMaxSize || index >= count ||
+      count > std::max<uint32_t>(totalSize, 1) ||
+      size_t(offset) + size > totalSize) {
+    mStats.fragmentsRejected++;
+    return false;
+  }
+  if (mStarted && session != mSession) {
+    if (session == mPreviousSession) {
+      mStats.fragmentsRejected++; // Late fragment of the replaced sender
+      return false;
+    }
+    // The sender restarted, its frame numbers start over
+    dropCurrent();
+    mPreviousSession = mSession;
+    mStarted = false;
+  }
+  int32_t age = int32_t(mFrame - frame);
+  if (mStarted && age > 0) {
+    mStats.fragmentsRejected++; // Late fragment of an older frame
+    return false;
+  }
+  if (!mStarted || frame != mFrame) {
+    dropCurrent();
+    if (mStarted && age < 0) {
+      mStats.framesMissed += uint32_t(-age) - 1;
+    }
+    mStarted = true;
+    mComplete = false;
+    mSession = session;
+    mFrame = frame;
+    mFragmentCount = count;
+    mFragmentsPending = count;
+    mEncoding = encoding;
+    mReceived.assign(count, false);
+    mData.resize(totalSize);
+  }
+  if (count != mFragmentCount || totalSize != mData.size() ||
+      mReceived[index]) {
+    mStats.fragmentsRejected++;
+    return false;
+  }
+  mReceived[index] = true;
+  std::memcpy(mData.data() + offset, data, size);
+  mStats.fragmentsReceived++;
+  if (--mFragmentsPending == 0) {
+    mComplete = true;
+    mStats.framesReceived++;
+    return true;
+  }
+  return false;
+}
+
+bool StateFragmentAssembler::addFragment(osc::Message &m) {
+  int session, frame, index, count, offset, totalSize, encoding;
+  osc::Blob blob;
+  m >> session >> frame >> index >> count >> offset >> totalSize >> encoding >>
+      blob;
+  if (index < 0 || count <= 0 || offset < 0 || totalSize < 0) {
+    mStats.fragmentsRejected++;
+    return false;
+  }
+  return addFragment(uint32_t(session), uint32_t(frame), uint32_t(index),
+                     uint32_t(count), uint32_t(offset), uint32_t(totalSize),
+                     uint32_t(encoding), blob.data, blob.size);
+}
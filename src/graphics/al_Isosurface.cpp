@@ -1,5 +1,8 @@
 #include "al/graphics/al_Isosurface.hpp"
 #include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include "al/graphics/al_Graphics.hpp"
 
 namespace al {
@@ -341,9 +344,14 @@ Isosurface::Isosurface(float lev, VertexAction& va)
       mValidSurface(false),
       mComputeNormals(true),
       mNormalize(true),
-      mInBox(false) {
+      mInBox(false),
+      mThreads(0),
+      mBrickSize(8),
+      mUpdated(false),
+      mUnusedIndices(0) {
   cellLengths(1);
   fieldDims(0);
+  mNB[0] = mNB[1] = mNB[2] = 0;
 }
 
 Isosurface::~Isosurface() {}
@@ -382,21 +390,26 @@ Compression pass:
 
 */
 
+// Get isosurface cell index depending on field values at corners of cell
+static int cellCase(const float* vals, float level) {
+  int idx = 0;
+  if (vals[0] < level) idx |= 1;
+  if (vals[2] < level) idx |= 2;
+  if (vals[3] < level) idx |= 4;
+  if (vals[1] < level) idx |= 8;
+  if (vals[4] < level) idx |= 16;
+  if (vals[6] < level) idx |= 32;
+  if (vals[7] < level) idx |= 64;
+  if (vals[5] < level) idx |= 128;
+  return idx;
+}
+
 void Isosurface::addCell(const int* cellIdx3, const float* vals) {
   const int& ix = cellIdx3[0];
   const int& iy = cellIdx3[1];
   const int& iz = cellIdx3[2];
 
-  // Get isosurface cell index depending on field values at corners of cell
-  int idx = 0;
-  if (vals[0] < level()) idx |= 1;
-  if (vals[2] < level()) idx |= 2;
-  if (vals[3] < level()) idx |= 4;
-  if (vals[1] < level()) idx |= 8;
-  if (vals[4] < level()) idx |= 16;
-  if (vals[6] < level()) idx |= 32;
-  if (vals[7] < level()) idx |= 64;
-  if (vals[5] < level()) idx |= 128;
+  int idx = cellCase(vals, level());
 
   // Create a triangulation of the isosurface in this cell
   const int edgeCode = sEdgeTable[idx];
@@ -564,6 +577,496 @@ void Isosurface::compressTriangles() {
   mEdgeTriangles.clear();
 }
 
+/*
+Slab-parallel extraction:
+
+The cells are split along z into slabs, ordered from the highest z down like
+the single threaded pass. Each slab is extracted on a worker thread with its
+own edge-to-vertex maps for the two field planes touched by the current row
+of cells, so vertices get the same order as in the single threaded pass.
+
+A vertex on the plane between two slabs belongs to the upper slab, where the
+single threaded pass meets it first. The lower slab computes its position
+again, which gives the same value, and keeps it as an external vertex. Face
+normals are summed per slab, and the sums for external vertices are added to
+the upper slab's vertices when stitching, in triangle order. Vertices,
+normals and indices are therefore the same as with one thread.
+*/
+
+struct Isosurface::Slab {
+  int zBegin, zEnd;  // range of cells
+  bool ownsTop;      // whether vertices on the plane zEnd belong to this slab
+  std::vector<Mesh::Vertex> vertices;
+  std::vector<Mesh::Normal> normals;
+  // Vertex indices, or kExternal - i for external vertex i
+  std::vector<int> indices;
+  // Vertices on the plane zEnd that belong to the slab above
+  std::vector<int> externalEdges;
+  std::vector<Mesh::Vertex> externalVertices;
+  std::vector<std::pair<int, Mesh::Normal>> externalNormals;
+  std::vector<unsigned> externalIndices;
+  // Edge IDs and vertices on the plane zBegin, sorted
+  std::vector<std::pair<int, int>> bottomEdges;
+  // Edge-to-vertex maps of the planes z and z + 1
+  std::vector<int>* planes[2];
+  int z;
+  size_t vertexOffset, indexOffset;
+
+  // Enumerators, as std::fill takes its value by reference and static const
+  // members would need a definition
+  enum { kEmpty = -1, kExternal = -2 };
+};
+
+namespace {
+// Runs task(i, worker) for i in [0, count) on up to threads threads, where
+// worker identifies the thread
+void runTasks(int count, int threads,
+              const std::function<void(int, int)>& task) {
+  std::atomic<int> next{0};
+  auto work = [&](int worker) {
+    for (int i = next++; i < count; i = next++) task(i, worker);
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < std::min(threads, count); ++i)
+    workers.emplace_back(work, i);
+  work(0);
+  for (auto& worker : workers) worker.join();
+}
+}  // namespace
+
+int Isosurface::slabThreads() const {
+  // Vertex actions expect to be called in order from one thread
+  if (mVertexAction != &noVertexAction) return 1;
+  // Small fields are faster without starting threads
+  int cells = (mNF[0] - 1) * (mNF[1] - 1) * (mNF[2] - 1);
+  if (cells < 32 * 32 * 32) return 1;
+  int n = mThreads > 0 ? mThreads : int(std::thread::hardware_concurrency());
+  return std::max(1, std::min(n, mNF[2] - 1));
+}
+
+void Isosurface::generateSlabs(const SlabExtractor& extract) {
+  int threads = slabThreads();
+  int cellsZ = mNF[2] - 1;
+  // More slabs than threads balances surfaces that are denser at some z
+  int numSlabs = std::min(cellsZ, 4 * threads);
+  std::vector<Slab> slabs(numSlabs);
+  for (int i = 0; i < numSlabs; ++i) {
+    slabs[i].zEnd = cellsZ - int(int64_t(i) * cellsZ / numSlabs);
+    slabs[i].zBegin = cellsZ - int(int64_t(i + 1) * cellsZ / numSlabs);
+    slabs[i].ownsTop = i == 0;
+  }
+
+  size_t planeSize = size_t(3) * mNF[0] * mNF[1];
+  // Edge-to-vertex maps are shared by the slabs extracted on one thread
+  std::vector<std::vector<int>> planes(2 * std::min(threads, numSlabs));
+  runTasks(numSlabs, threads, [&](int i, int worker) {
+    Slab& slab = slabs[i];
+    slab.planes[0] = &planes[2 * worker];
+    slab.planes[1] = &planes[2 * worker + 1];
+    slab.planes[0]->resize(planeSize);
+    slab.planes[1]->resize(planeSize);
+    slab.z = -1;
+    extract(slab, slab.zBegin, slab.zEnd);
+    std::sort(slab.bottomEdges.begin(), slab.bottomEdges.end());
+  });
+
+  // Stitch: number the vertices, resolve external vertices and add their
+  // normal sums to the slab above
+  size_t numVertices = 0, numIndices = 0;
+  for (int i = 0; i < numSlabs; ++i) {
+    Slab& slab = slabs[i];
+    slab.vertexOffset = numVertices;
+    slab.indexOffset = numIndices;
+    numVertices += slab.vertices.size();
+    numIndices += slab.indices.size();
+    if (i == 0) continue;
+    Slab& above = slabs[i - 1];
+    std::vector<int> local(slab.externalEdges.size());
+    for (size_t e = 0; e < slab.externalEdges.size(); ++e) {
+      auto it = std::lower_bound(above.bottomEdges.begin(),
+                                 above.bottomEdges.end(),
+                                 std::make_pair(slab.externalEdges[e], 0));
+      local[e] = it->second;
+      slab.externalIndices.push_back(unsigned(above.vertexOffset + it->second));
+    }
+    for (auto& contribution : slab.externalNormals) {
+      above.normals[local[contribution.first]] += contribution.second;
+    }
+  }
+
+  begin();
+  bool computeNormals = mComputeNormals && numVertices >= 3;
+  vertices().resize(numVertices);
+  if (computeNormals) Mesh::normals().resize(numVertices);
+  indices().resize(numIndices);
+  runTasks(numSlabs, threads, [&](int i, int) {
+    Slab& slab = slabs[i];
+    std::copy(slab.vertices.begin(), slab.vertices.end(),
+              vertices().begin() + slab.vertexOffset);
+    if (computeNormals) {
+      Mesh::Normal* normal = Mesh::normals().data() + slab.vertexOffset;
+      for (auto& n : slab.normals) {
+        *normal = n;
+        if (mNormalize) normal->normalize();
+        ++normal;
+      }
+    }
+    Mesh::Index* index = indices().data() + slab.indexOffset;
+    for (int v : slab.indices) {
+      *index++ = v >= 0 ? Mesh::Index(slab.vertexOffset + v)
+                        : slab.externalIndices[Slab::kExternal - v];
+    }
+  });
+  primitive(al::Mesh::TRIANGLES);
+  mValidSurface = true;
+}
+
+void Isosurface::addSlabCell(Slab& slab, int ix, int iy, int iz,
+                             const float* vals) const {
+  if (iz != slab.z) {
+    // Moving down one plane, the previous plane z is now z + 1
+    if (iz + 1 == slab.z) {
+      std::swap(slab.planes[0], slab.planes[1]);
+      std::fill(slab.planes[0]->begin(), slab.planes[0]->end(), Slab::kEmpty);
+    } else {
+      std::fill(slab.planes[0]->begin(), slab.planes[0]->end(), Slab::kEmpty);
+      std::fill(slab.planes[1]->begin(), slab.planes[1]->end(), Slab::kEmpty);
+    }
+    slab.z = iz;
+  }
+
+  int idx = cellCase(vals, level());
+  const int edgeCode = sEdgeTable[idx];
+  if (!edgeCode) return;
+
+  int cID = cellID(ix, iy, iz);
+  int edgeVertices[12];
+  for (int e = 0; e < 12; ++e) {
+    if (edgeCode & (1 << e))
+      edgeVertices[e] = addSlabVertex(slab, ix, iy, iz, cID, e, vals);
+  }
+
+  auto position = [&](int v) -> const Mesh::Vertex& {
+    return v >= 0 ? slab.vertices[v]
+                  : slab.externalVertices[Slab::kExternal - v];
+  };
+  auto addNormal = [&](int v, const Mesh::Normal& n) {
+    if (v >= 0)
+      slab.normals[v] += n;
+    else
+      slab.externalNormals.emplace_back(Slab::kExternal - v, n);
+  };
+
+  for (int i = 1; i <= sTriTable[idx][0]; i += 3) {
+    int v1 = edgeVertices[size_t(sTriTable[idx][i + 2])];
+    int v2 = edgeVertices[size_t(sTriTable[idx][i + 1])];
+    int v3 = edgeVertices[size_t(sTriTable[idx][i])];
+    slab.indices.push_back(v1);
+    slab.indices.push_back(v2);
+    slab.indices.push_back(v3);
+
+    if (mComputeNormals) {
+      // As in Mesh::generateNormals
+      const Mesh::Vertex& p1 = position(v1);
+      Mesh::Normal vn = cross(position(v2) - p1, position(v3) - p1);
+      addNormal(v1, vn);
+      addNormal(v2, vn);
+      addNormal(v3, vn);
+    }
+  }
+}
+
+int Isosurface::addSlabVertex(Slab& slab, int ix, int iy, int iz, int cellID,
+                              int edgeNo, const float* vals) const {
+  int eIdx = edgeID(cellID, edgeNo);
+  int planeSize = 3 * mNF[0] * mNF[1];
+  int plane = eIdx / planeSize;
+  int& v = (*slab.planes[plane - iz])[eIdx - plane * planeSize];
+  if (v != Slab::kEmpty) return v;
+
+  EdgeVertex ev = calcIntersection(ix, iy, iz, edgeNo, vals);
+  if (plane == slab.zEnd && !slab.ownsTop) {
+    v = Slab::kExternal - int(slab.externalEdges.size());
+    slab.externalEdges.push_back(eIdx);
+    slab.externalVertices.emplace_back(ev.x, ev.y, ev.z);
+  } else {
+    v = int(slab.vertices.size());
+    slab.vertices.emplace_back(ev.x, ev.y, ev.z);
+    if (mComputeNormals) slab.normals.emplace_back(0, 0, 0);
+    // x and y edges on the bottom plane are shared with the slab below
+    if (plane == slab.zBegin && eIdx % 3 != 2)
+      slab.bottomEdges.emplace_back(eIdx, v);
+  }
+  return v;
+}
+
+/*
+Bricks:
+
+The cells are grouped in cubic bricks. A brick whose field values are all
+below or all at or above the isolevel contains no surface and is skipped.
+
+update() extracts each brick on its own, from a copy of the brick's field
+points with a margin of one point for the gradient. Every brick has a range
+of the vertex and index buffers with some room to grow. A brick that no
+longer fits is moved to the end of the buffers and its old indices become
+degenerate triangles. The buffers are compacted when half of the index
+buffer is unused.
+*/
+
+struct Isosurface::BrickMesh {
+  float min, max;
+  std::vector<Mesh::Vertex> vertices;
+  std::vector<Mesh::Normal> normals;
+  std::vector<unsigned> indices;
+};
+
+namespace {
+// Lower field point of each cell edge as an offset from the cell, and the
+// edge's direction, as in Isosurface::fieldDims()
+const int sEdgeLower[12][4] = {{0, 0, 0, 1}, {0, 1, 0, 0}, {1, 0, 0, 1},
+                               {0, 0, 0, 0}, {0, 0, 1, 1}, {0, 1, 1, 0},
+                               {1, 0, 1, 1}, {0, 0, 1, 0}, {0, 0, 0, 2},
+                               {0, 1, 0, 2}, {1, 1, 0, 2}, {1, 0, 0, 2}};
+}  // namespace
+
+Isosurface& Isosurface::brickSize(int n) {
+  mBrickSize = std::max(1, n);
+  return *this;
+}
+
+void Isosurface::resizeBricks() {
+  for (int i = 0; i < 3; ++i)
+    mNB[i] = mNF[i] > 1 ? (mNF[i] - 2) / mBrickSize + 1 : 0;
+  mBricks.resize(size_t(mNB[0]) * mNB[1] * mNB[2]);
+}
+
+void Isosurface::runParallel(int count,
+                             const std::function<void(int)>& task) const {
+  int n = mThreads > 0 ? mThreads : int(std::thread::hardware_concurrency());
+  runTasks(count, std::max(1, n), [&](int i, int) { task(i); });
+}
+
+void Isosurface::markDirty(int x0, int y0, int z0, int x1, int y1, int z1) {
+  if (!mUpdated) return;
+  // Cells touching the points, and the cells whose vertex normals use the
+  // points for gradients
+  int lo[3] = {x0, y0, z0}, hi[3] = {x1, y1, z1};
+  int b0[3], b1[3];
+  for (int i = 0; i < 3; ++i) {
+    int c0 = std::max(lo[i] - 2, 0);
+    int c1 = std::min(hi[i], mNF[i] - 2);
+    if (c0 > c1) return;
+    b0[i] = c0 / mBrickSize;
+    b1[i] = c1 / mBrickSize;
+  }
+  for (int bz = b0[2]; bz <= b1[2]; ++bz)
+    for (int by = b0[1]; by <= b1[1]; ++by)
+      for (int bx = b0[0]; bx <= b1[0]; ++bx)
+        mBricks[bx + mNB[0] * (by + mNB[1] * bz)].dirty = true;
+}
+
+void Isosurface::markDirty() {
+  for (auto& brick : mBricks) brick.dirty = true;
+}
+
+void Isosurface::updateBricks(const BrickLoader& load) {
+  bool rebuild = !mUpdated || mUpdateLevel != mIsolevel ||
+                 mUpdateBrickSize != mBrickSize ||
+                 mUpdateNormals != mComputeNormals;
+  for (int i = 0; i < 3; ++i)
+    rebuild = rebuild || mUpdateNF[i] != mNF[i] || mUpdateL[i] != mL[i];
+  if (rebuild) {
+    begin();
+    resizeBricks();
+    Brick empty{};
+    empty.dirty = true;
+    mBricks.assign(mBricks.size(), empty);
+    mUnusedIndices = 0;
+    mUpdated = true;
+    mUpdateLevel = mIsolevel;
+    mUpdateBrickSize = mBrickSize;
+    mUpdateNormals = mComputeNormals;
+    for (int i = 0; i < 3; ++i) {
+      mUpdateNF[i] = mNF[i];
+      mUpdateL[i] = mL[i];
+    }
+  }
+
+  // From the highest z down, like generate()
+  std::vector<int> dirty;
+  for (int bz = mNB[2] - 1; bz >= 0; --bz)
+    for (int by = 0; by < mNB[1]; ++by)
+      for (int bx = 0; bx < mNB[0]; ++bx) {
+        int b = bx + mNB[0] * (by + mNB[1] * bz);
+        if (mBricks[b].dirty) dirty.push_back(b);
+      }
+
+  std::vector<BrickMesh> meshes(dirty.size());
+  size_t n = mBrickSize + 3;
+  runParallel(int(dirty.size()), [&](int i) {
+    std::vector<float> values(n * n * n);
+    load(dirty[i], values.data());
+    extractBrick(dirty[i], values.data(), meshes[i]);
+  });
+
+  for (size_t i = 0; i < dirty.size(); ++i) {
+    Brick& brick = mBricks[dirty[i]];
+    brick.min = meshes[i].min;
+    brick.max = meshes[i].max;
+    brick.dirty = false;
+    storeBrick(brick, meshes[i]);
+  }
+
+  if (mUnusedIndices > indices().size() / 2) {
+    // Compact the buffers, keeping the bricks' room to grow
+    Vertices vertices;
+    Normals normals;
+    Indices indices;
+    for (auto& brick : mBricks) {
+      if (brick.vertexCapacity == 0) continue;
+      unsigned vertexStart = unsigned(vertices.size());
+      auto v = this->vertices().begin() + brick.vertexStart;
+      vertices.insert(vertices.end(), v, v + brick.vertexCapacity);
+      if (mComputeNormals) {
+        auto n = Mesh::normals().begin() + brick.vertexStart;
+        normals.insert(normals.end(), n, n + brick.vertexCapacity);
+      }
+      unsigned indexStart = unsigned(indices.size());
+      for (unsigned j = 0; j < brick.indexCapacity; ++j)
+        indices.push_back(this->indices()[brick.indexStart + j] -
+                          brick.vertexStart + vertexStart);
+      brick.vertexStart = vertexStart;
+      brick.indexStart = indexStart;
+    }
+    this->vertices().swap(vertices);
+    Mesh::normals().swap(normals);
+    this->indices().swap(indices);
+    mUnusedIndices = 0;
+  }
+
+  primitive(al::Mesh::TRIANGLES);
+  mValidSurface = true;
+}
+
+void Isosurface::extractBrick(int brick, const float* values,
+                              BrickMesh& mesh) const {
+  const int n = mBrickSize + 3;  // points per row of values
+  const int m = mBrickSize + 1;  // points per row of the brick's cells
+  int bx = brick % mNB[0];
+  int by = (brick / mNB[0]) % mNB[1];
+  int bz = brick / (mNB[0] * mNB[1]);
+  int x0 = bx * mBrickSize, y0 = by * mBrickSize, z0 = bz * mBrickSize;
+  int nx = std::min(mBrickSize, mNF[0] - 1 - x0);
+  int ny = std::min(mBrickSize, mNF[1] - 1 - y0);
+  int nz = std::min(mBrickSize, mNF[2] - 1 - z0);
+
+  // Value at a point relative to the brick's first point
+  auto value = [&](int i, int j, int k) {
+    return values[((k + 1) * n + (j + 1)) * n + (i + 1)];
+  };
+
+  mesh.min = std::numeric_limits<float>::infinity();
+  mesh.max = -mesh.min;
+  for (int k = 0; k <= nz; ++k)
+    for (int j = 0; j <= ny; ++j)
+      for (int i = 0; i <= nx; ++i) {
+        float v = value(i, j, k);
+        if (v < mesh.min) mesh.min = v;
+        // NaN is never below the isolevel, like a large value
+        if (v > mesh.max)
+          mesh.max = v;
+        else if (v != v)
+          mesh.max = std::numeric_limits<float>::infinity();
+      }
+  if (mesh.max < level() || mesh.min >= level()) return;
+
+  // Field gradient by central differences, pointing out of the surface
+  auto gradient = [&](int i, int j, int k) {
+    return Mesh::Normal(
+        float((value(i - 1, j, k) - value(i + 1, j, k)) / (2 * mL[0])),
+        float((value(i, j - 1, k) - value(i, j + 1, k)) / (2 * mL[1])),
+        float((value(i, j, k - 1) - value(i, j, k + 1)) / (2 * mL[2])));
+  };
+
+  std::vector<int> edges(3 * m * m * m, -1);
+  for (int k = nz - 1; k >= 0; --k) {
+    for (int j = 0; j < ny; ++j) {
+      for (int i = 0; i < nx; ++i) {
+        const float v8[8] = {value(i, j, k),         value(i + 1, j, k),
+                             value(i, j + 1, k),     value(i + 1, j + 1, k),
+                             value(i, j, k + 1),     value(i + 1, j, k + 1),
+                             value(i, j + 1, k + 1), value(i + 1, j + 1, k + 1)};
+        int idx = cellCase(v8, level());
+        const int edgeCode = sEdgeTable[idx];
+        if (!edgeCode) continue;
+
+        int edgeVertices[12];
+        for (int e = 0; e < 12; ++e) {
+          if (!(edgeCode & (1 << e))) continue;
+          const int* l = sEdgeLower[e];
+          int& v = edges[3 * ((i + l[0]) + m * ((j + l[1]) + m * (k + l[2]))) +
+                         l[3]];
+          if (v < 0) {
+            EdgeVertex ev =
+                calcIntersection(x0 + i, y0 + j, z0 + k, e, v8);
+            v = int(mesh.vertices.size());
+            mesh.vertices.emplace_back(ev.x, ev.y, ev.z);
+            if (mComputeNormals) {
+              Mesh::Normal g0 = gradient(i + ev.corners[0][0],
+                                         j + ev.corners[0][1],
+                                         k + ev.corners[0][2]);
+              Mesh::Normal g1 = gradient(i + ev.corners[1][0],
+                                         j + ev.corners[1][1],
+                                         k + ev.corners[1][2]);
+              Mesh::Normal normal = g0 + (g1 - g0) * ev.mu;
+              if (normal.magSqr() > 0) normal.normalize();
+              mesh.normals.push_back(normal);
+            }
+          }
+          edgeVertices[e] = v;
+        }
+
+        for (int t = 1; t <= sTriTable[idx][0]; t += 3) {
+          mesh.indices.push_back(edgeVertices[size_t(sTriTable[idx][t + 2])]);
+          mesh.indices.push_back(edgeVertices[size_t(sTriTable[idx][t + 1])]);
+          mesh.indices.push_back(edgeVertices[size_t(sTriTable[idx][t])]);
+        }
+      }
+    }
+  }
+}
+
+void Isosurface::storeBrick(Brick& brick, const BrickMesh& mesh) {
+  size_t numVertices = mesh.vertices.size();
+  size_t numIndices = mesh.indices.size();
+  if (numVertices > brick.vertexCapacity || numIndices > brick.indexCapacity) {
+    // Move to the end of the buffers with room to grow by a quarter
+    std::fill(indices().begin() + brick.indexStart,
+              indices().begin() + brick.indexStart + brick.indexCapacity,
+              brick.vertexStart);
+    mUnusedIndices += brick.indexCapacity;
+    brick.vertexStart = unsigned(vertices().size());
+    brick.vertexCapacity = unsigned(numVertices + numVertices / 4);
+    brick.indexStart = unsigned(indices().size());
+    brick.indexCapacity = unsigned(numIndices + 3 * (numIndices / 12));
+    vertices().resize(brick.vertexStart + brick.vertexCapacity);
+    if (mComputeNormals) Mesh::normals().resize(vertices().size());
+    indices().resize(brick.indexStart + brick.indexCapacity);
+  }
+
+  std::copy(mesh.vertices.begin(), mesh.vertices.end(),
+            vertices().begin() + brick.vertexStart);
+  if (mComputeNormals)
+    std::copy(mesh.normals.begin(), mesh.normals.end(),
+              Mesh::normals().begin() + brick.vertexStart);
+  Index* index = indices().data() + brick.indexStart;
+  for (unsigned i : mesh.indices) *index++ = brick.vertexStart + i;
+  // Degenerate triangles fill the rest
+  std::fill(index, indices().data() + brick.indexStart + brick.indexCapacity,
+            brick.vertexStart);
+}
+
 Isosurface& Isosurface::cellLengths(double dx, double dy, double dz) {
   mL[0] = dx;
   mL[1] = dy;
@@ -6,7 +6,13 @@
 #include <fstream>
 // #include <cstdint>
 #include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <cstring>
+#include <functional>
+#include <limits>
+#include <thread>
 #include "al/graphics/al_Mesh.hpp"
 #include "al/system/al_Printing.hpp"
 
@@ -24,7 +30,8 @@ Mesh::Mesh(const Mesh& cpy)
       mTexCoord2s(cpy.mTexCoord2s),
       mTexCoord3s(cpy.mTexCoord3s),
       mIndices(cpy.mIndices),
-      mPrimitive(cpy.mPrimitive) {}
+      mPrimitive(cpy.mPrimitive),
+      mNormalAdjacency(cpy.mNormalAdjacency) {}
 
 void Mesh::copy(Mesh const& m) {
   mVertices = m.mVertices;
@@ -35,6 +42,7 @@ void Mesh::copy(Mesh const& m) {
   mTexCoord3s = m.mTexCoord3s;
   mIndices = m.mIndices;
   mPrimitive = m.mPrimitive;
+  mNormalAdjacency = m.mNormalAdjacency;
 }
 
 Mesh& Mesh::reset() {
@@ -169,191 +177,719 @@ void Mesh::invertNormals() {
 }
 
 void Mesh::compress() {
-  int Ni = (int)indices().size();
-  int Nv = (int)vertices().size();
-  if (Ni) {
-    AL_WARN_ONCE("cannot compress Mesh with indices");
-    return;
-  }
-  if (Nv == 0) {
+  if (vertices().empty()) {
     AL_WARN_ONCE("cannot compress Mesh with no vertices");
     return;
   }
+  weld(0, std::numeric_limits<float>::infinity());
+}
 
-  int Nc = (int)colors().size();
-  int Nn = (int)normals().size();
-  int Nt1 = (int)texCoord1s().size();
-  int Nt2 = (int)texCoord2s().size();
-  int Nt3 = (int)texCoord3s().size();
+namespace {
+// Runs task(i) for i in [0, count) on up to threads threads
+void runTasks(int count, int threads, const std::function<void(int)>& task) {
+  std::atomic<int> next{0};
+  auto work = [&]() {
+    for (int i = next++; i < count; i = next++) task(i);
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < std::min(threads, count); ++i) workers.emplace_back(work);
+  work();
+  for (auto& worker : workers) worker.join();
+}
 
-  // map tree to uniquely ID vertices with same values:
-  typedef std::map<float, int> Zmap;
-  typedef std::map<float, Zmap> Ymap;
-  typedef std::map<float, Ymap> Xmap;
-  Xmap xmap;
+// Runs f(begin, end) over [0, n) split in chunks
+void forChunks(size_t n, int threads,
+               const std::function<void(size_t, size_t)>& f) {
+  int chunks = int(std::min<size_t>(4 * size_t(threads), n / 4096 + 1));
+  runTasks(chunks, threads,
+           [&](int c) { f(n * c / chunks, n * (c + 1) / chunks); });
+}
 
-  // copy current values:
-  Mesh old(*this);
+struct WeldKey {
+  int64_t k[3];
+  bool operator==(const WeldKey& o) const {
+    return k[0] == o.k[0] && k[1] == o.k[1] && k[2] == o.k[2];
+  }
+};
 
-  // walk backward through the vertex list
-  // create a ID for each one
-  for (int i = (int)vertices().size() - 1; i >= 0; i--) {
-    Vertex& v = vertices()[i];
-    xmap[v.x][v.y][v.z] = i;
+uint64_t weldHash(const WeldKey& key) {
+  uint64_t h = 0;
+  for (int i = 0; i < 3; ++i) {
+    h = (h ^ uint64_t(key.k[i])) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 29;
   }
+  return h;
+}
 
-  // map of old vertex index to new vertex index:
-  typedef std::map<int, int> Imap;
-  Imap imap;
+// Open addressing table from a cell to the last vertex kept in it
+class WeldTable {
+public:
+  explicit WeldTable(size_t n) {
+    size_t size = 16;
+    while (size < 2 * n) size *= 2;
+    mSlots.assign(size, -1);
+    mMask = size - 1;
+  }
 
-  // reset current mesh:
-  reset();
+  // Slot of the cell, holding -1 if the cell is empty
+  int& slot(const WeldKey& key, uint64_t hash,
+            const std::vector<WeldKey>& keys) {
+    size_t i = hash & mMask;
+    while (mSlots[i] >= 0 && !(keys[mSlots[i]] == key)) i = (i + 1) & mMask;
+    return mSlots[i];
+  }
 
-  // walk forward, inserting if
-  for (size_t i = 0; i < old.vertices().size(); i++) {
-    Vertex& v = old.vertices()[i];
-    int idx = xmap[v.x][v.y][v.z];
-    Imap::iterator it = imap.find(idx);
-    if (it != imap.end()) {
-      // use existing
-      index(it->second);
-    } else {
-      // create new
-      int newidx = (int)vertices().size();
-      vertex(v);
-      if (Nc) color(old.colors()[i]);
-      if (Nn) normal(old.normals()[i]);
-      if (Nt1) texCoord(old.texCoord1s()[i]);
-      if (Nt2) texCoord(old.texCoord2s()[i]);
-      if (Nt3) texCoord(old.texCoord3s()[i]);
-      // store new index:
-      imap[idx] = newidx;
-      // use new index:
-      index(newidx);
+private:
+  std::vector<int> mSlots;
+  size_t mMask;
+};
+
+template <class T>
+void compact(std::vector<T>& buffer, const std::vector<int>& kept,
+             int threads) {
+  std::vector<T> out(kept.size());
+  forChunks(kept.size(), threads, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) out[i] = buffer[kept[i]];
+  });
+  buffer.swap(out);
+}
+}  // namespace
+
+size_t Mesh::weld(float epsilon, float attributeEpsilon, int threads) {
+  const int Nv = int(vertices().size());
+  if (Nv == 0) return 0;
+  if (threads <= 0)
+    threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+  bool hasNormals = normals().size() == size_t(Nv);
+  bool hasColors = colors().size() == size_t(Nv);
+  bool hasTexCoord1s = texCoord1s().size() == size_t(Nv);
+  bool hasTexCoord2s = texCoord2s().size() == size_t(Nv);
+  bool hasTexCoord3s = texCoord3s().size() == size_t(Nv);
+
+  auto near = [&](float a, float b) {
+    return a == b || std::abs(a - b) <= attributeEpsilon;
+  };
+  auto near3 = [&](const Vec3f& a, const Vec3f& b) {
+    return near(a[0], b[0]) && near(a[1], b[1]) && near(a[2], b[2]);
+  };
+  float epsilonSqr = epsilon * epsilon;
+  // Whether vertex i can be merged into vertex j
+  auto matches = [&](int i, int j) {
+    const Vertex& a = vertices()[i];
+    const Vertex& b = vertices()[j];
+    if (epsilon > 0 ? (a - b).magSqr() > epsilonSqr : !(a == b)) return false;
+    if (hasNormals && !near3(normals()[i], normals()[j])) return false;
+    if (hasColors) {
+      const Color& c = colors()[i];
+      const Color& d = colors()[j];
+      if (!near(c.r, d.r) || !near(c.g, d.g) || !near(c.b, d.b) ||
+          !near(c.a, d.a))
+        return false;
+    }
+    if (hasTexCoord1s && !near(texCoord1s()[i], texCoord1s()[j])) return false;
+    if (hasTexCoord2s && !(near(texCoord2s()[i][0], texCoord2s()[j][0]) &&
+                           near(texCoord2s()[i][1], texCoord2s()[j][1])))
+      return false;
+    if (hasTexCoord3s && !near3(texCoord3s()[i], texCoord3s()[j]))
+      return false;
+    return true;
+  };
+
+  // Cells are twice epsilon wide, so matches are in the vertex's cell or
+  // in the neighbor on the nearer side along each axis. With an epsilon of
+  // 0, cells are single positions.
+  std::vector<WeldKey> keys(Nv);
+  std::vector<uint64_t> hashes(Nv);
+  std::vector<uint8_t> sides(epsilon > 0 ? Nv : 0);
+  forChunks(Nv, threads, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+      for (int j = 0; j < 3; ++j) {
+        float v = vertices()[i][j];
+        if (epsilon > 0) {
+          double x = double(v) / (2.0 * epsilon);
+          double c = std::floor(x);
+          // NaN and huge positions share a cell
+          keys[i].k[j] = c > -1e18 && c < 1e18 ? int64_t(c) : 0;
+          if (x - c >= 0.5) sides[i] |= 1 << j;
+        } else {
+          uint32_t bits;
+          v = v == 0 ? 0.0f : v;  // -0 equals 0
+          std::memcpy(&bits, &v, sizeof(bits));
+          keys[i].k[j] = bits;
+        }
+      }
+      hashes[i] = weldHash(keys[i]);
+    }
+  });
+
+  // Vertex each vertex is merged into, itself if kept. Kept vertices in a
+  // cell are linked through previous
+  std::vector<int> target(Nv);
+  std::vector<int> previous(Nv);
+
+  if (epsilon > 0) {
+    // Matches may be in neighboring cells, so vertices are visited in order
+    WeldTable table(Nv);
+    for (int i = 0; i < Nv; ++i) {
+      int best = i;
+      for (int n = 0; n < 8; ++n) {
+        WeldKey key = keys[i];
+        for (int a = 0; a < 3; ++a) {
+          if (n & (1 << a)) key.k[a] += sides[i] & (1 << a) ? 1 : -1;
+        }
+        int j = n == 0 ? table.slot(key, hashes[i], keys)
+                       : table.slot(key, weldHash(key), keys);
+        for (; j >= 0; j = previous[j]) {
+          if (j < best && matches(i, j)) best = j;
+        }
+      }
+      target[i] = best;
+      if (best == i) {
+        int& head = table.slot(keys[i], hashes[i], keys);
+        previous[i] = head;
+        head = i;
+      }
     }
+  } else {
+    // Equal positions have equal hashes, so vertices are split by hash and
+    // each part is matched on its own, keeping the order within each part
+    int parts = threads > 1 ? 4 * threads : 1;
+    int chunks = threads > 1 ? int(std::min<size_t>(4 * size_t(threads),
+                                                    size_t(Nv) / 4096 + 1))
+                             : 1;
+    auto partOf = [&](int i) { return int((hashes[i] >> 32) % parts); };
+    std::vector<size_t> offsets(size_t(chunks) * parts + 1, 0);
+    runTasks(chunks, threads, [&](int c) {
+      for (int i = Nv * int64_t(c) / chunks; i < Nv * int64_t(c + 1) / chunks;
+           ++i)
+        offsets[size_t(partOf(i)) * chunks + c + 1]++;
+    });
+    for (size_t i = 1; i < offsets.size(); ++i) offsets[i] += offsets[i - 1];
+    std::vector<int> order(Nv);
+    runTasks(chunks, threads, [&](int c) {
+      std::vector<size_t> next(parts);
+      for (int p = 0; p < parts; ++p) next[p] = offsets[size_t(p) * chunks + c];
+      for (int i = Nv * int64_t(c) / chunks; i < Nv * int64_t(c + 1) / chunks;
+           ++i)
+        order[next[partOf(i)]++] = i;
+    });
+    runTasks(parts, threads, [&](int p) {
+      size_t begin = offsets[size_t(p) * chunks];
+      size_t end = offsets[size_t(p + 1) * chunks];
+      WeldTable table(end - begin);
+      for (size_t o = begin; o < end; ++o) {
+        int i = order[o];
+        int& head = table.slot(keys[i], hashes[i], keys);
+        int best = i;
+        for (int j = head; j >= 0; j = previous[j]) {
+          if (j < best && matches(i, j)) best = j;
+        }
+        target[i] = best;
+        if (best == i) {
+          previous[i] = head;
+          head = i;
+        }
+      }
+    });
   }
+
+  // Number the kept vertices in order
+  std::vector<int> kept;
+  std::vector<int> remap(Nv);
+  for (int i = 0; i < Nv; ++i) {
+    if (target[i] == i) {
+      remap[i] = int(kept.size());
+      kept.push_back(i);
+    }
+  }
+  size_t removed = Nv - kept.size();
+
+  if (indices().empty()) {
+    indices().resize(Nv);
+    forChunks(Nv, threads, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) indices()[i] = remap[target[i]];
+    });
+  } else {
+    forChunks(indices().size(), threads, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+        Index& index = indices()[i];
+        if (index < Index(Nv)) index = remap[target[index]];
+      }
+    });
+  }
+
+  if (removed) {
+    compact(vertices(), kept, threads);
+    if (hasNormals) compact(normals(), kept, threads);
+    if (hasColors) compact(colors(), kept, threads);
+    if (hasTexCoord1s) compact(texCoord1s(), kept, threads);
+    if (hasTexCoord2s) compact(texCoord2s(), kept, threads);
+    if (hasTexCoord3s) compact(texCoord3s(), kept, threads);
+  }
+  return removed;
 }
 
-void Mesh::generateNormals(bool normalize, bool equalWeightPerFace) {
-  struct F {
-    static Vertex calcNormal(const Vertex& v1, const Vertex& v2,
-                             const Vertex& v3, bool MWE) {
-      // MWAAT (mean weighted by areas of adjacent triangles)
-      Vertex vn = cross(v2 - v1, v3 - v1);
+namespace {
+// FIFO vertex cache as found in GPUs. A vertex is a hit if it was loaded
+// at most size misses ago.
+struct FifoCache {
+  FifoCache(size_t vertices, int size)
+      : loaded(vertices, 0), size(unsigned(size)), time(unsigned(size) + 1) {}
+
+  bool miss(Mesh::Index v) {
+    if (time - loaded[v] <= size) return false;
+    loaded[v] = time++;
+    return true;
+  }
+
+  void flush() { time += size + 1; }
+
+  std::vector<unsigned> loaded;
+  unsigned size;
+  unsigned time;
+};
+
+// Reorders buf to buf[remap[i]] = old buf[i]
+template <class T>
+void permute(std::vector<T>& buf, const std::vector<Mesh::Index>& remap) {
+  if (buf.size() != remap.size()) return;
+  std::vector<T> old(buf);
+  for (size_t i = 0; i < remap.size(); ++i) buf[remap[i]] = old[i];
+}
+}  // namespace
+
+float Mesh::cacheMissRatio(int cacheSize) const {
+  const size_t Nv = vertices().size();
+  const size_t Ni = indices().size();
+  const size_t N = Ni ? Ni : Nv;
+  size_t triangles = 0;
+  if (primitive() == TRIANGLES) {
+    triangles = N / 3;
+  } else if (primitive() == TRIANGLE_STRIP && N >= 3) {
+    triangles = N - 2;
+  }
+  if (triangles == 0) return 0;
+  // Without indices every vertex is transformed
+  if (!Ni) {
+    return float(primitive() == TRIANGLES ? triangles * 3 : Nv) / triangles;
+  }
+
+  FifoCache cache(Nv, std::max(cacheSize, 1));
+  size_t misses = 0;
+  const size_t count = primitive() == TRIANGLES ? triangles * 3 : Ni;
+  for (size_t i = 0; i < count; ++i) {
+    Index v = indices()[i];
+    if (v >= Nv || cache.miss(v)) ++misses;
+  }
+  return float(misses) / triangles;
+}
+
+void Mesh::optimize(int cacheSize, float overdrawThreshold) {
+  toTriangles();
+  if (primitive() != TRIANGLES || indices().size() < 3) return;
+
+  const size_t Nv = vertices().size();
+  Indices& I = indices();
+  const size_t Nf = I.size() / 3;
+  I.resize(Nf * 3);
+  for (Index v : I) {
+    if (v >= Nv) {
+      AL_WARN("Mesh::optimize: index %u out of range", v);
+      return;
+    }
+  }
+  cacheSize = std::max(4, std::min(cacheSize, 64));
+
+  // Forsyth's linear-speed vertex cache optimization: triangles are emitted
+  // greedily by the scores of their vertices, which favor vertices recently
+  // used and vertices with few remaining triangles.
+  std::vector<unsigned> offsets(Nv + 1, 0);
+  for (Index v : I) offsets[v + 1]++;
+  for (size_t v = 0; v < Nv; ++v) offsets[v + 1] += offsets[v];
+  std::vector<unsigned> tris(I.size());
+  std::vector<unsigned> live(Nv, 0);  // remaining triangles of each vertex
+  for (size_t t = 0; t < Nf; ++t) {
+    for (int k = 0; k < 3; ++k) {
+      Index v = I[t * 3 + k];
+      tris[offsets[v] + live[v]++] = unsigned(t);
+    }
+  }
 
-      // MWE (mean weighted equally)
-      if (MWE) vn.normalize();
+  std::vector<float> positionScore(cacheSize + 3, 0.f);
+  for (int p = 0; p < cacheSize; ++p) {
+    positionScore[p] =
+        p < 3 ? 0.75f : std::pow(1.f - float(p - 3) / (cacheSize - 3), 1.5f);
+  }
+  std::vector<int> cachePos(Nv, -1);
+  auto vertexScore = [&](Index v) {
+    if (live[v] == 0) return -1.f;
+    float score = cachePos[v] < 0 ? 0.f : positionScore[cachePos[v]];
+    return score + 2.f / std::sqrt(float(live[v]));
+  };
 
-      // MWA (mean weighted by angle)
-      // This doesn't work well with dynamic marching cubes- normals
-      // pop in and out for small triangles.
-      /*Vertex v12= v2-v1;
-      Vertex v13= v3-v1;
-      Vertex vn = cross(v12, v13).normalize();
-      vn *= angle(v12, v13) / M_PI;*/
+  std::vector<float> vscore(Nv), tscore(Nf, 0.f);
+  for (size_t v = 0; v < Nv; ++v) vscore[v] = vertexScore(Index(v));
+  for (size_t i = 0; i < I.size(); ++i) tscore[i / 3] += vscore[I[i]];
 
-      return vn;
+  auto rescore = [&](Index v) {
+    float score = vertexScore(v);
+    float delta = score - vscore[v];
+    vscore[v] = score;
+    for (unsigned j = offsets[v]; j < offsets[v] + live[v]; ++j) {
+      tscore[tris[j]] += delta;
     }
   };
 
+  Indices order;
+  order.reserve(I.size());
+  std::vector<size_t> hardStarts;  // where the greedy search ran dry
+  std::vector<char> emitted(Nf, 0);
+  std::vector<Index> cache, nextCache;
+  std::vector<size_t> stamp(Nv, 0);
+  size_t cursor = 0;
+  long best = -1;
+  for (size_t n = 0; n < Nf; ++n) {
+    if (best < 0) {
+      while (emitted[cursor]) ++cursor;
+      best = long(cursor);
+      hardStarts.push_back(n);
+    }
+    const size_t t = size_t(best);
+    emitted[t] = 1;
+    const Index* tv = &I[t * 3];
+
+    nextCache.clear();
+    for (int k = 0; k < 3; ++k) {
+      Index v = tv[k];
+      order.push_back(v);
+      // Remove the triangle from the live triangles of its vertices
+      unsigned* first = &tris[offsets[v]];
+      unsigned* last = first + live[v] - 1;
+      *std::find(first, last, unsigned(t)) = *last;
+      live[v]--;
+      if (stamp[v] != n + 1) {
+        stamp[v] = n + 1;
+        nextCache.push_back(v);
+      }
+    }
+    for (Index v : cache) {
+      if (stamp[v] != n + 1) {
+        stamp[v] = n + 1;
+        nextCache.push_back(v);
+      }
+    }
+    // Vertices beyond the cache keep their scores for a few more triangles
+    // so their triangles can still be found, as in Forsyth's reference code
+    for (size_t i = 0; i < nextCache.size(); ++i) {
+      Index v = nextCache[i];
+      cachePos[v] = i < size_t(cacheSize + 3) ? int(i) : -1;
+      rescore(v);
+    }
+    if (nextCache.size() > size_t(cacheSize + 3)) {
+      nextCache.resize(cacheSize + 3);
+    }
+    std::swap(cache, nextCache);
+
+    best = -1;
+    float bestScore = -1.f;
+    for (Index v : cache) {
+      for (unsigned j = offsets[v]; j < offsets[v] + live[v]; ++j) {
+        if (tscore[tris[j]] > bestScore) {
+          bestScore = tscore[tris[j]];
+          best = long(tris[j]);
+        }
+      }
+    }
+  }
+
+  // Overdraw: cut the order into clusters at the points where the cache
+  // search ran dry and wherever the cache miss ratio so far is within the
+  // threshold of its cluster's, then draw first the clusters that face away
+  // from the center, as they are likely to occlude the others (Sander,
+  // Nehab and Barczak, "Fast triangle reordering for vertex locality and
+  // reduced overdraw").
+  if (overdrawThreshold > 0 && Nf > 1) {
+    hardStarts.push_back(Nf);
+    FifoCache fifo(Nv, cacheSize);
+    auto triMisses = [&](size_t t) {
+      return int(fifo.miss(order[t * 3])) + int(fifo.miss(order[t * 3 + 1])) +
+             int(fifo.miss(order[t * 3 + 2]));
+    };
+    std::vector<size_t> clusters;
+    for (size_t h = 0; h + 1 < hardStarts.size(); ++h) {
+      const size_t begin = hardStarts[h], end = hardStarts[h + 1];
+      fifo.flush();
+      size_t misses = 0;
+      for (size_t t = begin; t < end; ++t) misses += triMisses(t);
+      const float limit = overdrawThreshold * misses / (end - begin);
+
+      clusters.push_back(begin);
+      fifo.flush();
+      size_t start = begin;
+      misses = 0;
+      for (size_t t = begin; t < end; ++t) {
+        misses += triMisses(t);
+        if (t + 1 < end && float(misses) / (t + 1 - start) <= limit) {
+          clusters.push_back(t + 1);
+          fifo.flush();
+          start = t + 1;
+          misses = 0;
+        }
+      }
+    }
+    clusters.push_back(Nf);
+
+    // Area weighted centroids and normals of the mesh and of each cluster
+    const size_t Nc = clusters.size() - 1;
+    std::vector<Vec3f> centroids(Nc), directions(Nc);
+    std::vector<float> areas(Nc, 0.f);
+    Vec3f center(0, 0, 0);
+    float area = 0;
+    for (size_t c = 0; c < Nc; ++c) {
+      for (size_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+        const Vertex& a = vertices()[order[t * 3]];
+        const Vertex& b = vertices()[order[t * 3 + 1]];
+        const Vertex& d = vertices()[order[t * 3 + 2]];
+        Vec3f n = cross(b - a, d - a);
+        float w = n.mag();
+        centroids[c] += (a + b + d) * (w / 3.f);
+        directions[c] += n;
+        areas[c] += w;
+      }
+      center += centroids[c];
+      area += areas[c];
+    }
+    if (area > 0) center /= area;
+    std::vector<float> keys(Nc);
+    std::vector<size_t> sorted(Nc);
+    for (size_t c = 0; c < Nc; ++c) {
+      if (areas[c] > 0) centroids[c] /= areas[c];
+      keys[c] = (centroids[c] - center).dot(directions[c].normalize());
+      sorted[c] = c;
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+    Indices clustered;
+    clustered.reserve(order.size());
+    for (size_t c : sorted) {
+      clustered.insert(clustered.end(), order.begin() + clusters[c] * 3,
+                       order.begin() + clusters[c + 1] * 3);
+    }
+    order.swap(clustered);
+  }
+
+  // Number vertices in order of first use so they are fetched sequentially.
+  // Unused vertices go last.
+  const Index unused = std::numeric_limits<Index>::max();
+  std::vector<Index> remap(Nv, unused);
+  Index next = 0;
+  for (Index& v : order) {
+    if (remap[v] == unused) remap[v] = next++;
+    v = remap[v];
+  }
+  for (Index& r : remap) {
+    if (r == unused) r = next++;
+  }
+  I.swap(order);
+  permute(vertices(), remap);
+  permute(normals(), remap);
+  permute(colors(), remap);
+  permute(texCoord1s(), remap);
+  permute(texCoord2s(), remap);
+  permute(texCoord3s(), remap);
+}
+
+// Built for the current indices. Writable access to them drops it.
+struct Mesh::NormalAdjacency {
+  Primitive primitive;
+  size_t vertices;
+  // Faces of vertex v in ascending order are faces[offsets[v], offsets[v+1])
+  std::vector<unsigned> offsets;
+  std::vector<unsigned> faces;
+};
+
+namespace {
+Mesh::Vertex faceNormal(const Mesh::Vertex& v1, const Mesh::Vertex& v2,
+                        const Mesh::Vertex& v3, bool MWE) {
+  // MWAAT (mean weighted by areas of adjacent triangles)
+  Mesh::Vertex vn = cross(v2 - v1, v3 - v1);
+
+  // MWE (mean weighted equally)
+  if (MWE) vn.normalize();
+
+  // MWA (mean weighted by angle)
+  // This doesn't work well with dynamic marching cubes- normals
+  // pop in and out for small triangles.
+  /*Vertex v12= v2-v1;
+  Vertex v13= v3-v1;
+  Vertex vn = cross(v12, v13).normalize();
+  vn *= angle(v12, v13) / M_PI;*/
+
+  return vn;
+}
+
+// Normalizes like Vec::normalize(). The vectors are split into blocks of
+// x, y and z arrays so the square roots and divisions vectorize.
+void normalizeNormals(Mesh::Normal* normals, size_t n) {
+  const size_t B = 64;
+  float x[B], y[B], z[B];
+  for (size_t b = 0; b < n; b += B) {
+    Mesh::Normal* p = normals + b;
+    const size_t m = std::min(B, n - b);
+    for (size_t i = 0; i < m; ++i) {
+      x[i] = p[i][0];
+      y[i] = p[i][1];
+      z[i] = p[i][2];
+    }
+    for (size_t i = 0; i < m; ++i) {
+      float mag = std::sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+      bool valid = mag > 1e-20f;
+      float s = 1.f / (valid ? mag : 1.f);
+      x[i] = valid ? x[i] * s : 1.f;
+      y[i] = valid ? y[i] * s : 0.f;
+      z[i] = valid ? z[i] * s : 0.f;
+    }
+    for (size_t i = 0; i < m; ++i) p[i].set(x[i], y[i], z[i]);
+  }
+}
+}  // namespace
+
+void Mesh::generateNormals(bool normalize, bool equalWeightPerFace,
+                           int threads) {
   size_t Nv = vertices().size();
 
   // need at least one triangle
   if (Nv < 3) return;
+  if (threads <= 0)
+    threads = std::max(1, int(std::thread::hardware_concurrency()));
 
   // make same number of normals as vertices
   normals().clear();
-  // normals().reserve(Nv);
-  // for (size_t i = 0; i < Nv; i += 1) {
-  //   normals().emplace_back();
-  // }
   normals().resize(Nv);
 
-  // compute vertex based normals
-  if (indices().size()) {
-    for (unsigned i = 0; i < Nv; ++i) normals()[i].set(0, 0, 0);
-
-    size_t Ni = indices().size();
+  const Vertex* V = vertices().data();
+  Normal* N = normals().data();
 
+  // compute vertex based normals. The indices are read through mIndices, as
+  // the non-const indices() would drop the adjacency table.
+  if (mIndices.size()) {
+    size_t Ni = mIndices.size();
+    const Index* I = mIndices.data();
+    size_t Nf = 0;
+    unsigned stride = 1;
     if (primitive() == TRIANGLES) {
-      Ni = Ni - (Ni % 3);  // must be multiple of 3
-
-      for (unsigned i = 0; i < Ni; i += 3) {
-        Index i1 = indices()[i];
-        Index i2 = indices()[i + 1];
-        Index i3 = indices()[i + 2];
-
-        Vertex vn = F::calcNormal(vertices()[i1], vertices()[i2],
-                                  vertices()[i3], equalWeightPerFace);
+      Nf = Ni / 3;  // must be multiple of 3
+      stride = 3;
+    } else if (primitive() == TRIANGLE_STRIP && Ni >= 3) {
+      Nf = Ni - 2;
+    }
 
-        normals()[i1] += vn;
-        normals()[i2] += vn;
-        normals()[i3] += vn;
+    // Flip every other strip normal due to change in winding direction
+    auto normalOf = [&](size_t f) {
+      unsigned odd = stride == 1 ? f & 1 : 0;
+      const Index* i = I + f * stride;
+      return faceNormal(V[i[0]], V[i[1 + odd]], V[i[2 - odd]],
+                        equalWeightPerFace);
+    };
+
+    if (threads == 1) {
+      for (size_t f = 0; f < Nf; ++f) {
+        Vertex vn = normalOf(f);
+        const Index* i = I + f * stride;
+        N[i[0]] += vn;
+        N[i[1]] += vn;
+        N[i[2]] += vn;
       }
-    } else if (primitive() == TRIANGLE_STRIP) {
-      for (unsigned i = 0; i < Ni - 2; ++i) {
-        // Flip every other normal due to change in winding direction
-        unsigned odd = i & 1;
-
-        Index i1 = indices()[i];
-        Index i2 = indices()[i + 1 + odd];
-        Index i3 = indices()[i + 2 - odd];
-
-        Vertex vn = F::calcNormal(vertices()[i1], vertices()[i2],
-                                  vertices()[i3], equalWeightPerFace);
+      if (normalize) normalizeNormals(N, Nv);
+      return;
+    }
 
-        normals()[i1] += vn;
-        normals()[i2] += vn;
-        normals()[i3] += vn;
+    // Vertices gather their face normals in face order, which adds the same
+    // values in the same order as the loop above
+    auto adjacency = mNormalAdjacency;
+    if (!adjacency || adjacency->primitive != primitive() ||
+        adjacency->vertices != Nv) {
+      auto table = std::make_shared<NormalAdjacency>();
+      table->primitive = primitive();
+      table->vertices = Nv;
+      table->offsets.assign(Nv + 1, 0);
+      for (size_t f = 0; f < Nf; ++f) {
+        for (unsigned k = 0; k < 3; ++k) {
+          Index v = I[f * stride + k];
+          if (v < Nv) table->offsets[v + 1]++;
+        }
+      }
+      for (size_t v = 0; v < Nv; ++v) {
+        table->offsets[v + 1] += table->offsets[v];
       }
+      table->faces.resize(table->offsets[Nv]);
+      std::vector<unsigned> fill(table->offsets.begin(),
+                                 table->offsets.end() - 1);
+      for (size_t f = 0; f < Nf; ++f) {
+        for (unsigned k = 0; k < 3; ++k) {
+          Index v = I[f * stride + k];
+          if (v < Nv) table->faces[fill[v]++] = unsigned(f);
+        }
+      }
+      adjacency = table;
+      mNormalAdjacency = adjacency;
     }
 
-    // normalize the normals
-    if (normalize)
-      for (unsigned i = 0; i < Nv; ++i) normals()[i].normalize();
+    std::vector<Vertex> faceNormals(Nf);
+    forChunks(Nf, threads, [&](size_t begin, size_t end) {
+      for (size_t f = begin; f < end; ++f) faceNormals[f] = normalOf(f);
+    });
+    const unsigned* offsets = adjacency->offsets.data();
+    const unsigned* faces = adjacency->faces.data();
+    forChunks(Nv, threads, [&](size_t begin, size_t end) {
+      for (size_t v = begin; v < end; ++v) {
+        Normal n(0, 0, 0);
+        for (unsigned j = offsets[v]; j < offsets[v + 1]; ++j) {
+          n += faceNormals[faces[j]];
+        }
+        N[v] = n;
+      }
+      if (normalize) normalizeNormals(N + begin, end - begin);
+    });
   }
 
   // non-indexed case
   else {
     // compute face based normals
     if (primitive() == TRIANGLES) {
-      unsigned N = (unsigned)(Nv - (Nv % 3));
-
-      for (unsigned i = 0; i < N; i += 3) {
-        unsigned i1 = i + 0;
-        unsigned i2 = i + 1;
-        unsigned i3 = i + 2;
-        const Vertex& v1 = vertices()[i1];
-        const Vertex& v2 = vertices()[i2];
-        const Vertex& v3 = vertices()[i3];
-
-        Vertex vn = cross(v2 - v1, v3 - v1);
-        if (normalize) vn.normalize();
-
-        normals()[i1] = vn;
-        normals()[i2] = vn;
-        normals()[i3] = vn;
-      }
+      forChunks(Nv / 3, threads, [&](size_t begin, size_t end) {
+        for (size_t f = begin; f < end; ++f) {
+          size_t i = f * 3;
+          Vertex vn = cross(V[i + 1] - V[i], V[i + 2] - V[i]);
+          if (normalize) vn.normalize();
+          N[i] = N[i + 1] = N[i + 2] = vn;
+        }
+      });
     }
     // compute vertex based normals
     else if (primitive() == TRIANGLE_STRIP) {
-      for (unsigned i = 0; i < Nv; ++i) normals()[i].set(0, 0, 0);
-
-      for (unsigned i = 0; i < Nv - 2; ++i) {
-        // Flip every other normal due to change in winding direction
-        unsigned odd = i & 1;
-
-        Vertex vn = F::calcNormal(vertices()[i], vertices()[i + 1 + odd],
-                                  vertices()[i + 2 - odd], equalWeightPerFace);
-
-        normals()[i] += vn;
-        normals()[i + 1] += vn;
-        normals()[i + 2] += vn;
-      }
-
-      // normalize the normals
-      if (normalize)
-        for (unsigned i = 0; i < Nv; ++i) normals()[i].normalize();
+      // Flip every other normal due to change in winding direction
+      std::vector<Vertex> faceNormals(Nv - 2);
+      forChunks(Nv - 2, threads, [&](size_t begin, size_t end) {
+        for (size_t f = begin; f < end; ++f) {
+          unsigned odd = f & 1;
+          faceNormals[f] = faceNormal(V[f], V[f + 1 + odd], V[f + 2 - odd],
+                                      equalWeightPerFace);
+        }
+      });
+      // Vertex v is in faces v - 2, v - 1 and v
+      forChunks(Nv, threads, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; ++v) {
+          Normal n(0, 0, 0);
+          for (size_t f = v < 2 ? 0 : v - 2; f <= v && f < Nv - 2; ++f) {
+            n += faceNormals[f];
+          }
+          N[v] = n;
+        }
+        if (normalize) normalizeNormals(N + begin, end - begin);
+      });
     }
   }
 }
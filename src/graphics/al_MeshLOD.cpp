@@ -0,0 +1,523 @@
+#include "al/graphics/al_MeshLOD.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include "al/system/al_Printing.hpp"
+
+using namespace al;
+
+namespace {
+// Runs task(i) for i in [0, count) on up to threads threads
+void runTasks(int count, int threads, const std::function<void(int)>& task) {
+  std::atomic<int> next{0};
+  auto work = [&]() {
+    for (int i = next++; i < count; i = next++) task(i);
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < std::min(threads, count); ++i) workers.emplace_back(work);
+  work();
+  for (auto& worker : workers) worker.join();
+}
+
+// Runs f(begin, end) over [0, n) split in chunks
+void forChunks(size_t n, int threads,
+               const std::function<void(size_t, size_t)>& f) {
+  int chunks = int(std::min<size_t>(4 * size_t(threads), n / 4096 + 1));
+  runTasks(chunks, threads,
+           [&](int c) { f(n * c / chunks, n * (c + 1) / chunks); });
+}
+
+typedef Mesh::Index Index;
+
+// Sum of weighted squared distances to planes
+struct Quadric {
+  double a00{0}, a01{0}, a02{0}, a11{0}, a12{0}, a22{0};
+  double b0{0}, b1{0}, b2{0}, c{0};
+  double w{0};
+
+  // Plane n.p + d = 0 with unit normal n
+  void addPlane(const Vec3d& n, double d, double weight) {
+    a00 += weight * n[0] * n[0];
+    a01 += weight * n[0] * n[1];
+    a02 += weight * n[0] * n[2];
+    a11 += weight * n[1] * n[1];
+    a12 += weight * n[1] * n[2];
+    a22 += weight * n[2] * n[2];
+    b0 += weight * d * n[0];
+    b1 += weight * d * n[1];
+    b2 += weight * d * n[2];
+    c += weight * d * d;
+    w += weight;
+  }
+
+  Quadric& operator+=(const Quadric& q) {
+    a00 += q.a00;
+    a01 += q.a01;
+    a02 += q.a02;
+    a11 += q.a11;
+    a12 += q.a12;
+    a22 += q.a22;
+    b0 += q.b0;
+    b1 += q.b1;
+    b2 += q.b2;
+    c += q.c;
+    w += q.w;
+    return *this;
+  }
+
+  // Weighted sum of squared distances from p
+  double distance(const Vec3f& p) const {
+    double x = p[0], y = p[1], z = p[2];
+    double r = a00 * x * x + a11 * y * y + a22 * z * z +
+               2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+               2 * (b0 * x + b1 * y + b2 * z) + c;
+    return std::max(r, 0.0);
+  }
+};
+
+enum VertexKind : uint8_t {
+  INTERIOR,  // moves anywhere
+  BORDER,    // moves along open borders
+  LOCKED     // seams, non-manifold vertices and locked borders
+};
+
+struct Collapse {
+  Index from, to;
+  float error;
+};
+
+// Triangles around each vertex, offsets[v] to offsets[v + 1] in triangles
+struct Incidence {
+  void build(const std::vector<Index>& tris, size_t Nv) {
+    offsets.assign(Nv + 1, 0);
+    for (Index v : tris) offsets[v + 1]++;
+    for (size_t v = 0; v < Nv; ++v) offsets[v + 1] += offsets[v];
+    triangles.resize(tris.size());
+    std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < tris.size(); ++i) {
+      triangles[fill[tris[i]]++] = unsigned(i / 3);
+    }
+  }
+
+  std::vector<unsigned> offsets;
+  std::vector<unsigned> triangles;
+};
+
+// Removes vertices not used by indices, keeping the order of the others
+void removeUnused(Mesh& mesh) {
+  const size_t Nv = mesh.vertices().size();
+  const Index unused = std::numeric_limits<Index>::max();
+  std::vector<Index> remap(Nv, unused);
+  for (Index v : mesh.indices()) remap[v] = 0;
+  Index next = 0;
+  for (auto& r : remap) {
+    if (r != unused) r = next++;
+  }
+  auto compact = [&](auto& buf) {
+    if (buf.size() != Nv) return;
+    for (size_t v = 0; v < Nv; ++v) {
+      if (remap[v] != unused) buf[remap[v]] = buf[v];
+    }
+    buf.resize(next);
+  };
+  compact(mesh.vertices());
+  compact(mesh.normals());
+  compact(mesh.colors());
+  compact(mesh.texCoord1s());
+  compact(mesh.texCoord2s());
+  compact(mesh.texCoord3s());
+  for (auto& i : mesh.indices()) i = remap[i];
+}
+}  // namespace
+
+float MeshSimplifier::simplify(Mesh& mesh) const {
+  int threads = mThreads;
+  if (threads <= 0)
+    threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+  mesh.toTriangles();
+  if (mesh.primitive() != Mesh::TRIANGLES) {
+    AL_WARN("MeshSimplifier: primitive must be triangles or triangle strip");
+    return 0;
+  }
+  if (mesh.indices().empty()) {
+    mesh.weld(0, 0, threads);
+  }
+  const size_t Nv = mesh.vertices().size();
+  const Mesh::Vertex* P = mesh.vertices().data();
+  for (Index v : mesh.indices()) {
+    if (v >= Nv) {
+      AL_WARN("MeshSimplifier: index %u out of range", v);
+      return 0;
+    }
+  }
+
+  // Vertices at the same position, with different attributes
+  const Index unused = std::numeric_limits<Index>::max();
+  std::vector<Index> group(Nv);
+  {
+    size_t size = 1;
+    while (size < 2 * Nv) size <<= 1;
+    std::vector<Index> table(size, unused);
+    for (size_t v = 0; v < Nv; ++v) {
+      uint32_t bits[3];
+      std::memcpy(bits, &P[v][0], sizeof(bits));
+      size_t h = (bits[0] * 73856093u ^ bits[1] * 19349663u ^
+                  bits[2] * 83492791u) & (size - 1);
+      while (table[h] != unused &&
+             std::memcmp(&P[table[h]][0], bits, sizeof(bits)) != 0) {
+        h = (h + 1) & (size - 1);
+      }
+      if (table[h] == unused) table[h] = Index(v);
+      group[v] = table[h];
+    }
+  }
+
+  // Triangles without zero area in the positions
+  std::vector<Index> tris;
+  {
+    const auto& I = mesh.indices();
+    tris.reserve(I.size() - I.size() % 3);
+    for (size_t i = 0; i + 2 < I.size(); i += 3) {
+      Index a = group[I[i]], b = group[I[i + 1]], c = group[I[i + 2]];
+      if (a != b && b != c && c != a) {
+        tris.insert(tris.end(), {I[i], I[i + 1], I[i + 2]});
+      }
+    }
+  }
+
+  // Topology and quadrics of each position, from the triangles around it
+  std::vector<Index> groupTris(tris.size());
+  for (size_t i = 0; i < tris.size(); ++i) groupTris[i] = group[tris[i]];
+  Incidence around;
+  around.build(groupTris, Nv);
+
+  std::vector<uint8_t> kind(Nv, INTERIOR);
+  std::vector<Quadric> quadrics(Nv);
+  forChunks(Nv, threads, [&](size_t begin, size_t end) {
+    std::vector<std::pair<Index, int>> edges;  // neighbor, +1 out -1 in
+    for (size_t g = begin; g < end; ++g) {
+      if (group[g] != g) continue;
+      edges.clear();
+      Quadric& q = quadrics[g];
+      for (unsigned j = around.offsets[g]; j < around.offsets[g + 1]; ++j) {
+        const Index* t = &groupTris[around.triangles[j] * 3];
+        int c = t[0] == g ? 0 : (t[1] == g ? 1 : 2);
+        edges.emplace_back(t[(c + 1) % 3], 1);
+        edges.emplace_back(t[(c + 2) % 3], -1);
+
+        Vec3d p0(P[t[0]]), p1(P[t[1]]), p2(P[t[2]]);
+        Vec3d n = cross(p1 - p0, p2 - p0);
+        double area = n.mag();
+        if (area > 0) {
+          n /= area;
+          q.addPlane(n, -n.dot(p0), area * 0.5);
+        }
+      }
+
+      // Each edge of a closed manifold is used once in each direction
+      std::sort(edges.begin(), edges.end());
+      uint8_t k = INTERIOR;
+      for (size_t e = 0; e < edges.size();) {
+        size_t f = e;
+        int out = 0, in = 0;
+        for (; f < edges.size() && edges[f].first == edges[e].first; ++f) {
+          (edges[f].second > 0 ? out : in)++;
+        }
+        if (out > 1 || in > 1) {
+          k = LOCKED;
+        } else if (out + in == 1 && k != LOCKED) {
+          k = BORDER;
+          if (!mLockBoundary) {
+            // Plane through the border edge, perpendicular to its triangle
+            Index w = edges[e].first;
+            for (unsigned j = around.offsets[g]; j < around.offsets[g + 1];
+                 ++j) {
+              const Index* t = &groupTris[around.triangles[j] * 3];
+              if (t[0] != w && t[1] != w && t[2] != w) continue;
+              Vec3d p0(P[t[0]]), p1(P[t[1]]), p2(P[t[2]]);
+              Vec3d normal = cross(p1 - p0, p2 - p0).normalize();
+              Vec3d edge = Vec3d(P[w]) - Vec3d(P[g]);
+              double length = edge.mag();
+              if (length > 0) {
+                Vec3d n = cross(edge, normal).normalize();
+                q.addPlane(n, -n.dot(Vec3d(P[g])), 10 * length * length);
+              }
+            }
+          }
+        }
+        e = f;
+      }
+      kind[g] = k == BORDER && mLockBoundary ? uint8_t(LOCKED) : k;
+    }
+  });
+  for (size_t v = 0; v < Nv; ++v) {
+    if (group[v] != v) kind[v] = kind[group[v]] = LOCKED;
+  }
+  groupTris = std::vector<Index>();
+  around = Incidence();
+
+  // Attribute difference between two vertices
+  const bool hasNormals = mesh.normals().size() == Nv;
+  const bool hasColors = mesh.colors().size() == Nv;
+  const bool hasTexCoords = mesh.texCoord2s().size() == Nv;
+  const double attributeWeight2 = double(mAttributeWeight) * mAttributeWeight;
+  auto attributeError = [&](Index a, Index b) {
+    double e = 0;
+    if (hasNormals) e += (mesh.normals()[a] - mesh.normals()[b]).magSqr();
+    if (hasColors) {
+      const Color &ca = mesh.colors()[a], &cb = mesh.colors()[b];
+      for (int i = 0; i < 4; ++i) e += (ca[i] - cb[i]) * (ca[i] - cb[i]);
+    }
+    if (hasTexCoords) {
+      e += (mesh.texCoord2s()[a] - mesh.texCoord2s()[b]).magSqr();
+    }
+    return e * attributeWeight2;
+  };
+  auto collapseError = [&](Index from, Index to) {
+    Quadric q = quadrics[group[from]];
+    q += quadrics[group[to]];
+    double e = q.w > 0 ? q.distance(P[to]) / q.w : 0;
+    return e + attributeError(from, to);
+  };
+  auto movable = [&](Index from, Index to) {
+    return kind[from] == INTERIOR ||
+           (kind[from] == BORDER && kind[to] != INTERIOR);
+  };
+
+  const double maxError = double(mTargetError) * mTargetError;
+  double error = 0;
+  Incidence incidence;
+  std::vector<Collapse> candidates, sorted, picked;
+  std::vector<int> users(Nv);  // picked collapses around each vertex
+  std::vector<Index> remap(Nv);
+  size_t rejected = 0;
+
+  // Number of triangles a collapse removes, 0 if it would change the
+  // topology or flip triangles
+  auto trianglesRemoved = [&](const Collapse& c, std::vector<Index>& ring) {
+    const Index u = c.from, v = c.to;
+    int shared = 0;
+    ring.clear();
+    for (unsigned j = incidence.offsets[u]; j < incidence.offsets[u + 1];
+         ++j) {
+      const Index* t = &tris[incidence.triangles[j] * 3];
+      if (t[0] == v || t[1] == v || t[2] == v) shared++;
+      for (int k = 0; k < 3; ++k) {
+        if (t[k] != u) ring.push_back(t[k]);
+      }
+    }
+    if (shared != (kind[u] == BORDER ? 1 : 2)) return 0;
+
+    // Only the vertices opposite the edge may be around both u and v, or
+    // the surface would fold onto itself. Each is in two triangles of v.
+    std::sort(ring.begin(), ring.end());
+    ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+    int common = 0;
+    for (unsigned j = incidence.offsets[v]; j < incidence.offsets[v + 1];
+         ++j) {
+      const Index* t = &tris[incidence.triangles[j] * 3];
+      for (int k = 0; k < 3; ++k) {
+        if (t[k] != v && t[k] != u &&
+            std::binary_search(ring.begin(), ring.end(), t[k])) {
+          common++;
+        }
+      }
+    }
+    if (common != 2 * shared) return 0;
+
+    // Triangles must not flip or end up on top of a triangle of v, as when
+    // collapsing a tetrahedron
+    for (unsigned j = incidence.offsets[u]; j < incidence.offsets[u + 1];
+         ++j) {
+      const Index* t = &tris[incidence.triangles[j] * 3];
+      if (t[0] == v || t[1] == v || t[2] == v) continue;
+      int k = t[0] == u ? 0 : (t[1] == u ? 1 : 2);
+      const Index a = t[(k + 1) % 3], b = t[(k + 2) % 3];
+      Vec3f before = cross(P[a] - P[u], P[b] - P[u]);
+      Vec3f after = cross(P[a] - P[v], P[b] - P[v]);
+      if (before.dot(after) < 0.25f * before.mag() * after.mag()) return 0;
+      for (unsigned i = incidence.offsets[v]; i < incidence.offsets[v + 1];
+           ++i) {
+        const Index* w = &tris[incidence.triangles[i] * 3];
+        if ((w[0] == a || w[1] == a || w[2] == a) &&
+            (w[0] == b || w[1] == b || w[2] == b)) {
+          return 0;
+        }
+      }
+    }
+    return shared;
+  };
+
+  while (tris.size() / 3 > mTargetTriangles) {
+    const size_t Nt = tris.size() / 3;
+
+    // Errors of collapsing each edge onto either vertex. Edges shared by two
+    // triangles are taken from the one where they go to a higher index.
+    candidates.resize(tris.size());
+    forChunks(Nt, threads, [&](size_t begin, size_t end) {
+      for (size_t t = begin; t < end; ++t) {
+        for (int k = 0; k < 3; ++k) {
+          Collapse& c = candidates[t * 3 + k];
+          Index a = tris[t * 3 + k], b = tris[t * 3 + (k + 1) % 3];
+          c.error = std::numeric_limits<float>::infinity();
+          if (a > b && (kind[a] == INTERIOR || kind[b] == INTERIOR)) continue;
+          if (movable(a, b)) c = {a, b, float(collapseError(a, b))};
+          if (movable(b, a)) {
+            float e = float(collapseError(b, a));
+            if (e < c.error) c = {b, a, e};
+          }
+        }
+      }
+    });
+    auto last = std::remove_if(candidates.begin(), candidates.end(),
+                               [&](const Collapse& c) {
+                                 return !(double(c.error) <= maxError);
+                               });
+    candidates.erase(last, candidates.end());
+    if (candidates.empty()) break;
+
+    // Sort by the high bits of the error, which is close enough to order
+    const int kBuckets = 1 << 16;
+    auto bucket = [](float e) {
+      uint32_t bits;
+      std::memcpy(&bits, &e, sizeof(bits));
+      return bits >> 15;
+    };
+    std::vector<unsigned> counts(kBuckets + 1, 0);
+    for (auto& c : candidates) counts[bucket(c.error) + 1]++;
+    for (int b = 0; b < kBuckets; ++b) counts[b + 1] += counts[b];
+    sorted.resize(candidates.size());
+    for (auto& c : candidates) sorted[counts[bucket(c.error)]++] = c;
+
+    // Pick the cheapest collapses that do not share triangles, then check
+    // them in parallel. The checks only read the triangles around both
+    // vertices, which no other collapse of the pass changes. The triangles
+    // of rejected collapses are released and picking repeats.
+    incidence.build(tris, Nv);
+    auto use = [&](Index u, int n) {
+      for (unsigned j = incidence.offsets[u]; j < incidence.offsets[u + 1];
+           ++j) {
+        const Index* t = &tris[incidence.triangles[j] * 3];
+        for (int k = 0; k < 3; ++k) users[t[k]] += n;
+      }
+    };
+    // Only the cheapest collapses are tried, about twice as many as needed
+    // plus as many as were rejected in the last pass, to stay close to the
+    // order of one collapse at a time. More are tried if all are rejected.
+    const size_t needed = Nt - mTargetTriangles;
+    size_t count = std::min(sorted.size(), needed + 1 + rejected);
+    rejected = 0;
+    std::vector<uint8_t> tried(sorted.size(), 0);
+    std::fill(users.begin(), users.end(), 0);
+    for (size_t v = 0; v < Nv; ++v) remap[v] = Index(v);
+    size_t removed = 0;
+    while (removed < needed) {
+      picked.clear();
+      size_t estimate = removed;
+      for (size_t i = 0; i < count && estimate < needed; ++i) {
+        const Index u = sorted[i].from, v = sorted[i].to;
+        if (tried[i] || users[u] || users[v]) continue;
+        tried[i] = 1;
+        picked.push_back(sorted[i]);
+        estimate += kind[u] == BORDER ? 1 : 2;
+        use(u, 1);
+      }
+      if (picked.empty()) {
+        if (removed > 0 || count == sorted.size()) break;
+        count = std::min(sorted.size(), count * 2);
+        continue;
+      }
+
+      std::vector<uint8_t> removes(picked.size());
+      forChunks(picked.size(), threads, [&](size_t begin, size_t end) {
+        std::vector<Index> ring;
+        for (size_t i = begin; i < end; ++i) {
+          removes[i] = uint8_t(trianglesRemoved(picked[i], ring));
+        }
+      });
+      for (size_t i = 0; i < picked.size(); ++i) {
+        const Index u = picked[i].from, v = picked[i].to;
+        if (!removes[i]) {
+          use(u, -1);
+          rejected++;
+          continue;
+        }
+        remap[u] = v;
+        quadrics[group[v]] += quadrics[group[u]];
+        error = std::max(error, double(picked[i].error));
+        removed += removes[i];
+      }
+    }
+    if (removed == 0) break;
+
+    // Remap triangles and drop collapsed ones
+    const int chunks =
+        int(std::min<size_t>(4 * size_t(threads), Nt / 4096 + 1));
+    std::vector<size_t> kept(chunks + 1, 0);
+    runTasks(chunks, threads, [&](int c) {
+      size_t n = 0;
+      for (size_t t = Nt * c / chunks; t < Nt * (c + 1) / chunks; ++t) {
+        Index a = remap[tris[t * 3]], b = remap[tris[t * 3 + 1]],
+              d = remap[tris[t * 3 + 2]];
+        if (a != b && b != d && d != a) n++;
+      }
+      kept[c + 1] = n;
+    });
+    for (int c = 0; c < chunks; ++c) kept[c + 1] += kept[c];
+    std::vector<Index> next(kept[chunks] * 3);
+    runTasks(chunks, threads, [&](int c) {
+      size_t n = kept[c];
+      for (size_t t = Nt * c / chunks; t < Nt * (c + 1) / chunks; ++t) {
+        Index a = remap[tris[t * 3]], b = remap[tris[t * 3 + 1]],
+              d = remap[tris[t * 3 + 2]];
+        if (a != b && b != d && d != a) {
+          next[n * 3] = a;
+          next[n * 3 + 1] = b;
+          next[n * 3 + 2] = d;
+          n++;
+        }
+      }
+    });
+    tris.swap(next);
+  }
+
+  mesh.indices() = tris;
+  removeUnused(mesh);
+  return float(std::sqrt(error));
+}
+
+void MeshLOD::generate(const Mesh& mesh, int levels, float ratio,
+                       MeshSimplifier simplifier) {
+  mLevels.assign(1, mesh);
+  mErrors.assign(1, 0.f);
+  Mesh current = mesh;
+  float error = 0;
+  for (int i = 1; i < levels; ++i) {
+    size_t triangles = current.indices().size() / 3;
+    if (i == 1) {
+      // Level 0 may be a strip or have no indices
+      simplifier.targetTriangles(std::numeric_limits<size_t>::max());
+      simplifier.simplify(current);
+      triangles = current.indices().size() / 3;
+    }
+    simplifier.targetTriangles(size_t(triangles * ratio));
+    error += simplifier.simplify(current);
+    if (current.indices().size() / 3 > triangles * 0.95) break;
+    mLevels.push_back(current);
+    mErrors.push_back(error);
+  }
+}
+
+int MeshLOD::select(float distance, float scale) const {
+  for (int i = levels() - 1; i > 0; --i) {
+    if (mErrors[i] * scale <= mTolerance * distance) return i;
+  }
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include "al/graphics/al_VAOMesh.hpp"
+#include <cstdint>
 #include <iostream>
+#include <vector>
 
 using namespace al;
 
@@ -9,14 +11,16 @@ VAOMesh::VAOMesh(Primitive p) : Mesh(p) {
 }
 
 // when copying, make new vao
-VAOMesh::VAOMesh(VAOMesh const& other) : Mesh(other) {
+VAOMesh::VAOMesh(VAOMesh const& other)
+    : Mesh(other), mCompactIndices(other.mCompactIndices) {
   vaoWrapper = std::make_shared<VAOWrapper>();
   if (gl::loaded()) update();
   // std::cout << "copy ctor" << std::endl;
 }
 
 // when moving, move vao
-VAOMesh::VAOMesh(VAOMesh&& other) : Mesh(other) {
+VAOMesh::VAOMesh(VAOMesh&& other)
+    : Mesh(other), mCompactIndices(other.mCompactIndices) {
   vaoWrapper = other.vaoWrapper;
   // std::cout << "move ctor" << std::endl;
 }
@@ -24,6 +28,7 @@ VAOMesh::VAOMesh(VAOMesh&& other) : Mesh(other) {
 // when copying, make new vao
 VAOMesh& VAOMesh::operator=(VAOMesh const& other) {
   copy(other);
+  mCompactIndices = other.mCompactIndices;
   vaoWrapper = std::make_shared<VAOWrapper>();
   if (gl::loaded()) update();
   // std::cout << "copy assignment" << std::endl;
@@ -33,6 +38,7 @@ VAOMesh& VAOMesh::operator=(VAOMesh const& other) {
 // when moving, move vao
 VAOMesh& VAOMesh::operator=(VAOMesh&& other) {
   copy(other);
+  mCompactIndices = other.mCompactIndices;
   vaoWrapper = other.vaoWrapper;
   // std::cout << "move assignment" << std::endl;
   return *this;
@@ -53,7 +59,8 @@ void VAOMesh::update() {
   // updateAttrib(texCoord3s(), mTexcoord3dAtt);
   // updateAttrib(texCoord1s(), mTexcoord1dAtt);
   // vao().unbind();
-  if (indices().size() > 0) {
+  // Indices are only read, so mIndices keeps the normals table of Mesh
+  if (mIndices.size() > 0) {
     if (!indexBuffer().created()) {
       // mIndexBuffer.create();
       // mIndexBuffer.bufferType(GL_ELEMENT_ARRAY_BUFFER);
@@ -61,8 +68,18 @@ void VAOMesh::update() {
       indexBuffer().bufferType(GL_ELEMENT_ARRAY_BUFFER);
     }
     indexBuffer().bind();
-    indexBuffer().data(sizeof(unsigned int) * indices().size(),
-                       indices().data());
+    // If enabled, meshes with few enough vertices use 16-bit indices
+    if (mCompactIndices && vertices().size() <= 65536) {
+      auto& shortIndices = vaoWrapper->shortIndices;
+      shortIndices.assign(mIndices.begin(), mIndices.end());
+      indexBuffer().data(sizeof(uint16_t) * shortIndices.size(),
+                         shortIndices.data());
+      vaoWrapper->indexType = GL_UNSIGNED_SHORT;
+    } else {
+      indexBuffer().data(sizeof(unsigned int) * mIndices.size(),
+                         mIndices.data());
+      vaoWrapper->indexType = GL_UNSIGNED_INT;
+    }
     // indexBuffer().unbind();
   }
 }
@@ -104,10 +121,11 @@ template void VAOMesh::updateAttrib<Vec4f>(std::vector<Vec4f> const& data,
 
 void VAOMesh::draw() {
   vao().bind();
-  if (indices().size() > 0) {
+  if (mIndices.size() > 0) {
     indexBuffer().bind();
-    int num_indices = (int)indices().size();
-    glDrawElements(vaoWrapper->GLPrimMode, num_indices, GL_UNSIGNED_INT, NULL);
+    int num_indices = (int)mIndices.size();
+    glDrawElements(vaoWrapper->GLPrimMode, num_indices, vaoWrapper->indexType,
+                   NULL);
     // indexBuffer().unbind();
   } else {
     int num_vertices = (int)vertices().size();
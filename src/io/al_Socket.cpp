@@ -40,6 +40,10 @@ does not perform any handshake for connection.)
 //#include "al/system/al_Config.h"
 #include "al/system/al_Printing.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
 using namespace al;
 
 #if defined(AL_SOCKET_DUMMY)
@@ -66,6 +70,7 @@ public:
   void timeout(float v) {}
   bool listen() { return false; }
   bool accept(Socket::Impl *newSock) { return false; }
+  bool setBlocking(bool blocking) { return false; }
   bool opened() const { return false; }
   int recv(char *buffer, int maxlen, char *from) { return 0; }
   int send(const char *buffer, int len) { return 0; }
@@ -73,6 +78,18 @@ public:
 
 /*static*/ std::string Socket::hostIP() { return "0.0.0.0"; }
 /*static*/ std::string Socket::hostName() { return "dummy_invalid"; }
+/*static*/ bool Socket::wouldBlock() { return false; }
+
+struct SocketPoller::Impl {
+  bool add(Socket &socket, int events) { return false; }
+  bool modify(Socket &socket, int events) { return false; }
+  bool remove(Socket &socket) { return false; }
+  size_t wait(std::vector<SocketPoller::Event> &events, al_sec timeout) {
+    events.clear();
+    return 0;
+  }
+  void wakeUp() {}
+};
 
 // Native socket code
 #else
@@ -112,6 +129,7 @@ const char *errorString() {
 
 #define INIT_SOCKET WsInit::get()
 typedef SOCKET SocketHandle;
+#define poll WSAPoll
 #define SHUT_RDWR SD_BOTH
 DWORD secToTimeout(float t) {
   return t >= 0. ? DWORD(t * 1000. + 0.5) : 4294967295; // msec
@@ -127,6 +145,13 @@ DWORD secToTimeout(float t) {
 #include <sys/time.h> // timeval
 #include <unistd.h>   // close, gethostname
 
+#if defined(AL_LINUX)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
+
 #include <sstream>
 
 const char *errorString() { return strerror(errno); }
@@ -387,6 +412,9 @@ public:
 
   bool bind() { // for server-side
     if (opened()) {
+      // Replace the socket created by open() with one bound to the address
+      closesocket(mSocketHandle);
+      mSocketHandle = INVALID_SOCKET;
       struct addrinfo *p;
       for (p = mAddrInfo; p != nullptr; p = p->ai_next) {
         if ((mSocketHandle = socket(p->ai_family, p->ai_socktype,
@@ -412,6 +440,7 @@ public:
         }
 
         // success!
+        timeout(mTimeout);
         return true;
       }
     }
@@ -511,14 +540,31 @@ public:
     return true;
   }
 
+  bool setBlocking(bool blocking) {
+#ifdef AL_WINDOWS
+    u_long nb = blocking ? 0 : 1;
+    return ::ioctlsocket(mSocketHandle, FIONBIO, &nb) != SOCKET_ERROR;
+#else
+    int nb = blocking ? 0 : 1;
+    return ::ioctl(mSocketHandle, FIONBIO, &nb) != SOCKET_ERROR;
+#endif
+  }
+
   bool opened() const { return INVALID_SOCKET != mSocketHandle; }
 
+  SocketHandle handle() const { return mSocketHandle; }
+
   size_t recv(char *buffer, size_t maxlen, char *from) {
     return ::recv(mSocketHandle, buffer, maxlen, 0);
   }
 
   int send(const char *buffer, int len) {
+#ifdef MSG_NOSIGNAL
+    // Report closed connections as errors instead of raising SIGPIPE
+    return (int)::send(mSocketHandle, buffer, len, MSG_NOSIGNAL);
+#else
     return (int)::send(mSocketHandle, buffer, len, 0);
+#endif
   }
 
 private:
@@ -568,6 +614,190 @@ std::string Socket::nameToIp(std::string name) {
   return buf;
 }
 
+/*static*/ bool Socket::wouldBlock() {
+#ifdef AL_WINDOWS
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+#if defined(AL_LINUX)
+
+struct SocketPoller::Impl {
+  Impl() {
+    mPoll = epoll_create1(EPOLL_CLOEXEC);
+    mWakeUp = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mPoll < 0 || mWakeUp < 0) {
+      AL_WARN("unable to create socket poller: %s", errorString());
+      return;
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(mPoll, EPOLL_CTL_ADD, mWakeUp, &event);
+  }
+
+  ~Impl() {
+    if (mWakeUp >= 0) {
+      ::close(mWakeUp);
+    }
+    if (mPoll >= 0) {
+      ::close(mPoll);
+    }
+  }
+
+  bool control(int operation, Socket &socket, int events) {
+    epoll_event event{};
+    event.events = ((events & SocketPoller::READ) ? EPOLLIN : 0) |
+                   ((events & SocketPoller::WRITE) ? EPOLLOUT : 0);
+    event.data.ptr = &socket;
+    if (epoll_ctl(mPoll, operation, socket.mImpl->handle(), &event) < 0) {
+      AL_WARN("unable to watch socket at %s:%i: %s", socket.address().c_str(),
+              socket.port(), errorString());
+      return false;
+    }
+    return true;
+  }
+
+  bool add(Socket &socket, int events) {
+    return control(EPOLL_CTL_ADD, socket, events);
+  }
+
+  bool modify(Socket &socket, int events) {
+    return control(EPOLL_CTL_MOD, socket, events);
+  }
+
+  bool remove(Socket &socket) {
+    epoll_event event{};
+    return epoll_ctl(mPoll, EPOLL_CTL_DEL, socket.mImpl->handle(), &event) ==
+           0;
+  }
+
+  size_t wait(std::vector<SocketPoller::Event> &events, al_sec timeout) {
+    events.clear();
+    epoll_event ready[64];
+    int count = epoll_wait(mPoll, ready, 64,
+                           timeout < 0 ? -1 : int(timeout * 1000.0 + 0.5));
+    for (int i = 0; i < count; i++) {
+      if (!ready[i].data.ptr) {
+        uint64_t value;
+        while (::read(mWakeUp, &value, sizeof(value)) > 0) {
+        }
+        continue;
+      }
+      int flags = 0;
+      if (ready[i].events & EPOLLIN) {
+        flags |= SocketPoller::READ;
+      }
+      if (ready[i].events & EPOLLOUT) {
+        flags |= SocketPoller::WRITE;
+      }
+      if (ready[i].events & (EPOLLHUP | EPOLLERR)) {
+        flags |= SocketPoller::HANGUP;
+      }
+      events.push_back({static_cast<Socket *>(ready[i].data.ptr), flags});
+    }
+    return events.size();
+  }
+
+  void wakeUp() {
+    uint64_t value = 1;
+    if (::write(mWakeUp, &value, sizeof(value)) < 0) {
+      AL_WARN("unable to wake up socket poller: %s", errorString());
+    }
+  }
+
+  int mPoll{-1};
+  int mWakeUp{-1};
+};
+
+#else
+
+struct SocketPoller::Impl {
+  bool add(Socket &socket, int events) {
+    std::unique_lock<std::mutex> lk(mLock);
+    mSockets.push_back({&socket, events});
+    return true;
+  }
+
+  bool modify(Socket &socket, int events) {
+    std::unique_lock<std::mutex> lk(mLock);
+    for (auto &entry : mSockets) {
+      if (entry.socket == &socket) {
+        entry.events = events;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool remove(Socket &socket) {
+    std::unique_lock<std::mutex> lk(mLock);
+    for (auto it = mSockets.begin(); it != mSockets.end(); it++) {
+      if (it->socket == &socket) {
+        mSockets.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t wait(std::vector<SocketPoller::Event> &events, al_sec timeout) {
+    events.clear();
+    al_sec deadline = al_steady_time() + timeout;
+    while (!mWokenUp.exchange(false)) {
+      std::vector<SocketPoller::Event> watched;
+      std::vector<pollfd> fds;
+      {
+        std::unique_lock<std::mutex> lk(mLock);
+        watched = mSockets;
+      }
+      for (auto &entry : watched) {
+        pollfd fd{};
+        fd.fd = entry.socket->mImpl->handle();
+        fd.events = ((entry.events & SocketPoller::READ) ? POLLIN : 0) |
+                    ((entry.events & SocketPoller::WRITE) ? POLLOUT : 0);
+        fds.push_back(fd);
+      }
+      // poll() can't be interrupted portably, so long waits are split
+      al_sec slice = 0.01;
+      if (timeout >= 0) {
+        slice = std::min(slice, deadline - al_steady_time());
+      }
+      int count = poll(fds.data(), (unsigned long)fds.size(),
+                       slice > 0 ? int(slice * 1000.0 + 0.5) : 0);
+      for (size_t i = 0; count > 0 && i < fds.size(); i++) {
+        int flags = 0;
+        if (fds[i].revents & POLLIN) {
+          flags |= SocketPoller::READ;
+        }
+        if (fds[i].revents & POLLOUT) {
+          flags |= SocketPoller::WRITE;
+        }
+        if (fds[i].revents & (POLLHUP | POLLERR)) {
+          flags |= SocketPoller::HANGUP;
+        }
+        if (flags) {
+          events.push_back({watched[i].socket, flags});
+        }
+      }
+      if (!events.empty() || (timeout >= 0 && al_steady_time() >= deadline)) {
+        break;
+      }
+    }
+    return events.size();
+  }
+
+  void wakeUp() { mWokenUp = true; }
+
+  std::mutex mLock;
+  std::vector<SocketPoller::Event> mSockets;
+  std::atomic<bool> mWokenUp{false};
+};
+
+#endif
+
 #endif // native socket
 
 // Everything below is common across all platforms
@@ -619,6 +849,10 @@ size_t Socket::send(const char *buffer, size_t len) {
 
 bool Socket::listen() { return mImpl->listen(); }
 
+bool Socket::setBlocking(bool blocking) {
+  return mImpl->setBlocking(blocking);
+}
+
 bool Socket::accept(Socket &sock) {
   bool accepted = mImpl->accept(sock.mImpl);
   if (accepted) {
@@ -633,3 +867,23 @@ bool SocketClient::onOpen() { return connect(); }
 bool SocketServer::onOpen() { return bind(); }
 
 ValueSource *Socket::valueSource() { return &mValueSource; }
+
+SocketPoller::SocketPoller() : mImpl(new Impl) {}
+
+SocketPoller::~SocketPoller() { delete mImpl; }
+
+bool SocketPoller::add(Socket &socket, int events) {
+  return mImpl->add(socket, events);
+}
+
+bool SocketPoller::modify(Socket &socket, int events) {
+  return mImpl->modify(socket, events);
+}
+
+bool SocketPoller::remove(Socket &socket) { return mImpl->remove(socket); }
+
+size_t SocketPoller::wait(std::vector<Event> &events, al_sec timeout) {
+  return mImpl->wait(events, timeout);
+}
+
+void SocketPoller::wakeUp() { mImpl->wakeUp(); }
@@ -0,0 +1,251 @@
+#include "al/protocol/al_ClusterClock.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+using namespace al;
+
+namespace {
+enum {
+  CLOCK_REQUEST = CommandConnection::COMMAND_LAST_INTERNAL,
+  CLOCK_REPLY
+};
+
+// Request: type, client send time. Reply adds the primary's receive and send
+// times.
+const size_t kRequestSize = 1 + sizeof(double);
+const size_t kReplySize = 1 + 3 * sizeof(double);
+
+// Requests sent quickly after connecting for a first estimate
+const int kInitialRequests = 8;
+const al_sec kInitialInterval = 0.02;
+// Replies needed before the clock counts as synchronized
+const uint64_t kMinSamples = 4;
+// Recent replies used for the estimate
+const size_t kMaxSamples = 64;
+// Replies this much slower than the fastest are still used
+const double kDelayTolerance = 50.0e-6;
+// Drift is only estimated over at least this time span
+const double kMinDriftSpan = 1.0;
+// Quartz clocks are off by well under this rate
+const double kMaxDrift = 500.0e-6;
+} // namespace
+
+// ClusterClockServer ----------------------------------------------------------
+
+ClusterClockServer::ClusterClockServer() {
+  mVersion = 1;
+  mRevision = 0;
+}
+
+ClusterClockServer::~ClusterClockServer() {
+  if (mRunning) {
+    stop();
+  }
+}
+
+bool ClusterClockServer::start(uint16_t serverPort, const char *serverAddr) {
+  return CommandServer::start(serverPort, serverAddr);
+}
+
+bool ClusterClockServer::processIncomingMessage(Message &message,
+                                                Socket *src) {
+  if (message.remainingBytes() < kRequestSize ||
+      message.getByte() != CLOCK_REQUEST) {
+    return false;
+  }
+  double times[3];
+  times[0] = message.get<double>();
+  times[1] = localTime();
+  uint8_t reply[kReplySize];
+  reply[0] = CLOCK_REPLY;
+  times[2] = localTime();
+  std::memcpy(reply + 1, times, sizeof(times));
+  return sendMessage(reply, kReplySize, src);
+}
+
+// ClusterClockClient ----------------------------------------------------------
+
+ClusterClockClient::ClusterClockClient() {
+  mVersion = 1;
+  mRevision = 0;
+}
+
+ClusterClockClient::~ClusterClockClient() {
+  if (mSyncThread) {
+    stop();
+  }
+}
+
+bool ClusterClockClient::start(uint16_t serverPort, const char *serverAddr) {
+  if (!CommandClient::start(serverPort, serverAddr)) {
+    return false;
+  }
+  mSyncRunning = true;
+  mSyncThread = std::make_unique<std::thread>([this]() {
+    int requests = 0;
+    while (mSyncRunning) {
+      sendRequest();
+      al_sec interval =
+          requests++ < kInitialRequests ? kInitialInterval : mSyncInterval;
+      al_sec wakeUp = al_steady_time() + interval;
+      while (mSyncRunning && al_steady_time() < wakeUp) {
+        al_sleep(std::min(0.01, wakeUp - al_steady_time()));
+      }
+    }
+  });
+  return true;
+}
+
+void ClusterClockClient::stop() {
+  mSyncRunning = false;
+  if (mSyncThread) {
+    mSyncThread->join();
+    mSyncThread = nullptr;
+  }
+  CommandClient::stop();
+}
+
+void ClusterClockClient::sendRequest() {
+  uint8_t request[kRequestSize];
+  request[0] = CLOCK_REQUEST;
+  double sendTime = localTime();
+  std::memcpy(request + 1, &sendTime, sizeof(sendTime));
+  sendMessage(request, kRequestSize);
+}
+
+bool ClusterClockClient::processIncomingMessage(Message &message,
+                                                Socket * /*src*/) {
+  if (message.remainingBytes() < kReplySize ||
+      message.getByte() != CLOCK_REPLY) {
+    return false;
+  }
+  al_sec receiveTime = localTime();
+  double sendTime = message.get<double>();
+  double primaryReceiveTime = message.get<double>();
+  double primarySendTime = message.get<double>();
+
+  Sample sample;
+  sample.time = (sendTime + receiveTime) * 0.5;
+  sample.delay =
+      (receiveTime - sendTime) - (primarySendTime - primaryReceiveTime);
+  sample.offset = ((primaryReceiveTime - sendTime) +
+                   (primarySendTime - receiveTime)) *
+                  0.5;
+  addSample(sample);
+  return true;
+}
+
+void ClusterClockClient::addSample(const Sample &sample) {
+  mSamples.push_back(sample);
+  if (mSamples.size() > kMaxSamples) {
+    mSamples.pop_front();
+  }
+
+  // The offset error is at most half the round trip, so only the replies
+  // that were held up least in queues are used: the faster half, and any
+  // close to the fastest.
+  std::vector<double> delays;
+  for (auto &s : mSamples) {
+    delays.push_back(s.delay);
+  }
+  std::sort(delays.begin(), delays.end());
+  double minDelay = delays.front();
+  double maxDelay =
+      std::max(delays[delays.size() / 2], minDelay + kDelayTolerance);
+
+  double meanTime = 0.0, meanOffset = 0.0;
+  const Sample *first = nullptr, *last = nullptr;
+  int count = 0;
+  for (auto &s : mSamples) {
+    if (s.delay <= maxDelay) {
+      if (!first) {
+        first = &s;
+      }
+      last = &s;
+      meanTime += s.time;
+      meanOffset += s.offset;
+      count++;
+    }
+  }
+  meanTime /= count;
+  meanOffset /= count;
+
+  double drift = 0.0;
+  if (count >= 4 && last->time - first->time >= kMinDriftSpan) {
+    // Least squares line through the offsets
+    double covariance = 0.0, variance = 0.0;
+    for (auto &s : mSamples) {
+      if (s.delay <= maxDelay) {
+        covariance += (s.time - meanTime) * (s.offset - meanOffset);
+        variance += (s.time - meanTime) * (s.time - meanTime);
+      }
+    }
+    drift = std::max(-kMaxDrift, std::min(kMaxDrift, covariance / variance));
+  } else {
+    // Without a drift estimate, older offsets are less accurate
+    meanTime = last->time;
+    meanOffset = last->offset;
+  }
+
+  publish({meanTime, meanOffset, drift});
+  mRoundTrip = minDelay;
+  if (++mSampleCount >= kMinSamples) {
+    mSynchronized = true;
+  }
+}
+
+void ClusterClockClient::publish(const Estimate &estimate) {
+  // Only the connection thread writes
+  uint32_t version = mEstimateVersion.load(std::memory_order_relaxed);
+  mEstimateVersion.store(version + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  mReference.store(estimate.reference, std::memory_order_relaxed);
+  mOffset.store(estimate.offset, std::memory_order_relaxed);
+  mDrift.store(estimate.drift, std::memory_order_relaxed);
+  mEstimateVersion.store(version + 2, std::memory_order_release);
+}
+
+ClusterClockClient::Estimate ClusterClockClient::estimate() const {
+  Estimate estimate;
+  uint32_t before, after;
+  do {
+    before = mEstimateVersion.load(std::memory_order_acquire);
+    estimate.reference = mReference.load(std::memory_order_relaxed);
+    estimate.offset = mOffset.load(std::memory_order_relaxed);
+    estimate.drift = mDrift.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = mEstimateVersion.load(std::memory_order_relaxed);
+  } while ((before & 1) != 0 || before != after);
+  return estimate;
+}
+
+al_sec ClusterClockClient::toCluster(al_sec local) {
+  Estimate e = estimate();
+  return local + e.offset + e.drift * (local - e.reference);
+}
+
+al_sec ClusterClockClient::toLocal(al_sec cluster) {
+  Estimate e = estimate();
+  return (cluster - e.offset + e.drift * e.reference) / (1.0 + e.drift);
+}
+
+bool ClusterClockClient::waitForSync(double timeout) {
+  al_sec deadline = al_steady_time() + timeout;
+  while (!mSynchronized && al_steady_time() < deadline) {
+    al_sleep(0.005);
+  }
+  return mSynchronized;
+}
+
+ClusterClockStats ClusterClockClient::stats() {
+  Estimate e = estimate();
+  ClusterClockStats stats;
+  stats.samples = mSampleCount;
+  stats.roundTrip = mRoundTrip;
+  stats.offset = e.offset + e.drift * (localTime() - e.reference);
+  stats.drift = e.drift;
+  return stats;
+}
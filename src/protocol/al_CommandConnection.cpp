@@ -4,6 +4,14 @@
 #include <array>
 #include <iostream>
 
+namespace {
+// Handshake of clients that send capabilities
+const size_t kHandshakeSize = 6;
+// Time to wait for the last byte of a handshake before taking it as one from
+// a client without capabilities
+const al_sec kLegacyHandshakeWait = 0.05;
+} // namespace
+
 namespace Convert {
 auto to_bytes(std::uint16_t x) {
   std::array<std::uint8_t, 2> b;
@@ -51,16 +59,171 @@ void CommandConnection::stop() {
   for (auto &connection : mConnectionThreads) {
     connection->join();
   }
+  mConnectionThreads.clear();
   mState = BarrierState::NONE;
 }
 
+void CommandConnection::setCompression(bool enable, CompressionCodec codec,
+                                       size_t threshold) {
+  std::unique_lock<std::mutex> lk(mCompressorLock);
+  mCompression = enable;
+  mCompressionThreshold = threshold;
+  // Command data is rarely made of arrays, so bytes are not shuffled
+  mCompressor.configure(codec, 1);
+}
+
+CompressionStats CommandConnection::compressionStats() {
+  std::unique_lock<std::mutex> lk(mCompressorLock);
+  return mCompressor.compressStats();
+}
+
+CompressionStats CommandConnection::decompressionStats() {
+  std::unique_lock<std::mutex> lk(mDecompressorLock);
+  return mDecompressor.decompressStats();
+}
+
+void CommandConnection::encodeMessage(const uint8_t *message, size_t length,
+                                      uint8_t peerCapabilities,
+                                      std::vector<uint8_t> &out) {
+  size_t headerSize = (peerCapabilities & CAPABILITY_FRAMING) ? 4 : 0;
+  out.clear();
+  if (mCompression && (peerCapabilities & CAPABILITY_COMPRESSION) &&
+      length >= mCompressionThreshold) {
+    std::unique_lock<std::mutex> lk(mCompressorLock);
+    // Prefix the block with the command byte and its size
+    if (mCompressor.compress(message, length, mCompressed)) {
+      uint32_t blockSize = uint32_t(mCompressed.size());
+      out.resize(headerSize + 5 + mCompressed.size());
+      out[headerSize] = COMPRESSED;
+      memcpy(out.data() + headerSize + 1, &blockSize, sizeof(uint32_t));
+      memcpy(out.data() + headerSize + 5, mCompressed.data(),
+             mCompressed.size());
+    }
+  }
+  if (out.empty()) {
+    out.resize(headerSize + length);
+    memcpy(out.data() + headerSize, message, length);
+  }
+  if (headerSize > 0) {
+    uint32_t frameSize = uint32_t(out.size() - headerSize);
+    memcpy(out.data(), &frameSize, sizeof(uint32_t));
+  }
+}
+
+bool CommandConnection::sendTo(Socket &socket, const uint8_t *message,
+                               size_t length, uint8_t peerCapabilities) {
+  std::vector<uint8_t> out;
+  encodeMessage(message, length, peerCapabilities, out);
+  size_t sent = 0;
+  while (sent < out.size()) {
+    size_t bytes =
+        socket.send((const char *)out.data() + sent, out.size() - sent);
+    if (bytes == 0 || bytes > out.size() - sent) {
+      return false;
+    }
+    sent += bytes;
+  }
+  return true;
+}
+
+bool CommandConnection::processMessage(Message &message, Socket *src) {
+  if (message.remainingBytes() > 0 && message.data()[0] == PING) {
+    if (mVerbose) {
+      std::cout << "Got ping request" << std::endl;
+    }
+    message.getByte();
+    uint8_t pong[2] = {PONG, 0};
+    return sendMessage(pong, 2, mState == SERVER ? src : nullptr);
+  }
+  if (message.remainingBytes() > 0 && message.data()[0] == PONG) {
+    if (mVerbose) {
+      std::cout << "Got pong from " << src->address() << ":" << src->port()
+                << std::endl;
+    }
+    message.getByte();
+    return true;
+  }
+  if (message.remainingBytes() == 0 || message.data()[0] != COMPRESSED) {
+    return processIncomingMessage(message, src);
+  }
+  if (message.remainingBytes() < 5) {
+    std::cerr << __FILE__ << " : Truncated compressed message" << std::endl;
+    return false;
+  }
+  message.getByte();
+  uint32_t blockSize = message.getUint32();
+  if (blockSize > message.remainingBytes()) {
+    std::cerr << __FILE__ << " : Truncated compressed message" << std::endl;
+    return false;
+  }
+  std::vector<unsigned char> decompressed;
+  {
+    std::unique_lock<std::mutex> lk(mDecompressorLock);
+    if (!mDecompressor.decompress(message.data(), blockSize, decompressed,
+                                  kMaxMessageSize)) {
+      std::cerr << __FILE__ << " : Invalid compressed message" << std::endl;
+      message.pushReadIndex(blockSize);
+      return false;
+    }
+  }
+  message.pushReadIndex(blockSize);
+  Message inner(decompressed.data(), decompressed.size());
+  return processIncomingMessage(inner, src);
+}
+
+bool CommandConnection::processReceived(std::vector<uint8_t> &received,
+                                        uint8_t peerCapabilities,
+                                        Socket *src) {
+  // Each frame, or each read from peers without framing, holds one message
+  auto processBlock = [&](uint8_t *data, size_t size) {
+    Message message(data, size);
+    if (!processMessage(message, src)) {
+      std::cerr << __FILE__ << " : Unable to process message(" << (int)data[0]
+                << ") from " << src->address() << ":" << src->port()
+                << std::endl;
+    }
+  };
+
+  if (!(peerCapabilities & CAPABILITY_FRAMING)) {
+    // Older peers don't frame messages, so treat each read as a block
+    if (!received.empty()) {
+      processBlock(received.data(), received.size());
+    }
+    received.clear();
+    return true;
+  }
+
+  size_t offset = 0;
+  while (received.size() - offset >= 4) {
+    uint32_t frameSize;
+    memcpy(&frameSize, received.data() + offset, sizeof(uint32_t));
+    if (frameSize > kMaxMessageSize) {
+      std::cerr << __FILE__ << " : Message of " << frameSize
+                << " bytes is too large from " << src->address() << ":"
+                << src->port() << std::endl;
+      received.clear();
+      return false;
+    }
+    if (received.size() - offset - 4 < frameSize) {
+      break;
+    }
+    if (frameSize > 0) {
+      processBlock(received.data() + offset + 4, frameSize);
+    }
+    offset += 4 + frameSize;
+  }
+  received.erase(received.begin(), received.begin() + offset);
+  return true;
+}
+
 /// =====================================
 ///
 std::vector<float> CommandServer::ping(double timeoutSecs) {
   std::vector<float> pingTimes;
 
   std::unique_lock<std::mutex> lk(mConnectionsLock);
-  for (auto listener : mServerConnections) {
+  for (size_t i = 0; i < mServerConnections.size(); i++) {
+    auto &listener = mServerConnections[i];
     if (mVerbose) {
       std::cout << "pinging " << listener->address() << ":" << listener->port()
                 << std::endl;
@@ -69,7 +232,7 @@ std::vector<float> CommandServer::ping(double timeoutSecs) {
     unsigned char message[2] = {0, 0};
 
     message[0] = PING;
-    listener->send((const char *)message, 2);
+    queueMessage(i, message, 2);
     size_t bytes = 0;
     // FIXME need to check responses
 
@@ -120,145 +283,338 @@ bool CommandServer::start(uint16_t serverPort, const char *serverAddr) {
     return false;
   }
 
+  if (!mSocket.setBlocking(false) ||
+      !mPoller.add(mSocket, SocketPoller::READ)) {
+    std::cerr << "ERROR setting up server socket" << std::endl;
+    mSocket.close();
+    return false;
+  }
+
   mRunning = true;
-  mBootstrapServerThread = std::make_unique<std::thread>([&]() {
-    // Receive data
-    if (mVerbose) {
-      std::cout << "Server started" << std::endl;
+  mReactorThread = std::make_unique<std::thread>([&]() { runReactor(); });
+
+  mState = CommandConnection::SERVER;
+  return true;
+}
+
+void CommandServer::stop() {
+
+  mRunning = false;
+  mPoller.wakeUp();
+  if (mReactorThread) {
+    mReactorThread->join();
+    mReactorThread = nullptr;
+  }
+  for (auto &pending : mPendingConnections) {
+    mPoller.remove(*pending.socket);
+    pending.socket->close();
+  }
+  mPendingConnections.clear();
+  {
+    std::unique_lock<std::mutex> lk(mConnectionsLock);
+    for (auto connectionSocket : mServerConnections) {
+      mPoller.remove(*connectionSocket);
+      connectionSocket->close();
     }
+    mServerConnections.clear();
+    mConnectionVersions.clear();
+    mConnectionCapabilities.clear();
+    mConnectionStates.clear();
+  }
+  mPoller.remove(mSocket);
+  mSocket.close();
+  mState = BarrierState::NONE;
+}
 
-    while (mRunning) {
-      std::shared_ptr<Socket> incomingConnectionSocket =
-          std::make_shared<Socket>();
-      if (mSocket.accept(*incomingConnectionSocket)) {
-        if (mVerbose) {
-          std::cout << "Got Connection Request "
-                    << incomingConnectionSocket->address() << ":"
-                    << incomingConnectionSocket->port() << std::endl;
+void CommandServer::runReactor() {
+  if (mVerbose) {
+    std::cout << "Server started" << std::endl;
+  }
+  std::vector<SocketPoller::Event> events;
+  while (mRunning) {
+    bool legacyPending = false;
+    for (size_t i = 0; i < mPendingConnections.size();) {
+      al_sec deadline = mPendingConnections[i].legacyDeadline;
+      if (deadline > 0 && al_steady_time() >= deadline) {
+        completeHandshake(i);
+      } else {
+        legacyPending |= deadline > 0;
+        i++;
+      }
+    }
+    mPoller.wait(events, legacyPending ? kLegacyHandshakeWait : 0.5);
+    for (auto &event : events) {
+      if (event.socket == &mSocket) {
+        acceptConnections();
+        continue;
+      }
+      // Only this thread adds and removes connections, so they can be read
+      // without holding the lock
+      bool found = false;
+      for (size_t i = 0; i < mPendingConnections.size(); i++) {
+        if (mPendingConnections[i].socket.get() == event.socket) {
+          handshake(i);
+          found = true;
+          break;
         }
-        uint8_t message[8192];
-
-        int bytesRecv = incomingConnectionSocket->recv((char *)message, 8192);
-        if (bytesRecv > 0 && bytesRecv <= 8192) {
-          if (message[0] == HANDSHAKE) {
-            uint16_t version = 0;
-            uint16_t revision = 0;
-            if (bytesRecv >= 4) {
-              Convert::from_bytes((const uint8_t *)&message[1], version);
-              Convert::from_bytes((const uint8_t *)&message[3], revision);
-            }
-
-            if (mVerbose) {
-              std::cout << "Handshake for "
-                        << incomingConnectionSocket->address() << ":"
-                        << incomingConnectionSocket->port() << std::endl;
-              std::cout << "Client reports protocol version " << version
-                        << " revision " << revision << std::endl;
-            }
-
-            message[0] = HANDSHAKE_ACK;
-            memcpy(message + 1, &mVersion, sizeof(uint16_t));
-            memcpy(message + 1 + sizeof(uint16_t), &mRevision,
-                   sizeof(uint16_t));
-
-            auto bytesSent =
-                incomingConnectionSocket->send((const char *)message, 5);
-            if (bytesSent != 5) {
-              std::cerr << "ERROR sending handshake ack" << std::endl;
-            }
-            {
-              std::unique_lock<std::mutex> lk(mConnectionsLock);
-              mServerConnections.emplace_back(incomingConnectionSocket);
-              mConnectionVersions.emplace_back(
-                  std::pair<uint16_t, uint16_t>{version, revision});
-            }
-
-            onConnection(incomingConnectionSocket.get());
-
-            mConnectionThreads.emplace_back(std::make_unique<std::thread>(
-                [&](std::shared_ptr<Socket> client) {
-                  uint8_t commandMessage[8192];
-                  size_t bufferSize = 0;
-                  while (mRunning) {
-                    size_t bytes = client->recv(
-                        (char *)(commandMessage + bufferSize), 4096);
-
-                    while (bytes > 0 && bytes < 4097) {
-                      Message message(commandMessage, bytes);
-                      if (mVerbose) {
-                        std::cout << "Server received message from "
-                                  << client->address() << ":" << client->port()
-                                  << std::endl;
-                      }
-                      if (!processIncomingMessage(message, client.get())) {
-                        std::cerr << __FILE__
-                                  << " : Server unable to process message("
-                                  << (int)commandMessage[0] << ") from client "
-                                  << client->address() << ":" << client->port()
-                                  << std::endl;
-                      } else {
-                        if (message.remainingBytes() > 0) {
-                          memcpy(commandMessage, message.data(),
-                                 message.remainingBytes());
-                          bufferSize = message.remainingBytes();
-                        } else {
-                          bufferSize = 0;
-                        }
-                      }
-                      bytes = client->recv(
-                          (char *)(commandMessage + bufferSize), 4096);
-                    }
-                    if (bytes != SIZE_MAX && bytes != 0) {
-                      std::cerr
-                          << __FILE__
-                          << " : Unexpected command size. Flushing buffer."
-                          << bytes << std::endl;
-                    }
-                  }
-
-                  if (mVerbose) {
-                    std::cout << "Client stopped" << std::endl;
-                  }
-                },
-                incomingConnectionSocket));
-          } else {
-            std::cerr << __FILE__ << ": Server unable to recognize message "
-                      << (int)message[0] << std::endl;
+      }
+      for (size_t i = 0; !found && i < mServerConnections.size(); i++) {
+        if (mServerConnections[i].get() == event.socket) {
+          if (event.events & SocketPoller::WRITE) {
+            flush(i);
+          }
+          if (event.events & (SocketPoller::READ | SocketPoller::HANGUP)) {
+            receive(i);
+          } else if (mConnectionStates[i]->failed) {
+            closeConnection(i);
           }
+          break;
         }
       }
     }
-    //    incomingConnectionSocket->close();
+  }
+  if (mVerbose) {
+    std::cout << "Server stopped" << std::endl;
+  }
+}
 
+void CommandServer::acceptConnections() {
+  while (mRunning) {
+    auto incomingConnectionSocket = std::make_shared<Socket>();
+    if (!mSocket.accept(*incomingConnectionSocket)) {
+      return;
+    }
     if (mVerbose) {
-      std::cout << "Server stopped" << std::endl;
+      std::cout << "Got Connection Request "
+                << incomingConnectionSocket->address() << ":"
+                << incomingConnectionSocket->port() << std::endl;
     }
-  });
+    if (!incomingConnectionSocket->setBlocking(false) ||
+        !mPoller.add(*incomingConnectionSocket, SocketPoller::READ)) {
+      incomingConnectionSocket->close();
+      continue;
+    }
+    mPendingConnections.push_back({incomingConnectionSocket, {}});
+  }
+}
 
-  mState = CommandConnection::SERVER;
-  return true;
+void CommandServer::handshake(size_t pendingIndex) {
+  auto &pending = mPendingConnections[pendingIndex];
+  auto socket = pending.socket;
+  uint8_t buffer[64];
+  bool closed = false;
+  while (true) {
+    size_t bytes = socket->recv((char *)buffer, sizeof(buffer));
+    if (bytes == 0) {
+      closed = true;
+      break;
+    } else if (bytes > sizeof(buffer)) {
+      closed = !Socket::wouldBlock();
+      break;
+    }
+    pending.received.insert(pending.received.end(), buffer, buffer + bytes);
+  }
+  auto &received = pending.received;
+  bool valid = received.empty() || received[0] == HANDSHAKE;
+  if (!valid) {
+    std::cerr << __FILE__ << ": Server unable to recognize message "
+              << (int)received[0] << std::endl;
+  }
+  if (closed || !valid) {
+    mPoller.remove(*socket);
+    socket->close();
+    mPendingConnections.erase(mPendingConnections.begin() + pendingIndex);
+    return;
+  }
+  // The handshake can arrive in pieces. Clients send 6 bytes, or 5 if they
+  // predate capabilities. Those wait for the acknowledgement before sending
+  // anything else, so a 5 byte handshake is complete if nothing follows it
+  // for a moment.
+  if (received.size() < kHandshakeSize) {
+    if (received.size() == kHandshakeSize - 1 && pending.legacyDeadline == 0) {
+      pending.legacyDeadline = al_steady_time() + kLegacyHandshakeWait;
+    }
+    return;
+  }
+  completeHandshake(pendingIndex);
 }
 
-void CommandServer::stop() {
+void CommandServer::completeHandshake(size_t pendingIndex) {
+  auto pending = std::move(mPendingConnections[pendingIndex]);
+  mPendingConnections.erase(mPendingConnections.begin() + pendingIndex);
+  auto &socket = pending.socket;
+  size_t bytesRecv = std::min(pending.received.size(), kHandshakeSize);
+  uint8_t message[8];
+  std::copy(pending.received.begin(), pending.received.begin() + bytesRecv,
+            message);
+
+  uint16_t version = 0;
+  uint16_t revision = 0;
+  Convert::from_bytes((const uint8_t *)&message[1], version);
+  Convert::from_bytes((const uint8_t *)&message[3], revision);
+  // Clients that know about capabilities append them
+  bool hasCapabilities = bytesRecv == kHandshakeSize;
+  uint8_t clientCapabilities = hasCapabilities ? message[5] : 0;
 
-  mRunning = false;
-  mSocket.close();
-  if (mBootstrapServerThread) {
-    mBootstrapServerThread->join();
+  if (mVerbose) {
+    std::cout << "Handshake for " << socket->address() << ":"
+              << socket->port() << std::endl;
+    std::cout << "Client reports protocol version " << version
+              << " revision " << revision << std::endl;
   }
+
+  message[0] = HANDSHAKE_ACK;
+  memcpy(message + 1, &mVersion, sizeof(uint16_t));
+  memcpy(message + 1 + sizeof(uint16_t), &mRevision, sizeof(uint16_t));
+  message[5] = capabilities();
+  size_t ackSize = hasCapabilities ? 6 : 5;
   {
     std::unique_lock<std::mutex> lk(mConnectionsLock);
-    for (auto connectionSocket : mServerConnections) {
-      connectionSocket->close();
+    mServerConnections.emplace_back(socket);
+    mConnectionVersions.emplace_back(
+        std::pair<uint16_t, uint16_t>{version, revision});
+    mConnectionCapabilities.emplace_back(clientCapabilities & capabilities());
+    mConnectionStates.emplace_back(std::make_unique<Connection>());
+    mConnectionStates.back()->received.assign(
+        pending.received.begin() + bytesRecv, pending.received.end());
+    // The acknowledgement is sent as it is, framing starts after it
+    if (!queueMessage(mServerConnections.size() - 1, message, ackSize,
+                      false)) {
+      std::cerr << "ERROR sending handshake ack" << std::endl;
     }
   }
 
-  for (auto &connection : mConnectionThreads) {
-    connection->join();
+  onConnection(socket.get());
+  if (!mConnectionStates.back()->received.empty()) {
+    receive(mServerConnections.size() - 1);
   }
-  mState = BarrierState::NONE;
 }
 
+void CommandServer::receive(size_t index) {
+  auto client = mServerConnections[index];
+  auto &state = *mConnectionStates[index];
+  uint8_t buffer[8192];
+  bool closed = state.failed;
+  while (!closed) {
+    size_t bytes = client->recv((char *)buffer, sizeof(buffer));
+    if (bytes == 0) {
+      closed = true;
+    } else if (bytes > sizeof(buffer)) {
+      closed = !Socket::wouldBlock();
+      break;
+    } else {
+      state.received.insert(state.received.end(), buffer, buffer + bytes);
+    }
+  }
+  if (!state.received.empty()) {
+    if (mVerbose) {
+      std::cout << "Server received message from " << client->address() << ":"
+                << client->port() << std::endl;
+    }
+    if (!processReceived(state.received, mConnectionCapabilities[index],
+                         client.get())) {
+      closed = true;
+    }
+  }
+  if (closed) {
+    // Handlers may have closed connections, so look the client up again
+    for (size_t i = 0; i < mServerConnections.size(); i++) {
+      if (mServerConnections[i] == client) {
+        closeConnection(i);
+        break;
+      }
+    }
+  }
+}
+
+void CommandServer::closeConnection(size_t index) {
+  auto client = mServerConnections[index];
+  if (mVerbose) {
+    std::cout << "Client stopped " << client->address() << ":"
+              << client->port() << std::endl;
+  }
+  {
+    std::unique_lock<std::mutex> lk(mConnectionsLock);
+    mServerConnections.erase(mServerConnections.begin() + index);
+    mConnectionVersions.erase(mConnectionVersions.begin() + index);
+    mConnectionCapabilities.erase(mConnectionCapabilities.begin() + index);
+    mConnectionStates.erase(mConnectionStates.begin() + index);
+  }
+  onDisconnection(client.get());
+  mPoller.remove(*client);
+  client->close();
+}
+
+bool CommandServer::queueMessage(size_t index, const uint8_t *message,
+                                 size_t length, bool encode) {
+  auto &state = *mConnectionStates[index];
+  if (state.failed) {
+    return false;
+  }
+  std::vector<uint8_t> out;
+  if (encode) {
+    encodeMessage(message, length, mConnectionCapabilities[index], out);
+  } else {
+    out.assign(message, message + length);
+  }
+  if (state.queuedBytes > 0 &&
+      state.queuedBytes + out.size() > mSendQueueLimit) {
+    if (!state.overflowing) {
+      std::cerr << "Send queue full for " << mServerConnections[index]->address()
+                << ":" << mServerConnections[index]->port()
+                << ". Dropping messages" << std::endl;
+      state.overflowing = true;
+    }
+    mDroppedMessages++;
+    return false;
+  }
+  state.overflowing = false;
+  state.queuedBytes += out.size();
+  state.sendQueue.emplace_back(std::move(out));
+  if (state.sendQueue.size() == 1) {
+    flushLocked(index);
+  }
+  return !state.failed;
+}
+
+void CommandServer::flush(size_t index) {
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
+  flushLocked(index);
+}
+
+void CommandServer::flushLocked(size_t index) {
+  auto &socket = *mServerConnections[index];
+  auto &state = *mConnectionStates[index];
+  while (!state.sendQueue.empty()) {
+    auto &front = state.sendQueue.front();
+    size_t remaining = front.size() - state.sendOffset;
+    size_t bytes =
+        socket.send((const char *)front.data() + state.sendOffset, remaining);
+    if (bytes == 0 || bytes > remaining) {
+      if (bytes > remaining && !Socket::wouldBlock()) {
+        // The reactor closes the connection when it sees the error
+        state.failed = true;
+        state.sendQueue.clear();
+        state.sendOffset = 0;
+        state.queuedBytes = 0;
+      }
+      break;
+    }
+    state.sendOffset += bytes;
+    if (state.sendOffset == front.size()) {
+      state.queuedBytes -= front.size();
+      state.sendQueue.pop_front();
+      state.sendOffset = 0;
+    }
+  }
+  // Only wait for the socket to become writable while data is queued
+  bool watchWrite = !state.sendQueue.empty();
+  if (watchWrite != state.writeWatched) {
+    mPoller.modify(socket, SocketPoller::READ |
+                               (watchWrite ? SocketPoller::WRITE : 0));
+    state.writeWatched = watchWrite;
+  }
+}
 uint16_t CommandServer::waitForConnections(uint16_t connectionCount,
                                            double timeout) {
   if (mState == BarrierState::SERVER) {
@@ -301,17 +657,17 @@ bool CommandServer::sendMessage(uint8_t *message, size_t length,
     return false;
   }
 
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
   if (!dst) {
-
-    std::unique_lock<std::mutex> lk(mConnectionsLock);
-    for (auto connection : mServerConnections) {
+    for (size_t i = 0; i < mServerConnections.size(); i++) {
+      auto &connection = mServerConnections[i];
       if (!src || connection->address() != src->ipAddr ||
           connection->port() != src->port) {
         if (mVerbose) {
           std::cout << "Sending message to " << connection->address() << ":"
                     << connection->port() << std::endl;
         }
-        ret &= connection->send((const char *)message, length) == length;
+        ret &= queueMessage(i, message, length);
       }
     }
 
@@ -320,11 +676,26 @@ bool CommandServer::sendMessage(uint8_t *message, size_t length,
       std::cout << "Sending message to " << dst->address() << ":" << dst->port()
                 << std::endl;
     }
-    ret = dst->send((const char *)message, length) == length;
+    ret = false;
+    for (size_t i = 0; i < mServerConnections.size(); i++) {
+      if (mServerConnections[i].get() == dst) {
+        ret = queueMessage(i, message, length);
+        break;
+      }
+    }
   }
   return ret;
 }
 
+size_t CommandServer::queuedBytes() {
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
+  size_t bytes = 0;
+  for (auto &state : mConnectionStates) {
+    bytes += state->queuedBytes;
+  }
+  return bytes;
+}
+
 // -----------------------------------------------------------------------
 
 bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
@@ -332,8 +703,10 @@ bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
     std::cerr << "Error opening bootstrap socket" << std::endl;
     return false;
   }
+  mDisconnected = false;
   std::condition_variable cv;
   std::mutex mutex;
+  bool handshakeDone = false;
   std::unique_lock<std::mutex> lk(mutex);
   mConnectionThreads.push_back(std::make_unique<std::thread>([&]() {
     // For a client connection, mSocket is connected to a server socket on
@@ -341,6 +714,9 @@ bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
 
     if (!mSocket.connect()) {
       std::cerr << "Error connecting bootstrap socket" << std::endl;
+      std::unique_lock<std::mutex> lk(mutex);
+      handshakeDone = true;
+      cv.notify_one();
       return;
     }
 
@@ -352,14 +728,20 @@ bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
 
     memcpy(message + 1, &mVersion, sizeof(uint16_t));
     memcpy(message + 1 + sizeof(uint16_t), &mRevision, sizeof(uint16_t));
+    // The capabilities are always sent, as framing is always offered.
+    // Servers that predate them read the handshake with a single recv(),
+    // ignore the extra byte and answer with 5 bytes, after which messages
+    // are sent without framing.
+    message[5] = capabilities();
 
     // TODO provide functionality to validat connection versions
-    auto bytesSent = mSocket.send((const char *)message, 5);
-    if (bytesSent != 5) {
+    auto bytesSent = mSocket.send((const char *)message, kHandshakeSize);
+    if (bytesSent != kHandshakeSize) {
       std::cerr << "ERROR sending handshake" << std::endl;
     }
-    size_t bytesRecv = mSocket.recv((char *)message, 5);
-    if (bytesRecv == 5 && message[0] == HANDSHAKE_ACK) {
+    size_t bytesRecv = mSocket.recv((char *)message, kHandshakeSize);
+    if (bytesRecv >= 5 && bytesRecv <= 6 && message[0] == HANDSHAKE_ACK) {
+      mServerCapabilities = bytesRecv == 6 ? message[5] & capabilities() : 0;
       uint16_t version = 0;
       uint16_t revision = 0;
       if (bytesRecv >= 4) {
@@ -374,14 +756,20 @@ bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
       }
       mRunning = true;
     } else {
+      std::cerr << "ERROR: no handshake ack from server" << std::endl;
+      mRunning = false;
+      std::unique_lock<std::mutex> lk(mutex);
+      handshakeDone = true;
+      cv.notify_one();
       return;
     }
     {
       std::unique_lock<std::mutex> lk(mutex);
+      handshakeDone = true;
       cv.notify_one();
     }
-    uint8_t commandMessage[2048];
-    size_t bufferSize = 0;
+    std::vector<uint8_t> received;
+    uint8_t buffer[8192];
 
     onConnection(&mSocket);
     while (mRunning) {
@@ -389,34 +777,24 @@ bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
         std::cerr << "ERROR: Socket not open" << std::endl;
       }
 
-      size_t bytes = mSocket.recv((char *)(commandMessage + bufferSize), 1024);
-      if (bytes > 0 && bytes < 1025) {
-        bufferSize += bytes;
-        if (commandMessage[0] == PING) {
-          clientHandlePing(mSocket);
-        } else {
-          Message message(commandMessage, bytes);
-          if (mVerbose) {
-            std::cout << "Client received message from " << mSocket.address()
-                      << ":" << mSocket.port() << std::endl;
-          }
-          if (!processIncomingMessage(message, &mSocket)) {
-            std::cerr << __FILE__ << " : Client unable to process message("
-                      << (int)commandMessage[0] << ") from "
-                      << mSocket.address() << ":" << mSocket.port()
-                      << std::endl;
-
-          } else {
-            if (message.remainingBytes() > 0) {
-              memcpy(commandMessage, message.data(), message.remainingBytes());
-              bufferSize = message.remainingBytes();
-            } else {
-              bufferSize = 0;
-            }
-          }
+      size_t bytes = mSocket.recv((char *)buffer, sizeof(buffer));
+      if (bytes == 0) {
+        if (mRunning) {
+          std::cerr << "Connection closed by server " << mSocket.address()
+                    << ":" << mSocket.port() << std::endl;
+        }
+        mDisconnected = true;
+        break;
+      } else if (bytes <= sizeof(buffer)) {
+        received.insert(received.end(), buffer, buffer + bytes);
+        if (mVerbose) {
+          std::cout << "Client received message from " << mSocket.address()
+                    << ":" << mSocket.port() << std::endl;
+        }
+        if (!processReceived(received, mServerCapabilities, &mSocket)) {
+          mDisconnected = true;
+          break;
         }
-      } else if (bytes != SIZE_MAX && bytes != 0) {
-        std::cerr << "ERROR: Network buffer overrun. " << bytes << std::endl;
       }
     }
     //        connectionSocket.close();
@@ -425,19 +803,24 @@ bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
     }
   }));
 
-  cv.wait(lk);
-  return true;
+  // Wait for the handshake, which also fails if no server is found
+  cv.wait(lk, [&]() { return handshakeDone; });
+  if (!mRunning) {
+    mConnectionThreads.back()->join();
+    mConnectionThreads.pop_back();
+  }
+  return mRunning;
 }
 
 void CommandClient::clientHandlePing(Socket &client) {
   if (mVerbose) {
     std::cout << "Client got ping request" << std::endl;
   }
-  char buffer[2] = {0, 0};
+  uint8_t buffer[2] = {0, 0};
   buffer[0] = PONG;
   //  std::cout << "sending pong" << std::endl;
-  int bytesSent = client.send((const char *)buffer, 2);
-  if (bytesSent != 2) {
+  std::unique_lock<std::mutex> lk(mSendLock);
+  if (!sendTo(client, buffer, 2, mServerCapabilities)) {
     std::cerr << "ERROR: sent bytes mismatch for pong" << std::endl;
   }
 }
@@ -456,7 +839,8 @@ bool CommandClient::sendMessage(uint8_t *message, size_t length, Socket *dst,
         std::cout << "Sending message to " << mSocket.address() << ":"
                   << mSocket.port() << std::endl;
       }
-      ret = mSocket.send((const char *)message, length) == length;
+      std::unique_lock<std::mutex> lk(mSendLock);
+      ret = sendTo(mSocket, message, length, mServerCapabilities);
     }
   } else {
     if (mSocket.address() != dst->address() || mSocket.port() != dst->port()) {
@@ -464,7 +848,8 @@ bool CommandClient::sendMessage(uint8_t *message, size_t length, Socket *dst,
         std::cout << "Sending message to " << dst->address() << ":"
                   << dst->port() << std::endl;
       }
-      ret = dst->send((const char *)message, length) == length;
+      std::unique_lock<std::mutex> lk(mSendLock);
+      ret = sendTo(*dst, message, length, 0);
     }
   }
   return ret;
@@ -0,0 +1,314 @@
+#include "al/protocol/al_Compression.hpp"
+
+#include <cstring>
+
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+namespace {
+const size_t kMinMatch = 4;
+// The last bytes are always literals, which lets the decoder copy without
+// checking for the end of the input inside a match
+const size_t kLastLiterals = 5;
+const size_t kMatchSearchLimit = 12;
+const size_t kMaxOffset = 65535;
+const int kHashBits = 14;
+
+inline uint32_t read32(const unsigned char *p) {
+  uint32_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline uint64_t read64(const unsigned char *p) {
+  uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+inline uint32_t hashSequence(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+// Writes the 15+ part of a length
+inline unsigned char *writeLength(unsigned char *op, size_t length) {
+  while (length >= 255) {
+    *op++ = 255;
+    length -= 255;
+  }
+  *op++ = (unsigned char)length;
+  return op;
+}
+
+inline bool readLength(const unsigned char *&ip, const unsigned char *end,
+                       size_t &length) {
+  unsigned char byte;
+  do {
+    if (ip >= end) {
+      return false;
+    }
+    byte = *ip++;
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+inline unsigned char *writeSequence(unsigned char *op,
+                                    const unsigned char *literals,
+                                    size_t literalLength) {
+  unsigned char *token = op++;
+  if (literalLength >= 15) {
+    *token = 15 << 4;
+    op = writeLength(op, literalLength - 15);
+  } else {
+    *token = (unsigned char)(literalLength << 4);
+  }
+  if (literalLength > 0) {
+    std::memcpy(op, literals, literalLength);
+  }
+  return op + literalLength;
+}
+
+void writeHeader(unsigned char *out, CompressionCodec codec,
+                 uint8_t elementSize, uint32_t size) {
+  out[0] = (unsigned char)codec;
+  out[1] = elementSize;
+  out[2] = 0;
+  out[3] = 0;
+  std::memcpy(out + 4, &size, sizeof(size));
+}
+} // namespace
+
+size_t al::lzCompress(const unsigned char *in, size_t size, unsigned char *out,
+                      size_t capacity) {
+  if (capacity < lzCompressBound(size)) {
+    return 0;
+  }
+  unsigned char *op = out;
+  size_t anchor = 0;
+  if (size > kMatchSearchLimit) {
+    uint32_t table[1 << kHashBits];
+    std::memset(table, 0, sizeof(table));
+    const size_t searchLimit = size - kMatchSearchLimit;
+    const size_t matchLimit = size - kLastLiterals;
+    size_t ip = 1;
+    while (ip < searchLimit) {
+      uint32_t sequence = read32(in + ip);
+      uint32_t &entry = table[hashSequence(sequence)];
+      size_t candidate = entry;
+      entry = uint32_t(ip);
+      if (ip - candidate > kMaxOffset || read32(in + candidate) != sequence) {
+        // Skip faster through data that does not compress
+        ip += 1 + ((ip - anchor) >> 6);
+        continue;
+      }
+      // Extend the match backwards over literals and then forwards
+      while (ip > anchor && candidate > 0 && in[ip - 1] == in[candidate - 1]) {
+        ip--;
+        candidate--;
+      }
+      size_t length = kMinMatch;
+      while (ip + length + 8 <= matchLimit &&
+             read64(in + ip + length) == read64(in + candidate + length)) {
+        length += 8;
+      }
+      while (ip + length < matchLimit &&
+             in[ip + length] == in[candidate + length]) {
+        length++;
+      }
+
+      unsigned char *token = op;
+      op = writeSequence(op, in + anchor, ip - anchor);
+      size_t offset = ip - candidate;
+      *op++ = (unsigned char)(offset & 0xff);
+      *op++ = (unsigned char)(offset >> 8);
+      size_t matchCode = length - kMinMatch;
+      if (matchCode >= 15) {
+        *token |= 15;
+        op = writeLength(op, matchCode - 15);
+      } else {
+        *token |= (unsigned char)matchCode;
+      }
+      ip += length;
+      anchor = ip;
+      if (ip - 2 < searchLimit) {
+        table[hashSequence(read32(in + ip - 2))] = uint32_t(ip - 2);
+      }
+    }
+  }
+  op = writeSequence(op, in + anchor, size - anchor);
+  return size_t(op - out);
+}
+
+bool al::lzDecompress(const unsigned char *in, size_t inSize,
+                      unsigned char *out, size_t size) {
+  const unsigned char *ip = in;
+  const unsigned char *end = in + inSize;
+  size_t op = 0;
+  while (ip < end) {
+    unsigned char token = *ip++;
+    size_t literalLength = token >> 4;
+    if (literalLength == 15 && !readLength(ip, end, literalLength)) {
+      return false;
+    }
+    if (literalLength > size_t(end - ip) || literalLength > size - op) {
+      return false;
+    }
+    if (literalLength > 0) {
+      std::memcpy(out + op, ip, literalLength);
+    }
+    ip += literalLength;
+    op += literalLength;
+    if (ip == end) {
+      break; // Last sequence has no match
+    }
+    if (end - ip < 2) {
+      return false;
+    }
+    size_t offset = size_t(ip[0]) | (size_t(ip[1]) << 8);
+    ip += 2;
+    size_t length = token & 15;
+    if (length == 15 && !readLength(ip, end, length)) {
+      return false;
+    }
+    length += kMinMatch;
+    if (offset == 0 || offset > op || length > size - op) {
+      return false;
+    }
+    const unsigned char *match = out + op - offset;
+    if (offset >= length) {
+      std::memcpy(out + op, match, length);
+    } else {
+      // Overlapping copy repeats the last offset bytes
+      for (size_t i = 0; i < length; i++) {
+        out[op + i] = match[i];
+      }
+    }
+    op += length;
+  }
+  return op == size;
+}
+
+void al::byteShuffle(const unsigned char *in, unsigned char *out, size_t size,
+                     size_t elementSize) {
+  if (elementSize < 2) {
+    if (size > 0) {
+      std::memcpy(out, in, size);
+    }
+    return;
+  }
+  size_t count = size / elementSize;
+  for (size_t byte = 0; byte < elementSize; byte++) {
+    unsigned char *dst = out + byte * count;
+    const unsigned char *src = in + byte;
+    for (size_t i = 0; i < count; i++) {
+      dst[i] = src[i * elementSize];
+    }
+  }
+  size_t tail = count * elementSize;
+  if (tail < size) {
+    std::memcpy(out + tail, in + tail, size - tail);
+  }
+}
+
+void al::byteUnshuffle(const unsigned char *in, unsigned char *out,
+                       size_t size, size_t elementSize) {
+  if (elementSize < 2) {
+    if (size > 0) {
+      std::memcpy(out, in, size);
+    }
+    return;
+  }
+  size_t count = size / elementSize;
+  for (size_t byte = 0; byte < elementSize; byte++) {
+    const unsigned char *src = in + byte * count;
+    unsigned char *dst = out + byte;
+    for (size_t i = 0; i < count; i++) {
+      dst[i * elementSize] = src[i];
+    }
+  }
+  size_t tail = count * elementSize;
+  if (tail < size) {
+    std::memcpy(out + tail, in + tail, size - tail);
+  }
+}
+
+// Compressor ------------------------------------------------------------------
+
+void Compressor::configure(CompressionCodec codec, uint8_t elementSize) {
+  mCodec = codec;
+  mElementSize = elementSize > 0 ? elementSize : 1;
+}
+
+bool Compressor::compress(const void *data, size_t size,
+                          std::vector<unsigned char> &out) {
+  al_sec start = al_steady_time();
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  mCompressStats.blocks++;
+  mCompressStats.rawBytes += size;
+  size_t written = 0;
+  if (mCodec != CompressionCodec::NONE && size <= UINT32_MAX) {
+    out.resize(kHeaderSize + lzCompressBound(size));
+    writeHeader(out.data(), mCodec, mElementSize, uint32_t(size));
+    if (mCodec == CompressionCodec::SHUFFLE_LZ) {
+      mShuffled.resize(size);
+      byteShuffle(bytes, mShuffled.data(), size, mElementSize);
+      bytes = mShuffled.data();
+    }
+    written = lzCompress(bytes, size, out.data() + kHeaderSize,
+                         out.size() - kHeaderSize);
+  }
+  mCompressStats.seconds += al_steady_time() - start;
+  if (written == 0 || kHeaderSize + written >= size) {
+    mCompressStats.blocksRaw++;
+    mCompressStats.codedBytes += size;
+    return false;
+  }
+  out.resize(kHeaderSize + written);
+  mCompressStats.codedBytes += out.size();
+  return true;
+}
+
+size_t Compressor::decompressedSize(const void *block, size_t size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(block);
+  if (size < kHeaderSize || bytes[0] == 0 ||
+      bytes[0] > (unsigned char)CompressionCodec::SHUFFLE_LZ) {
+    return 0;
+  }
+  uint32_t rawSize;
+  std::memcpy(&rawSize, bytes + 4, sizeof(rawSize));
+  return rawSize;
+}
+
+bool Compressor::decompress(const void *block, size_t size,
+                            std::vector<unsigned char> &out, size_t maxSize) {
+  size_t rawSize = decompressedSize(block, size);
+  if (rawSize == 0 || rawSize > maxSize) {
+    return false;
+  }
+  al_sec start = al_steady_time();
+  const unsigned char *bytes = static_cast<const unsigned char *>(block);
+  CompressionCodec codec = CompressionCodec(bytes[0]);
+  uint8_t elementSize = bytes[1];
+  out.resize(rawSize);
+  bool ok;
+  if (codec == CompressionCodec::SHUFFLE_LZ) {
+    mShuffled.resize(rawSize);
+    ok = lzDecompress(bytes + kHeaderSize, size - kHeaderSize,
+                      mShuffled.data(), rawSize);
+    if (ok) {
+      byteUnshuffle(mShuffled.data(), out.data(), rawSize, elementSize);
+    }
+  } else {
+    ok = lzDecompress(bytes + kHeaderSize, size - kHeaderSize, out.data(),
+                      rawSize);
+  }
+  mDecompressStats.seconds += al_steady_time() - start;
+  if (ok) {
+    mDecompressStats.blocks++;
+    mDecompressStats.rawBytes += rawSize;
+    mDecompressStats.codedBytes += size;
+  }
+  return ok;
+}
@@ -0,0 +1,387 @@
+#include "al/protocol/al_FrameBarrier.hpp"
+
+#include <cstring>
+#include <iostream>
+
+using namespace al;
+
+namespace {
+enum {
+  BARRIER_REGISTER = CommandConnection::COMMAND_LAST_INTERNAL,
+  BARRIER_REGISTER_ACK
+};
+
+enum : uint8_t { PACKET_READY = 1, PACKET_RELEASE = 2 };
+
+// UDP packet: type, unused byte, client id, frame
+const size_t kPacketSize = 8;
+// Lost ready packets are sent again after this time
+const al_sec kResendInterval = 0.002;
+// Renderers that miss this many frames in a row are no longer waited for
+const uint16_t kMaxMissedFrames = 3;
+
+void writePacket(char *packet, uint8_t type, uint16_t id, uint32_t frame) {
+  packet[0] = char(type);
+  packet[1] = 0;
+  std::memcpy(packet + 2, &id, sizeof(id));
+  std::memcpy(packet + 4, &frame, sizeof(frame));
+}
+
+bool readPacket(const char *packet, size_t size, uint8_t &type, uint16_t &id,
+                uint32_t &frame) {
+  if (size != kPacketSize) {
+    return false;
+  }
+  type = uint8_t(packet[0]);
+  std::memcpy(&id, packet + 2, sizeof(id));
+  std::memcpy(&frame, packet + 4, sizeof(frame));
+  return true;
+}
+
+// Frame numbers wrap around
+bool frameReached(uint32_t frame, uint32_t target) {
+  return int32_t(frame - target) >= 0;
+}
+
+void addWait(FrameBarrierStats &stats, double wait, bool timedOut) {
+  stats.frames++;
+  stats.lastWait = wait;
+  stats.totalWait += wait;
+  if (wait > stats.maxWait) {
+    stats.maxWait = wait;
+  }
+  if (timedOut) {
+    stats.timeouts++;
+  }
+}
+} // namespace
+
+// FrameBarrierServer ----------------------------------------------------------
+
+FrameBarrierServer::FrameBarrierServer() {
+  mVersion = 1;
+  mRevision = 0;
+}
+
+FrameBarrierServer::~FrameBarrierServer() {
+  if (mUdpRunning) {
+    stop();
+  }
+}
+
+bool FrameBarrierServer::start(uint16_t serverPort, const char *serverAddr) {
+  if (!mUdpSocket.open(serverPort, serverAddr, 0.1,
+                       Socket::UDP | Socket::DGRAM)) {
+    std::cerr << "ERROR opening frame barrier port " << serverPort
+              << std::endl;
+    return false;
+  }
+  if (!CommandServer::start(serverPort, serverAddr)) {
+    mUdpSocket.close();
+    return false;
+  }
+  mUdpRunning = true;
+  mUdpThread = std::make_unique<std::thread>([this]() {
+    char packet[16];
+    while (mUdpRunning) {
+      size_t bytes = mUdpSocket.recv(packet, sizeof(packet));
+      uint8_t type;
+      uint16_t id;
+      uint32_t frame;
+      if (!readPacket(packet, bytes, type, id, frame) ||
+          type != PACKET_READY) {
+        continue;
+      }
+      std::shared_ptr<SocketClient> releaseSocket;
+      uint32_t releaseFrame;
+      {
+        std::unique_lock<std::mutex> lk(mBarrierLock);
+        if (id >= mClients.size() || !mClients[id].socket) {
+          continue;
+        }
+        auto &client = mClients[id];
+        client.active = true;
+        if (frameReached(frame, client.readyFrame)) {
+          client.readyFrame = frame;
+        }
+        if (frameReached(mFrame, frame)) {
+          // Released already, the release was lost or the renderer was late
+          releaseSocket = client.socket;
+          releaseFrame = mFrame;
+        } else {
+          mReadyCondition.notify_one();
+        }
+      }
+      if (releaseSocket) {
+        sendRelease(*releaseSocket, releaseFrame);
+      }
+    }
+  });
+  return true;
+}
+
+void FrameBarrierServer::stop() {
+  mUdpRunning = false;
+  if (mUdpThread) {
+    mUdpThread->join();
+    mUdpThread = nullptr;
+  }
+  mUdpSocket.close();
+  CommandServer::stop();
+  std::unique_lock<std::mutex> lk(mBarrierLock);
+  mClients.clear();
+}
+
+bool FrameBarrierServer::allReady(uint32_t frame) {
+  for (auto &client : mClients) {
+    if (client.active && !frameReached(client.readyFrame, frame)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void FrameBarrierServer::sendRelease(SocketClient &socket, uint32_t frame) {
+  char packet[kPacketSize];
+  writePacket(packet, PACKET_RELEASE, 0, frame);
+  socket.send(packet, kPacketSize);
+}
+
+bool FrameBarrierServer::sync() {
+  al_sec start = al_steady_time();
+  std::unique_lock<std::mutex> lk(mBarrierLock);
+  mReleaseSockets.clear();
+  uint32_t frame = mFrame + 1;
+  bool ready = mReadyCondition.wait_for(
+      lk, std::chrono::microseconds(int64_t(mTimeout * 1.0e6)),
+      [&]() { return allReady(frame); });
+  mFrame = frame;
+  for (auto &client : mClients) {
+    if (!client.socket) {
+      continue;
+    }
+    if (frameReached(client.readyFrame, frame)) {
+      client.missedFrames = 0;
+    } else if (client.active && ++client.missedFrames >= kMaxMissedFrames) {
+      std::cerr << "Frame barrier: renderer " << client.socket->address()
+                << ":" << client.socket->port() << " not responding"
+                << std::endl;
+      client.active = false;
+    }
+    mReleaseSockets.push_back(client.socket);
+  }
+  addWait(mStats, al_steady_time() - start, !ready);
+  lk.unlock();
+  // Renderers are released without holding the lock, so that ready packets
+  // are not held up by the sends
+  for (auto &socket : mReleaseSockets) {
+    sendRelease(*socket, frame);
+  }
+  return ready;
+}
+
+size_t FrameBarrierServer::activeClients() {
+  std::unique_lock<std::mutex> lk(mBarrierLock);
+  size_t count = 0;
+  for (auto &client : mClients) {
+    if (client.active) {
+      count++;
+    }
+  }
+  return count;
+}
+
+FrameBarrierStats FrameBarrierServer::stats() {
+  std::unique_lock<std::mutex> lk(mBarrierLock);
+  return mStats;
+}
+
+bool FrameBarrierServer::processIncomingMessage(Message &message,
+                                                Socket *src) {
+  if (message.remainingBytes() < 3 || message.getByte() != BARRIER_REGISTER) {
+    return false;
+  }
+  uint16_t udpPort = message.get<uint16_t>();
+  size_t id;
+  {
+    std::unique_lock<std::mutex> lk(mBarrierLock);
+    // A renderer that registers again takes over its slot. Otherwise use the
+    // slot of a renderer that has disconnected.
+    id = mClients.size();
+    for (size_t i = 0; i < mClients.size(); i++) {
+      auto &socket = mClients[i].socket;
+      if (socket && socket->port() == udpPort &&
+          socket->address() == src->address()) {
+        id = i;
+        break;
+      } else if (!socket && id == mClients.size()) {
+        id = i;
+      }
+    }
+    if (id > UINT16_MAX) {
+      std::cerr << "ERROR: too many frame barrier renderers" << std::endl;
+      return false;
+    }
+    BarrierClient client;
+    client.socket = std::make_shared<SocketClient>();
+    if (!client.socket->open(udpPort, src->address().c_str(), 0,
+                             Socket::UDP | Socket::DGRAM)) {
+      std::cerr << "ERROR opening frame barrier socket for "
+                << src->address() << ":" << udpPort << std::endl;
+      return false;
+    }
+    client.connection = src;
+    // Don't hold the current frame for a renderer that just joined
+    client.readyFrame = mFrame + 1;
+    if (id == mClients.size()) {
+      mClients.push_back(std::move(client));
+    } else {
+      mClients[id] = std::move(client);
+    }
+  }
+  uint8_t reply[3];
+  reply[0] = BARRIER_REGISTER_ACK;
+  uint16_t replyId = uint16_t(id);
+  std::memcpy(reply + 1, &replyId, sizeof(replyId));
+  if (mVerbose) {
+    std::cout << "Frame barrier: registered " << src->address() << ":"
+              << udpPort << " as " << id << std::endl;
+  }
+  return sendMessage(reply, 3, src);
+}
+
+void FrameBarrierServer::onDisconnection(Socket *connection) {
+  std::unique_lock<std::mutex> lk(mBarrierLock);
+  for (auto &client : mClients) {
+    if (client.connection == connection) {
+      if (mVerbose) {
+        std::cout << "Frame barrier: renderer " << client.socket->address()
+                  << ":" << client.socket->port() << " disconnected"
+                  << std::endl;
+      }
+      client = BarrierClient();
+      client.active = false;
+    }
+  }
+  // Waiting renderers may all be ready now
+  mReadyCondition.notify_one();
+}
+
+// FrameBarrierClient ----------------------------------------------------------
+
+FrameBarrierClient::FrameBarrierClient() {
+  mVersion = 1;
+  mRevision = 0;
+}
+
+FrameBarrierClient::~FrameBarrierClient() {
+  if (mRunning) {
+    stop();
+  }
+}
+
+bool FrameBarrierClient::start(uint16_t serverPort, const char *serverAddr) {
+  // Several renderers can run on one machine, so find a free port for the
+  // release messages
+  uint16_t udpPort = 0;
+  for (uint16_t port = serverPort + 1; port < serverPort + 64; port++) {
+    if (mUdpSocket.open(port, "0.0.0.0", kResendInterval,
+                        Socket::UDP | Socket::DGRAM)) {
+      udpPort = port;
+      break;
+    }
+  }
+  if (udpPort == 0) {
+    std::cerr << "ERROR: no free port for frame barrier" << std::endl;
+    return false;
+  }
+  if (!mServerSocket.open(serverPort, serverAddr, 0,
+                          Socket::UDP | Socket::DGRAM) ||
+      !CommandClient::start(serverPort, serverAddr)) {
+    stop();
+    return false;
+  }
+  uint8_t message[3];
+  message[0] = BARRIER_REGISTER;
+  std::memcpy(message + 1, &udpPort, sizeof(udpPort));
+  if (!sendMessage(message, 3)) {
+    std::cerr << "ERROR: frame barrier registration not sent" << std::endl;
+    stop();
+    return false;
+  }
+
+  bool registered;
+  {
+    // The connection thread takes this lock when the ack arrives, so it must
+    // be released before stop() joins that thread
+    std::unique_lock<std::mutex> lk(mRegisterLock);
+    registered = mRegisterCondition.wait_for(
+        lk, std::chrono::seconds(2), [this]() { return bool(mRegistered); });
+  }
+  if (!registered) {
+    std::cerr << "ERROR: frame barrier registration timed out" << std::endl;
+    stop();
+    return false;
+  }
+  return true;
+}
+
+void FrameBarrierClient::stop() {
+  mRegistered = false;
+  CommandClient::stop();
+  mUdpSocket.close();
+  mServerSocket.close();
+}
+
+void FrameBarrierClient::sendReady(uint32_t frame) {
+  char packet[kPacketSize];
+  writePacket(packet, PACKET_READY, mId, frame);
+  mServerSocket.send(packet, kPacketSize);
+}
+
+bool FrameBarrierClient::sync() {
+  if (!mRegistered) {
+    return false;
+  }
+  al_sec start = al_steady_time();
+  al_sec deadline = start + mTimeout;
+  uint32_t target = mFrame + 1;
+  bool released = false;
+  sendReady(target);
+  while (!released) {
+    char packet[16];
+    size_t bytes = mUdpSocket.recv(packet, sizeof(packet));
+    uint8_t type;
+    uint16_t id;
+    uint32_t frame;
+    if (readPacket(packet, bytes, type, id, frame)) {
+      // Older releases may still be queued, e.g. duplicates
+      if (type == PACKET_RELEASE && frameReached(frame, target)) {
+        mFrame = frame;
+        released = true;
+      }
+    } else if (al_steady_time() < deadline) {
+      sendReady(target);
+    }
+    if (!released && al_steady_time() >= deadline) {
+      break;
+    }
+  }
+  addWait(mStats, al_steady_time() - start, !released);
+  return released;
+}
+
+bool FrameBarrierClient::processIncomingMessage(Message &message,
+                                                Socket * /*src*/) {
+  if (message.remainingBytes() < 3 ||
+      message.getByte() != BARRIER_REGISTER_ACK) {
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> lk(mRegisterLock);
+    mId = message.get<uint16_t>();
+    mRegistered = true;
+  }
+  mRegisterCondition.notify_all();
+  return true;
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include <iostream>
+#include <new>
 
 #include "al/system/al_Printing.hpp"
 #include "ip/UdpSocket.h"
@@ -181,11 +182,35 @@ public:
   ::osc::ReceivedMessageArgumentStream args;
 };
 
+Message::Message() : mTimeTag(1) { mSenderAddr[0] = '\0'; }
+
 Message::Message(const char *message, int size, const TimeTag &timeTag,
                  const char *senderAddr)
-    : mImpl(new Impl(message, size)), mTimeTag(timeTag) {
-  OSCTRY("Message()", mAddressPattern = mImpl->AddressPattern();
-         mTypeTags = mImpl->ArgumentCount() ? mImpl->TypeTags() : "";
+    : Message() {
+  reset(message, size, timeTag, senderAddr);
+}
+
+Message::~Message() {
+  if (mImpl) {
+    mImpl->~Impl();
+  }
+}
+
+void Message::reset(const char *message, int size, const TimeTag &timeTag,
+                    const char *senderAddr) {
+  static_assert(sizeof(Impl) <= sizeof(mImplStorage),
+                "Message::Impl does not fit in Message::mImplStorage");
+  static_assert(alignof(Impl) <= 8, "Message::Impl alignment too large");
+  if (mImpl) {
+    mImpl->~Impl();
+    mImpl = nullptr;
+  }
+  mAddressPattern.clear();
+  mTypeTags.clear();
+  mTimeTag = timeTag;
+  OSCTRY("Message()", mImpl = new (mImplStorage) Impl(message, size);
+         mAddressPattern = mImpl->AddressPattern();
+         if (mImpl->ArgumentCount()) { mTypeTags = mImpl->TypeTags(); };
          resetStream();)
   if (senderAddr != nullptr) {
     strncpy(mSenderAddr, senderAddr, 32);
@@ -194,8 +219,6 @@ Message::Message(const char *message, int size, const TimeTag &timeTag,
   }
 }
 
-Message::~Message() { OSCTRY("~Message()", delete mImpl;) }
-
 void Message::print() const {
   OSCTRY(
       "Message::print",
@@ -285,10 +308,13 @@ Message &Message::operator>>(Blob &v) {
 
 class Send::SocketSender {
 public:
-  UdpTransmitSocket transmitSocket;
+  UdpSocket transmitSocket;
 
-  SocketSender(uint16_t port, const char *address)
-      : transmitSocket{IpEndpointName{address, port}} {}
+  SocketSender(uint16_t port, const char *address) {
+    // Connecting to a broadcast address fails unless broadcast is enabled
+    transmitSocket.SetEnableBroadcast(true);
+    transmitSocket.Connect(IpEndpointName{address, port});
+  }
 
   size_t send(const char *data, std::size_t size) {
     transmitSocket.Send(data, size);
@@ -319,6 +345,18 @@ bool Send::open(uint16_t port, const char *address) {
   return true;
 }
 
+void Send::multicastTTL(int ttl) {
+  if (socketSender) {
+    socketSender->transmitSocket.SetMulticastTTL(ttl);
+  }
+}
+
+void Send::multicastLoopback(bool loopback) {
+  if (socketSender) {
+    socketSender->transmitSocket.SetMulticastLoopback(loopback);
+  }
+}
+
 size_t Send::send() {
   size_t r = send(*this);
   OSCTRY("Packet::endMessage", Packet::clear();)
@@ -331,6 +369,12 @@ size_t Send::send(const Packet &p) {
   return r;
 }
 
+size_t Send::sendRaw(const char *data, size_t size) {
+  size_t r = 0;
+  OSCTRY("Send::sendRaw", r = socketSender->send(data, size);)
+  return r;
+}
+
 static void *recvThreadFunc(void *user) {
   Recv *r = static_cast<Recv *>(user);
   r->loop();
@@ -369,10 +413,10 @@ public:
   void stop() { receiveSocket.AsynchronousBreak(); }
 };
 
-Recv::Recv() : mBuffer(1024), mBackground(false) {}
+Recv::Recv() : mBackground(false) {}
 
 Recv::Recv(uint16_t port, const char *address, al_sec timeout)
-    : mBuffer(1024), mBackground(false) {
+    : mBackground(false) {
   open(port, address, timeout);
 }
 
@@ -400,6 +444,26 @@ bool Recv::open(uint16_t port, const char *address, al_sec timeout) {
   return true;
 }
 
+bool Recv::joinMulticastGroup(const char *group,
+                              const char *interfaceAddress) {
+  if (!socketReceiver) {
+    return false;
+  }
+  try {
+    unsigned long interfaceIp = IpEndpointName::ANY_ADDRESS;
+    if (*interfaceAddress != '\0') {
+      interfaceIp = IpEndpointName(interfaceAddress).address;
+    }
+    socketReceiver->receiveSocket.JoinMulticastGroup(IpEndpointName(group),
+                                                     interfaceIp);
+  } catch (const std::runtime_error &e) {
+    std::cout << "run time exception at Recv::joinMulticastGroup: "
+              << e.what() << " " << group << std::endl;
+    return false;
+  }
+  return true;
+}
+
 int Recv::recv() { return 0; }
 
 bool Recv::start() {
@@ -418,12 +482,32 @@ void Recv::stop() {
 }
 
 void Recv::parse(const char *packet, int size, const char *senderAddr) {
-  std::memcpy(&mBuffer[0], packet, size);
-  auto messages = parse(&mBuffer[0], size, 1, senderAddr);
+  mCurrentPacket = packet;
+  // The packet is walked again for each handler rather than collecting the
+  // messages, as parsing in place costs less than storing them
   for (auto *handler : mHandlers) {
-    for (auto m : messages) {
-      handler->onMessage(*m);
+    visit(handler, packet, size, 1, senderAddr);
+  }
+  mCurrentPacket = nullptr;
+}
+
+void Recv::visit(PacketHandler *handler, const char *packet, int size,
+                 TimeTag timeTag, const char *senderAddr) {
+  try {
+    ::osc::ReceivedPacket p(packet, size);
+    if (p.IsBundle()) {
+      ::osc::ReceivedBundle r(p);
+      for (auto it = r.ElementsBegin(); it != r.ElementsEnd(); ++it) {
+        visit(handler, it->Contents(), it->Size(), r.TimeTag(), senderAddr);
+      }
+    } else if (p.IsMessage()) {
+      mMessage.reset(packet, size, timeTag, senderAddr);
+      if (mMessage.mImpl) {
+        handler->onMessage(mMessage);
+      }
     }
+  } catch (::osc::Exception &e) {
+    AL_WARN("OSC error: %s", e.what());
   }
 }
 
@@ -1,15 +1,158 @@
 #include "al/scene/al_DistributedScene.hpp"
+#include "al/protocol/al_ClusterClock.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
 
 using namespace al;
 
+namespace {
+// Frame header: version, unused byte, u16 voice name count, u32 sequence,
+// u32 event count, f32 position resolution, f64 cluster time when sent (0
+// without a clock). Voice names follow as u16 length and characters, then
+// the events, each starting with its type.
+const uint8_t kFrameVersion = 3;
+const size_t kHeaderSize = 24;
+// Fits in a single notifier packet
+const size_t kMaxFrameSize = 1200;
+// Poses are sent as absolute values at least this often
+const uint16_t kPoseKeyframeInterval = 32;
+// The sender checks for frames this often if a wake up is missed
+const auto kSendPollInterval = std::chrono::milliseconds(5);
+
+enum : uint8_t {
+  EVENT_TRIGGER_ON = 1,
+  EVENT_TRIGGER_OFF,
+  EVENT_FREE,
+  EVENT_ALL_NOTES_OFF,
+  EVENT_PARAMETER_FLOAT,
+  EVENT_PARAMETER_POSE
+};
+
+enum : uint8_t { FIELD_FLOAT = 0, FIELD_STRING = 1 };
+enum : uint8_t { POSE_DELTA = 1 };
+
+template <typename T> void put(std::vector<uint8_t> &buffer, T value) {
+  size_t offset = buffer.size();
+  buffer.resize(offset + sizeof(T));
+  std::memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+void putString(std::vector<uint8_t> &buffer, const std::string &s) {
+  uint16_t length = uint16_t(std::min(s.size(), size_t(UINT16_MAX)));
+  put(buffer, length);
+  buffer.insert(buffer.end(), s.begin(), s.begin() + length);
+}
+
+struct FrameReader {
+  const uint8_t *data;
+  size_t size;
+  size_t pos{0};
+  bool ok{true};
+
+  FrameReader(const uint8_t *data_, size_t size_) : data(data_), size(size_) {}
+
+  template <typename T> T get() {
+    T value{};
+    if (pos + sizeof(T) > size) {
+      ok = false;
+      return value;
+    }
+    std::memcpy(&value, data + pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+  }
+
+  std::string getString() {
+    uint16_t length = get<uint16_t>();
+    if (!ok || pos + length > size) {
+      ok = false;
+      return std::string();
+    }
+    std::string s((const char *)data + pos, length);
+    pos += length;
+    return s;
+  }
+};
+
+// Key for a parameter of a voice: voice id in the high bits
+uint64_t parameterKey(int id, uint16_t index) {
+  return (uint64_t(uint32_t(id)) << 16) | index;
+}
+
+template <typename T> void eraseVoice(std::map<uint64_t, T> &map, int id) {
+  map.erase(map.lower_bound(parameterKey(id, 0)),
+            map.upper_bound(parameterKey(id, UINT16_MAX)));
+}
+
+// Orientation as the three smallest components of the unit quaternion
+void putQuat(std::vector<uint8_t> &buffer, const Quatd &quat) {
+  Quatd q = quat;
+  q.normalize();
+  double components[4] = {q.w, q.x, q.y, q.z};
+  uint8_t largest = 0;
+  for (uint8_t i = 1; i < 4; i++) {
+    if (std::abs(components[i]) > std::abs(components[largest])) {
+      largest = i;
+    }
+  }
+  double sign = components[largest] < 0 ? -1.0 : 1.0;
+  put(buffer, largest);
+  for (uint8_t i = 0; i < 4; i++) {
+    if (i != largest) {
+      double value = components[i] * sign * M_SQRT2 * 32767.0;
+      value = std::max(-32767.0, std::min(32767.0, value));
+      put(buffer, int16_t(std::lround(value)));
+    }
+  }
+}
+
+Quatd getQuat(FrameReader &reader) {
+  uint8_t largest = reader.get<uint8_t>() & 3;
+  double components[4];
+  double sum = 0.0;
+  for (uint8_t i = 0; i < 4; i++) {
+    if (i != largest) {
+      components[i] = reader.get<int16_t>() / (32767.0 * M_SQRT2);
+      sum += components[i] * components[i];
+    }
+  }
+  components[largest] = std::sqrt(std::max(0.0, 1.0 - sum));
+  return Quatd(components[0], components[1], components[2], components[3]);
+}
+} // namespace
+
 DistributedScene::DistributedScene(std::string name, int threadPoolSize,
                                    TimeMasterMode masterMode)
-    : DynamicScene(threadPoolSize, masterMode) {
+    : DynamicScene(threadPoolSize, masterMode),
+      mEventPool(new QueuedEvent[kEventPoolSize]) {
   mName = name;
+  for (uint32_t i = 0; i < kEventPoolSize; i++) {
+    mEventPool[i].poolIndex = i;
+    mEventPool[i].nextFree = i + 1 < kEventPoolSize ? i + 2 : 0;
+  }
+  mFreeEvents = 1;
 
   PolySynth::registerTriggerOnCallback(
       [this](SynthVoice *voice, int offsetFrames, int id, void *userData) {
-        if (this->mNotifier) {
+        if (this->mNotifier && mBinaryReplication) {
+          QueuedEvent *event = acquireEvent(EVENT_TRIGGER_ON, id);
+          event->offsetFrames = offsetFrames;
+          event->voiceName = demangle(typeid(*voice).name());
+          auto fields = voice->getTriggerParams();
+          put(event->fields, uint8_t(std::min(fields.size(), size_t(255))));
+          for (size_t i = 0; i < fields.size() && i < 255; i++) {
+            if (fields[i].type() == ParameterField::FLOAT) {
+              put(event->fields, FIELD_FLOAT);
+              put(event->fields, fields[i].get<float>());
+            } else {
+              put(event->fields, FIELD_STRING);
+              putString(event->fields, fields[i].get<std::string>());
+            }
+          }
+          queueEvent(event);
+        } else if (this->mNotifier) {
           osc::Packet p;
           std::string prefix = "/" + this->name();
           if (prefix.size() == 1) {
@@ -40,7 +183,9 @@ DistributedScene::DistributedScene(std::string name, int threadPoolSize,
       });
 
   PolySynth::registerTriggerOffCallback([this](int id, void *userData) {
-    if (this->mNotifier) {
+    if (this->mNotifier && mBinaryReplication) {
+      queueEvent(acquireEvent(EVENT_TRIGGER_OFF, id));
+    } else if (this->mNotifier) {
       osc::Packet p;
       std::string prefix = "/" + this->name();
       if (prefix.size() == 1) {
@@ -59,7 +204,16 @@ DistributedScene::DistributedScene(std::string name, int threadPoolSize,
   });
 
   PolySynth::registerFreeCallback([this](int id, void *userData) {
-    if (this->mNotifier) {
+    if (this->mNotifier && mBinaryReplication) {
+      // Voices are freed by the time master, which hands the id to the
+      // sender instead of waiting for it
+      if (mFreedVoices.writeSpace() >= sizeof(id)) {
+        mFreedVoices.write((const char *)&id, sizeof(id));
+        mReplicationPending = true;
+      } else {
+        queueEvent(acquireEvent(EVENT_FREE, id));
+      }
+    } else if (this->mNotifier) {
       osc::Packet p;
       std::string prefix = "/" + this->name();
       if (prefix.size() == 1) {
@@ -84,11 +238,17 @@ DistributedScene::DistributedScene(std::string name, int threadPoolSize,
     if (!this->mNotifier) {
       return;
     }
+    // Parameters are numbered in the frames by their position, counting
+    // trigger parameters first
+    uint16_t index = 0;
     for (ParameterMeta *param : voice->triggerParameters()) {
       if (strcmp(typeid(*param).name(), typeid(Parameter).name()) == 0) {
+        ParameterSlot *slot = addParameterSlot(voice, index, false);
         dynamic_cast<Parameter *>(param)->registerChangeCallback(
-            [this, param, voice](float value) {
-              if (this->mNotifier) {
+            [this, param, voice, slot](float value) {
+              if (this->mNotifier && mBinaryReplication) {
+                queueParameter(slot, value);
+              } else if (this->mNotifier) {
                 std::string prefix = "/" + this->name();
                 if (prefix.size() == 1) {
                   prefix = "";
@@ -103,14 +263,18 @@ DistributedScene::DistributedScene(std::string name, int threadPoolSize,
               //                                << "-> " << value << std::endl;
             });
       }
+      index++;
     }
     // register callbacks for internal parameters
     for (auto *param : voice->parameters()) {
       if (strcmp(typeid(*param).name(), typeid(Parameter).name()) ==
           0) { // Parameter
         Parameter *p = dynamic_cast<Parameter *>(param);
-        p->registerChangeCallback([&, p, voice](float value) {
-          if (this->mNotifier) {
+        ParameterSlot *slot = addParameterSlot(voice, index, false);
+        p->registerChangeCallback([&, p, voice, slot](float value) {
+          if (this->mNotifier && mBinaryReplication) {
+            queueParameter(slot, value);
+          } else if (this->mNotifier) {
             std::string prefix = "/" + this->name() + "/voice";
             if (prefix.size() == 1) {
               prefix = "";
@@ -125,8 +289,11 @@ DistributedScene::DistributedScene(std::string name, int threadPoolSize,
       if (strcmp(typeid(*param).name(), typeid(ParameterPose).name()) ==
           0) { // Parameter
         ParameterPose *p = dynamic_cast<ParameterPose *>(param);
-        p->registerChangeCallback([&, p, voice](Pose value) {
-          if (this->mNotifier) {
+        ParameterSlot *slot = addParameterSlot(voice, index, true);
+        p->registerChangeCallback([&, p, voice, slot](Pose value) {
+          if (this->mNotifier && mBinaryReplication) {
+            queueParameter(slot, value);
+          } else if (this->mNotifier) {
             std::string prefix = "/" + this->name() + "/voice";
             if (prefix.size() == 1) {
               prefix = "";
@@ -138,12 +305,43 @@ DistributedScene::DistributedScene(std::string name, int threadPoolSize,
           }
         });
       }
+      index++;
     }
   });
 }
 
+DistributedScene::~DistributedScene() {
+  // The clock thread calls processQueuedEvents()
+  stopCpuClockThread();
+  if (mSendThread) {
+    mSending = false;
+    mSendWake.notify_one();
+    mSendThread->join();
+  }
+  QueuedEvent *event = mQueuedEvents.exchange(nullptr);
+  while (event) {
+    QueuedEvent *next = event->next;
+    releaseEvent(event);
+    event = next;
+  }
+}
+
+void DistributedScene::registerNotifier(OSCNotifier &notifier) {
+  mNotifier = &notifier;
+  if (!mSendThread) {
+    mSending = true;
+    mSendThread = std::make_unique<std::thread>([this]() { runSender(); });
+  }
+}
+
 void al::DistributedScene::allNotesOff() {
   PolySynth::allNotesOff();
+  if (mBinaryReplication) {
+    if (this->mNotifier) {
+      queueEvent(acquireEvent(EVENT_ALL_NOTES_OFF, -1));
+    }
+    return;
+  }
   osc::Packet p;
   std::string prefix = "/" + this->name();
   if (prefix.size() == 1) {
@@ -174,7 +372,29 @@ bool al::DistributedScene::consumeMessage(osc::Message &m,
     }
   }
 
-  if (address == "/triggerOn") {
+  if (address == "/frame") {
+    if (m.typeTags() == "b") {
+      osc::Blob blob;
+      m >> blob;
+      // Applied by processQueuedEvents() in the time master context
+      uint32_t size = uint32_t(blob.size);
+      double sendTime;
+      if (mClock && size >= kHeaderSize) {
+        std::memcpy(&sendTime, (const uint8_t *)blob.data + 16,
+                    sizeof(sendTime));
+        if (sendTime > 0.0 && sendTime + mLatency < mClock->now()) {
+          mFramesLate++;
+        }
+      }
+      if (mReceivedFrames.writeSpace() < sizeof(size) + size) {
+        mFramesDropped++;
+        return true;
+      }
+      mReceivedFrames.write((const char *)&size, sizeof(size));
+      mReceivedFrames.write((const char *)blob.data, size);
+      return true;
+    }
+  } else if (address == "/triggerOn") {
     if (m.typeTags().size() > 2 && m.typeTags()[0] == 'i' &&
         m.typeTags()[1] == 'i' && m.typeTags()[2] == 's') {
       int offset, id;
@@ -271,3 +491,578 @@ bool al::DistributedScene::consumeMessage(osc::Message &m,
   }
   return false;
 }
+
+SceneReplicationStats DistributedScene::replicationStats() {
+  SceneReplicationStats stats;
+  stats.framesSent = mFramesSent;
+  stats.bytesSent = mBytesSent;
+  stats.eventsSent = mEventsSent;
+  stats.framesReceived = mFramesReceived;
+  stats.framesLost = mFramesLost;
+  stats.framesDropped = mFramesDropped;
+  stats.framesLate = mFramesLate;
+  return stats;
+}
+
+void DistributedScene::processQueuedEvents() {
+  // With a clock, frames are applied in the block that contains their time
+  al_sec now = 0.0;
+  al_sec blockDuration = 0.0;
+  double sampleRate = 0.0;
+  if (mClock) {
+    now = mClock->now();
+    if (mMasterMode == TimeMasterMode::TIME_MASTER_AUDIO &&
+        internalAudioIO.framesPerSecond() > 0) {
+      sampleRate = internalAudioIO.framesPerSecond();
+      blockDuration = internalAudioIO.framesPerBuffer() / sampleRate;
+    }
+  }
+  uint8_t header[sizeof(uint32_t) + kHeaderSize];
+  while (mReceivedFrames.peek((char *)header, sizeof(header)) ==
+         sizeof(header)) {
+    uint32_t size;
+    double sendTime;
+    std::memcpy(&size, header, sizeof(size));
+    std::memcpy(&sendTime, header + sizeof(size) + 16, sizeof(sendTime));
+    if (mReceivedFrames.readSpace() < sizeof(size) + size) {
+      break;
+    }
+    int offsetFrames = 0;
+    if (mClock && sendTime > 0.0) {
+      al_sec playTime = sendTime + mLatency;
+      if (playTime > now + blockDuration) {
+        break; // Frames are in order, so all others are due later too
+      }
+      if (sampleRate > 0) {
+        int blockFrames = int(internalAudioIO.framesPerBuffer());
+        offsetFrames = int((playTime - now) * sampleRate);
+        offsetFrames = std::max(0, std::min(blockFrames - 1, offsetFrames));
+      }
+    }
+    mReceivedFrames.read((char *)&size, sizeof(size));
+    if (mApplyBuffer.size() < size) {
+      mApplyBuffer.resize(size);
+    }
+    mReceivedFrames.read((char *)mApplyBuffer.data(), size);
+    applyFrame(mApplyBuffer.data(), size, offsetFrames);
+  }
+
+  if (mNotifier && mReplicationPending) {
+    // Frames are encoded and sent by the sender thread. Anything queued
+    // after this goes in the next frame.
+    if (mFrameTimes.writeSpace() >= sizeof(now)) {
+      mFrameTimes.write((const char *)&now, sizeof(now));
+    }
+    mSendWake.notify_one();
+  }
+}
+
+void DistributedScene::runSender() {
+  while (mSending) {
+    {
+      std::unique_lock<std::mutex> lk(mSendWakeLock);
+      mSendWake.wait_for(lk, kSendPollInterval, [this]() {
+        return !mSending || mFrameTimes.readSpace() > 0;
+      });
+    }
+    // Frames requested while the previous ones were sent are merged
+    al_sec sendTime;
+    bool requested = false;
+    while (mFrameTimes.read((char *)&sendTime, sizeof(sendTime)) ==
+           sizeof(sendTime)) {
+      requested = true;
+    }
+    if (!requested) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lk(mReplicationLock);
+    mReplicationPending = false;
+    collectQueued();
+    sendFrames(sendTime);
+  }
+}
+
+void DistributedScene::beginEvent(uint8_t type) {
+  mEventOffsets.push_back(mPendingEvents.size());
+  put(mPendingEvents, type);
+}
+
+void DistributedScene::queueFree(int id) {
+  beginEvent(EVENT_FREE);
+  put(mPendingEvents, int32_t(id));
+  mFreedIds.push_back(id);
+}
+
+uint16_t DistributedScene::voiceNameIndex(const std::string &name) {
+  for (size_t i = 0; i < mVoiceNames.size(); i++) {
+    if (mVoiceNames[i] == name) {
+      return uint16_t(i);
+    }
+  }
+  mVoiceNames.push_back(name);
+  return uint16_t(mVoiceNames.size() - 1);
+}
+
+DistributedScene::QueuedEvent *DistributedScene::acquireEvent(uint8_t type,
+                                                              int id) {
+  QueuedEvent *event = nullptr;
+  uint64_t head = mFreeEvents.load(std::memory_order_acquire);
+  while (uint32_t(head) != 0) {
+    QueuedEvent *e = &mEventPool[uint32_t(head) - 1];
+    uint64_t next = (head & ~uint64_t(UINT32_MAX)) + (uint64_t(1) << 32) +
+                    e->nextFree.load(std::memory_order_relaxed);
+    if (mFreeEvents.compare_exchange_weak(head, next,
+                                          std::memory_order_acquire,
+                                          std::memory_order_acquire)) {
+      event = e;
+      break;
+    }
+  }
+  if (!event) {
+    // Events are not dropped, as replicas would lose voices. The trigger
+    // path allocates already, for the trigger parameters.
+    event = new QueuedEvent;
+  }
+  event->type = type;
+  event->id = id;
+  event->offsetFrames = 0;
+  event->fields.clear();
+  return event;
+}
+
+void DistributedScene::releaseEvent(QueuedEvent *event) {
+  if (event->poolIndex == UINT32_MAX) {
+    delete event;
+    return;
+  }
+  uint64_t head = mFreeEvents.load(std::memory_order_relaxed);
+  uint64_t next;
+  do {
+    event->nextFree.store(uint32_t(head), std::memory_order_relaxed);
+    next = (head & ~uint64_t(UINT32_MAX)) + (uint64_t(1) << 32) +
+           event->poolIndex + 1;
+  } while (!mFreeEvents.compare_exchange_weak(
+      head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void DistributedScene::queueEvent(QueuedEvent *event) {
+  event->next = mQueuedEvents.load(std::memory_order_relaxed);
+  while (!mQueuedEvents.compare_exchange_weak(event->next, event,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+  }
+  mReplicationPending = true;
+}
+
+DistributedScene::ParameterSlot *
+DistributedScene::addParameterSlot(SynthVoice *voice, uint16_t index,
+                                   bool isPose) {
+  auto *slot = new ParameterSlot;
+  slot->voice = voice;
+  slot->index = index;
+  slot->isPose = isPose;
+  std::unique_lock<std::mutex> lk(mReplicationLock);
+  mParameterSlots.emplace_back(slot);
+  return slot;
+}
+
+void DistributedScene::queueParameter(ParameterSlot *slot, float value) {
+  int id = slot->voice->id();
+  if (!slot->voice->active() || id < 0) {
+    // Values of voices not yet triggered are sent with the trigger
+    return;
+  }
+  slot->id.store(id, std::memory_order_relaxed);
+  slot->value.store(value, std::memory_order_relaxed);
+  markQueued(slot);
+}
+
+void DistributedScene::queueParameter(ParameterSlot *slot, const Pose &pose) {
+  int id = slot->voice->id();
+  if (!slot->voice->active() || id < 0) {
+    return;
+  }
+  slot->id.store(id, std::memory_order_relaxed);
+  slot->pose.store(pose);
+  markQueued(slot);
+}
+
+void DistributedScene::markQueued(ParameterSlot *slot) {
+  // Releases the value to the sender, which clears the flag before reading
+  // it, so a change after that queues the slot again
+  if (!slot->queued.exchange(true, std::memory_order_acq_rel)) {
+    slot->next = mQueuedSlots.load(std::memory_order_relaxed);
+    while (!mQueuedSlots.compare_exchange_weak(slot->next, slot,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+    }
+  }
+  mReplicationPending = true;
+}
+
+void DistributedScene::collectQueued() {
+  // The stack holds the newest event first
+  mCollectedEvents.clear();
+  QueuedEvent *event =
+      mQueuedEvents.exchange(nullptr, std::memory_order_acquire);
+  for (; event; event = event->next) {
+    mCollectedEvents.push_back(event);
+  }
+  for (auto it = mCollectedEvents.rbegin(); it != mCollectedEvents.rend();
+       ++it) {
+    QueuedEvent *e = *it;
+    switch (e->type) {
+    case EVENT_TRIGGER_ON:
+      beginEvent(EVENT_TRIGGER_ON);
+      put(mPendingEvents, e->id);
+      put(mPendingEvents, e->offsetFrames);
+      put(mPendingEvents, voiceNameIndex(e->voiceName));
+      mPendingEvents.insert(mPendingEvents.end(), e->fields.begin(),
+                            e->fields.end());
+      break;
+    case EVENT_TRIGGER_OFF:
+      beginEvent(EVENT_TRIGGER_OFF);
+      put(mPendingEvents, e->id);
+      break;
+    case EVENT_FREE:
+      queueFree(e->id);
+      break;
+    case EVENT_ALL_NOTES_OFF:
+      beginEvent(EVENT_ALL_NOTES_OFF);
+      mQueuedParameters.clear();
+      mSentPoses.clear();
+      break;
+    }
+    releaseEvent(e);
+  }
+  int freed;
+  while (mFreedVoices.read((char *)&freed, sizeof(freed)) == sizeof(freed)) {
+    queueFree(freed);
+  }
+
+  ParameterSlot *slot =
+      mQueuedSlots.exchange(nullptr, std::memory_order_acquire);
+  while (slot) {
+    ParameterSlot *next = slot->next;
+    slot->queued.exchange(false, std::memory_order_acq_rel);
+    int id = slot->id.load(std::memory_order_relaxed);
+    Pose pose;
+    if (slot->isPose && !slot->pose.load(pose)) {
+      markQueued(slot); // Overwritten while copied, try in the next frame
+    } else {
+      auto &parameter = mQueuedParameters[parameterKey(id, slot->index)];
+      parameter.id = id;
+      parameter.index = slot->index;
+      parameter.isPose = slot->isPose;
+      parameter.pose = pose;
+      parameter.value = slot->value.load(std::memory_order_relaxed);
+    }
+    slot = next;
+  }
+}
+
+void DistributedScene::sendFrames(al_sec sendTime) {
+  if (mEventOffsets.empty() && mQueuedParameters.empty()) {
+    return;
+  }
+  for (int id : mFreedIds) {
+    eraseVoice(mQueuedParameters, id);
+    eraseVoice(mSentPoses, id);
+  }
+
+  uint32_t events = 0;
+  auto beginFrame = [&]() {
+    mFrame.resize(kHeaderSize);
+    mFrame[0] = kFrameVersion;
+    mFrame[1] = 0;
+    uint16_t numNames = uint16_t(mVoiceNames.size());
+    std::memcpy(mFrame.data() + 2, &numNames, sizeof(numNames));
+    std::memcpy(mFrame.data() + 12, &mPositionResolution, sizeof(float));
+    std::memcpy(mFrame.data() + 16, &sendTime, sizeof(sendTime));
+    for (auto &name : mVoiceNames) {
+      putString(mFrame, name);
+    }
+    events = 0;
+  };
+  // Events are kept whole, so a frame only goes over the size limit if a
+  // single event does
+  auto append = [&](const uint8_t *data, size_t size) {
+    if (events > 0 && mFrame.size() + size > kMaxFrameSize) {
+      sendFrame(mFrame, events);
+      beginFrame();
+    }
+    mFrame.insert(mFrame.end(), data, data + size);
+    events++;
+  };
+
+  beginFrame();
+  mEventOffsets.push_back(mPendingEvents.size());
+  for (size_t i = 0; i + 1 < mEventOffsets.size(); i++) {
+    append(mPendingEvents.data() + mEventOffsets[i],
+           mEventOffsets[i + 1] - mEventOffsets[i]);
+  }
+  for (auto &entry : mQueuedParameters) {
+    auto &parameter = entry.second;
+    mParameterBuffer.clear();
+    if (parameter.isPose) {
+      put(mParameterBuffer, EVENT_PARAMETER_POSE);
+      put(mParameterBuffer, int32_t(parameter.id));
+      put(mParameterBuffer, parameter.index);
+      encodePose(mParameterBuffer, entry.first, parameter.pose);
+    } else {
+      put(mParameterBuffer, EVENT_PARAMETER_FLOAT);
+      put(mParameterBuffer, int32_t(parameter.id));
+      put(mParameterBuffer, parameter.index);
+      put(mParameterBuffer, parameter.value);
+    }
+    append(mParameterBuffer.data(), mParameterBuffer.size());
+  }
+  if (events > 0) {
+    sendFrame(mFrame, events);
+  }
+
+  mPendingEvents.clear();
+  mEventOffsets.clear();
+  mVoiceNames.clear();
+  mQueuedParameters.clear();
+  mFreedIds.clear();
+}
+
+void DistributedScene::sendFrame(std::vector<uint8_t> &frame,
+                                 uint32_t events) {
+  uint32_t sequence = mSequence++;
+  std::memcpy(frame.data() + 4, &sequence, sizeof(sequence));
+  std::memcpy(frame.data() + 8, &events, sizeof(events));
+
+  std::string prefix = "/" + this->name();
+  if (prefix.size() == 1) {
+    prefix = "";
+  }
+  osc::Packet p(int(frame.size() + prefix.size()) + 64);
+  p.beginMessage(prefix + "/frame");
+  p << osc::Blob(frame.data(), frame.size());
+  p.endMessage();
+  mNotifier->send(p);
+
+  mFramesSent++;
+  mBytesSent += frame.size();
+  mEventsSent += events;
+}
+
+void DistributedScene::encodePose(std::vector<uint8_t> &buffer, uint64_t key,
+                                  const Pose &pose) {
+  Vec3f position = pose.pos();
+  auto &coder = mSentPoses[key];
+  bool delta = coder.sentSinceKeyframe > 0 &&
+               coder.sentSinceKeyframe < kPoseKeyframeInterval;
+  int16_t steps[3];
+  if (delta) {
+    for (int i = 0; i < 3; i++) {
+      // Relative to the position the replica has, so errors don't add up
+      float value =
+          std::round((position[i] - coder.position[i]) / mPositionResolution);
+      if (std::abs(value) > 32767.0f) {
+        delta = false;
+        break;
+      }
+      steps[i] = int16_t(value);
+    }
+  }
+  if (delta) {
+    put(buffer, POSE_DELTA);
+    for (int i = 0; i < 3; i++) {
+      put(buffer, steps[i]);
+      coder.position[i] += steps[i] * mPositionResolution;
+    }
+    coder.sentSinceKeyframe++;
+  } else {
+    put(buffer, uint8_t(0));
+    for (int i = 0; i < 3; i++) {
+      put(buffer, position[i]);
+    }
+    coder.position = position;
+    coder.sentSinceKeyframe = 1;
+  }
+  putQuat(buffer, pose.quat());
+}
+
+SynthVoice *DistributedScene::findVoice(int id) {
+  for (auto &triggered : mFrameVoices) {
+    if (triggered.first == id) {
+      return triggered.second;
+    }
+  }
+  auto *voice = mActiveVoices;
+  while (voice) {
+    if (voice->id() == id) {
+      return voice;
+    }
+    voice = voice->next;
+  }
+  // Frames are applied by the time master, which may be the audio thread,
+  // so it does not wait for a voice being triggered elsewhere. The value is
+  // then missed, like one for a voice that is not triggered yet.
+  std::unique_lock<std::mutex> lk(mVoiceToInsertLock, std::try_to_lock);
+  if (!lk.owns_lock()) {
+    return nullptr;
+  }
+  voice = mVoicesToInsert;
+  while (voice) {
+    if (voice->id() == id) {
+      return voice;
+    }
+    voice = voice->next;
+  }
+  return nullptr;
+}
+
+void DistributedScene::applyFrame(const uint8_t *data, size_t size,
+                                  int offsetFrames) {
+  FrameReader reader(data, size);
+  uint8_t version = reader.get<uint8_t>();
+  reader.get<uint8_t>();
+  uint16_t numNames = reader.get<uint16_t>();
+  uint32_t sequence = reader.get<uint32_t>();
+  uint32_t events = reader.get<uint32_t>();
+  float resolution = reader.get<float>();
+  reader.get<double>();
+  if (!reader.ok || version != kFrameVersion) {
+    std::cerr << "ERROR: Unsupported scene frame" << std::endl;
+    return;
+  }
+  mFramesReceived++;
+  if (mHasSequence && sequence != mLastSequence + 1) {
+    mFramesLost += uint32_t(sequence - mLastSequence - 1);
+    // Position deltas may refer to values that were lost
+    mReceivedPositions.clear();
+  }
+  mHasSequence = true;
+  mLastSequence = sequence;
+
+  mFrameNames.resize(numNames);
+  for (auto &name : mFrameNames) {
+    name = reader.getString();
+  }
+  mFrameVoices.clear();
+
+  for (uint32_t i = 0; i < events && reader.ok; i++) {
+    uint8_t type = reader.get<uint8_t>();
+    switch (type) {
+    case EVENT_TRIGGER_ON: {
+      int id = reader.get<int32_t>();
+      // Offset in the primary's block, after the offset of the frame
+      int offset = std::max(0, int(reader.get<int32_t>()));
+      uint16_t nameIndex = reader.get<uint16_t>();
+      uint8_t numFields = reader.get<uint8_t>();
+      std::vector<ParameterField> fields;
+      for (uint8_t field = 0; field < numFields; field++) {
+        if (reader.get<uint8_t>() == FIELD_FLOAT) {
+          fields.emplace_back(reader.get<float>());
+        } else {
+          fields.emplace_back(reader.getString());
+        }
+      }
+      if (!reader.ok || nameIndex >= mFrameNames.size()) {
+        break;
+      }
+      auto *voice = getVoice(mFrameNames[nameIndex]);
+      if (voice) {
+        voice->setTriggerParams(fields);
+        triggerOn(voice, offsetFrames + offset, id);
+        mFrameVoices.push_back({id, voice});
+      } else {
+        std::cerr << "Can't get free voice of type: " << mFrameNames[nameIndex]
+                  << std::endl;
+      }
+      break;
+    }
+    case EVENT_TRIGGER_OFF: {
+      int id = reader.get<int32_t>();
+      if (reader.ok) {
+        triggerOff(id);
+      }
+      break;
+    }
+    case EVENT_FREE: {
+      int id = reader.get<int32_t>();
+      if (reader.ok) {
+        mVoiceIdsToFree.write((const char *)&id, sizeof(int));
+        eraseVoice(mReceivedPositions, id);
+      }
+      break;
+    }
+    case EVENT_ALL_NOTES_OFF:
+      PolySynth::allNotesOff();
+      mReceivedPositions.clear();
+      break;
+    case EVENT_PARAMETER_FLOAT: {
+      int id = reader.get<int32_t>();
+      uint16_t index = reader.get<uint16_t>();
+      float value = reader.get<float>();
+      SynthVoice *voice = reader.ok ? findVoice(id) : nullptr;
+      if (voice) {
+        auto triggerParameters = voice->triggerParameters();
+        ParameterMeta *param = nullptr;
+        if (index < triggerParameters.size()) {
+          param = triggerParameters[index];
+        } else if (index - triggerParameters.size() <
+                   voice->parameters().size()) {
+          param = voice->parameters()[index - triggerParameters.size()];
+        }
+        if (auto *p = dynamic_cast<Parameter *>(param)) {
+          p->set(value);
+        }
+      }
+      break;
+    }
+    case EVENT_PARAMETER_POSE: {
+      int id = reader.get<int32_t>();
+      uint16_t index = reader.get<uint16_t>();
+      uint8_t flags = reader.get<uint8_t>();
+      uint64_t key = parameterKey(id, index);
+      Vec3f position;
+      bool valid = true;
+      if (flags & POSE_DELTA) {
+        auto base = mReceivedPositions.find(key);
+        valid = base != mReceivedPositions.end();
+        for (int axis = 0; axis < 3; axis++) {
+          float step = reader.get<int16_t>() * resolution;
+          if (valid) {
+            position[axis] = base->second[axis] + step;
+          }
+        }
+      } else {
+        for (int axis = 0; axis < 3; axis++) {
+          position[axis] = reader.get<float>();
+        }
+      }
+      Quatd quat = getQuat(reader);
+      if (!reader.ok || !valid) {
+        // Wait for the next absolute value
+        break;
+      }
+      mReceivedPositions[key] = position;
+      SynthVoice *voice = findVoice(id);
+      if (voice) {
+        size_t numTrigger = voice->triggerParameters().size();
+        if (index >= numTrigger &&
+            index - numTrigger < voice->parameters().size()) {
+          auto *p = dynamic_cast<ParameterPose *>(
+              voice->parameters()[index - numTrigger]);
+          if (p) {
+            p->set(Pose(Vec3d(position), quat));
+          }
+        }
+      }
+      break;
+    }
+    default:
+      std::cerr << "ERROR: Unknown scene frame event " << int(type)
+                << std::endl;
+      return;
+    }
+  }
+  if (!reader.ok) {
+    std::cerr << "ERROR: Truncated scene frame" << std::endl;
+  }
+}
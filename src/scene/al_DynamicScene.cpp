@@ -1,8 +1,10 @@
 #include "al/scene/al_DynamicScene.hpp"
 
 #include "al/graphics/al_Shapes.hpp"
+#include "al/math/al_Frustum.hpp"
 
 #include <algorithm>
+#include <limits>
 
 using namespace std;
 using namespace al;
@@ -101,6 +103,7 @@ DynamicScene::~DynamicScene() {
 
 void DynamicScene::prepare(AudioIOData &io) {
   internalAudioIO.framesPerBuffer(io.framesPerBuffer());
+  internalAudioIO.framesPerSecond(io.framesPerSecond());
   internalAudioIO.channelsIn(mVoiceMaxInputChannels);
   internalAudioIO.channelsOut(mVoiceMaxOutputChannels);
   internalAudioIO.channelsBus(mVoiceBusChannels);
@@ -131,39 +134,97 @@ void DynamicScene::render(Graphics &g) {
     processVoiceTurnOff();
   }
   std::unique_lock<std::mutex> lk(mGraphicsLock);
-  std::vector<PositionedVoice *> voices;
-  voices.reserve(128);
+  mDrawVoices.clear();
   auto voice = mActiveVoices;
   while (voice) {
-    voices.push_back((PositionedVoice *)voice);
+    if (voice->active()) {
+      mDrawVoices.push_back(voice);
+    }
     voice = voice->next;
   }
-  if (mSortDrawingByDistance) {
-    // FIXME this is crashing in some undetermined cases.
-    // For now a working but inefficient way of sorting
-    auto viewPos = mListenerPose.pos();
-    std::sort(voices.begin(), voices.end(),
-              [&](PositionedVoice *a, PositionedVoice *b) -> bool {
-                auto distA = (a->pose().pos() - viewPos).mag();
-                auto distB = (b->pose().pos() - viewPos).mag();
-                return distA >= distB;
-              });
+
+  // Bounding spheres, in the space of the current model matrix
+  Matrix4f model = g.modelMatrix();
+  size_t count = mDrawVoices.size();
+  mDrawPositioned.resize(count);
+  mDrawMatrices.resize(count);
+  mDrawPoses.resize(count);
+  mDrawX.resize(count);
+  mDrawY.resize(count);
+  mDrawZ.resize(count);
+  mDrawRadius.resize(count);
+  mDrawVisible.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    PositionedVoice *posVoice = dynamic_cast<PositionedVoice *>(mDrawVoices[i]);
+    mDrawPositioned[i] = posVoice;
+    if (!posVoice) {
+      // Drawn untransformed and never culled
+      mDrawMatrices[i] = model;
+      mDrawX[i] = mDrawY[i] = mDrawZ[i] = 0.0f;
+      mDrawRadius[i] = std::numeric_limits<float>::infinity();
+      continue;
+    }
+    // preProcess() may move the voice, so it runs before the pose is read
+    g.pushMatrix();
+    posVoice->preProcess(g);
+    mDrawMatrices[i] = g.modelMatrix();
+    g.popMatrix();
+    mDrawPoses[i] = posVoice->pose();
+    const Vec3d &pos = mDrawPoses[i].pos();
+    mDrawX[i] = float(pos.x);
+    mDrawY[i] = float(pos.y);
+    mDrawZ[i] = float(pos.z);
+    float radius = posVoice->boundingRadius();
+    // The sphere is not in the frustum's space if preProcess() transformed
+    // the voice
+    bool transformed = !std::equal(model.elems(), model.elems() + 16,
+                                   mDrawMatrices[i].elems());
+    mDrawRadius[i] = radius < 0 || transformed
+                         ? std::numeric_limits<float>::infinity()
+                         : radius * std::abs(posVoice->size());
+    posVoice->mListenerDistance = float((pos - mListenerPose.pos()).mag());
   }
-  for (auto voice : voices) {
-    // TODO implement offset?
-    if (voice->active()) {
-      g.pushMatrix();
-      if (dynamic_cast<PositionedVoice *>(voice)) {
-        PositionedVoice *posVoice = static_cast<PositionedVoice *>(voice);
-        posVoice->preProcess(g);
-        Pose pose = posVoice->pose();
-        g.translate(pose.x(), pose.y(), pose.z());
-        g.rotate(pose.quat());
-        g.scale(posVoice->size());
-      }
-      voice->onProcess(g);
-      g.popMatrix();
+  if (count > 0) {
+    Frustumd frustum;
+    frustum.fromMatrix(g.projMatrix() * g.viewMatrix() * model);
+    frustum.testSpheres(mDrawX.data(), mDrawY.data(), mDrawZ.data(),
+                        mDrawRadius.data(), int(count), mDrawVisible.data());
+  }
+
+  auto draw = [&](unsigned i) {
+    PositionedVoice *posVoice = mDrawPositioned[i];
+    g.pushMatrix(mDrawMatrices[i]);
+    if (posVoice) {
+      Pose &pose = mDrawPoses[i];
+      g.translate(pose.x(), pose.y(), pose.z());
+      g.rotate(pose.quat());
+      g.scale(posVoice->size());
+    }
+    mDrawVoices[i]->onProcess(g);
+    g.popMatrix();
+  };
+  // Opaque voices are drawn in list order, the rest from back to front
+  mDrawSorted.clear();
+  for (unsigned i = 0; i < count; i++) {
+    if (!mDrawVisible[i]) {
+      continue;
     }
+    PositionedVoice *posVoice = mDrawPositioned[i];
+    if (posVoice && (mSortDrawingByDistance || posVoice->transparent())) {
+      mDrawSorted.push_back({posVoice->mListenerDistance, i});
+    } else {
+      draw(i);
+    }
+  }
+  // Ties are broken by index, so the order is stable without the buffer
+  // that std::stable_sort allocates
+  std::sort(mDrawSorted.begin(), mDrawSorted.end(),
+            [](const DrawOrder &a, const DrawOrder &b) {
+              return a.distance > b.distance ||
+                     (a.distance == b.distance && a.index < b.index);
+            });
+  for (const DrawOrder &o : mDrawSorted) {
+    draw(o.index);
   }
   if (mMasterMode == TimeMasterMode::TIME_MASTER_GRAPHICS) {
     processInactiveVoices();
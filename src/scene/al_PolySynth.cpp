@@ -383,12 +383,7 @@ PolySynth::PolySynth(TimeMasterMode masterMode) : mMasterMode(masterMode) {
   }
 }
 
-PolySynth::~PolySynth() {
-  if (mCpuClockThread) {
-    mRunCPUClock = false;
-    mCpuClockThread->join();
-  }
-}
+PolySynth::~PolySynth() { stopCpuClockThread(); }
 
 int PolySynth::triggerOn(SynthVoice *voice, int offsetFrames, int id,
                          void *userData) {
@@ -660,11 +655,7 @@ void PolySynth::setTimeMaster(TimeMasterMode masterMode) {
     mRunCPUClock = true;
     startCpuClockThread();
   } else {
-    if (mCpuClockThread) {
-      mRunCPUClock = false;
-      mCpuClockThread->join();
-      mCpuClockThread = nullptr;
-    }
+    stopCpuClockThread();
   }
 }
 
@@ -826,8 +817,17 @@ void PolySynth::startCpuClockThread() {
   }
 }
 
+void PolySynth::stopCpuClockThread() {
+  if (mCpuClockThread) {
+    mRunCPUClock = false;
+    mCpuClockThread->join();
+    mCpuClockThread = nullptr;
+  }
+}
+
 void PolySynth::prepare(AudioIOData &io) {
   internalAudioIO.framesPerBuffer(io.framesPerBuffer());
+  internalAudioIO.framesPerSecond(io.framesPerSecond());
   internalAudioIO.channelsIn(mVoiceMaxInputChannels);
   internalAudioIO.channelsOut(mVoiceMaxOutputChannels);
   internalAudioIO.channelsBus(mVoiceBusChannels);
@@ -1,9 +1,11 @@
 
 #include "al/scene/al_SynthSequencer.hpp"
+#include "al/protocol/al_ClusterClock.hpp"
 
 #include <algorithm>
 #include <cassert>
 #include <climits>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <sstream>
@@ -11,11 +13,28 @@
 
 using namespace al;
 
+namespace {
+// Larger differences to the cluster clock are corrected at once
+const double kMaxClockCorrection = 0.05;
+// Fraction of the difference to the cluster clock corrected each block
+const double kClockCorrectionRate = 0.05;
+} // namespace
+
 void SynthSequencer::render(AudioIOData &io) {
   if (mMasterMode == TimeMasterMode::TIME_MASTER_AUDIO) {
     double timeIncrement =
         mNormalizedTempo * io.framesPerBuffer() / (double)io.framesPerSecond();
     double blockStartTime = mMasterTime;
+    if (mClock) {
+      // The audio callback runs with some jitter, so the difference is
+      // smoothed over many blocks
+      double difference = clockTime() - blockStartTime;
+      if (std::abs(difference) > kMaxClockCorrection) {
+        blockStartTime = mMasterTime = clockTime();
+      } else {
+        timeIncrement += difference * kClockCorrectionRate;
+      }
+    }
     mMasterTime += timeIncrement;
     processEvents(blockStartTime, mNormalizedTempo * io.framesPerSecond());
   }
@@ -26,7 +45,7 @@ void SynthSequencer::render(Graphics &g) {
   if (mMasterMode == TimeMasterMode::TIME_MASTER_GRAPHICS) {
     assert(mFps > 0);
     double blockStartTime = mMasterTime;
-    mMasterTime += (1.0 / mFps);
+    mMasterTime = mClock ? clockTime() : mMasterTime + (1.0 / mFps);
     processEvents(blockStartTime, mNormalizedTempo);
   }
   mPolySynth->render(g);
@@ -35,7 +54,7 @@ void SynthSequencer::render(Graphics &g) {
 void SynthSequencer::update(double dt) {
   if (mMasterMode == TimeMasterMode::TIME_MASTER_UPDATE) {
     double blockStartTime = mMasterTime;
-    mMasterTime += dt;
+    mMasterTime = mClock ? clockTime() : mMasterTime + dt;
     processEvents(blockStartTime, mNormalizedTempo);
   }
   mPolySynth->update(dt);
@@ -47,6 +66,14 @@ void SynthSequencer::print() {
 }
 
 bool SynthSequencer::playSequence(std::string sequenceName, float startTime) {
+  return playSequenceAt(mClock ? mClock->now() : 0.0, sequenceName, startTime);
+}
+
+bool SynthSequencer::playSequenceAt(double clusterTime,
+                                    std::string sequenceName,
+                                    float startTime) {
+  mClockStart = clusterTime;
+  mClockStartTime = startTime;
   //        synth().allNotesOff();
   // Add an offset of 0.1 to make sure the allNotesOff message gets processed
   // before the sequence
@@ -83,7 +110,8 @@ bool SynthSequencer::playSequence(std::string sequenceName, float startTime) {
             }
             lk.unlock();
             double blockStartTime = mMasterTime;
-            mMasterTime += timeIncrement;
+            mMasterTime =
+                mClock ? clockTime() : mMasterTime + timeIncrement;
             processEvents(blockStartTime, 1.0e9 / granularityns);
             std::this_thread::sleep_until(
                 startTime + std::chrono::nanoseconds(uint32_t(granularityns)));
@@ -115,10 +143,18 @@ void SynthSequencer::stopSequence() {
   }
 }
 
+double SynthSequencer::clockTime() {
+  return mClockStartTime + (mClock->now() - mClockStart) * mNormalizedTempo;
+}
+
 void SynthSequencer::setTime(float newTime) {
   synth().allNotesOff();
   //  mPlaybackStartTime = newTime;
   mMasterTime = newTime;
+  if (mClock) {
+    mClockStart = mClock->now();
+    mClockStartTime = newTime;
+  }
   mNextEvent = 0;
 
   //  std::cout << "Setting time not implemented" <<std::endl;
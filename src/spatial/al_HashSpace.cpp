@@ -1,8 +1,48 @@
 #include "al/spatial/al_HashSpace.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <thread>
+
 #include "al/math/al_Functions.hpp"
 
 using namespace al;
 
+namespace {
+
+// Runs task(0) .. task(count - 1) on up to threads threads
+void runTasks(int count, int threads, const std::function<void(int)>& task) {
+  std::atomic<int> next{0};
+  auto work = [&]() {
+    for (int i = next++; i < count; i = next++) task(i);
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < std::min(threads, count); ++i) workers.emplace_back(work);
+  work();
+  for (auto& worker : workers) worker.join();
+}
+
+int threadCount(int threads) {
+  if (threads > 0) return threads;
+  return std::max(1, int(std::thread::hardware_concurrency()));
+}
+
+// Number of tasks to split n items in
+int taskCount(size_t n, int threads) {
+  return int(std::min<size_t>(4 * size_t(threads), n / 1024 + 1));
+}
+
+struct Closer {
+  bool operator()(const HashSpace::Neighbor& a,
+                  const HashSpace::Neighbor& b) const {
+    return a.distanceSquared < b.distanceSquared ||
+           (a.distanceSquared == b.distanceSquared && a.id < b.id);
+  }
+};
+
+}  // namespace
+
 // resolution can be 1 to 10; the dim is 2^resolution i.e. 2..1024
 // (the limit is 10 so that the hash can fit inside a uint32_t integer)
 // default 5 implies 32 units per side
@@ -96,3 +136,185 @@ HashSpace ::HashSpace(uint32_t resolution, uint32_t numObjects)
 }
 
 HashSpace ::~HashSpace() {}
+
+void HashSpace ::update(int threads) {
+  threads = threadCount(threads);
+  uint32_t n = mObjects.size();
+  mVoxelStarts.assign(mDim3 + 1, 0);
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t h = mObjects[i].hash;
+    if (h != invalidHash()) mVoxelStarts[h + 1]++;
+  }
+  for (uint32_t h = 0; h < mDim3; h++) {
+    mVoxelStarts[h + 1] += mVoxelStarts[h];
+  }
+  uint32_t sorted = mVoxelStarts[mDim3];
+  mSortedIds.resize(sorted);
+  mSortedX.resize(sorted);
+  mSortedY.resize(sorted);
+  mSortedZ.resize(sorted);
+
+  // scatter the ids, using the starts as cursors and restoring them after
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t h = mObjects[i].hash;
+    if (h != invalidHash()) mSortedIds[mVoxelStarts[h]++] = i;
+  }
+  for (uint32_t h = mDim3; h > 0; h--) {
+    mVoxelStarts[h] = mVoxelStarts[h - 1];
+  }
+  mVoxelStarts[0] = 0;
+
+  int tasks = taskCount(sorted, threads);
+  runTasks(tasks, threads, [&](int t) {
+    uint32_t end = uint64_t(sorted) * (t + 1) / tasks;
+    for (uint32_t i = uint64_t(sorted) * t / tasks; i < end; i++) {
+      const Vec3d& pos = mObjects[mSortedIds[i]].pos;
+      mSortedX[i] = pos.x;
+      mSortedY[i] = pos.y;
+      mSortedZ[i] = pos.z;
+    }
+  });
+}
+
+void HashSpace ::neighbors(Neighbors& result, double maxRadius,
+                           uint32_t maxResults, int threads) const {
+  threads = threadCount(threads);
+  uint32_t sorted = mSortedIds.size();
+  result.mSpans.assign(mObjects.size(), Neighbors::Span{nullptr, 0});
+  if (maxResults == 0 || sorted == 0) return;
+
+  const int dim = mDim, half = mDimHalf;
+  const float radius = std::min(maxRadius, double(mDimHalf));
+  const float r2 = radius * radius;
+
+  // rows of voxels along x around a voxel, nearest first
+  struct Row {
+    int y, z;
+    float near2;  // lower bound of the squared distance to the row
+  };
+  std::vector<Row> rows;
+  int reach = std::min(int(std::ceil(radius)) + 1, half);
+  for (int z = -reach; z <= std::min(reach, half - 1); z++) {
+    for (int y = -reach; y <= std::min(reach, half - 1); y++) {
+      float near = std::max(0.f, std::sqrt(float(y * y + z * z)) - 1.5f);
+      rows.push_back(Row{y, z, near * near});
+    }
+  }
+  std::sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+    return a.near2 < b.near2;
+  });
+
+  // squared distance that likely holds maxResults objects, by the density
+  float guess = r2;
+  if (maxResults < sorted) {
+    float volume = float(maxResults) * mDim3 / sorted;
+    float r = std::cbrt(volume * 3 / (4 * float(M_PI)));
+    guess = std::min(r2, 2 * r * r);
+  }
+
+  // distance along an axis from position f within a voxel to the voxel
+  // offset by o, which is reached both ways at -half
+  auto gap = [half](int o, float f) {
+    float g = std::max(0.f, std::max(o - f, f - o - 1));
+    return o == -half ? std::min(g, half - f) : g;
+  };
+
+  // distances are computed in blocks, which vectorizes
+  const uint32_t kBlock = 64;
+  int tasks = taskCount(sorted, threads);
+  result.mArenas.resize(std::max(result.mArenas.size(), size_t(tasks)));
+  runTasks(tasks, threads, [&](int t) {
+    std::vector<Neighbor>& arena = result.mArenas[t];
+    arena.clear();
+    uint32_t begin = uint64_t(sorted) * t / tasks;
+    uint32_t end = uint64_t(sorted) * (t + 1) / tasks;
+    // the arena can still grow, so spans are set once the task is done
+    std::vector<size_t> firsts(end - begin + 1);
+
+    for (uint32_t i = begin; i < end; i++) {
+      float x = mSortedX[i], y = mSortedY[i], z = mSortedZ[i];
+      Vec3i cell(x, y, z);
+      float fy = y - cell.y, fz = z - cell.z;
+      size_t first = arena.size();
+      uint32_t count = 0;
+      float worst;
+
+      // keeps the nearest objects found
+      auto add = [&](uint32_t j, float d2) {
+        Neighbor n{mSortedIds[j], d2};
+        if (count < maxResults) {
+          arena.push_back(n);
+          // once full, keep a max heap of the nearest
+          if (++count == maxResults) {
+            std::make_heap(arena.begin() + first, arena.end(), Closer());
+            worst = arena[first].distanceSquared;
+          }
+        } else if (Closer()(n, arena[first])) {
+          std::pop_heap(arena.begin() + first, arena.end(), Closer());
+          arena.back() = n;
+          std::push_heap(arena.begin() + first, arena.end(), Closer());
+          worst = arena[first].distanceSquared;
+        }
+      };
+
+      // scans the sorted objects in [from, to)
+      auto scan = [&](uint32_t from, uint32_t to) {
+        for (; from < to; from += kBlock) {
+          uint32_t size = std::min(to - from, kBlock);
+          const float *X = &mSortedX[from], *Y = &mSortedY[from],
+                      *Z = &mSortedZ[from];
+          float d2[kBlock];
+          for (uint32_t j = 0; j < size; j++) {
+            float dx = X[j] - x, dy = Y[j] - y, dz = Z[j] - z;
+            dx = dx >= half ? dx - dim : (dx < -half ? dx + dim : dx);
+            dy = dy >= half ? dy - dim : (dy < -half ? dy + dim : dy);
+            dz = dz >= half ? dz - dim : (dz < -half ? dz + dim : dz);
+            d2[j] = dx * dx + dy * dy + dz * dz;
+          }
+          for (uint32_t j = 0; j < size; j++) {
+            if (d2[j] <= worst && from + j != i) add(from + j, d2[j]);
+          }
+        }
+      };
+
+      // search within the guess first, and widen it if that is not enough
+      for (float limit = guess;; limit = std::min(4 * limit, r2)) {
+        arena.resize(first);
+        count = 0;
+        worst = limit;
+        for (const Row& row : rows) {
+          if (row.near2 > worst) break;
+          float gy = gap(row.y, fy), gz = gap(row.z, fz);
+          float gyz2 = gy * gy + gz * gz;
+          if (gyz2 > worst) continue;
+          // voxels of the row within reach, which are contiguous in the
+          // sorted arrays unless the row wraps around
+          float ex = std::sqrt(worst - gyz2);
+          // (shifted by dim to truncate positive numbers)
+          int x0 = int(x - ex + dim) - dim, x1 = int(x + ex);
+          if (x1 - x0 + 1 >= dim) {
+            x0 = 0;
+            x1 = dim - 1;
+          }
+          uint32_t rowHash = hashy(cell.y + row.y) + hashz(cell.z + row.z);
+          uint32_t lo = hashx(x0), hi = hashx(x1);
+          if (lo <= hi) {
+            scan(mVoxelStarts[rowHash + lo], mVoxelStarts[rowHash + hi + 1]);
+          } else {
+            scan(mVoxelStarts[rowHash + lo], mVoxelStarts[rowHash + dim]);
+            scan(mVoxelStarts[rowHash], mVoxelStarts[rowHash + hi + 1]);
+          }
+        }
+        if (count == maxResults || limit >= r2) break;
+      }
+      std::sort(arena.begin() + first, arena.end(), Closer());
+      firsts[i - begin] = first;
+    }
+    firsts[end - begin] = arena.size();
+    for (uint32_t i = begin; i < end; i++) {
+      size_t first = firsts[i - begin];
+      result.mSpans[mSortedIds[i]] = Neighbors::Span{
+          arena.data() + first, uint32_t(firsts[i - begin + 1] - first)};
+    }
+  });
+}
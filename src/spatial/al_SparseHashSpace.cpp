@@ -0,0 +1,297 @@
+#include "al/spatial/al_SparseHashSpace.hpp"
+
+#include <algorithm>
+
+using namespace al;
+
+// cell coordinates are clamped to this, so that neighboring coordinates do
+// not overflow; the outermost cells extend to infinity
+static const int kCellLimit = 1 << 30;
+
+SparseHashSpace ::SparseHashSpace(double cellSize, uint32_t numObjects)
+    : mCellSize(cellSize > 0 ? cellSize : 1) {
+  this->numObjects(numObjects);
+}
+
+void SparseHashSpace ::numObjects(int numObjects) {
+  mObjects.clear();
+  mObjects.resize(numObjects);
+  for (unsigned i = 0; i < mObjects.size(); i++) {
+    mObjects[i].id = i;
+  }
+  mCells.clear();
+  mFreeCells.clear();
+  mTable.assign(16, invalidCell());
+}
+
+SparseHashSpace &SparseHashSpace ::move(uint32_t objectId, const Vec3d &pos) {
+  Object &o = mObjects[objectId];
+  o.pos = pos;
+  if (!std::isfinite(pos.x) || !std::isfinite(pos.y) ||
+      !std::isfinite(pos.z)) {
+    // not in any cell, its distance to anything is undefined
+    return remove(objectId);
+  }
+  Vec3i coord = cellCoord(pos);
+  if (o.cell != invalidCell()) {
+    if (mCells[o.cell].coord == coord) {
+      return *this;
+    }
+    remove(objectId);
+  }
+  uint32_t cell = findCell(coord);
+  if (cell == invalidCell()) {
+    cell = addCell(coord);
+  }
+  // link at the head of the cell's list:
+  Cell &c = mCells[cell];
+  o.cell = cell;
+  o.prev = invalidCell();
+  o.next = c.first;
+  if (c.first != invalidCell()) {
+    mObjects[c.first].prev = objectId;
+  }
+  c.first = objectId;
+  c.count++;
+  return *this;
+}
+
+SparseHashSpace &SparseHashSpace ::remove(uint32_t objectId) {
+  Object &o = mObjects[objectId];
+  if (o.cell == invalidCell()) {
+    return *this;
+  }
+  Cell &c = mCells[o.cell];
+  if (o.prev != invalidCell()) {
+    mObjects[o.prev].next = o.next;
+  } else {
+    c.first = o.next;
+  }
+  if (o.next != invalidCell()) {
+    mObjects[o.next].prev = o.prev;
+  }
+  if (--c.count == 0) {
+    removeCell(o.cell);
+  }
+  o.cell = o.next = o.prev = invalidCell();
+  return *this;
+}
+
+Vec3i SparseHashSpace ::cellCoord(const Vec3d &pos) const {
+  // clamped before the conversion to int, which is undefined out of range;
+  // NaN maps to 0
+  const double limit = kCellLimit;
+  Vec3i coord;
+  for (int i = 0; i < 3; i++) {
+    double c = std::floor(pos[i] / mCellSize);
+    coord[i] = c >= -limit ? (c <= limit ? int(c) : int(limit))
+                           : (c < -limit ? int(-limit) : 0);
+  }
+  return coord;
+}
+
+uint32_t SparseHashSpace ::slot(const Vec3i &coord) const {
+  uint32_t h = uint32_t(coord.x) * 73856093u ^ uint32_t(coord.y) * 19349663u ^
+               uint32_t(coord.z) * 83492791u;
+  // spread the bits over the table with a Fibonacci hash
+  return (h * 2654435769u) & (mTable.size() - 1);
+}
+
+uint32_t SparseHashSpace ::findCell(const Vec3i &coord) const {
+  uint32_t mask = mTable.size() - 1;
+  for (uint32_t i = slot(coord);; i = (i + 1) & mask) {
+    uint32_t cell = mTable[i];
+    if (cell == invalidCell() || mCells[cell].coord == coord) {
+      return cell;
+    }
+  }
+}
+
+uint32_t SparseHashSpace ::addCell(const Vec3i &coord) {
+  // keep the table at most half full:
+  if (2 * (numCells() + 1) > mTable.size()) {
+    growTable();
+  }
+  uint32_t cell;
+  if (mFreeCells.empty()) {
+    cell = mCells.size();
+    mCells.push_back(Cell());
+  } else {
+    cell = mFreeCells.back();
+    mFreeCells.pop_back();
+  }
+  mCells[cell].coord = coord;
+  mCells[cell].first = invalidCell();
+  mCells[cell].count = 0;
+
+  uint32_t mask = mTable.size() - 1;
+  uint32_t i = slot(coord);
+  while (mTable[i] != invalidCell()) {
+    i = (i + 1) & mask;
+  }
+  mTable[i] = cell;
+  return cell;
+}
+
+void SparseHashSpace ::removeCell(uint32_t cell) {
+  uint32_t mask = mTable.size() - 1;
+  uint32_t i = slot(mCells[cell].coord);
+  while (mTable[i] != cell) {
+    i = (i + 1) & mask;
+  }
+  // shift back the following entries that probed past the removed one,
+  // so that lookups need no tombstones
+  for (uint32_t j = (i + 1) & mask; mTable[j] != invalidCell();
+       j = (j + 1) & mask) {
+    uint32_t home = slot(mCells[mTable[j]].coord);
+    bool movable = i <= j ? (home <= i || home > j) : (home <= i && home > j);
+    if (movable) {
+      mTable[i] = mTable[j];
+      i = j;
+    }
+  }
+  mTable[i] = invalidCell();
+  mCells[cell].first = invalidCell();
+  mFreeCells.push_back(cell);
+}
+
+void SparseHashSpace ::growTable() {
+  mTable.assign(2 * mTable.size(), invalidCell());
+  uint32_t mask = mTable.size() - 1;
+  for (uint32_t cell = 0; cell < mCells.size(); cell++) {
+    if (mCells[cell].count == 0) {
+      continue; // free
+    }
+    uint32_t i = slot(mCells[cell].coord);
+    while (mTable[i] != invalidCell()) {
+      i = (i + 1) & mask;
+    }
+    mTable[i] = cell;
+  }
+}
+
+int SparseHashSpace::Query ::operator()(const SparseHashSpace &space,
+                                        const Vec3d center, double maxRadius,
+                                        double minRadius) {
+  return find(space, center, nullptr, maxRadius, minRadius);
+}
+
+int SparseHashSpace::Query ::operator()(const SparseHashSpace &space,
+                                        const Object *obj, double maxRadius,
+                                        double minRadius) {
+  return find(space, obj->pos, obj, maxRadius, minRadius);
+}
+
+int SparseHashSpace::Query ::find(const SparseHashSpace &space,
+                                  const Vec3d &center, const Object *exclude,
+                                  double maxRadius, double minRadius) {
+  size_t start = mObjects.size();
+  if (mMaxResults == 0 || space.numCells() == 0 || std::isnan(maxRadius) ||
+      !std::isfinite(center.x) || !std::isfinite(center.y) ||
+      !std::isfinite(center.z)) {
+    return 0;
+  }
+  const double minr2 = minRadius * minRadius;
+  double maxr2 = maxRadius * maxRadius;
+  const double size = space.mCellSize;
+
+  // keeps the nearest results, as a max heap once full
+  auto add = [&](const Object &o) {
+    if (&o == exclude) {
+      return;
+    }
+    double d2 = (o.pos - center).magSqr();
+    if (d2 < minr2 || d2 > maxr2) {
+      return;
+    }
+    Result r(const_cast<Object *>(&o), d2);
+    if (mObjects.size() - start < mMaxResults) {
+      mObjects.push_back(r);
+      if (mObjects.size() - start == mMaxResults) {
+        std::make_heap(mObjects.begin() + start, mObjects.end(),
+                       Result::compare);
+        maxr2 = mObjects[start].distanceSquared;
+      }
+    } else if (d2 < mObjects[start].distanceSquared) {
+      std::pop_heap(mObjects.begin() + start, mObjects.end(), Result::compare);
+      mObjects.back() = r;
+      std::push_heap(mObjects.begin() + start, mObjects.end(), Result::compare);
+      maxr2 = mObjects[start].distanceSquared;
+    }
+  };
+  // distance along an axis from the center to a cell
+  auto gap = [&](int i, int c) {
+    double lo = c > -kCellLimit ? c * size : -HUGE_VAL;
+    double hi = c < kCellLimit ? (c + 1.) * size : HUGE_VAL;
+    return center[i] < lo ? lo - center[i]
+                          : (center[i] > hi ? center[i] - hi : 0.);
+  };
+  auto addCell = [&](const Cell &cell) {
+    for (uint32_t i = cell.first; i != invalidCell();
+         i = space.mObjects[i].next) {
+      add(space.mObjects[i]);
+    }
+  };
+
+  Vec3i lo = space.cellCoord(center - maxRadius);
+  Vec3i hi = space.cellCoord(center + maxRadius);
+  double boxCells = (double(hi.x) - lo.x + 1) * (double(hi.y) - lo.y + 1) *
+                    (double(hi.z) - lo.z + 1);
+  if (boxCells > space.numCells()) {
+    // fewer cells are occupied than cover the radius:
+    for (const Cell &cell : space.mCells) {
+      if (cell.count == 0) {
+        continue;
+      }
+      double gx = gap(0, cell.coord.x), gy = gap(1, cell.coord.y),
+             gz = gap(2, cell.coord.z);
+      if (gx * gx + gy * gy + gz * gz <= maxr2) {
+        addCell(cell);
+      }
+    }
+  } else {
+    for (int z = lo.z; z <= hi.z; z++) {
+      double gz = gap(2, z);
+      for (int y = lo.y; y <= hi.y; y++) {
+        double gy = gap(1, y);
+        double gyz2 = gz * gz + gy * gy;
+        if (gyz2 > maxr2) {
+          continue;
+        }
+        for (int x = lo.x; x <= hi.x; x++) {
+          double gx = gap(0, x);
+          if (gx * gx + gyz2 > maxr2) {
+            continue;
+          }
+          uint32_t cell = space.findCell(Vec3i(x, y, z));
+          if (cell != invalidCell()) {
+            addCell(space.mCells[cell]);
+          }
+        }
+      }
+    }
+  }
+  std::sort(mObjects.begin() + start, mObjects.end(), Result::compare);
+  return mObjects.size() - start;
+}
+
+SparseHashSpace::Object *
+SparseHashSpace::Query ::nearest(const SparseHashSpace &space,
+                                 const Object *obj) {
+  clear();
+  uint32_t maxResults = mMaxResults;
+  mMaxResults = 1;
+  // widen the search until something is found, or the search covers
+  // more cells than are occupied, where all cells are searched
+  double radius = space.mCellSize;
+  while (!(*this)(space, obj, radius)) {
+    double cells = 2 * radius / space.mCellSize + 1;
+    if (cells * cells * cells > space.numCells()) {
+      (*this)(space, obj, HUGE_VAL);
+      break;
+    }
+    radius *= 2;
+  }
+  mMaxResults = maxResults;
+  return size() ? mObjects[0].object : nullptr;
+}
@@ -43,11 +43,12 @@ void Parameter::setNoCalls(float value, void *blockReceiver) {
   if (mProcessCallback) {
     value = (*mProcessCallback)(value); //, mProcessUdata);
   }
-  if (blockReceiver) {
-    runChangeCallbacksSynchronous(value, nullptr);
-  }
-
+  bool deferred =
+      blockReceiver && runChangeCallbacksSynchronous(value, nullptr);
   mValue = value;
+  if (deferred) {
+    notifyDispatcher();
+  }
 }
 
 void Parameter::set(float value, ValueSource *src) {
@@ -59,8 +60,32 @@ void Parameter::set(float value, ValueSource *src) {
     value = (*mProcessCallback)(value); //, mProcessUdata);
   }
 
-  runChangeCallbacksSynchronous(value, src);
+  bool deferred = runChangeCallbacksSynchronous(value, src);
   mValue = value;
+  if (deferred) {
+    notifyDispatcher();
+  }
+}
+
+void Parameter::setSmoothing(SmoothingMode mode, float time,
+                             float sampleRate) {
+  mSmoother.configure(mode, time, sampleRate, mMax - mMin);
+  mSmoother.reset(get());
+}
+
+float Parameter::nextSample() {
+  mSmoother.setTarget(get());
+  return mSmoother.next();
+}
+
+void Parameter::processBlock(float *buffer, size_t numFrames) {
+  mSmoother.setTarget(get());
+  mSmoother.process(buffer, numFrames);
+}
+
+ParameterRamp<float> Parameter::ramp(size_t numFrames) {
+  mSmoother.setTarget(get());
+  return mSmoother.ramp(numFrames);
 }
 
 // ParameterInt
@@ -90,11 +115,12 @@ void ParameterInt::setNoCalls(int32_t value, void *blockReceiver) {
   if (mProcessCallback) {
     value = (*mProcessCallback)(value); //, mProcessUdata);
   }
-  if (blockReceiver) {
-    runChangeCallbacksSynchronous(value, nullptr);
-  }
-
+  bool deferred =
+      blockReceiver && runChangeCallbacksSynchronous(value, nullptr);
   mValue = value;
+  if (deferred) {
+    notifyDispatcher();
+  }
 }
 
 void ParameterInt::set(int32_t value, ValueSource *src) {
@@ -106,8 +132,11 @@ void ParameterInt::set(int32_t value, ValueSource *src) {
     value = (*mProcessCallback)(value); //, mProcessUdata);
   }
 
-  runChangeCallbacksSynchronous(value, src);
+  bool deferred = runChangeCallbacksSynchronous(value, src);
   mValue = value;
+  if (deferred) {
+    notifyDispatcher();
+  }
 }
 
 // ParameterBool
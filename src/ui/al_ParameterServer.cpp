@@ -5,133 +5,284 @@
 #include <algorithm>
 #include <cctype>
 #include <cstring>
+#include <unordered_map>
 
 using namespace al;
 
 // OSCNotifier implementation -------------------------------------------------
 
-OSCNotifier::OSCNotifier() { mHandshakeHandler.notifier = this; }
+OSCNotifier::OSCNotifier()
+    : mNotificationPool(new Notification[kNotificationPoolSize]) {
+  mHandshakeHandler.notifier = this;
+  for (uint32_t i = 0; i < kNotificationPoolSize; i++) {
+    mNotificationPool[i].poolIndex = i;
+    mNotificationPool[i].nextFree = i + 1 < kNotificationPoolSize ? i + 2 : 0;
+  }
+  mFreeNotifications = 1;
+}
 
 OSCNotifier::~OSCNotifier() {
+  stopNotificationThread();
+  flushNotifications();
   for (osc::Send *sender : mOSCSenders) {
     delete sender;
   }
 }
 
+void OSCNotifier::addListener(std::string IPaddress, uint16_t oscPort) {
+  auto newListenerSocket = new osc::Send;
+
+  if (newListenerSocket->open(oscPort, IPaddress.c_str())) {
+    // Resolve once here, name resolution can block
+    auto ip = Socket::nameToIp(IPaddress);
+    mListenerLock.lock();
+    mOSCSenders.push_back(newListenerSocket);
+    mListenerIps.push_back(ip);
+    mListenerLock.unlock();
+    mHasListeners.store(true, std::memory_order_release);
+    startNotificationThread();
+    //		std::cout << "Registered listener " << IPaddress << ":"
+    //<< oscPort<< std::endl;
+  } else {
+    delete newListenerSocket;
+    std::cerr << "ERROR: Could not register listener " << IPaddress << ":"
+              << oscPort << std::endl;
+  }
+}
+
 void OSCNotifier::notifyListeners(std::string OSCaddress, float value,
                                   ValueSource *src) {
-  mListenerLock.lock();
-  for (osc::Send *sender : mOSCSenders) {
-    auto ip = Socket::nameToIp(sender->address());
-
-    if (!src || (src->port == 0 && src->ipAddr != ip) ||
-        (src->port != sender->port() && src->ipAddr != ip)) {
-      sender->send(OSCaddress, value);
-    }
-    //		std::cout << "Notifying " << sender->address() << ":" <<
-    // sender->port() << " -- " << OSCaddress << std::endl;
-  }
-  mListenerLock.unlock();
+  queueMessage(OSCaddress, src, value);
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, int value,
                                   ValueSource *src) {
-  mListenerLock.lock();
-  for (osc::Send *sender : mOSCSenders) {
-    auto ip = Socket::nameToIp(sender->address());
-
-    if (!src || (src->port == 0 && src->ipAddr != ip) ||
-        (src->port != sender->port() && src->ipAddr != ip)) {
-      sender->send(OSCaddress, value);
-    }
-    //        std::cout << "Notifying " << sender->address() << ":" <<
-    //        sender->port() << " -- " << OSCaddress << std::endl;
-  }
-  mListenerLock.unlock();
+  queueMessage(OSCaddress, src, value);
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, std::string value,
                                   ValueSource *src) {
-  mListenerLock.lock();
-  for (osc::Send *sender : mOSCSenders) {
-    auto ip = Socket::nameToIp(sender->address());
-
-    if (!src || (src->port == 0 && src->ipAddr != ip) ||
-        (src->port != sender->port() && src->ipAddr != ip)) {
-      sender->send(OSCaddress, value);
-    }
-    //    std::cout << "Notifying " << sender->address() << ":" <<
-    //    sender->port()
-    //              << " -- " << OSCaddress << std::endl;
-  }
-  mListenerLock.unlock();
+  queueMessage(OSCaddress, src, value);
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, Vec3f value,
                                   ValueSource *src) {
-  mListenerLock.lock();
-  for (osc::Send *sender : mOSCSenders) {
-    auto ip = Socket::nameToIp(sender->address());
-
-    if (!src || (src->port == 0 && src->ipAddr != ip) ||
-        (src->port != sender->port() && src->ipAddr != ip)) {
-      sender->send(OSCaddress, value[0], value[1], value[2]);
-    }
-    //		std::cout << "Notifying " << sender->address() << ":" <<
-    // sender->port() << " -- " << OSCaddress << std::endl;
-  }
-  mListenerLock.unlock();
+  queueMessage(OSCaddress, src, value[0], value[1], value[2]);
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, Vec4f value,
                                   ValueSource *src) {
-  mListenerLock.lock();
-  for (osc::Send *sender : mOSCSenders) {
-    auto ip = Socket::nameToIp(sender->address());
-
-    if (!src || (src->port == 0 && src->ipAddr != ip) ||
-        (src->port != sender->port() && src->ipAddr != ip)) {
-      sender->send(OSCaddress, value[0], value[1], value[2], value[3]);
-    }
-    //		std::cout << "Notifying " << sender->address() << ":" <<
-    // sender->port() << " -- " << OSCaddress << std::endl;
-  }
-  mListenerLock.unlock();
+  queueMessage(OSCaddress, src, value[0], value[1], value[2], value[3]);
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, Pose value,
                                   ValueSource *src) {
-  mListenerLock.lock();
-  for (osc::Send *sender : mOSCSenders) {
-    auto ip = Socket::nameToIp(sender->address());
+  queueMessage(OSCaddress, src, (float)value.pos()[0], (float)value.pos()[1],
+               (float)value.pos()[2], (float)value.quat().w,
+               (float)value.quat().x, (float)value.quat().y,
+               (float)value.quat().z);
+}
 
-    if (!src || (src->port == 0 && src->ipAddr != ip) ||
-        (src->port != sender->port() && src->ipAddr != ip)) {
-      sender->send(OSCaddress, (float)value.pos()[0], (float)value.pos()[1],
-                   (float)value.pos()[2], (float)value.quat().w,
-                   (float)value.quat().x, (float)value.quat().y,
-                   (float)value.quat().z);
+void OSCNotifier::notifyListeners(std::string OSCaddress, Color value,
+                                  ValueSource *src) {
+  queueMessage(OSCaddress, src, float(value.r), float(value.g),
+               float(value.b));
+}
+
+void OSCNotifier::send(osc::Packet &p) {
+  if (!mHasListeners.load(std::memory_order_acquire)) {
+    return;
+  }
+  auto *notification = acquireNotification();
+  if (!notification) {
+    return;
+  }
+  notification->address.clear();
+  notification->data.assign(p.data(), p.data() + p.size());
+  notification->hasSource = false;
+  queueNotification(notification);
+}
+
+void OSCNotifier::appendPadded(std::vector<char> &data, const char *str,
+                               size_t len) {
+  // OSC strings are null terminated and padded to a multiple of 4 bytes
+  data.insert(data.end(), str, str + len);
+  data.resize(data.size() + 4 - (len % 4), 0);
+}
+
+void OSCNotifier::appendArgument(std::vector<char> &data, int value) {
+  uint32_t v = uint32_t(value);
+  const char bytes[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+  data.insert(data.end(), bytes, bytes + 4);
+}
+
+void OSCNotifier::appendArgument(std::vector<char> &data, float value) {
+  int32_t v;
+  std::memcpy(&v, &value, sizeof(v));
+  appendArgument(data, int(v));
+}
+
+OSCNotifier::Notification *OSCNotifier::acquireNotification() {
+  uint64_t head = mFreeNotifications.load(std::memory_order_acquire);
+  while (uint32_t(head) != 0) {
+    Notification *n = &mNotificationPool[uint32_t(head) - 1];
+    uint64_t next = (head & ~uint64_t(UINT32_MAX)) + (uint64_t(1) << 32) +
+                    n->nextFree.load(std::memory_order_relaxed);
+    if (mFreeNotifications.compare_exchange_weak(head, next,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_acquire)) {
+      return n;
     }
-    //		std::cout << "Notifying " << sender->address() << ":" <<
-    // sender->port() << " -- " << OSCaddress << std::endl;
   }
-  mListenerLock.unlock();
+  // Pool exhausted by a burst
+  mDroppedNotifications.fetch_add(1, std::memory_order_relaxed);
+  return nullptr;
 }
 
-void OSCNotifier::notifyListeners(std::string OSCaddress, Color value,
-                                  ValueSource *src) {
-  mListenerLock.lock();
-  for (osc::Send *sender : mOSCSenders) {
-    auto ip = Socket::nameToIp(sender->address());
+void OSCNotifier::releaseNotification(Notification *notification) {
+  uint64_t head = mFreeNotifications.load(std::memory_order_relaxed);
+  uint64_t next;
+  do {
+    notification->nextFree.store(uint32_t(head), std::memory_order_relaxed);
+    next = (head & ~uint64_t(UINT32_MAX)) + (uint64_t(1) << 32) +
+           notification->poolIndex + 1;
+  } while (!mFreeNotifications.compare_exchange_weak(
+      head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void OSCNotifier::queueNotification(Notification *notification) {
+  notification->next = mPendingNotifications.load(std::memory_order_relaxed);
+  while (!mPendingNotifications.compare_exchange_weak(
+      notification->next, notification, std::memory_order_release,
+      std::memory_order_relaxed)) {
+  }
+}
+
+bool OSCNotifier::isSource(const Notification &notification,
+                           size_t listenerIndex) {
+  if (!notification.hasSource) {
+    return false;
+  }
+  const ValueSource &src = notification.source;
+  const std::string &ip = mListenerIps[listenerIndex];
+  return !((src.port == 0 && src.ipAddr != ip) ||
+           (src.port != mOSCSenders[listenerIndex]->port() &&
+            src.ipAddr != ip));
+}
+
+void OSCNotifier::flushNotifications() {
+  std::unique_lock<std::mutex> lk(mFlushLock);
+  Notification *head = mPendingNotifications.exchange(
+      nullptr, std::memory_order_acquire);
+  if (!head) {
+    return;
+  }
+  // The stack holds the newest notification first. Restore queue order and
+  // coalesce: a repeated address replaces the earlier entry and takes its
+  // place at the end, so the final value is still sent after anything that
+  // was queued before it.
+  std::vector<Notification *> notifications;
+  for (Notification *n = head; n; n = n->next) {
+    notifications.push_back(n);
+  }
+  std::reverse(notifications.begin(), notifications.end());
+  std::unordered_map<std::string, size_t> latest;
+  for (size_t i = 0; i < notifications.size(); i++) {
+    const std::string &address = notifications[i]->address;
+    if (address.size() > 0) {
+      auto previous = latest.find(address);
+      if (previous != latest.end()) {
+        releaseNotification(notifications[previous->second]);
+        notifications[previous->second] = nullptr;
+        previous->second = i;
+      } else {
+        latest[address] = i;
+      }
+    }
+  }
 
-    if (!src || (src->port == 0 && src->ipAddr != ip) ||
-        (src->port != sender->port() && src->ipAddr != ip)) {
-      sender->send(OSCaddress, float(value.r), float(value.g), float(value.b));
+  // OSC bundle: "#bundle\0", 8 byte time tag (1 is "immediately"), then
+  // each element prefixed by its big endian int32 size.
+  const char bundleHeader[16] = {'#', 'b', 'u', 'n', 'd', 'l', 'e', 0,
+                                 0,   0,   0,   0,   0,   0,   0,   1};
+  const size_t maxPacketSize = mMaxPacketSize.load();
+  std::vector<char> bundle;
+  bundle.reserve(maxPacketSize);
+  std::unique_lock<std::mutex> listenerLock(mListenerLock);
+  for (size_t listener = 0; listener < mOSCSenders.size(); listener++) {
+    osc::Send *sender = mOSCSenders[listener];
+    const std::vector<char> *single = nullptr;
+    size_t elementCount = 0;
+    bundle.assign(bundleHeader, bundleHeader + 16);
+    auto sendPending = [&]() {
+      if (elementCount == 1) { // Skip bundle overhead for single messages
+        sender->sendRaw(single->data(), single->size());
+      } else if (elementCount > 1) {
+        sender->sendRaw(bundle.data(), bundle.size());
+      }
+      bundle.resize(16);
+      elementCount = 0;
+    };
+    for (Notification *notification : notifications) {
+      if (!notification || isSource(*notification, listener)) {
+        continue;
+      }
+      const std::vector<char> &data = notification->data;
+      if (bundle.size() + 4 + data.size() > maxPacketSize) {
+        sendPending();
+        if (16 + 4 + data.size() > maxPacketSize) {
+          sender->sendRaw(data.data(), data.size());
+          continue;
+        }
+      }
+      uint32_t size = (uint32_t)data.size();
+      bundle.push_back(char(size >> 24));
+      bundle.push_back(char(size >> 16));
+      bundle.push_back(char(size >> 8));
+      bundle.push_back(char(size));
+      bundle.insert(bundle.end(), data.begin(), data.end());
+      single = &data;
+      elementCount++;
     }
-    //		std::cout << "Notifying " << sender->address() << ":" <<
-    // sender->port() << " -- " << OSCaddress << std::endl;
+    sendPending();
+  }
+  for (Notification *notification : notifications) {
+    if (notification) {
+      releaseNotification(notification);
+    }
+  }
+}
+
+void OSCNotifier::startNotificationThread() {
+  if (mNotificationThreadRunning.exchange(true)) {
+    return;
+  }
+  mNotificationThread = std::make_unique<std::thread>([this]() {
+    // Wait a full interval before each flush, so notifications queued right
+    // after addListener() are sent together
+    std::unique_lock<std::mutex> lk(mNotificationThreadLock);
+    while (mNotificationThreadRunning) {
+      if (!mNotificationThreadWake.wait_for(
+              lk, std::chrono::duration<double>(mNotificationInterval.load()),
+              [this]() { return !mNotificationThreadRunning; })) {
+        lk.unlock();
+        flushNotifications();
+        lk.lock();
+      }
+    }
+  });
+}
+
+void OSCNotifier::stopNotificationThread() {
+  {
+    std::unique_lock<std::mutex> lk(mNotificationThreadLock);
+    mNotificationThreadRunning = false;
+  }
+  mNotificationThreadWake.notify_all();
+  if (mNotificationThread) {
+    mNotificationThread->join();
+    mNotificationThread = nullptr;
   }
-  mListenerLock.unlock();
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, ParameterMeta *param,
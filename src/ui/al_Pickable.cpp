@@ -18,18 +18,23 @@ Pickable::Pickable() {
 
 bool Pickable::event(PickEvent e) {
   bool child = false;
-  for (unsigned int i = 0; i < children.size(); i++) {
-    if (testChildren) {
-      Rayd ray = transformRayLocal(e.ray);
-      auto ev = PickEvent(e.type, ray);
+  if (testChildren && !children.empty()) {
+    Rayd ray = transformRayLocal(e.ray);
+    auto ev = PickEvent(e.type, ray);
+    for (unsigned int i = 0; i < children.size(); i++) {
       child |= children[i]->event(ev);
-    } else
+    }
+  } else {
+    for (unsigned int i = 0; i < children.size(); i++) {
       children[i]->clearSelection();
+    }
   }
   if (child)
     return true;
   else {
-    Hit h = intersect(e.ray);
+    // rays that miss the bounds can not hit, so skip the exact test
+    Hit h = mayIntersect(e.ray) ? intersect(e.ray)
+                                : Hit(false, e.ray, -1, this);
     return onEvent(e, h);
   }
 }
@@ -77,31 +82,69 @@ void Pickable::draw(Graphics &g, std::function<void(Pickable &)> f) {
 }
 
 Rayd Pickable::transformRayLocal(const Rayd &ray) {
-  Matrix4d t, r, s;
-  Matrix4d model = t.translation(pose.get().pos()) *
-                   r.fromQuat(pose.get().quat()) * s.scaling(scaleVec.get());
-  Matrix4d invModel = Matrix4d::inverse(model);
+  const Matrix4d &invModel = inverseModelMatrix();
   Vec4d o = invModel.transform(Vec4d(ray.o, 1));
   Vec4d d = invModel.transform(Vec4d(ray.d, 0));
   return Rayd(o.sub<3>(0), d.sub<3>(0));
 }
 
 Vec3f Pickable::transformVecWorld(const Vec3f &v, float w) {
-  Matrix4d t, r, s;
-  Matrix4d model = t.translation(pose.get().pos()) *
-                   r.fromQuat(pose.get().quat()) * s.scaling(scaleVec.get());
-  Vec4d o = model.transform(Vec4d(v, w));
+  Vec4d o = modelMatrix().transform(Vec4d(v, w));
   return Vec3f(o.sub<3>(0));
 }
 
 Vec3f Pickable::transformVecLocal(const Vec3f &v, float w) {
-  Matrix4d t, r, s;
-  Matrix4d invModel = t.translation(pose.get().pos()) *
-                      r.fromQuat(pose.get().quat()) * s.scaling(scaleVec.get());
-  Vec4d o = invModel.transform(Vec4d(v, w));
+  Vec4d o = inverseModelMatrix().transform(Vec4d(v, w));
   return Vec3f(o.sub<3>(0));
 }
 
+bool Pickable::updateTransforms() {
+  // both snapshots must be updated, so no short circuit
+  bool poseChanged = mPoseSnapshot.update();
+  bool scaleChanged = mScaleSnapshot.update();
+  if (mTransformsValid && !poseChanged && !scaleChanged) return false;
+  Pose p = mPoseSnapshot.get();
+  Matrix4d t, r, s;
+  mModel = t.translation(p.pos()) * r.fromQuat(p.quat()) *
+           s.scaling(mScaleSnapshot.get());
+  mInverseModel = Matrix4d::inverse(mModel);
+  mTransformsValid = true;
+  mBoundsValid = false;
+  return true;
+}
+
+bool Pickable::updateBounds() {
+  BoundingBoxData local;
+  bool bounded = localBounds(local);
+  updateTransforms();
+  if (mBoundsValid && bounded == mBounded &&
+      (!bounded ||
+       (local.min == mLocalBounds.min && local.max == mLocalBounds.max))) {
+    return false;
+  }
+  mBoundsValid = true;
+  mBounded = bounded;
+  mLocalBounds = local;
+  if (bounded) {
+    // as in PickableBB::updateAABB(), padded for rounding
+    Matrix4d absModel(mModel);
+    for (int i = 0; i < 16; i++) absModel[i] = std::abs(absModel[i]);
+    Vec4d cen = mModel.transform(Vec4d(local.cen, 1));
+    Vec4d dim = absModel.transform(Vec4d(local.dim, 0));
+    Vec3f pad = Vec3f(dim.sub<3>(0)) * 1e-4f + 1e-6f;
+    mParentBounds.setCenterDim(cen.sub<3>(0), Vec3f(dim.sub<3>(0)) + pad);
+  }
+  return true;
+}
+
+bool Pickable::mayIntersect(const Rayd &r) {
+  updateBounds();
+  if (!mBounded) return true;
+  Rayd ray(r);
+  Vec3d cen(mParentBounds.cen), dim(mParentBounds.dim);
+  return ray.intersectBox(cen, dim) > 0;
+}
+
 void PickableBB::set(Mesh &m) {
   mesh = &m;
   bb.set(*mesh);
@@ -109,8 +152,13 @@ void PickableBB::set(Mesh &m) {
 
 Hit PickableBB::intersect(Rayd r) {
   auto ray = transformRayLocal(r);
-  double t = intersectBB(ray) * scaleVec.get().x;
-  // auto r2 = Rayd(r.o*scaleVec.get(), r.d);
+  double t = intersectBB(ray);
+  if (t > 0 && testMesh && mesh) {
+    t = intersectMesh(ray);
+  }
+  // Rayd normalizes the local direction, so convert t back to a distance
+  // along r. Scaling by scaleVec.x alone is wrong for non-uniform scales.
+  t *= Vec3d(modelMatrix().transform(Vec4d(ray.d, 0)).sub<3>(0)).mag();
   if (t > 0)
     return Hit(true, r, t, this);
   else
@@ -315,3 +363,45 @@ void PickableBB::updateAABB() {
   Vec4d dim = absModel.transform(Vec4d(bb.dim, 0));
   aabb.setCenterDim(cen.sub<3>(0), dim.sub<3>(0));
 }
+
+double PickableBB::intersectMesh(Rayd localRay) {
+  const auto &v = mesh->vertices();
+  const auto &indices = mesh->indices();
+  size_t n = indices.empty() ? v.size() : indices.size();
+  auto vertex = [&](size_t i) -> Vec3d {
+    return Vec3d(v[indices.empty() ? i : indices[i]]);
+  };
+  // nearest hit by the Moller-Trumbore ray triangle test
+  double nearest = -1;
+  auto triangle = [&](size_t i0, size_t i1, size_t i2) {
+    Vec3d p0 = vertex(i0);
+    Vec3d e1 = vertex(i1) - p0, e2 = vertex(i2) - p0;
+    Vec3d p = cross(localRay.d, e2);
+    double det = e1.dot(p);
+    if (det == 0) return;
+    double invDet = 1 / det;
+    Vec3d s = localRay.o - p0;
+    double u = s.dot(p) * invDet;
+    if (u < 0 || u > 1) return;
+    Vec3d q = cross(s, e1);
+    double w = localRay.d.dot(q) * invDet;
+    if (w < 0 || u + w > 1) return;
+    double t = e2.dot(q) * invDet;
+    if (t > 0 && (nearest < 0 || t < nearest)) nearest = t;
+  };
+  switch (mesh->primitive()) {
+    case Mesh::TRIANGLES:
+      for (size_t i = 0; i + 2 < n; i += 3) triangle(i, i + 1, i + 2);
+      break;
+    case Mesh::TRIANGLE_STRIP:
+      for (size_t i = 0; i + 2 < n; i++) triangle(i, i + 1, i + 2);
+      break;
+    case Mesh::TRIANGLE_FAN:
+      for (size_t i = 1; i + 1 < n; i++) triangle(0, i, i + 1);
+      break;
+    default:
+      // no triangles, so the bounding box is the best there is
+      return intersectBB(localRay);
+  }
+  return nearest;
+}
@@ -1,12 +1,108 @@
 #include "al/ui/al_PickableManager.hpp"
 
+#include <algorithm>
+
 using namespace al;
 
+PickableManager::~PickableManager() {
+  for (size_t i = 0; i < mPickables.size(); i++) {
+    mPickables[i]->pose.removeChangeCallback(mCallbacks[i].pose);
+    mPickables[i]->scaleVec.removeChangeCallback(mCallbacks[i].scale);
+  }
+}
+
 PickableManager &PickableManager::registerPickable(Pickable &p) {
   mPickables.push_back(&p);
+  mHierarchyValid = false;
+  std::shared_ptr<std::atomic<bool>> changed = mBoundsChanged;
+  Callbacks callbacks;
+  callbacks.pose =
+      p.pose.registerChangeCallback([changed](Pose) { changed->store(true); });
+  callbacks.scale = p.scaleVec.registerChangeCallback(
+      [changed](Vec3f) { changed->store(true); });
+  mCallbacks.push_back(callbacks);
+  return *this;
+}
+
+PickableManager &PickableManager::unregisterPickable(Pickable &p) {
+  auto it = std::find(mPickables.begin(), mPickables.end(), &p);
+  if (it != mPickables.end()) {
+    auto callbacks = mCallbacks.begin() + (it - mPickables.begin());
+    p.pose.removeChangeCallback(callbacks->pose);
+    p.scaleVec.removeChangeCallback(callbacks->scale);
+    mCallbacks.erase(callbacks);
+    mPickables.erase(it);
+    mHierarchyValid = false;
+  }
   return *this;
 }
+
 Hit PickableManager::intersect(Rayd r) {
+  updateHierarchy();
+  Hit hmin = Hit(false, r, 1e10, NULL);
+  for (Pickable *p : mUnbounded) {
+    Hit h = p->intersect(r);
+    if (h.hit && h.t < hmin.t) {
+      hmin = h;
+    }
+  }
+  if (mNodes.empty()) {
+    return hmin;
+  }
+
+  Vec3d inv;
+  for (int i = 0; i < 3; i++) {
+    // avoids 0 * inf for rays parallel to a face
+    inv[i] = r.d[i] != 0 ? 1 / r.d[i] : 1e30;
+  }
+  // distance along the ray to the box of a node, or -1 if missed
+  auto entry = [&](const Node &n) {
+    double tmin = 0, tmax = hmin.t;
+    for (int i = 0; i < 3; i++) {
+      double t0 = (n.min[i] - r.o[i]) * inv[i];
+      double t1 = (n.max[i] - r.o[i]) * inv[i];
+      if (t0 > t1) {
+        std::swap(t0, t1);
+      }
+      tmin = std::max(tmin, t0);
+      tmax = std::min(tmax, t1);
+    }
+    return tmin <= tmax ? tmin : -1.;
+  };
+
+  mStack.clear();
+  if (entry(mNodes.back()) >= 0) {
+    mStack.push_back(int(mNodes.size()) - 1); // the root
+  }
+  while (!mStack.empty()) {
+    const Node &n = mNodes[mStack.back()];
+    mStack.pop_back();
+    if (n.left < 0) {
+      Hit h = n.pickable->intersect(r);
+      if (h.hit && h.t < hmin.t) {
+        hmin = h;
+      }
+      continue;
+    }
+    double tl = entry(mNodes[n.left]);
+    double tr = entry(mNodes[n.right]);
+    // visit the nearer child first, so that it prunes the other
+    int first = n.left, second = n.right;
+    if (tr >= 0 && (tl < 0 || tr < tl)) {
+      std::swap(first, second);
+      std::swap(tl, tr);
+    }
+    if (tr >= 0) {
+      mStack.push_back(second);
+    }
+    if (tl >= 0) {
+      mStack.push_back(first);
+    }
+  }
+  return hmin;
+}
+
+Hit PickableManager::intersectAll(Rayd r) {
   Hit hmin = Hit(false, r, 1e10, NULL);
   for (Pickable *p : mPickables) {
     Hit h = p->intersect(r);
@@ -17,6 +113,137 @@ Hit PickableManager::intersect(Rayd r) {
   return hmin;
 }
 
+void PickableManager::updateHierarchy() {
+  if (!mHierarchyValid) {
+    buildHierarchy();
+    return;
+  }
+  if (!mBoundsChanged->exchange(false)) {
+    return;
+  }
+  bool refit = false;
+  for (size_t i = 0; i < mPickables.size(); i++) {
+    Pickable *p = mPickables[i];
+    if (!p->updateBounds()) {
+      continue;
+    }
+    if (p->bounded() != (mLeaves[i] >= 0)) {
+      buildHierarchy();
+      return;
+    }
+    if (!p->bounded()) {
+      continue;
+    }
+    // refit the leaf and its ancestors
+    Node &leaf = mNodes[mLeaves[i]];
+    leaf.min = p->parentBounds().min;
+    leaf.max = p->parentBounds().max;
+    for (int n = leaf.parent; n >= 0; n = mNodes[n].parent) {
+      fitNode(mNodes[n]);
+    }
+    refit = true;
+  }
+  if (refit) {
+    mArea = 0;
+    for (const Node &n : mNodes) {
+      mArea += surfaceArea(n);
+    }
+    // moved pickables make nodes overlap, which slows down traversal
+    if (mArea > 2 * mBuildArea) {
+      buildHierarchy();
+    }
+  }
+}
+
+void PickableManager::buildHierarchy() {
+  mBoundsChanged->store(false);
+  mNodes.clear();
+  mUnbounded.clear();
+  mLeaves.assign(mPickables.size(), -1);
+  std::vector<int> leaves;
+  for (size_t i = 0; i < mPickables.size(); i++) {
+    Pickable *p = mPickables[i];
+    p->updateBounds();
+    if (!p->bounded()) {
+      mUnbounded.push_back(p);
+      continue;
+    }
+    Node leaf;
+    leaf.min = p->parentBounds().min;
+    leaf.max = p->parentBounds().max;
+    leaf.parent = leaf.left = leaf.right = -1;
+    leaf.pickable = p;
+    mLeaves[i] = int(mNodes.size());
+    leaves.push_back(int(mNodes.size()));
+    mNodes.push_back(leaf);
+  }
+  if (!leaves.empty()) {
+    // the root is the last node
+    mNodes.reserve(2 * leaves.size() - 1);
+    buildNode(leaves, 0, int(leaves.size()), -1);
+  }
+  mBuildArea = 0;
+  for (const Node &n : mNodes) {
+    mBuildArea += surfaceArea(n);
+  }
+  mArea = mBuildArea;
+  mHierarchyValid = true;
+}
+
+int PickableManager::buildNode(std::vector<int> &leaves, int begin, int end,
+                               int parent) {
+  if (end - begin == 1) {
+    mNodes[leaves[begin]].parent = parent;
+    return leaves[begin];
+  }
+  // split at the median along the longest axis of the centers
+  Vec3f lo = mNodes[leaves[begin]].min + mNodes[leaves[begin]].max;
+  Vec3f hi = lo;
+  for (int i = begin + 1; i < end; i++) {
+    Vec3f c = mNodes[leaves[i]].min + mNodes[leaves[i]].max;
+    for (int k = 0; k < 3; k++) {
+      lo[k] = std::min(lo[k], c[k]);
+      hi[k] = std::max(hi[k], c[k]);
+    }
+  }
+  Vec3f extent = hi - lo;
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                 : (extent.y > extent.z ? 1 : 2);
+  int mid = (begin + end) / 2;
+  std::nth_element(leaves.begin() + begin, leaves.begin() + mid,
+                   leaves.begin() + end, [&](int a, int b) {
+                     return mNodes[a].min[axis] + mNodes[a].max[axis] <
+                            mNodes[b].min[axis] + mNodes[b].max[axis];
+                   });
+
+  int left = buildNode(leaves, begin, mid, -1);
+  int right = buildNode(leaves, mid, end, -1);
+  int index = int(mNodes.size());
+  mNodes.push_back(Node());
+  Node &n = mNodes[index];
+  n.parent = parent;
+  n.left = left;
+  n.right = right;
+  n.pickable = nullptr;
+  mNodes[left].parent = mNodes[right].parent = index;
+  fitNode(n);
+  return index;
+}
+
+void PickableManager::fitNode(Node &n) {
+  const Node &l = mNodes[n.left];
+  const Node &r = mNodes[n.right];
+  for (int k = 0; k < 3; k++) {
+    n.min[k] = std::min(l.min[k], r.min[k]);
+    n.max[k] = std::max(l.max[k], r.max[k]);
+  }
+}
+
+float PickableManager::surfaceArea(const Node &n) {
+  Vec3f d = n.max - n.min;
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
 void PickableManager::event(PickEvent e) {
   Hit h = intersect(e.ray);
   for (Pickable *p : mPickables) {
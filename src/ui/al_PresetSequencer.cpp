@@ -7,6 +7,7 @@
 #include <string>
 
 #include "al/io/al_File.hpp"
+#include "al/protocol/al_ClusterClock.hpp"
 #include "al/ui/al_Composition.hpp"
 #include "al/ui/al_SequenceRecorder.hpp"
 
@@ -160,8 +161,16 @@ void PresetSequencer::sequencerFunction(al::PresetSequencer *sequencer) {
     sequencer->mPlayPromiseObj->set_value();
     //    }
 
+    ClusterClock *clock = sequencer->mClock;
+    double lastClockTime = clock ? clock->now() : 0.0;
     while (sequencer->running()) {
-      sequencer->stepSequencer(sequencer->mGranularity * 1.0e-9);
+      double dt = sequencer->mGranularity * 1.0e-9;
+      if (clock) {
+        double clockTime = clock->now();
+        dt = clockTime - lastClockTime;
+        lastClockTime = clockTime;
+      }
+      sequencer->stepSequencer(dt);
       std::this_thread::sleep_for(
           std::chrono::nanoseconds(sequencer->mGranularity));
     }
@@ -0,0 +1,92 @@
+// Benchmark for culling bounding spheres against a view frustum
+//
+// Tests random spheres around the viewer against the frustums of the six
+// faces of a cube map, as an omni renderer draws a DynamicScene, one
+// sphere at a time with Frustum::testSphere() and in a batch with
+// Frustum::testSpheres(). Both must agree on which spheres are outside.
+
+#include <cstdio>
+#include <vector>
+
+#include "al/math/al_Frustum.hpp"
+#include "al/math/al_Matrix4.hpp"
+#include "al/math/al_Random.hpp"
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+static const int kFrames = 20;
+static const int kSpheres = 100000;
+static const float kExtent = 200;
+
+int main() {
+  rnd::Random<> rng(1);
+  std::vector<float> x(kSpheres), y(kSpheres), z(kSpheres), r(kSpheres);
+  for (int i = 0; i < kSpheres; i++) {
+    x[i] = rng.uniformS() * kExtent / 2;
+    y[i] = rng.uniformS() * kExtent / 2;
+    z[i] = rng.uniformS() * kExtent / 2;
+    r[i] = rng.uniform() * 2;
+  }
+
+  const Vec3f dirs[6] = {{1, 0, 0},  {-1, 0, 0}, {0, 1, 0},
+                         {0, -1, 0}, {0, 0, 1},  {0, 0, -1}};
+  const Vec3f ups[6] = {{0, 1, 0}, {0, 1, 0},  {0, 0, -1},
+                        {0, 0, 1}, {0, 1, 0}, {0, 1, 0}};
+  Matrix4f proj = Matrix4f::perspective(90.f, 1.f, 0.1f, 1000.f);
+  Frustumd faces[6];
+  double cornerError = 0;
+  for (int f = 0; f < 6; f++) {
+    faces[f].fromMatrix(proj * Matrix4f::lookAt(Vec3f(), dirs[f], ups[f]));
+    for (int c = 0; c < 8; c++) {
+      // each corner lies on three planes
+      for (int p = 0; p < 6; p++) {
+        double d = std::abs(faces[f].pl[p].distance(faces[f].corner(c)));
+        if (d < 1e-3 * faces[f].corner(c).mag()) continue;
+        // on the other planes it must be inside
+        if (faces[f].pl[p].inNegativeSpace(faces[f].corner(c))) {
+          cornerError = std::max(cornerError, d);
+        }
+      }
+    }
+  }
+
+  std::vector<unsigned char> inside(kSpheres);
+  al_sec singleTime = 0, batchTime = 0;
+  long drawn = 0, mismatches = 0;
+  for (int frame = 0; frame < kFrames; frame++) {
+    for (int f = 0; f < 6; f++) {
+      const Frustumd &frustum = faces[f];
+      al_sec t0 = al_steady_time();
+      int singleDrawn = 0;
+      for (int i = 0; i < kSpheres; i++) {
+        singleDrawn += frustum.testSphere(Vec3d(x[i], y[i], z[i]), r[i]) !=
+                       Frustumd::OUTSIDE;
+      }
+      al_sec t1 = al_steady_time();
+      frustum.testSpheres(x.data(), y.data(), z.data(), r.data(), kSpheres,
+                          inside.data());
+      al_sec t2 = al_steady_time();
+
+      singleTime += t1 - t0;
+      batchTime += t2 - t1;
+      int batchDrawn = 0;
+      for (int i = 0; i < kSpheres; i++) {
+        batchDrawn += inside[i];
+      }
+      drawn += batchDrawn;
+      mismatches += std::abs(batchDrawn - singleDrawn);
+    }
+  }
+
+  std::printf("%d spheres, 6 cube faces, %d frames\n", kSpheres, kFrames);
+  std::printf("drawn per face:  %.1f%%\n",
+              100. * drawn / (double(kSpheres) * 6 * kFrames));
+  std::printf("testSphere:      %.3f ms per frame\n",
+              singleTime * 1000 / kFrames);
+  std::printf("testSpheres:     %.3f ms per frame\n",
+              batchTime * 1000 / kFrames);
+  std::printf("mismatches:      %ld\n", mismatches);
+  std::printf("corner error:    %g\n", cornerError);
+  return 0;
+}
@@ -0,0 +1,148 @@
+// Benchmark for HashSpace batch neighbor queries
+//
+// Moves a flock of agents and finds the neighbors of every agent each frame,
+// once with a Query per agent and once with HashSpace::neighbors() on
+// different numbers of threads: all neighbors within a radius, and the
+// nearest neighbors, for which the Query results are sorted. The batch
+// results are checked against a brute force search for a sample of agents.
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "al/math/al_Random.hpp"
+#include "al/spatial/al_HashSpace.hpp"
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+static const int kFrames = 5;
+static const uint32_t kAgents = 100000;
+
+struct Search {
+  const char *name;
+  double radius;
+  uint32_t maxResults;
+};
+
+static void moveAgents(HashSpace &space, rnd::Random<> &rng) {
+  for (uint32_t id = 0; id < space.numObjects(); id++) {
+    Vec3d step(rng.uniformS(), rng.uniformS(), rng.uniformS());
+    space.move(id, space.object(id).pos + step * 0.5);
+  }
+}
+
+// Nearest neighbors of one agent by checking all agents
+static std::vector<HashSpace::Neighbor>
+bruteForce(HashSpace &space, uint32_t id, const Search &search) {
+  std::vector<HashSpace::Neighbor> found;
+  Vec3f pos(space.object(id).pos);
+  float r2 = search.radius * search.radius;
+  for (uint32_t j = 0; j < space.numObjects(); j++) {
+    if (j == id) {
+      continue;
+    }
+    Vec3f rel = space.wrapRelative(Vec3f(space.object(j).pos) - pos);
+    float d2 = rel.magSqr();
+    if (d2 <= r2) {
+      found.push_back({j, d2});
+    }
+  }
+  std::sort(found.begin(), found.end(),
+            [](const HashSpace::Neighbor &a, const HashSpace::Neighbor &b) {
+              return a.distanceSquared < b.distanceSquared ||
+                     (a.distanceSquared == b.distanceSquared && a.id < b.id);
+            });
+  if (found.size() > search.maxResults) {
+    found.resize(search.maxResults);
+  }
+  return found;
+}
+
+int main() {
+  int cores = int(std::thread::hardware_concurrency());
+  std::vector<int> threadCounts = {1, 2, 4};
+  if (cores > 4) {
+    threadCounts.push_back(cores);
+  }
+  const Search searches[] = {{"radius", 2.5, 64}, {"nearest", 4, 16}};
+
+  rnd::Random<> rng(1);
+  HashSpace space(6, kAgents);
+  for (uint32_t id = 0; id < kAgents; id++) {
+    space.move(id, space.dim() * rng.uniform(), space.dim() * rng.uniform(),
+               space.dim() * rng.uniform());
+  }
+  std::printf("%u agents, %d frames, %d cores\n", kAgents, kFrames, cores);
+  std::printf("%-8s %6s %5s %-10s %8s %12s %12s %10s %8s\n", "search",
+              "radius", "max", "method", "threads", "update (ms)",
+              "query (ms)", "found", "speedup");
+
+  for (const Search &search : searches) {
+    bool sorted = search.maxResults < 64;
+    HashSpace::Query query(sorted ? 1024 : search.maxResults);
+    al_sec queryTime = 0;
+    size_t found = 0;
+    for (int frame = 0; frame < kFrames; frame++) {
+      moveAgents(space, rng);
+      al_sec start = al_steady_time();
+      found = 0;
+      for (uint32_t id = 0; id < kAgents; id++) {
+        query.clear();
+        uint32_t n = query(space, &space.object(id), search.radius);
+        if (sorted) {
+          n = std::min(n, search.maxResults);
+          std::partial_sort(query.begin(), query.begin() + n, query.end(),
+                            [](const HashSpace::Query::Result &a,
+                               const HashSpace::Query::Result &b) {
+                              return a.distanceSquared < b.distanceSquared;
+                            });
+        }
+        found += n;
+      }
+      queryTime += al_steady_time() - start;
+    }
+    queryTime /= kFrames;
+    std::printf("%-8s %6.1f %5u %-10s %8d %12s %12.2f %10zu %8s\n",
+                search.name, search.radius, search.maxResults, "Query", 1, "-",
+                queryTime * 1000.0, found, "");
+
+    HashSpace::Neighbors neighbors;
+    for (int threads : threadCounts) {
+      al_sec updateTime = 0, neighborsTime = 0;
+      for (int frame = 0; frame < kFrames; frame++) {
+        moveAgents(space, rng);
+        al_sec start = al_steady_time();
+        space.update(threads);
+        al_sec mid = al_steady_time();
+        space.neighbors(neighbors, search.radius, search.maxResults, threads);
+        neighborsTime += al_steady_time() - mid;
+        updateTime += mid - start;
+      }
+      updateTime /= kFrames;
+      neighborsTime /= kFrames;
+
+      found = 0;
+      for (uint32_t id = 0; id < kAgents; id++) {
+        found += neighbors[id].size();
+      }
+      bool same = true;
+      for (uint32_t id = 0; id < kAgents; id += kAgents / 100) {
+        std::vector<HashSpace::Neighbor> expected =
+            bruteForce(space, id, search);
+        const HashSpace::Neighbors::Span &span = neighbors[id];
+        same &= span.size() == expected.size();
+        for (uint32_t i = 0; same && i < span.size(); i++) {
+          same &= span[i].id == expected[i].id;
+        }
+      }
+      std::printf("%-8s %6.1f %5u %-10s %8d %12.2f %12.2f %10zu %7.2fx%s\n",
+                  search.name, search.radius, search.maxResults, "neighbors",
+                  threads, updateTime * 1000.0, neighborsTime * 1000.0, found,
+                  queryTime / (updateTime + neighborsTime),
+                  same ? "" : "  MISMATCH");
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,165 @@
+// Benchmark for isosurface extraction
+//
+// Extracts the surface of a field of moving blobs with different numbers of
+// threads and checks that the meshes are identical. Then compares skipping
+// empty bricks and incremental updates for a small blob moving through a
+// large field.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "al/graphics/al_Isosurface.hpp"
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+static const int kFrames = 5;
+
+// Sum of inverse square distances to a few orbiting points
+static void fillField(std::vector<float> &field, int n, float t) {
+  const int kBlobs = 6;
+  float blobs[kBlobs][3];
+  for (int b = 0; b < kBlobs; b++) {
+    float phase = t + b * 1.047f;
+    blobs[b][0] = 0.5f + 0.3f * std::cos(phase * (1 + b % 3));
+    blobs[b][1] = 0.5f + 0.3f * std::sin(phase * (1 + b % 2));
+    blobs[b][2] = 0.5f + 0.3f * std::cos(phase * 0.7f + b);
+  }
+  float scale = 1.0f / (n - 1);
+  for (int z = 0; z < n; z++) {
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        float sum = 0;
+        for (auto &blob : blobs) {
+          float dx = x * scale - blob[0];
+          float dy = y * scale - blob[1];
+          float dz = z * scale - blob[2];
+          sum += 0.01f / (dx * dx + dy * dy + dz * dz + 0.001f);
+        }
+        field[(size_t(z) * n + y) * n + x] = sum;
+      }
+    }
+  }
+}
+
+// Adds a cone of height s and radius r around a point
+static void addBlob(std::vector<float> &field, int n, const float *c, float r,
+                    float s) {
+  int lo[3], hi[3];
+  for (int i = 0; i < 3; i++) {
+    lo[i] = std::max(0, int(c[i] - r));
+    hi[i] = std::min(n - 1, int(c[i] + r) + 1);
+  }
+  for (int z = lo[2]; z <= hi[2]; z++) {
+    for (int y = lo[1]; y <= hi[1]; y++) {
+      for (int x = lo[0]; x <= hi[0]; x++) {
+        float dx = x - c[0], dy = y - c[1], dz = z - c[2];
+        float d = std::sqrt(dx * dx + dy * dy + dz * dz);
+        field[(size_t(z) * n + y) * n + x] += s * std::max(0.0f, r - d);
+      }
+    }
+  }
+}
+
+static bool sameMesh(const Mesh &a, const Mesh &b) {
+  return a.vertices() == b.vertices() && a.normals() == b.normals() &&
+         a.indices() == b.indices();
+}
+
+int main() {
+  const int sizes[] = {64, 128, 256};
+  int cores = int(std::thread::hardware_concurrency());
+  std::vector<int> threadCounts = {1, 2, 4};
+  if (cores > 4) {
+    threadCounts.push_back(cores);
+  }
+  std::printf("%d frames per size, %d cores\n", kFrames, cores);
+  std::printf("%6s %8s %10s %12s %12s %8s\n", "field", "threads", "vertices",
+              "triangles", "time (ms)", "speedup");
+  for (int n : sizes) {
+    std::vector<float> field(size_t(n) * n * n);
+    fillField(field, n, 0.0f);
+    Isosurface reference;
+    reference.threads(1);
+    reference.level(1.0f);
+    reference.generate(field.data(), n, 1.0f / (n - 1));
+
+    double serialTime = 0;
+    for (int threads : threadCounts) {
+      Isosurface surface;
+      surface.threads(threads);
+      surface.level(1.0f);
+      al_sec time = 0;
+      bool same = true;
+      for (int frame = 0; frame < kFrames; frame++) {
+        fillField(field, n, frame * 0.1f);
+        al_sec start = al_steady_time();
+        surface.generate(field.data(), n, 1.0f / (n - 1));
+        time += al_steady_time() - start;
+        if (frame == kFrames - 1) {
+          fillField(field, n, 0.0f);
+          surface.generate(field.data(), n, 1.0f / (n - 1));
+          same = sameMesh(surface, reference);
+        }
+      }
+      time /= kFrames;
+      if (threads == 1) {
+        serialTime = time;
+      }
+      std::printf("%5d^3 %8d %10zu %12zu %12.2f %7.2fx%s\n", n, threads,
+                  surface.vertices().size(), surface.indices().size() / 3,
+                  time * 1000.0, serialTime / time, same ? "" : "  MISMATCH");
+    }
+  }
+
+  // Sparse surface: one small blob moving through the field
+  const int n = 256;
+  const float radius = 8;
+  std::printf("\nBlob of radius %.0f moving through %d^3 field\n", radius, n);
+  std::vector<float> field(size_t(n) * n * n, 0.0f);
+  Isosurface full, bricks, incremental;
+  full.brickSize(n);
+  for (Isosurface *s : {&full, &bricks, &incremental}) {
+    s->level(radius * 0.5f);
+    s->fieldDims(n).cellLengths(1.0 / (n - 1));
+  }
+  al_sec fullTime = 0, brickTime = 0, updateTime = 0;
+  float center[3] = {n * 0.25f, n * 0.5f, n * 0.5f};
+  for (int frame = 0; frame < kFrames; frame++) {
+    if (frame > 0) {
+      addBlob(field, n, center, radius, -1.0f);
+      center[0] += 2.0f;
+    }
+    addBlob(field, n, center, radius, 1.0f);
+    int lo[3], hi[3];
+    for (int i = 0; i < 3; i++) {
+      lo[i] = int(center[i] - radius) - 3;
+      hi[i] = int(center[i] + radius) + 3;
+    }
+    incremental.markDirty(lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+
+    al_sec start = al_steady_time();
+    full.generate(field.data());
+    al_sec t1 = al_steady_time();
+    bricks.generate(field.data());
+    al_sec t2 = al_steady_time();
+    incremental.update(field.data());
+    al_sec t3 = al_steady_time();
+    // The first update extracts all bricks
+    if (frame > 0) {
+      updateTime += t3 - t2;
+    }
+    fullTime += t1 - start;
+    brickTime += t2 - t1;
+  }
+  std::printf("%24s %12s\n", "", "time (ms)");
+  std::printf("%24s %12.3f\n", "all cells", fullTime * 1000.0 / kFrames);
+  std::printf("%24s %12.3f\n", "skipping empty bricks",
+              brickTime * 1000.0 / kFrames);
+  std::printf("%24s %12.3f\n", "update changed bricks",
+              updateTime * 1000.0 / (kFrames - 1));
+  return 0;
+}
@@ -0,0 +1,93 @@
+// Benchmark for MeshSimplifier and MeshLOD
+//
+// Simplifies meshes of a few million triangles with different numbers of
+// threads, then prints the levels of detail generated for each mesh.
+
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "al/graphics/al_Isosurface.hpp"
+#include "al/graphics/al_MeshLOD.hpp"
+#include "al/graphics/al_Shapes.hpp"
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+// Bumpy sphere
+static void fillField(std::vector<float> &field, int n) {
+  for (int z = 0; z < n; z++) {
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        float dx = x - n * 0.5f, dy = y - n * 0.5f, dz = z - n * 0.5f;
+        field[(size_t(z) * n + y) * n + x] =
+            std::sqrt(dx * dx + dy * dy + dz * dz) +
+            n * 0.02f * std::sin(x * 0.15f) * std::cos(y * 0.1f) *
+                std::sin(z * 0.12f);
+      }
+    }
+  }
+}
+
+static void benchmark(const char *name, const Mesh &mesh) {
+  int cores = int(std::thread::hardware_concurrency());
+  std::vector<int> threadCounts = {1, 2, 4};
+  if (cores > 4) {
+    threadCounts.push_back(cores);
+  }
+  size_t triangles = mesh.indices().size() / 3;
+  std::printf("\n%s: %zu triangles, %zu vertices\n", name, triangles,
+              mesh.vertices().size());
+  std::printf("%8s %10s %12s %12s %12s %8s\n", "threads", "target",
+              "triangles", "error", "time (ms)", "speedup");
+  for (float ratio : {0.5f, 0.1f, 0.01f}) {
+    double serialTime = 0;
+    for (int threads : threadCounts) {
+      Mesh simplified = mesh;
+      MeshSimplifier simplifier;
+      simplifier.threads(threads).targetTriangles(size_t(triangles * ratio));
+      al_sec start = al_steady_time();
+      float error = simplifier.simplify(simplified);
+      al_sec time = al_steady_time() - start;
+      if (threads == 1) {
+        serialTime = time;
+      }
+      std::printf("%8d %10zu %12zu %12.2e %12.1f %7.2fx\n", threads,
+                  simplifier.targetTriangles(),
+                  simplified.indices().size() / 3, error, time * 1000.0,
+                  serialTime / time);
+    }
+  }
+
+  MeshLOD lod;
+  MeshSimplifier simplifier;
+  simplifier.threads(0);
+  al_sec start = al_steady_time();
+  lod.generate(mesh, 6, 0.25f, simplifier);
+  al_sec time = al_steady_time() - start;
+  std::printf("%d levels in %.1f ms\n", lod.levels(), time * 1000.0);
+  std::printf("%6s %12s %12s %16s\n", "level", "triangles", "error",
+              "from distance");
+  for (int i = 0; i < lod.levels(); i++) {
+    std::printf("%6d %12zu %12.2e %16.2f\n", i,
+                lod.level(i).indices().size() / 3, lod.error(i),
+                lod.error(i) / lod.tolerance());
+  }
+}
+
+int main() {
+  Mesh sphere;
+  addSphere(sphere, 1, 1024, 1024);
+  benchmark("sphere 1024x1024", sphere);
+
+  const int n = 320;
+  std::vector<float> field(size_t(n) * n * n);
+  fillField(field, n);
+  Isosurface iso;
+  iso.threads(0);
+  iso.level(n * 0.4f);
+  iso.generate(field.data(), n, 2.0f / (n - 1));
+  benchmark("isosurface 320^3", iso);
+  return 0;
+}
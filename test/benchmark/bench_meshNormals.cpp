@@ -0,0 +1,100 @@
+// Benchmark for Mesh::generateNormals
+//
+// Generates the normals of a rippling indexed grid and of the same grid as a
+// triangle strip with different numbers of threads, and checks that the
+// normals are identical to the serial ones. The vertex to face table is built
+// in the first frame and reused after that.
+
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "al/graphics/al_Mesh.hpp"
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+static const int kFrames = 10;
+
+// Grid of n by n vertices, as triangles or as one strip per row joined by
+// degenerate triangles
+static void makeGrid(Mesh &mesh, int n, bool strip) {
+  mesh.reset();
+  mesh.primitive(strip ? Mesh::TRIANGLE_STRIP : Mesh::TRIANGLES);
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      mesh.vertex(float(x) / (n - 1), float(y) / (n - 1), 0.0f);
+    }
+  }
+  for (int y = 0; y < n - 1; y++) {
+    for (int x = 0; x < n - 1; x++) {
+      unsigned i = y * n + x;
+      if (strip) {
+        if (x == 0 && y > 0) {
+          mesh.index(i);
+        }
+        mesh.index(i, i + n);
+        if (x == n - 2) {
+          mesh.index(i + 1, i + 1 + n, i + 1 + n);
+        }
+      } else {
+        mesh.index(i, i + 1, i + n);
+        mesh.index(i + 1, i + n + 1, i + n);
+      }
+    }
+  }
+}
+
+static void ripple(Mesh &mesh, float t) {
+  for (auto &v : mesh.vertices()) {
+    float dx = v.x - 0.5f, dy = v.y - 0.5f;
+    v.z = 0.05f * std::sin(40.0f * std::sqrt(dx * dx + dy * dy) - t);
+  }
+}
+
+int main() {
+  const int sizes[] = {256, 1024};
+  int cores = int(std::thread::hardware_concurrency());
+  std::vector<int> threadCounts = {1, 2, 4};
+  if (cores > 4) {
+    threadCounts.push_back(cores);
+  }
+  std::printf("%d frames per mesh, %d cores\n", kFrames, cores);
+  std::printf("%6s %6s %8s %10s %12s %12s %8s\n", "grid", "type", "threads",
+              "vertices", "indices", "time (ms)", "speedup");
+  for (int n : sizes) {
+    for (bool strip : {false, true}) {
+      Mesh reference;
+      makeGrid(reference, n, strip);
+      ripple(reference, 0.0f);
+      reference.generateNormals();
+
+      double serialTime = 0;
+      for (int threads : threadCounts) {
+        Mesh mesh;
+        makeGrid(mesh, n, strip);
+        al_sec time = 0;
+        for (int frame = 0; frame < kFrames; frame++) {
+          ripple(mesh, frame * 0.3f);
+          al_sec start = al_steady_time();
+          mesh.generateNormals(true, false, threads);
+          time += al_steady_time() - start;
+        }
+        ripple(mesh, 0.0f);
+        mesh.generateNormals(true, false, threads);
+        bool same = mesh.normals() == reference.normals();
+
+        time /= kFrames;
+        if (threads == 1) {
+          serialTime = time;
+        }
+        std::printf("%6d %6s %8d %10zu %12zu %12.2f %7.2fx%s\n", n,
+                    strip ? "strip" : "tris", threads, mesh.vertices().size(),
+                    mesh.indices().size(), time * 1000.0, serialTime / time,
+                    same ? "" : "  MISMATCH");
+      }
+    }
+  }
+  return 0;
+}
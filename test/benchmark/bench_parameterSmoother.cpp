@@ -0,0 +1,82 @@
+// Benchmark for ParameterSmoother
+//
+// Smooths a bank of parameters block by block, as an audio callback would,
+// while they are moving towards new targets and after they have settled.
+// Settled smoothers should only cost a copy (process()) or nothing at all
+// (ramp()), so a large patch of mostly idle parameters stays cheap.
+
+#include <cstdio>
+#include <vector>
+
+#include "al/system/al_Time.hpp"
+#include "al/ui/al_ParameterSmoother.hpp"
+
+using namespace al;
+
+static const float kSampleRate = 48000.0f;
+static const size_t kBlockSize = 512;
+static const int kBlocks = 200;
+
+static volatile float gSink; // Keeps the smoothed values observable
+
+struct Result {
+  double blockTime;
+  float checksum;
+};
+
+// moving: give every smoother a new target at the start of each block
+static Result run(std::vector<ParameterSmoother<float>> &smoothers,
+                  bool useRamp, bool moving) {
+  std::vector<float> buffer(kBlockSize);
+  float checksum = 0;
+  al_sec start = al_steady_time();
+  for (int block = 0; block < kBlocks; block++) {
+    for (size_t i = 0; i < smoothers.size(); i++) {
+      auto &smoother = smoothers[i];
+      if (moving) {
+        smoother.setTarget(float((block + i) % 7));
+      }
+      if (useRamp) {
+        auto ramp = smoother.ramp(kBlockSize);
+        checksum += ramp[kBlockSize - 1];
+      } else {
+        smoother.process(buffer.data(), kBlockSize);
+        checksum += buffer[kBlockSize - 1];
+      }
+    }
+  }
+  return {(al_steady_time() - start) / kBlocks, checksum};
+}
+
+int main() {
+  const size_t counts[] = {100, 1000, 10000};
+  const SmoothingMode modes[] = {SmoothingMode::LINEAR,
+                                 SmoothingMode::EXPONENTIAL};
+  double blockDuration = kBlockSize / kSampleRate;
+  std::printf("%d blocks of %zu frames, %.2f ms per block at %.0f Hz\n",
+              kBlocks, kBlockSize, blockDuration * 1000.0, kSampleRate);
+  std::printf("%8s %12s %8s %14s %14s %10s\n", "params", "mode", "call",
+              "moving (ms)", "settled (ms)", "ratio");
+  for (size_t count : counts) {
+    for (SmoothingMode mode : modes) {
+      for (bool useRamp : {false, true}) {
+        std::vector<ParameterSmoother<float>> smoothers(count);
+        for (auto &smoother : smoothers) {
+          smoother.configure(mode, 0.05f, kSampleRate);
+        }
+        Result moving = run(smoothers, useRamp, true);
+        for (auto &smoother : smoothers) {
+          smoother.reset(smoother.target());
+        }
+        Result settled = run(smoothers, useRamp, false);
+        std::printf("%8zu %12s %8s %14.4f %14.4f %9.1fx\n", count,
+                    mode == SmoothingMode::LINEAR ? "linear" : "exponential",
+                    useRamp ? "ramp" : "process", moving.blockTime * 1000.0,
+                    settled.blockTime * 1000.0,
+                    moving.blockTime / settled.blockTime);
+        gSink = moving.checksum + settled.checksum;
+      }
+    }
+  }
+  return 0;
+}
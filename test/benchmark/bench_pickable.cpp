@@ -0,0 +1,93 @@
+// Benchmark for picking with PickableManager
+//
+// Casts rays from the center of a field of randomly placed and rotated
+// PickableBB boxes, testing every pickable against testing the pickables
+// that the bounding volume hierarchy finds, and checks that both give the
+// same nearest hit. Between frames some of the boxes move, which refits
+// the hierarchy.
+
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "al/graphics/al_Shapes.hpp"
+#include "al/math/al_Random.hpp"
+#include "al/system/al_Time.hpp"
+#include "al/ui/al_PickableManager.hpp"
+
+using namespace al;
+
+static const int kFrames = 5;
+static const int kRays = 1000;
+static const float kExtent = 100;
+static const float kMoving = 0.1f; // fraction of boxes moving each frame
+
+static Pose randomPose(rnd::Random<> &rng) {
+  Vec3f pos(rng.uniformS(), rng.uniformS(), rng.uniformS());
+  Quatf quat(rng.uniformS(), rng.uniformS(), rng.uniformS(), rng.uniformS());
+  return Pose(pos * kExtent, quat.normalize());
+}
+
+int main() {
+  Mesh cube;
+  addCube(cube);
+  const int counts[] = {100, 1000, 10000};
+
+  std::printf("%d rays, %d frames, %g%% of boxes moving\n", kRays, kFrames,
+              kMoving * 100);
+  std::printf("%8s %14s %14s %14s %8s %10s\n", "boxes", "linear (ms)",
+              "bvh (ms)", "event (ms)", "hits", "mismatch");
+
+  for (int count : counts) {
+    rnd::Random<> rng(1);
+    std::vector<std::unique_ptr<PickableBB>> boxes;
+    PickableManager manager;
+    for (int i = 0; i < count; i++) {
+      boxes.emplace_back(new PickableBB(cube));
+      boxes.back()->pose = randomPose(rng);
+      boxes.back()->scale = 0.5f + rng.uniform();
+      manager << boxes.back().get();
+    }
+
+    al_sec linearTime = 0, bvhTime = 0, eventTime = 0;
+    int hits = 0, mismatches = 0;
+    for (int frame = 0; frame < kFrames; frame++) {
+      for (int i = 0; i < count * kMoving; i++) {
+        boxes[rng.uniform(count)]->pose = randomPose(rng);
+      }
+      std::vector<Rayd> rays(kRays);
+      for (Rayd &r : rays) {
+        r.set(Vec3d(), Vec3d(rng.normal(), rng.normal(), rng.normal()));
+      }
+
+      std::vector<Hit> linear(kRays), bvh(kRays);
+      al_sec t0 = al_steady_time();
+      for (int i = 0; i < kRays; i++) {
+        linear[i] = manager.intersectAll(rays[i]);
+      }
+      al_sec t1 = al_steady_time();
+      for (int i = 0; i < kRays; i++) {
+        bvh[i] = manager.intersect(rays[i]);
+      }
+      al_sec t2 = al_steady_time();
+      for (int i = 0; i < kRays; i++) {
+        manager.event(PickEvent(Point, rays[i]));
+      }
+      al_sec t3 = al_steady_time();
+
+      linearTime += t1 - t0;
+      bvhTime += t2 - t1;
+      eventTime += t3 - t2;
+      for (int i = 0; i < kRays; i++) {
+        hits += linear[i].hit;
+        if (linear[i].hit != bvh[i].hit || linear[i].p != bvh[i].p) {
+          mismatches++;
+        }
+      }
+    }
+    std::printf("%8d %14.2f %14.2f %14.2f %8d %10d\n", count,
+                linearTime * 1000 / kFrames, bvhTime * 1000 / kFrames,
+                eventTime * 1000 / kFrames, hits / kFrames, mismatches);
+  }
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Benchmark for SparseHashSpace against HashSpace
+//
+// Moves agents and queries the neighbors of every agent each frame, for a
+// dense cube of agents and for sparse clusters of agents in a large world.
+// The HashSpace covers the extent of the agents, scaled to its dimension,
+// while the SparseHashSpace has cells the size of the query radius.
+
+#include <cstdio>
+#include <vector>
+
+#include "al/math/al_Random.hpp"
+#include "al/spatial/al_HashSpace.hpp"
+#include "al/spatial/al_SparseHashSpace.hpp"
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+static const int kFrames = 5;
+static const uint32_t kAgents = 100000;
+static const double kRadius = 2;
+static const uint32_t kMaxResults = 64;
+
+struct Scene {
+  const char *name;
+  double extent;      // agents are placed in [0, extent) per axis
+  int clusters;       // 0 for uniformly distributed agents
+  uint32_t resolution; // of the HashSpace
+};
+
+static std::vector<Vec3d> place(const Scene &scene, rnd::Random<> &rng) {
+  std::vector<Vec3d> positions(kAgents);
+  std::vector<Vec3d> centers(scene.clusters);
+  for (auto &c : centers) {
+    c = Vec3d(rng.uniform(), rng.uniform(), rng.uniform()) * scene.extent;
+  }
+  for (uint32_t i = 0; i < kAgents; i++) {
+    if (scene.clusters) {
+      positions[i] = centers[i % scene.clusters] +
+                     Vec3d(rng.normal(), rng.normal(), rng.normal()) * 5.0;
+    } else {
+      positions[i] =
+          Vec3d(rng.uniform(), rng.uniform(), rng.uniform()) * scene.extent;
+    }
+  }
+  return positions;
+}
+
+static void jiggle(std::vector<Vec3d> &positions, rnd::Random<> &rng) {
+  for (auto &p : positions) {
+    p += Vec3d(rng.uniformS(), rng.uniformS(), rng.uniformS()) * 0.2;
+  }
+}
+
+int main() {
+  const Scene scenes[] = {{"dense", 64, 0, 6}, {"sparse", 100000, 200, 7}};
+  std::printf("%u agents, radius %g, up to %u results, %d frames\n", kAgents,
+              kRadius, kMaxResults, kFrames);
+  std::printf("%-8s %-16s %10s %10s %12s %12s\n", "scene", "index", "cells",
+              "move (ms)", "query (ms)", "found");
+
+  for (const Scene &scene : scenes) {
+    rnd::Random<> rng(1);
+    std::vector<Vec3d> start = place(scene, rng);
+
+    {
+      HashSpace space(scene.resolution, kAgents);
+      double scale = space.dim() / scene.extent;
+      HashSpace::Query query(kMaxResults);
+      std::vector<Vec3d> positions = start;
+      al_sec moveTime = 0, queryTime = 0;
+      size_t found = 0;
+      for (int frame = 0; frame < kFrames; frame++) {
+        jiggle(positions, rng);
+        al_sec t0 = al_steady_time();
+        for (uint32_t id = 0; id < kAgents; id++) {
+          space.move(id, positions[id] * scale);
+        }
+        al_sec t1 = al_steady_time();
+        found = 0;
+        for (uint32_t id = 0; id < kAgents; id++) {
+          query.clear();
+          found += query(space, &space.object(id), kRadius * scale);
+        }
+        moveTime += t1 - t0;
+        queryTime += al_steady_time() - t1;
+      }
+      std::printf("%-8s %-16s %10u %10.2f %12.2f %12zu\n", scene.name,
+                  "HashSpace", space.dim() * space.dim() * space.dim(),
+                  moveTime * 1000.0 / kFrames, queryTime * 1000.0 / kFrames,
+                  found);
+    }
+
+    {
+      SparseHashSpace space(kRadius, kAgents);
+      SparseHashSpace::Query query(kMaxResults);
+      std::vector<Vec3d> positions = start;
+      al_sec moveTime = 0, queryTime = 0;
+      size_t found = 0;
+      for (int frame = 0; frame < kFrames; frame++) {
+        jiggle(positions, rng);
+        al_sec t0 = al_steady_time();
+        for (uint32_t id = 0; id < kAgents; id++) {
+          space.move(id, positions[id]);
+        }
+        al_sec t1 = al_steady_time();
+        found = 0;
+        for (uint32_t id = 0; id < kAgents; id++) {
+          query.clear();
+          found += query(space, &space.object(id), kRadius);
+        }
+        moveTime += t1 - t0;
+        queryTime += al_steady_time() - t1;
+      }
+      std::printf("%-8s %-16s %10u %10.2f %12.2f %12zu\n", scene.name,
+                  "SparseHashSpace", space.numCells(),
+                  moveTime * 1000.0 / kFrames, queryTime * 1000.0 / kFrames,
+                  found);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+// Benchmark for delta encoded state distribution
+//
+// Simulates a particle system state where a fraction of the particles move
+// each frame and reports bandwidth savings and codec cost.
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "al/app/al_StateDistributionDomain.hpp"
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+struct Particle {
+  float position[3];
+  float velocity[3];
+  float color[2];
+};
+
+static const size_t kParticleCount = 65536; // 2 MB of state
+static const int kFrames = 300;
+
+int main() {
+  const double changeRates[] = {0.001, 0.01, 0.05, 0.2, 1.0};
+  std::printf("%d frames of %zu KB state, keyframe every 30 frames\n", kFrames,
+              kParticleCount * sizeof(Particle) / 1024);
+  std::printf("%10s %12s %14s %14s\n", "changed", "bandwidth", "encode (ms)",
+              "decode (ms)");
+  for (double rate : changeRates) {
+    std::vector<Particle> state(kParticleCount);
+    std::vector<Particle> received(kParticleCount);
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<size_t> pick(0, kParticleCount - 1);
+    size_t changesPerFrame = size_t(rate * kParticleCount);
+
+    StateDeltaEncoder encoder;
+    encoder.configure(64, 30);
+    StateDeltaDecoder decoder;
+    al_sec encodeTime = 0, decodeTime = 0;
+    for (int frame = 0; frame < kFrames; frame++) {
+      if (rate >= 1.0) {
+        for (auto &p : state) {
+          p.position[0] += p.velocity[0] + 0.01f;
+        }
+      } else {
+        for (size_t i = 0; i < changesPerFrame; i++) {
+          state[pick(rng)].position[0] += 0.01f;
+        }
+      }
+      al_sec start = al_steady_time();
+      auto &encoded =
+          encoder.encode(state.data(), sizeof(Particle) * state.size());
+      al_sec mid = al_steady_time();
+      decoder.decode(encoded.data(), encoded.size(), received.data(),
+                     sizeof(Particle) * received.size());
+      decodeTime += al_steady_time() - mid;
+      encodeTime += mid - start;
+    }
+    bool ok = std::memcmp(state.data(), received.data(),
+                          sizeof(Particle) * state.size()) == 0;
+    std::printf("%9.1f%% %11.1f%% %14.3f %14.3f%s\n", rate * 100.0,
+                100.0 * encoder.bytesOut() / encoder.bytesIn(),
+                encodeTime * 1000.0 / kFrames, decodeTime * 1000.0 / kFrames,
+                ok ? "" : "  MISMATCH");
+  }
+  return 0;
+}
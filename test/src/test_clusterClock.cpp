@@ -0,0 +1,99 @@
+
+#include "catch.hpp"
+
+#include "al/protocol/al_ClusterClock.hpp"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace al;
+
+#ifndef _WIN32
+namespace {
+// Local clock with an offset and running at a different rate than the
+// primary's
+class SkewedClockClient : public ClusterClockClient {
+public:
+  SkewedClockClient(double offset, double drift)
+      : mOffset(offset), mDrift(drift) {}
+  ~SkewedClockClient() { stop(); }
+
+  al_sec localTime() override {
+    return al_steady_time() * (1.0 + mDrift) + mOffset;
+  }
+
+private:
+  double mOffset;
+  double mDrift;
+};
+
+// Largest difference between the estimated and the true cluster time, or a
+// negative value if synchronization failed
+double measureSkew(double offset, double drift) {
+  SkewedClockClient clock(offset, drift);
+  clock.setSyncInterval(0.05);
+  bool started = false;
+  al_sec deadline = al_steady_time() + 2.0;
+  while (!started && al_steady_time() < deadline) {
+    started = clock.start(16330, "localhost");
+    if (!started) {
+      al_sleep(0.05);
+    }
+  }
+  if (!started || !clock.waitForSync()) {
+    return -1.0;
+  }
+  // Long enough to estimate the drift
+  al_sleep(2.5);
+  double skew = 0.0;
+  for (int i = 0; i < 100; i++) {
+    al_sec before = al_steady_time();
+    al_sec clusterTime = clock.now();
+    al_sec after = al_steady_time();
+    // Skip readings where the process was preempted
+    if (after - before < 100.0e-6) {
+      skew = std::max(skew, std::abs(clusterTime - (before + after) * 0.5));
+    }
+    al_sleep(0.005);
+  }
+  return skew;
+}
+} // namespace
+
+TEST_CASE("ClusterClock residual skew") {
+  // Replicas in separate processes, started before the primary's threads.
+  // They inherit the steady clock origin, so their true offset is known.
+  al_start_steady_clock();
+  const int numReplicas = 3;
+  pid_t pids[numReplicas];
+  int pipes[numReplicas][2];
+  for (int i = 0; i < numReplicas; i++) {
+    REQUIRE(pipe(pipes[i]) == 0);
+    pids[i] = fork();
+    REQUIRE(pids[i] >= 0);
+    if (pids[i] == 0) {
+      close(pipes[i][0]);
+      double skew = measureSkew(100.0 * (i + 1), 100.0e-6 * (i - 1));
+      ssize_t written = write(pipes[i][1], &skew, sizeof(skew));
+      _exit(written == sizeof(skew) ? 0 : 1);
+    }
+    close(pipes[i][1]);
+  }
+
+  ClusterClockServer server;
+  REQUIRE(server.start(16330, "localhost"));
+  for (int i = 0; i < numReplicas; i++) {
+    double skew = -1.0;
+    REQUIRE(read(pipes[i][0], &skew, sizeof(skew)) == sizeof(skew));
+    close(pipes[i][0]);
+    int status;
+    waitpid(pids[i], &status, 0);
+    INFO("replica " << i << " skew " << skew);
+    REQUIRE(skew >= 0.0);
+    REQUIRE(skew < 0.001);
+  }
+  server.stop();
+}
+#endif
@@ -0,0 +1,275 @@
+
+#include "catch.hpp"
+
+#include <atomic>
+#include <thread>
+
+#include "al/protocol/al_CommandConnection.hpp"
+
+using namespace al;
+
+namespace {
+enum { TEST_DATA = CommandConnection::COMMAND_LAST_INTERNAL };
+
+bool checkData(Message &m) {
+  uint32_t size = m.get<uint32_t>();
+  if (m.remainingBytes() != size) {
+    return false;
+  }
+  for (uint32_t i = 0; i < size; i++) {
+    if (m.data()[i] != uint8_t(i * 7)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<uint8_t> makeData(uint32_t size) {
+  std::vector<uint8_t> data(5 + size);
+  data[0] = TEST_DATA;
+  memcpy(data.data() + 1, &size, sizeof(size));
+  for (uint32_t i = 0; i < size; i++) {
+    data[5 + i] = uint8_t(i * 7);
+  }
+  return data;
+}
+
+class TestServer : public CommandServer {
+public:
+  bool processIncomingMessage(Message &m, Socket *src) override {
+    if (m.getByte() == TEST_DATA) {
+      checkData(m) ? received++ : corrupt++;
+      return true;
+    }
+    return false;
+  }
+  std::atomic<int> received{0};
+  std::atomic<int> corrupt{0};
+};
+
+class TestClient : public CommandClient {
+public:
+  bool processIncomingMessage(Message &m, Socket *src) override {
+    if (m.getByte() == TEST_DATA) {
+      checkData(m) ? received++ : corrupt++;
+      return true;
+    }
+    return false;
+  }
+  std::atomic<int> received{0};
+  std::atomic<int> corrupt{0};
+};
+} // namespace
+
+TEST_CASE("CommandServer framed messages") {
+  TestServer server;
+  REQUIRE(server.start(16320, "localhost"));
+  TestClient clients[4];
+  for (auto &client : clients) {
+    REQUIRE(client.start(16320, "localhost"));
+  }
+  REQUIRE(server.waitForConnections(4, 5.0) == 4);
+
+  // Messages larger than the socket buffers arrive whole
+  std::vector<uint32_t> sizes = {1, 3000, 100000, 1000000};
+  for (auto size : sizes) {
+    auto data = makeData(size);
+    REQUIRE(server.sendMessage(data.data(), data.size()));
+    for (auto &client : clients) {
+      REQUIRE(client.sendMessage(data.data(), data.size()));
+    }
+  }
+
+  int expected = int(sizes.size());
+  al_sec start = al_steady_time();
+  auto done = [&]() {
+    for (auto &client : clients) {
+      if (client.received != expected) {
+        return false;
+      }
+    }
+    return server.received == 4 * expected;
+  };
+  while (!done() && al_steady_time() - start < 5.0) {
+    al_sleep(0.01);
+  }
+  REQUIRE(server.received == 4 * expected);
+  REQUIRE(server.corrupt == 0);
+  for (auto &client : clients) {
+    REQUIRE(client.received == expected);
+    REQUIRE(client.corrupt == 0);
+  }
+
+  // Closed connections are removed
+  clients[0].stop();
+  clients[1].stop();
+  start = al_steady_time();
+  while (server.connectionCount() > 2 && al_steady_time() - start < 2.0) {
+    al_sleep(0.01);
+  }
+  REQUIRE(server.connectionCount() == 2);
+
+  clients[2].stop();
+  clients[3].stop();
+  server.stop();
+}
+
+TEST_CASE("CommandServer handshake in pieces") {
+  TestServer server;
+  REQUIRE(server.start(16325, "localhost"));
+
+  auto waitForCount = [&](size_t count) {
+    al_sec start = al_steady_time();
+    while (server.connectionCount() != count &&
+           al_steady_time() - start < 2.0) {
+      al_sleep(0.01);
+    }
+    return server.connectionCount() == count;
+  };
+  auto recvAck = [](SocketClient &socket) {
+    uint8_t ack[8];
+    size_t total = 0;
+    al_sec start = al_steady_time();
+    while (total < 5 && al_steady_time() - start < 2.0) {
+      size_t bytes = socket.recv((char *)ack + total, sizeof(ack) - total);
+      if (bytes > 0 && bytes <= sizeof(ack) - total) {
+        total += bytes;
+      }
+    }
+    return total >= 5 && ack[0] == CommandConnection::HANDSHAKE_ACK
+               ? total
+               : size_t(0);
+  };
+  const uint8_t handshake[6] = {CommandConnection::HANDSHAKE, 7, 0, 2, 0,
+                                CommandConnection::CAPABILITY_FRAMING};
+
+  // A handshake split across several packets
+  SocketClient split;
+  REQUIRE(split.open(16325, "localhost", 0.5, Socket::TCP));
+  split.send((const char *)handshake, 1);
+  al_sleep(0.1);
+  split.send((const char *)handshake + 1, 3);
+  al_sleep(0.1);
+  REQUIRE(server.connectionCount() == 0);
+  split.send((const char *)handshake + 4, 2);
+  REQUIRE(recvAck(split) == 6);
+  REQUIRE(waitForCount(1));
+
+  // A 5 byte handshake from a client without capabilities
+  SocketClient legacy;
+  REQUIRE(legacy.open(16325, "localhost", 0.5, Socket::TCP));
+  legacy.send((const char *)handshake, 5);
+  REQUIRE(recvAck(legacy) == 5);
+  REQUIRE(waitForCount(2));
+
+  // A short handshake is never accepted
+  SocketClient shortHandshake;
+  REQUIRE(shortHandshake.open(16325, "localhost", 0.5, Socket::TCP));
+  shortHandshake.send((const char *)handshake, 3);
+  al_sleep(0.2);
+  shortHandshake.close();
+  al_sleep(0.1);
+  REQUIRE(server.connectionCount() == 2);
+
+  split.close();
+  legacy.close();
+  REQUIRE(waitForCount(0));
+  server.stop();
+}
+
+TEST_CASE("CommandServer compression with mixed peers") {
+  TestServer server;
+  server.setCompression(true, CompressionCodec::LZ, 64);
+  REQUIRE(server.start(16335, "localhost"));
+  TestClient plain;
+  REQUIRE(plain.start(16335, "localhost"));
+  TestClient compressing;
+  compressing.setCompression(true, CompressionCodec::LZ, 64);
+  REQUIRE(compressing.start(16335, "localhost"));
+  REQUIRE(server.waitForConnections(2, 5.0) == 2);
+
+  // makeData() repeats every 256 bytes, so it compresses well
+  auto data = makeData(100000);
+  REQUIRE(server.sendMessage(data.data(), data.size()));
+  REQUIRE(plain.sendMessage(data.data(), data.size()));
+  REQUIRE(compressing.sendMessage(data.data(), data.size()));
+
+  al_sec start = al_steady_time();
+  while ((server.received != 2 || plain.received != 1 ||
+          compressing.received != 1) &&
+         al_steady_time() - start < 5.0) {
+    al_sleep(0.01);
+  }
+  REQUIRE(server.received == 2);
+  REQUIRE(server.corrupt == 0);
+  REQUIRE(plain.received == 1);
+  REQUIRE(plain.corrupt == 0);
+  REQUIRE(compressing.received == 1);
+  REQUIRE(compressing.corrupt == 0);
+
+  // Only the peers that both offered compression used the COMPRESSED wrapper
+  REQUIRE(server.compressionStats().blocks == 1);
+  REQUIRE(server.compressionStats().codedBytes < data.size() / 10);
+  REQUIRE(server.decompressionStats().blocks == 1);
+  REQUIRE(compressing.compressionStats().blocks == 1);
+  REQUIRE(compressing.decompressionStats().blocks == 1);
+  REQUIRE(plain.compressionStats().blocks == 0);
+  REQUIRE(plain.decompressionStats().blocks == 0);
+
+  plain.stop();
+  compressing.stop();
+  server.stop();
+}
+
+TEST_CASE("CommandClient with a server that predates capabilities") {
+  // Does what servers did before capabilities were added: a single recv()
+  // for the handshake, a 5 byte ack and messages without framing
+  SocketServer listener(16345, "localhost", 2.0, Socket::TCP);
+  REQUIRE(listener.listen());
+  Socket connection;
+  size_t handshakeBytes = 0;
+  bool accepted = false;
+  std::thread server([&]() {
+    if (!listener.accept(connection)) {
+      return;
+    }
+    accepted = true;
+    char message[8192];
+    handshakeBytes = connection.recv(message, sizeof(message));
+    uint8_t ack[5] = {CommandConnection::HANDSHAKE_ACK, 0, 0, 0, 0};
+    connection.send((const char *)ack, sizeof(ack));
+  });
+
+  TestClient client;
+  REQUIRE(client.start(16345, "localhost"));
+  server.join();
+  REQUIRE(accepted);
+  REQUIRE(handshakeBytes == 6);
+
+  auto data = makeData(3000);
+  REQUIRE(client.sendMessage(data.data(), data.size()));
+  std::vector<uint8_t> received;
+  al_sec start = al_steady_time();
+  while (received.size() < data.size() && al_steady_time() - start < 2.0) {
+    char buffer[8192];
+    size_t bytes = connection.recv(buffer, sizeof(buffer));
+    if (bytes == 0) {
+      break;
+    }
+    received.insert(received.end(), buffer, buffer + bytes);
+  }
+  REQUIRE(received == data);
+
+  REQUIRE(connection.send((const char *)data.data(), data.size()) ==
+          data.size());
+  start = al_steady_time();
+  while (client.received != 1 && al_steady_time() - start < 2.0) {
+    al_sleep(0.01);
+  }
+  REQUIRE(client.received == 1);
+  REQUIRE(client.corrupt == 0);
+
+  client.stop();
+  connection.close();
+  listener.close();
+}
@@ -0,0 +1,181 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "al/protocol/al_CommandConnection.hpp"
+#include "al/protocol/al_Compression.hpp"
+
+using namespace al;
+
+namespace {
+std::vector<unsigned char> compress(const std::vector<unsigned char> &data) {
+  std::vector<unsigned char> out(lzCompressBound(data.size()));
+  size_t written = lzCompress(data.data(), data.size(), out.data(), out.size());
+  out.resize(written);
+  return out;
+}
+
+// Decompresses into a buffer of exactly size bytes, so reads or writes past
+// it are caught by the address sanitizer
+bool decompress(const std::vector<unsigned char> &block, size_t inSize,
+                size_t size, std::vector<unsigned char> &out) {
+  std::vector<unsigned char> in(block.begin(), block.begin() + inSize);
+  out.assign(size, 0);
+  return lzDecompress(in.data(), in.size(), out.data(), size);
+}
+
+std::vector<unsigned char> randomBytes(size_t size, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::vector<unsigned char> data(size);
+  for (auto &byte : data) {
+    byte = (unsigned char)rng();
+  }
+  return data;
+}
+} // namespace
+
+TEST_CASE("lzCompress round trips") {
+  std::vector<std::vector<unsigned char>> inputs;
+  inputs.push_back({});
+  inputs.push_back({42});
+  inputs.push_back(randomBytes(13, 1));
+  inputs.push_back(randomBytes(100000, 2));
+  inputs.push_back(std::vector<unsigned char>(100000, 7));
+  std::vector<unsigned char> pattern(70000);
+  for (size_t i = 0; i < pattern.size(); i++) {
+    pattern[i] = (unsigned char)(i % 251);
+  }
+  inputs.push_back(pattern);
+
+  for (auto &data : inputs) {
+    INFO("size " << data.size());
+    auto block = compress(data);
+    REQUIRE(block.size() > 0);
+    REQUIRE(block.size() <= lzCompressBound(data.size()));
+    std::vector<unsigned char> out;
+    REQUIRE(decompress(block, block.size(), data.size(), out));
+    REQUIRE(out == data);
+  }
+
+  // Repetitive data compresses
+  REQUIRE(compress(inputs[4]).size() < 1000);
+  REQUIRE(compress(pattern).size() < 1000);
+
+  // Too small a capacity is refused
+  std::vector<unsigned char> small(10);
+  REQUIRE(lzCompress(inputs[3].data(), inputs[3].size(), small.data(),
+                     small.size()) == 0);
+}
+
+TEST_CASE("lzDecompress rejects malformed input") {
+  std::vector<unsigned char> data(5000);
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = (unsigned char)((i / 3) % 17);
+  }
+  auto block = compress(data);
+  std::vector<unsigned char> out;
+
+  // Every truncation fails
+  for (size_t size = 0; size < block.size(); size++) {
+    REQUIRE_FALSE(decompress(block, size, data.size(), out));
+  }
+  // So does a wrong output size
+  REQUIRE_FALSE(decompress(block, block.size(), data.size() - 1, out));
+  REQUIRE_FALSE(decompress(block, block.size(), data.size() + 1, out));
+
+  // An offset before the start of the output
+  std::vector<unsigned char> badOffset = {0x10, 'a', 0x05, 0x00, 0x00};
+  REQUIRE_FALSE(decompress(badOffset, badOffset.size(), 5, out));
+  std::vector<unsigned char> zeroOffset = {0x10, 'a', 0x00, 0x00, 0x00};
+  REQUIRE_FALSE(decompress(zeroOffset, zeroOffset.size(), 5, out));
+  // A literal length running past the end of the input
+  std::vector<unsigned char> longLiterals = {0xf0, 0xff, 0xff, 'a'};
+  REQUIRE_FALSE(decompress(longLiterals, longLiterals.size(), 600, out));
+
+  // Corrupted blocks may decode to anything, but stay within the buffers
+  std::mt19937 rng(9);
+  for (int i = 0; i < 2000; i++) {
+    auto corrupt = block;
+    for (int j = 0; j < 3; j++) {
+      corrupt[rng() % corrupt.size()] = (unsigned char)rng();
+    }
+    decompress(corrupt, corrupt.size(), data.size(), out);
+  }
+  for (int i = 0; i < 2000; i++) {
+    auto garbage = randomBytes(1 + rng() % 64, rng());
+    decompress(garbage, garbage.size(), 1 + rng() % 256, out);
+  }
+}
+
+TEST_CASE("byteUnshuffle reverses byteShuffle") {
+  auto data = randomBytes(1003, 4);
+  for (size_t elementSize : {1, 2, 3, 4, 8}) {
+    INFO("element size " << elementSize);
+    std::vector<unsigned char> shuffled(data.size());
+    std::vector<unsigned char> restored(data.size());
+    byteShuffle(data.data(), shuffled.data(), data.size(), elementSize);
+    byteUnshuffle(shuffled.data(), restored.data(), data.size(), elementSize);
+    REQUIRE(restored == data);
+    // Bytes after the last whole element are not moved
+    size_t tail = data.size() / elementSize * elementSize;
+    REQUIRE(std::equal(data.begin() + tail, data.end(),
+                       shuffled.begin() + tail));
+  }
+
+  // Byte k of every float ends up in the k-th quarter
+  float values[3] = {1.0f, 2.0f, 3.0f};
+  unsigned char bytes[12];
+  unsigned char shuffled[12];
+  std::memcpy(bytes, values, sizeof(bytes));
+  byteShuffle(bytes, shuffled, sizeof(bytes), 4);
+  for (int byte = 0; byte < 4; byte++) {
+    for (int i = 0; i < 3; i++) {
+      REQUIRE(shuffled[byte * 3 + i] == bytes[i * 4 + byte]);
+    }
+  }
+}
+
+TEST_CASE("Compressor blocks") {
+  std::vector<float> values(4096);
+  for (size_t i = 0; i < values.size(); i++) {
+    values[i] = float(i % 64) * 0.25f;
+  }
+  size_t size = values.size() * sizeof(float);
+
+  for (auto codec : {CompressionCodec::LZ, CompressionCodec::SHUFFLE_LZ}) {
+    Compressor compressor(codec, 4);
+    Compressor decompressor(CompressionCodec::NONE);
+    std::vector<unsigned char> block;
+    REQUIRE(compressor.compress(values.data(), size, block));
+    REQUIRE(block.size() < size);
+    REQUIRE(Compressor::decompressedSize(block.data(), block.size()) == size);
+
+    std::vector<unsigned char> out;
+    REQUIRE(decompressor.decompress(block.data(), block.size(), out, size));
+    REQUIRE(out.size() == size);
+    REQUIRE(std::memcmp(out.data(), values.data(), size) == 0);
+    REQUIRE(decompressor.decompressStats().blocks == 1);
+
+    // The size in the header is checked against the limit before allocating
+    REQUIRE_FALSE(
+        decompressor.decompress(block.data(), block.size(), out, size - 1));
+    uint32_t huge = uint32_t(CommandConnection::kMaxMessageSize + 1);
+    std::memcpy(block.data() + 4, &huge, sizeof(huge));
+    REQUIRE_FALSE(decompressor.decompress(block.data(), block.size(), out,
+                                          CommandConnection::kMaxMessageSize));
+    // Unknown codecs and short headers are rejected
+    block[0] = 9;
+    REQUIRE(Compressor::decompressedSize(block.data(), block.size()) == 0);
+    REQUIRE(Compressor::decompressedSize(block.data(), 7) == 0);
+  }
+
+  // Data that does not get smaller is left to be sent as is
+  Compressor compressor;
+  auto noise = randomBytes(1000, 3);
+  std::vector<unsigned char> block;
+  REQUIRE_FALSE(compressor.compress(noise.data(), noise.size(), block));
+  REQUIRE(compressor.compressStats().blocksRaw == 1);
+}
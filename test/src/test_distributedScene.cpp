@@ -0,0 +1,249 @@
+
+#include "catch.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "al/scene/al_DistributedScene.hpp"
+
+using namespace al;
+
+namespace {
+const uint16_t kPort = 10840;
+const float kResolution = 0.001f;
+
+class PoseVoice : public SynthVoice {
+public:
+  Parameter amp{"amp", "", 0.5};
+  ParameterPose pose{"pose"};
+
+  PoseVoice() {
+    registerTriggerParameter(amp);
+    registerParameter(pose);
+  }
+};
+
+// Passes the primary's frames to the replica, or drops them to leave gaps
+// in the sequence
+class FrameLink : public osc::PacketHandler {
+public:
+  FrameLink(DistributedScene &replica) : mReplica(replica) {}
+
+  void onMessage(osc::Message &m) override {
+    if (!drop) {
+      mReplica.consumeMessage(m, "scene");
+    }
+    received++;
+  }
+
+  std::atomic<bool> drop{false};
+  std::atomic<int> received{0};
+
+private:
+  DistributedScene &mReplica;
+};
+
+PoseVoice *findVoice(DistributedScene &scene, int id) {
+  for (auto *voice = scene.getActiveVoices(); voice; voice = voice->next) {
+    if (voice->id() == id) {
+      return static_cast<PoseVoice *>(voice);
+    }
+  }
+  return nullptr;
+}
+
+// Sends the changes queued on the primary and applies them on the replica
+bool step(DistributedScene &primary, DistributedScene &replica,
+          FrameLink &link) {
+  int received = link.received;
+  primary.processVoices();
+  al_sec deadline = al_steady_time() + 1.0;
+  while (link.received == received && al_steady_time() < deadline) {
+    al_sleep(0.001);
+  }
+  replica.processVoices();
+  return link.received > received;
+}
+
+bool samePose(const Pose &a, const Pose &b) {
+  for (int i = 0; i < 3; i++) {
+    if (std::abs(a.pos()[i] - b.pos()[i]) > kResolution * 0.51) {
+      return false;
+    }
+  }
+  // q and -q are the same orientation
+  Quatd qa = a.quat();
+  Quatd qb = b.quat();
+  double dot = qa.w * qb.w + qa.x * qb.x + qa.y * qb.y + qa.z * qb.z;
+  return 1.0 - std::abs(dot) < 1.0e-6;
+}
+
+Quatd orientation(int i) {
+  // Each component is the largest in turn, with both signs
+  const Quatd quats[] = {Quatd(1, 0, 0, 0),
+                         Quatd(-0.2, 0.9, 0.1, -0.3),
+                         Quatd(0.1, -0.3, -0.9, 0.2),
+                         Quatd(-0.4, 0.1, 0.3, -0.8),
+                         Quatd(0.5, 0.5, 0.5, 0.5),
+                         Quatd(-0.5, -0.5, 0.5, 0.5),
+                         Quatd().fromEuler(0.3 * i, 0.2 * i, 0.1 * i)};
+  Quatd quat = quats[i % 7];
+  return quat.normalize();
+}
+} // namespace
+
+TEST_CASE("DistributedScene frame round trip") {
+  DistributedScene primary("scene", 0, TimeMasterMode::TIME_MASTER_FREE);
+  DistributedScene replica("scene", 0, TimeMasterMode::TIME_MASTER_FREE);
+  FrameLink link(replica);
+  osc::Recv recv;
+  REQUIRE(recv.open(kPort, "localhost", 0.0));
+  recv.handler(link);
+  REQUIRE(recv.start());
+  OSCNotifier notifier;
+  notifier.addListener("127.0.0.1", kPort);
+  // Voice parameters are replicated if allocated after this
+  primary.registerNotifier(notifier);
+
+  primary.setPositionResolution(kResolution);
+  replica.registerSynthClass<PoseVoice>();
+  primary.allocatePolyphony<PoseVoice>(4);
+  replica.allocatePolyphony<PoseVoice>(4);
+
+  // Trigger parameters and the offset in the block arrive with the voice
+  auto *voice = primary.getVoice<PoseVoice>();
+  voice->amp.set(0.25f);
+  int id = primary.triggerOn(voice, 17);
+  REQUIRE(step(primary, replica, link));
+  PoseVoice *copy = findVoice(replica, id);
+  REQUIRE(copy);
+  REQUIRE(copy->amp.get() == 0.25f);
+  REQUIRE(copy->getStartOffsetFrames(0) == 17);
+
+  // Small moves are sent as deltas, with absolute values every 32 frames
+  const int numFrames = 100;
+  std::vector<uint64_t> frameBytes;
+  Vec3d position(1, 2, 3);
+  for (int i = 0; i < numFrames; i++) {
+    position += Vec3d(0.0123, -0.0456, 0.00789 * (i % 5));
+    if (i == numFrames / 2) {
+      // Too far for a delta
+      position.x += 100;
+    }
+    voice->pose.set(Pose(position, orientation(i)));
+    uint64_t bytes = primary.replicationStats().bytesSent;
+    REQUIRE(step(primary, replica, link));
+    frameBytes.push_back(primary.replicationStats().bytesSent - bytes);
+    INFO("frame " << i);
+    REQUIRE(samePose(copy->pose.get(), voice->pose.get()));
+  }
+  uint64_t smallest =
+      *std::min_element(frameBytes.begin(), frameBytes.end());
+  long largeFrames = std::count_if(frameBytes.begin(), frameBytes.end(),
+                                   [&](uint64_t b) { return b > smallest; });
+  REQUIRE(largeFrames > 0);
+  REQUIRE(largeFrames <= numFrames / 32 + 2);
+
+  // Deltas that follow a lost frame are not applied until the next absolute
+  // value
+  int lost = 0;
+  for (int gap = 0; gap < 3; gap++) {
+    Pose before = copy->pose.get();
+    link.drop = true;
+    for (int i = 0; i <= gap; i++) {
+      position += Vec3d(0.05, 0.05, -0.05);
+      voice->pose.set(Pose(position, orientation(gap + i)));
+      REQUIRE(step(primary, replica, link));
+      lost++;
+    }
+    link.drop = false;
+    REQUIRE(samePose(copy->pose.get(), before));
+    bool recovered = false;
+    for (int i = 0; i < 40 && !recovered; i++) {
+      position += Vec3d(0.01, 0.02, 0.03);
+      voice->pose.set(Pose(position, orientation(i)));
+      REQUIRE(step(primary, replica, link));
+      recovered = samePose(copy->pose.get(), voice->pose.get());
+      if (!recovered) {
+        REQUIRE(samePose(copy->pose.get(), before));
+      }
+    }
+    REQUIRE(recovered);
+  }
+  REQUIRE(replica.replicationStats().framesLost == uint64_t(lost));
+
+  // Freed voices are freed on the replica
+  voice->free();
+  primary.processInactiveVoices();
+  REQUIRE(step(primary, replica, link));
+  replica.processVoiceTurnOff();
+  replica.processInactiveVoices();
+  REQUIRE(findVoice(replica, id) == nullptr);
+
+  recv.stop();
+}
+
+TEST_CASE("DistributedScene replicates changes made on several threads") {
+  DistributedScene primary("scene", 0, TimeMasterMode::TIME_MASTER_FREE);
+  DistributedScene replica("scene", 0, TimeMasterMode::TIME_MASTER_FREE);
+  FrameLink link(replica);
+  osc::Recv recv;
+  REQUIRE(recv.open(kPort + 1, "localhost", 0.0));
+  recv.handler(link);
+  REQUIRE(recv.start());
+  OSCNotifier notifier;
+  notifier.addListener("127.0.0.1", kPort + 1);
+  primary.registerNotifier(notifier);
+  primary.setPositionResolution(kResolution);
+  replica.registerSynthClass<PoseVoice>();
+  primary.allocatePolyphony<PoseVoice>(4);
+  replica.allocatePolyphony<PoseVoice>(4);
+
+  std::vector<PoseVoice *> voices;
+  std::vector<int> ids;
+  for (int i = 0; i < 4; i++) {
+    voices.push_back(primary.getVoice<PoseVoice>());
+    ids.push_back(primary.triggerOn(voices.back()));
+  }
+  REQUIRE(step(primary, replica, link));
+
+  // Two threads change each voice, while frames are sent
+  std::atomic<int> running{8};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; t++) {
+    threads.emplace_back([&, t]() {
+      PoseVoice *voice = voices[t % 4];
+      for (int i = 0; i < 2000; i++) {
+        if (t < 4) {
+          voice->amp.set(float(i) / 2000);
+        } else {
+          voice->pose.set(Pose(Vec3d(i * 0.001, t, -i * 0.002)));
+        }
+      }
+      running--;
+    });
+  }
+  while (running > 0) {
+    primary.processVoices();
+    replica.processVoices();
+    al_sleep(0.001);
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  // The last values arrive in the next frame
+  for (int i = 0; i < 4; i++) {
+    voices[i]->amp.set(0.1f * i);
+  }
+  REQUIRE(step(primary, replica, link));
+  for (int i = 0; i < 4; i++) {
+    INFO("voice " << i);
+    PoseVoice *copy = findVoice(replica, ids[i]);
+    REQUIRE(copy);
+    REQUIRE(copy->amp.get() == 0.1f * i);
+    REQUIRE(samePose(copy->pose.get(), voices[i]->pose.get()));
+  }
+
+  recv.stop();
+}
@@ -1,119 +1,81 @@
-
 #include "catch.hpp"
 
-#include "al/util/scene/al_DynamicScene.hpp"
-#include "al/sound/al_Speaker.hpp"
-#include "al/sound/al_Ambisonics.hpp"
-#include "al/io/al_AudioIOData.hpp"
-
-using namespace al;
-
-class Voice : public PositionedVoice {
-    virtual void onProcess(AudioIOData& io) override {
-        float outvalue = bufferCounter++;
-        while(io()) {
-            io.out(0) = outvalue;
-            outvalue += 0.5;
-        }
-    }
-
-    float bufferCounter = 1;
-};
-
-TEST_CASE( "Dynamic Scene Stereo Spatilaization" ) {
+#include <algorithm>
+#include <vector>
 
-    const int numChannels = 2;
-    AudioIOData audioData;
-    audioData.framesPerBuffer(16);
-    audioData.framesPerSecond(44100);
-    audioData.channelsIn(0);
-    audioData.channelsOut(numChannels);
+#include "al/graphics/al_Graphics.hpp"
+#include "al/scene/al_DynamicScene.hpp"
 
-    DynamicScene scene;
-    scene.prepare(audioData);
-
-    SpeakerLayout layout = StereoSpeakerLayout();
-
-    std::shared_ptr<StereoPanner> s = scene.setSpatializer<StereoPanner>(layout);
-    // configure spatializer
-//    std::shared_ptr<AmbisonicsSpatializer> s = scene.setSpatializer<AmbisonicsSpatializer>(layout);
-//    s->configure(2, 1, 1); // dim, order, flavor
-
-    Voice *newVoice = scene.getVoice<Voice>();
-    newVoice->useDistanceAttenuation(false);
-    scene.triggerOn(newVoice);
+using namespace al;
 
-    // Listener in origin looking into neg z-axis
-    scene.listenerPose().pos() = Vec3d(0,0,0);
-    scene.listenerPose().faceToward(Vec3d(0,0, -4));
+namespace {
+std::vector<int> drawn;
 
-    newVoice->pose().pos() = Vec4d(1.0, 0.0, 0.0); // hard right
+// Records the order voices are drawn in, without any GL calls
+class OrderVoice : public PositionedVoice {
+public:
+  int index{-1};
 
-    audioData.zeroOut(); // Buffers are not cleared by default
-    scene.render(audioData);
+  void onProcess(Graphics & /*g*/) override { drawn.push_back(index); }
+};
 
-	float *bufl = audioData.outBuffer(0);
-    float *bufr = audioData.outBuffer(1);
-    for (int i = 0; i < 16; i++) {
-        REQUIRE(*bufl++ < 1e-15);
-        REQUIRE(*bufr++ == 1 + (0.5 * i));
+std::vector<int> renderOrder(DynamicScene &scene) {
+  Graphics g;
+  g.projMatrix(Matrix4f::perspective(90, 1, 0.1f, 100));
+  drawn.clear();
+  scene.render(g);
+  return drawn;
+}
+} // namespace
+
+TEST_CASE("DynamicScene culling keeps the draw order") {
+  DynamicScene scene(0, TimeMasterMode::TIME_MASTER_GRAPHICS);
+  std::vector<OrderVoice *> voices;
+  std::vector<bool> visible;
+  for (int i = 0; i < 24; i++) {
+    auto *voice = scene.getVoice<OrderVoice>();
+    voice->index = i;
+    // Every third voice is behind the camera, and some are transparent
+    bool front = i % 3 != 0;
+    voice->setPose(Pose(Vec3d(i % 5 - 2, 0, front ? -3 - i % 7 : 5)));
+    voice->transparent(i % 4 == 1);
+    scene.triggerOn(voice);
+    voices.push_back(voice);
+    visible.push_back(front);
+  }
+
+  for (bool sorted : {false, true}) {
+    INFO("sorted " << sorted);
+    scene.sortDrawingByDistance(sorted);
+    for (auto *voice : voices) {
+      voice->boundingRadius(-1);
     }
+    std::vector<int> all = renderOrder(scene);
+    REQUIRE(all.size() == voices.size());
 
-    newVoice->pose().pos() = Vec4d(-1.0, 0.0, 0.0); // hard left
-
-    audioData.zeroOut(); // Buffers are not cleared by default
-    scene.render(audioData);
-
-    bufl = audioData.outBuffer(0);
-    bufr = audioData.outBuffer(1);
-    for (int i = 0; i < 16; i++) {
-        REQUIRE(*bufl++ == 2 + (0.5 * i));
-        REQUIRE(*bufr++ < 1e-15);
+    for (auto *voice : voices) {
+      voice->boundingRadius(0.5f);
     }
+    std::vector<int> expected;
+    for (int index : all) {
+      if (visible[index]) {
+        expected.push_back(index);
+      }
+    }
+    REQUIRE(renderOrder(scene) == expected);
+
+    // Transparent voices come last, from back to front
+    size_t firstTransparent = expected.size();
+    for (size_t i = 0; i < expected.size(); i++) {
+      if (voices[expected[i]]->transparent() || sorted) {
+        firstTransparent = std::min(firstTransparent, i);
+      } else {
+        REQUIRE(firstTransparent == expected.size());
+      }
+    }
+    for (size_t i = firstTransparent + 1; i < expected.size(); i++) {
+      REQUIRE(voices[expected[i - 1]]->listenerDistance() >=
+              voices[expected[i]]->listenerDistance());
+    }
+  }
 }
-
-TEST_CASE( "Dynamic Scene Ambisonics Spatilaization" ) {
-    const int numChannels = 8;
-    const int fpb = 4;
-    AudioIOData audioData;
-    audioData.framesPerBuffer(fpb);
-    audioData.framesPerSecond(44100);
-    audioData.channelsIn(0);
-    audioData.channelsOut(numChannels);
-
-    DynamicScene scene;
-    scene.prepare(audioData);
-
-    SpeakerLayout layout = SpeakerRingLayout<numChannels>();
-
-    std::shared_ptr<AmbisonicsSpatializer> s = scene.setSpatializer<AmbisonicsSpatializer>(layout);
-    // configure spatializer
-    s->configure(3, 3, 1); // dim, order, flavor
-
-    Voice *newVoice = scene.getVoice<Voice>();
-    newVoice->useDistanceAttenuation(false);
-    scene.triggerOn(newVoice);
-
-    // Listener in origin looking into neg z-axis
-    scene.listenerPose().pos() = Vec3d(0,0,0);
-    scene.listenerPose().faceToward(Vec3d(0,0, -4));
-
-    // Place voice in front
-    newVoice->pose().pos()[2] = -4.0;
-
-    s->print();
-    audioData.zeroOut(); // Buffers are not cleared by default
-    scene.render(audioData);
-
-
-	for (int spkr = 0; spkr < layout.numSpeakers(); spkr++) {
-        float *buf = audioData.outBuffer(spkr);
-		for (int i = 0; i < fpb; i++) {
-
-            std::cout << spkr << ":" << i << "   :  " << *buf++ << std::endl;
-//			REQUIRE(speakerSignals[i] > speakerSignals[spkr * bufferSize + 1]);
-		}
-        std::cout << "-----" << std::endl;
-	}
-}
-
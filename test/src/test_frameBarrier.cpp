@@ -0,0 +1,228 @@
+
+#include "catch.hpp"
+
+#include "al/protocol/al_FrameBarrier.hpp"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace al;
+
+#ifndef _WIN32
+namespace {
+const uint16_t kPort = 16340;
+const int kFrames = 20;
+const int kMissing = 10; // frames after one renderer stops syncing
+
+// What a renderer process reports back to the test
+struct RendererResult {
+  bool started{false};
+  int released{0};          // frames released in order
+  al_sec ready[kFrames + kMissing];
+  al_sec release[kFrames + kMissing];
+  bool lateTimedOut{false}; // sync() without a release from the primary
+  al_sec lateWait{0};
+};
+
+RendererResult runRenderer(int index, int frames) {
+  RendererResult result;
+  FrameBarrierClient client;
+  client.setTimeout(2.0);
+  al_sec deadline = al_steady_time() + 2.0;
+  while (!result.started && al_steady_time() < deadline) {
+    result.started = client.start(kPort, "localhost");
+    if (!result.started) {
+      al_sleep(0.05);
+    }
+  }
+  if (!result.started) {
+    return result;
+  }
+  for (int i = 0; i < frames; i++) {
+    // Renderers finish their frames at different times
+    al_sleep(0.001 * (index + 1));
+    result.ready[i] = al_steady_time();
+    bool released = client.sync();
+    result.release[i] = al_steady_time();
+    if (!released || client.frame() != uint32_t(i + 1)) {
+      break;
+    }
+    result.released++;
+  }
+  if (frames < kFrames + kMissing) {
+    // Stay registered without syncing while the primary times out
+    al_sleep(2.0);
+  } else {
+    // The primary has stopped releasing frames
+    client.setTimeout(0.1);
+    al_sec start = al_steady_time();
+    result.lateTimedOut = !client.sync();
+    result.lateWait = al_steady_time() - start;
+  }
+  client.stop();
+  return result;
+}
+} // namespace
+
+TEST_CASE("FrameBarrier release order and timeout") {
+  // Renderers inherit the steady clock origin, so their times are comparable
+  al_start_steady_clock();
+  const int numRenderers = 2;
+  // The first renderer syncs every frame, the second stops after kFrames
+  const int frames[numRenderers] = {kFrames + kMissing, kFrames};
+  pid_t pids[numRenderers];
+  int pipes[numRenderers][2];
+  for (int i = 0; i < numRenderers; i++) {
+    REQUIRE(pipe(pipes[i]) == 0);
+    pids[i] = fork();
+    REQUIRE(pids[i] >= 0);
+    if (pids[i] == 0) {
+      close(pipes[i][0]);
+      RendererResult result = runRenderer(i, frames[i]);
+      ssize_t written = write(pipes[i][1], &result, sizeof(result));
+      _exit(written == sizeof(result) ? 0 : 1);
+    }
+    close(pipes[i][1]);
+  }
+
+  FrameBarrierServer server;
+  server.setTimeout(0.2);
+  REQUIRE(server.start(kPort, "localhost"));
+  al_sec deadline = al_steady_time() + 5.0;
+  while (server.activeClients() < numRenderers &&
+         al_steady_time() < deadline) {
+    al_sleep(0.01);
+  }
+  REQUIRE(server.activeClients() == numRenderers);
+
+  al_sec primaryReady[kFrames + kMissing];
+  bool allReady[kFrames + kMissing];
+  for (int i = 0; i < kFrames + kMissing; i++) {
+    al_sleep(0.002);
+    primaryReady[i] = al_steady_time();
+    allReady[i] = server.sync();
+  }
+  size_t activeAfterTimeout = server.activeClients();
+
+  RendererResult results[numRenderers];
+  for (int i = 0; i < numRenderers; i++) {
+    REQUIRE(read(pipes[i][0], &results[i], sizeof(results[i])) ==
+            sizeof(results[i]));
+    close(pipes[i][0]);
+    int status;
+    waitpid(pids[i], &status, 0);
+  }
+  server.stop();
+
+  for (int i = 0; i < numRenderers; i++) {
+    INFO("renderer " << i);
+    REQUIRE(results[i].started);
+    REQUIRE(results[i].released == frames[i]);
+  }
+  // No renderer is released before the primary and every renderer still
+  // syncing have reported the frame ready
+  for (int f = 0; f < kFrames + kMissing; f++) {
+    al_sec lastReady = primaryReady[f];
+    for (int i = 0; i < numRenderers; i++) {
+      if (f < frames[i]) {
+        lastReady = std::max(lastReady, results[i].ready[f]);
+      }
+    }
+    for (int i = 0; i < numRenderers; i++) {
+      if (f < frames[i]) {
+        INFO("frame " << f << " renderer " << i);
+        REQUIRE(results[i].release[f] >= lastReady);
+      }
+    }
+  }
+
+  for (int f = 0; f < kFrames; f++) {
+    REQUIRE(allReady[f]);
+  }
+  // The missing renderer holds a few frames for the timeout, then it is no
+  // longer waited for
+  for (int f = kFrames; f < kFrames + kMissing; f++) {
+    INFO("frame " << f);
+    REQUIRE(allReady[f] == (f >= kFrames + 3));
+  }
+  REQUIRE(activeAfterTimeout == 1);
+  FrameBarrierStats stats = server.stats();
+  REQUIRE(stats.frames == uint64_t(kFrames + kMissing));
+  REQUIRE(stats.timeouts == 3);
+
+  // Without a release from the primary, the renderer gives up after its own
+  // timeout
+  REQUIRE(results[0].lateTimedOut);
+  REQUIRE(results[0].lateWait >= 0.1);
+  REQUIRE(results[0].lateWait < 0.5);
+}
+
+TEST_CASE("FrameBarrierClient registration timeout") {
+  // A command server that never acknowledges the barrier registration
+  CommandServer server;
+  REQUIRE(server.start(kPort + 10, "localhost"));
+
+  FrameBarrierClient client;
+  REQUIRE_FALSE(client.start(kPort + 10, "localhost"));
+  REQUIRE_FALSE(client.isRegistered());
+  REQUIRE_FALSE(client.sync());
+
+  // The release port the client had opened is free again
+  SocketServer udp;
+  REQUIRE(udp.open(kPort + 11, "0.0.0.0", 0, Socket::UDP | Socket::DGRAM));
+  udp.close();
+
+  // and the client can try again once a barrier is running
+  server.stop();
+  FrameBarrierServer barrier;
+  REQUIRE(barrier.start(kPort + 10, "localhost"));
+  REQUIRE(client.start(kPort + 10, "localhost"));
+  REQUIRE(client.isRegistered());
+  client.stop();
+  barrier.stop();
+}
+
+TEST_CASE("FrameBarrier drops disconnected renderers") {
+  FrameBarrierServer server;
+  server.setTimeout(0.5);
+  REQUIRE(server.start(kPort + 20, "localhost"));
+
+  auto waitForActive = [&](size_t count) {
+    al_sec deadline = al_steady_time() + 2.0;
+    while (server.activeClients() != count && al_steady_time() < deadline) {
+      al_sleep(0.01);
+    }
+    return server.activeClients() == count;
+  };
+
+  for (int i = 0; i < 3; i++) {
+    FrameBarrierClient client;
+    REQUIRE(client.start(kPort + 20, "localhost"));
+    REQUIRE(waitForActive(1));
+    client.stop();
+    REQUIRE(waitForActive(0));
+  }
+
+  // Only the connected renderer is waited for
+  FrameBarrierClient client;
+  client.setTimeout(2.0);
+  REQUIRE(client.start(kPort + 20, "localhost"));
+  REQUIRE(waitForActive(1));
+  bool clientReleased = false;
+  std::thread renderer([&]() { clientReleased = client.sync(); });
+  bool ready = server.sync();
+  renderer.join();
+  REQUIRE(ready);
+  REQUIRE(clientReleased);
+  REQUIRE(server.stats().timeouts == 0);
+
+  // and a renderer can register again after disconnecting
+  client.stop();
+  REQUIRE(client.start(kPort + 20, "localhost"));
+  REQUIRE(waitForActive(1));
+  client.stop();
+  server.stop();
+}
+#endif
@@ -0,0 +1,110 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "al/math/al_Frustum.hpp"
+#include "al/math/al_Matrix4.hpp"
+
+using namespace al;
+
+namespace {
+// Camera at (1, 2, 3) looking down -z, 90 degrees high and twice as wide,
+// from 1 to 10 units away
+Frustumd knownFrustum() {
+  Frustumd frustum;
+  frustum.fromMatrix(Matrix4d::perspective(90, 2, 1, 10) *
+                     Matrix4d::translation(Vec3d(-1, -2, -3)));
+  return frustum;
+}
+
+bool same(const Vec3d &a, const Vec3d &b) {
+  return (a - b).mag() < 1e-9;
+}
+} // namespace
+
+TEST_CASE("Frustum::fromMatrix extracts planes and corners") {
+  Frustumd frustum = knownFrustum();
+  Vec3d eye(1, 2, 3);
+  REQUIRE(same(frustum.ntl, eye + Vec3d(-2, 1, -1)));
+  REQUIRE(same(frustum.ntr, eye + Vec3d(2, 1, -1)));
+  REQUIRE(same(frustum.nbl, eye + Vec3d(-2, -1, -1)));
+  REQUIRE(same(frustum.nbr, eye + Vec3d(2, -1, -1)));
+  REQUIRE(same(frustum.ftl, eye + Vec3d(-20, 10, -10)));
+  REQUIRE(same(frustum.ftr, eye + Vec3d(20, 10, -10)));
+  REQUIRE(same(frustum.fbl, eye + Vec3d(-20, -10, -10)));
+  REQUIRE(same(frustum.fbr, eye + Vec3d(20, -10, -10)));
+
+  // Normalized planes facing inside, the same as computed from the corners
+  Frustumd fromCorners = frustum;
+  fromCorners.computePlanes();
+  for (int i = 0; i < 6; i++) {
+    INFO("plane " << i);
+    REQUIRE(frustum.pl[i].normal().mag() == Approx(1));
+    REQUIRE(same(frustum.pl[i].normal(), fromCorners.pl[i].normal()));
+    REQUIRE(frustum.pl[i].d() == Approx(fromCorners.pl[i].d()));
+  }
+  REQUIRE(same(frustum.pl[Frustumd::NEARP].normal(), Vec3d(0, 0, -1)));
+  REQUIRE(frustum.pl[Frustumd::NEARP].distance(eye) == Approx(-1));
+  REQUIRE(frustum.pl[Frustumd::FARP].distance(eye) == Approx(10));
+
+  REQUIRE(frustum.testPoint(eye + Vec3d(0, 0, -5)) == Frustumd::INSIDE);
+  REQUIRE(frustum.testPoint(eye + Vec3d(0, 0, -0.5)) == Frustumd::OUTSIDE);
+  REQUIRE(frustum.testPoint(eye + Vec3d(0, 0, -11)) == Frustumd::OUTSIDE);
+  REQUIRE(frustum.testPoint(eye + Vec3d(9, 0, -5)) == Frustumd::INSIDE);
+  REQUIRE(frustum.testPoint(eye + Vec3d(11, 0, -5)) == Frustumd::OUTSIDE);
+  REQUIRE(frustum.testPoint(eye + Vec3d(0, -6, -5)) == Frustumd::OUTSIDE);
+}
+
+TEST_CASE("Frustum::testSpheres matches testSphere") {
+  Frustumd frustum = knownFrustum();
+  Vec3d eye(1, 2, 3);
+
+  // Inside, outside behind the eye, straddling the near plane and the left
+  // plane, and infinite
+  std::vector<float> x = {0, 0, 0, -10, 100};
+  std::vector<float> y = {0, 0, 0, 0, 100};
+  std::vector<float> z = {-5, 2, -1, -5, 100};
+  std::vector<float> radius = {1, 1, 0.5f, 1, INFINITY};
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] += eye.x;
+    y[i] += eye.y;
+    z[i] += eye.z;
+  }
+  std::vector<unsigned char> inside(x.size());
+  frustum.testSpheres(x.data(), y.data(), z.data(), radius.data(),
+                      int(x.size()), inside.data());
+  REQUIRE(inside == std::vector<unsigned char>({1, 0, 1, 1, 1}));
+  REQUIRE(frustum.testSphere(Vec3d(x[0], y[0], z[0]), radius[0]) ==
+          Frustumd::INSIDE);
+  REQUIRE(frustum.testSphere(Vec3d(x[2], y[2], z[2]), radius[2]) ==
+          Frustumd::INTERSECT);
+  REQUIRE(frustum.testSphere(Vec3d(x[3], y[3], z[3]), radius[3]) ==
+          Frustumd::INTERSECT);
+
+  // Random spheres in and around the frustum
+  std::mt19937 rng(2);
+  std::uniform_real_distribution<double> uniform(-25, 25);
+  std::uniform_real_distribution<double> size(0, 3);
+  const int n = 2000;
+  std::vector<double> cx(n), cy(n), cz(n), r(n);
+  for (int i = 0; i < n; i++) {
+    cx[i] = eye.x + uniform(rng);
+    cy[i] = eye.y + uniform(rng) * 0.5;
+    cz[i] = eye.z + uniform(rng) * 0.5 - 6;
+    r[i] = size(rng);
+  }
+  inside.resize(n);
+  frustum.testSpheres(cx.data(), cy.data(), cz.data(), r.data(), n,
+                      inside.data());
+  int outside = 0;
+  for (int i = 0; i < n; i++) {
+    INFO("sphere " << i);
+    int result = frustum.testSphere(Vec3d(cx[i], cy[i], cz[i]), r[i]);
+    REQUIRE(bool(inside[i]) == (result != Frustumd::OUTSIDE));
+    outside += result == Frustumd::OUTSIDE;
+  }
+  REQUIRE(outside > n / 10);
+  REQUIRE(outside < n - n / 10);
+}
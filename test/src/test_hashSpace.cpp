@@ -0,0 +1,127 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "al/spatial/al_HashSpace.hpp"
+
+using namespace al;
+
+namespace {
+// Nearest maxResults objects within radius by testing every pair, with the
+// distances computed as HashSpace::neighbors() does
+std::vector<HashSpace::Neighbor> bruteForce(HashSpace &space, uint32_t id,
+                                            float radius,
+                                            uint32_t maxResults) {
+  const float dim = space.dim(), half = space.maxRadius();
+  radius = std::min(radius, half);
+  const float r2 = radius * radius;
+  std::vector<HashSpace::Neighbor> found;
+  HashSpace::Object &o = space.object(id);
+  if (o.hash == HashSpace::invalidHash()) {
+    return found;
+  }
+  float x = o.pos.x, y = o.pos.y, z = o.pos.z;
+  for (uint32_t j = 0; j < space.numObjects(); j++) {
+    HashSpace::Object &other = space.object(j);
+    if (j == id || other.hash == HashSpace::invalidHash()) {
+      continue;
+    }
+    float d[3] = {float(other.pos.x) - x, float(other.pos.y) - y,
+                  float(other.pos.z) - z};
+    for (float &dk : d) {
+      dk = dk >= half ? dk - dim : (dk < -half ? dk + dim : dk);
+    }
+    float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    if (d2 <= r2) {
+      found.push_back(HashSpace::Neighbor{j, d2});
+    }
+  }
+  std::sort(found.begin(), found.end(),
+            [](const HashSpace::Neighbor &a, const HashSpace::Neighbor &b) {
+              return a.distanceSquared < b.distanceSquared ||
+                     (a.distanceSquared == b.distanceSquared && a.id < b.id);
+            });
+  if (found.size() > maxResults) {
+    found.resize(maxResults);
+  }
+  return found;
+}
+
+bool matchesBruteForce(HashSpace &space, float radius, uint32_t maxResults,
+                       int threads) {
+  HashSpace::Neighbors neighbors;
+  space.update(threads);
+  space.neighbors(neighbors, radius, maxResults, threads);
+  if (neighbors.size() != space.numObjects()) {
+    return false;
+  }
+  for (uint32_t id = 0; id < space.numObjects(); id++) {
+    auto expected = bruteForce(space, id, radius, maxResults);
+    auto &found = neighbors[id];
+    if (found.size() != expected.size()) {
+      return false;
+    }
+    for (uint32_t k = 0; k < found.size(); k++) {
+      if (found[k].id != expected[k].id ||
+          found[k].distanceSquared != expected[k].distanceSquared) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+TEST_CASE("HashSpace::neighbors matches brute force") {
+  std::mt19937 rng(5);
+  HashSpace space(5, 1500);
+  const float dim = space.dim();
+  std::uniform_real_distribution<double> uniform(0, dim);
+  std::uniform_real_distribution<double> edge(-1.5, 1.5);
+  for (uint32_t i = 0; i < space.numObjects(); i++) {
+    if (i % 3 == 0) {
+      // Near the faces, edges and corners, so neighbors wrap around
+      space.move(i, edge(rng), edge(rng), i % 2 ? edge(rng) : uniform(rng));
+    } else {
+      space.move(i, uniform(rng), uniform(rng), uniform(rng));
+    }
+  }
+  // Objects at the same position, and one exactly on the wrap
+  space.move(1, space.object(2).pos);
+  space.move(4, dim, 0, dim);
+  space.move(5, 0, 0, 0);
+
+  const float radii[] = {0.5f, 1.0f, 2.7f, float(space.maxRadius()), 100.0f};
+  for (float radius : radii) {
+    for (uint32_t maxResults : {1u, 8u, 100u}) {
+      for (int threads : {1, 4}) {
+        INFO("radius " << radius << " max results " << maxResults
+                       << " threads " << threads);
+        REQUIRE(matchesBruteForce(space, radius, maxResults, threads));
+      }
+    }
+  }
+
+  // Removed objects are neither queried nor found, moved ones are found at
+  // their new positions
+  for (uint32_t i = 0; i < space.numObjects(); i += 7) {
+    space.remove(i);
+  }
+  for (uint32_t i = 3; i < space.numObjects(); i += 11) {
+    space.move(i, uniform(rng), uniform(rng), uniform(rng));
+  }
+  REQUIRE(matchesBruteForce(space, 3.0f, 16, 4));
+  HashSpace::Neighbors neighbors;
+  space.neighbors(neighbors, 3.0f, 16, 4);
+  REQUIRE(neighbors[0].size() == 0);
+
+  // An empty space and a query without results
+  HashSpace empty(4, 10);
+  for (uint32_t i = 0; i < empty.numObjects(); i++) {
+    empty.remove(i);
+  }
+  REQUIRE(matchesBruteForce(empty, 2.0f, 4, 1));
+  REQUIRE(matchesBruteForce(space, 3.0f, 0, 1));
+}
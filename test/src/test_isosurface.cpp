@@ -0,0 +1,136 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+#include "al/graphics/al_Isosurface.hpp"
+
+using namespace al;
+
+namespace {
+typedef std::array<float, 9> Triangle;
+
+// Adds a cone of height s and radius r around a point
+void addCone(std::vector<float> &field, int n, const float *c, float r,
+             float s) {
+  for (int z = 0; z < n; z++) {
+    for (int y = 0; y < n; y++) {
+      for (int x = 0; x < n; x++) {
+        float dx = x - c[0], dy = y - c[1], dz = z - c[2];
+        float d = std::sqrt(dx * dx + dy * dy + dz * dz);
+        field[(size_t(z) * n + y) * n + x] += s * std::max(0.0f, r - d);
+      }
+    }
+  }
+}
+
+// Triangles of a mesh without the degenerate triangles update() leaves in
+// unused parts of the buffers
+std::vector<Triangle> triangles(const Mesh &mesh) {
+  std::vector<Triangle> result;
+  auto &indices = mesh.indices();
+  auto &vertices = mesh.vertices();
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    auto &a = vertices[indices[i]];
+    auto &b = vertices[indices[i + 1]];
+    auto &c = vertices[indices[i + 2]];
+    if (a == b || b == c || a == c) {
+      continue;
+    }
+    result.push_back({a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z});
+  }
+  return result;
+}
+
+// Same corners in the same winding, starting at any corner
+bool sameTriangle(const Triangle &a, const Triangle &b) {
+  for (int first = 0; first < 3; first++) {
+    bool same = true;
+    for (int j = 0; j < 9 && same; j++) {
+      same = std::abs(a[j] - b[(3 * first + j) % 9]) < 1e-5f;
+    }
+    if (same) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Both meshes have the same triangles in any order. Vertex positions may
+// differ in the last bits, as bricks compute them from their own origin.
+bool sameTriangles(const Mesh &a, const Mesh &b) {
+  auto trianglesA = triangles(a);
+  auto trianglesB = triangles(b);
+  if (trianglesA.empty() || trianglesA.size() != trianglesB.size()) {
+    return false;
+  }
+  std::vector<bool> matched(trianglesB.size(), false);
+  for (auto &t : trianglesA) {
+    size_t i = 0;
+    while (i < trianglesB.size() &&
+           (matched[i] || !sameTriangle(t, trianglesB[i]))) {
+      i++;
+    }
+    if (i == trianglesB.size()) {
+      return false;
+    }
+    matched[i] = true;
+  }
+  return true;
+}
+} // namespace
+
+TEST_CASE("Isosurface update matches generate") {
+  const int n = 33;
+  const float level = 2.0f;
+  const float radius = 6.0f;
+  for (int brickSize : {5, 8, 16}) {
+    INFO("brick size " << brickSize);
+    std::vector<float> field(size_t(n) * n * n, 0.0f);
+    float still[3] = {20.0f, 20.0f, 12.0f};
+    addCone(field, n, still, radius, 1.0f);
+    float moving[3] = {6.0f, 15.5f, 16.0f};
+    addCone(field, n, moving, radius, 1.0f);
+
+    Isosurface incremental;
+    incremental.brickSize(brickSize);
+    incremental.level(level);
+    incremental.fieldDims(n).cellLengths(1.0 / (n - 1));
+    incremental.update(field.data());
+
+    // The cone moves across brick faces and into the other cone
+    for (int frame = 0; frame < 6; frame++) {
+      INFO("frame " << frame);
+      if (frame > 0) {
+        float previous[3] = {moving[0], moving[1], moving[2]};
+        addCone(field, n, moving, radius, -1.0f);
+        moving[0] += 2.5f;
+        moving[2] -= 0.75f;
+        addCone(field, n, moving, radius, 1.0f);
+        // Points within the radius of either position changed
+        int lo[3], hi[3];
+        for (int i = 0; i < 3; i++) {
+          lo[i] = int(std::min(previous[i], moving[i]) - radius);
+          hi[i] = int(std::max(previous[i], moving[i]) + radius) + 1;
+        }
+        incremental.markDirty(lo[0], lo[1], lo[2], hi[0], hi[1], hi[2]);
+        incremental.update(field.data());
+      }
+
+      Isosurface reference;
+      reference.level(level);
+      reference.generate(field.data(), n, 1.0f / (n - 1));
+      REQUIRE(sameTriangles(incremental, reference));
+    }
+
+    // Marking everything dirty gives the same surface too
+    incremental.markDirty();
+    incremental.update(field.data());
+    Isosurface reference;
+    reference.level(level);
+    reference.generate(field.data(), n, 1.0f / (n - 1));
+    REQUIRE(sameTriangles(incremental, reference));
+  }
+}
@@ -0,0 +1,410 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "al/graphics/al_Mesh.hpp"
+
+using namespace al;
+
+namespace {
+// Mesh::compress() before it used weld(), for meshes without indices
+Mesh legacyCompress(const Mesh &old) {
+  typedef std::map<float, int> Zmap;
+  typedef std::map<float, Zmap> Ymap;
+  typedef std::map<float, Ymap> Xmap;
+  Xmap xmap;
+  for (int i = (int)old.vertices().size() - 1; i >= 0; i--) {
+    const Mesh::Vertex &v = old.vertices()[i];
+    xmap[v.x][v.y][v.z] = i;
+  }
+  std::map<int, int> imap;
+  Mesh mesh;
+  for (size_t i = 0; i < old.vertices().size(); i++) {
+    const Mesh::Vertex &v = old.vertices()[i];
+    int idx = xmap[v.x][v.y][v.z];
+    auto it = imap.find(idx);
+    if (it != imap.end()) {
+      mesh.index(it->second);
+    } else {
+      int newidx = (int)mesh.vertices().size();
+      mesh.vertex(v);
+      if (old.colors().size()) mesh.color(old.colors()[i]);
+      if (old.normals().size()) mesh.normal(old.normals()[i]);
+      if (old.texCoord1s().size()) mesh.texCoord(old.texCoord1s()[i]);
+      if (old.texCoord2s().size()) mesh.texCoord(old.texCoord2s()[i]);
+      if (old.texCoord3s().size()) mesh.texCoord(old.texCoord3s()[i]);
+      imap[idx] = newidx;
+      mesh.index(newidx);
+    }
+  }
+  return mesh;
+}
+
+// Merges each vertex into the first earlier kept vertex it matches by
+// comparing with all of them
+Mesh bruteForceWeld(const Mesh &mesh, float epsilon, float attributeEpsilon) {
+  auto near = [&](float a, float b) {
+    return a == b || std::abs(a - b) <= attributeEpsilon;
+  };
+  auto matches = [&](size_t i, size_t j) {
+    const Mesh::Vertex &a = mesh.vertices()[i];
+    const Mesh::Vertex &b = mesh.vertices()[j];
+    if (epsilon > 0 ? (a - b).magSqr() > epsilon * epsilon : !(a == b)) {
+      return false;
+    }
+    const Color &c = mesh.colors()[i];
+    const Color &d = mesh.colors()[j];
+    return near(c.r, d.r) && near(c.g, d.g) && near(c.b, d.b) &&
+           near(c.a, d.a);
+  };
+  Mesh result;
+  std::vector<size_t> kept;
+  std::vector<int> remap(mesh.vertices().size());
+  for (size_t i = 0; i < mesh.vertices().size(); i++) {
+    size_t k = 0;
+    while (k < kept.size() && !matches(i, kept[k])) {
+      k++;
+    }
+    if (k == kept.size()) {
+      kept.push_back(i);
+      result.vertex(mesh.vertices()[i]);
+      result.color(mesh.colors()[i]);
+    }
+    remap[i] = int(k);
+  }
+  if (mesh.indices().empty()) {
+    for (size_t i = 0; i < mesh.vertices().size(); i++) {
+      result.index(remap[i]);
+    }
+  } else {
+    for (auto index : mesh.indices()) {
+      result.index(remap[index]);
+    }
+  }
+  return result;
+}
+
+// Points in a small box, so many are within epsilon of each other, and
+// copies of some of them. Colors take two values.
+Mesh randomMesh(int count, float size, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<float> position(0.0f, size);
+  Mesh mesh;
+  for (int i = 0; i < count; i++) {
+    if (i > 0 && rng() % 4 == 0) {
+      Mesh::Vertex copy = mesh.vertices()[rng() % i];
+      mesh.vertex(copy);
+    } else {
+      mesh.vertex(position(rng), position(rng), position(rng));
+    }
+    mesh.color(rng() % 8 == 0 ? Color(1, 0, 0) : Color(1, 0, 0.01f));
+  }
+  return mesh;
+}
+
+bool sameMesh(const Mesh &a, const Mesh &b) {
+  return a.vertices() == b.vertices() && a.colors() == b.colors() &&
+         a.normals() == b.normals() && a.texCoord1s() == b.texCoord1s() &&
+         a.texCoord2s() == b.texCoord2s() &&
+         a.texCoord3s() == b.texCoord3s() && a.indices() == b.indices();
+}
+} // namespace
+
+TEST_CASE("Mesh::weld matches brute force") {
+  const float epsilons[] = {0.0f, 0.05f, 0.2f};
+  const float attributeEpsilons[] = {0.0f, 0.1f};
+  for (float epsilon : epsilons) {
+    for (float attributeEpsilon : attributeEpsilons) {
+      for (int threads : {1, 4}) {
+        INFO("epsilon " << epsilon << " attribute epsilon "
+                        << attributeEpsilon << " threads " << threads);
+        Mesh mesh = randomMesh(3000, 2.0f, 17);
+        Mesh expected = bruteForceWeld(mesh, epsilon, attributeEpsilon);
+        size_t removed = mesh.weld(epsilon, attributeEpsilon, threads);
+        REQUIRE(removed > 0);
+        REQUIRE(removed == 3000 - expected.vertices().size());
+        REQUIRE(sameMesh(mesh, expected));
+      }
+    }
+  }
+}
+
+TEST_CASE("Mesh::weld keeps vertices with different attributes") {
+  Mesh mesh;
+  mesh.vertex(0, 0, 0);
+  mesh.vertex(0, 0, 0);
+  mesh.vertex(0, 0, 0.001f);
+  mesh.normal(0, 0, 1);
+  mesh.normal(0, 1, 0);
+  mesh.normal(0, 0, 1);
+
+  Mesh copy = mesh;
+  REQUIRE(copy.weld() == 0);
+  REQUIRE(copy.vertices().size() == 3);
+  std::vector<Mesh::Index> unchanged{0, 1, 2};
+  REQUIRE(copy.indices() == unchanged);
+
+  // Positions within epsilon merge only if the normals match
+  copy = mesh;
+  REQUIRE(copy.weld(0.01f) == 1);
+  std::vector<Mesh::Index> merged{0, 1, 0};
+  REQUIRE(copy.indices() == merged);
+  REQUIRE(copy.normals()[1] == Mesh::Normal(0, 1, 0));
+
+  copy = mesh;
+  REQUIRE(copy.weld(0.01f, 1.0f) == 2);
+  REQUIRE(copy.vertices().size() == 1);
+  REQUIRE(copy.normals()[0] == Mesh::Normal(0, 0, 1));
+}
+
+TEST_CASE("Mesh::weld remaps existing indices") {
+  Mesh mesh = randomMesh(500, 1.0f, 5);
+  std::mt19937 rng(3);
+  for (int i = 0; i < 900; i++) {
+    mesh.index(rng() % 500);
+  }
+  Mesh expected = bruteForceWeld(mesh, 0.05f, 0.0f);
+  REQUIRE(mesh.weld(0.05f) == 500 - expected.vertices().size());
+  REQUIRE(mesh.indices().size() == 900);
+  REQUIRE(sameMesh(mesh, expected));
+
+  // Corners shared by two triangles are remapped in both
+  Mesh quad;
+  quad.vertex(0, 0, 0);
+  quad.vertex(1, 0, 0);
+  quad.vertex(0, 0, 0);
+  quad.vertex(1, 1, 0);
+  quad.indices() = {0, 1, 3, 2, 3, 1};
+  REQUIRE(quad.weld() == 1);
+  REQUIRE(quad.vertices().size() == 3);
+  std::vector<Mesh::Index> remapped{0, 1, 2, 0, 2, 1};
+  REQUIRE(quad.indices() == remapped);
+}
+
+TEST_CASE("Mesh::compress matches the previous implementation") {
+  std::mt19937 rng(11);
+  std::uniform_int_distribution<int> coordinate(0, 5);
+  Mesh mesh;
+  for (int i = 0; i < 2000; i++) {
+    // Positions on a coarse grid repeat often, attributes rarely do
+    mesh.vertex(coordinate(rng), coordinate(rng), coordinate(rng) * 0.5f);
+    mesh.color(rng() % 256 / 255.0f, 0, 1);
+    mesh.normal(0, 0, rng() % 2 ? 1 : -1);
+    mesh.texCoord(rng() % 100 * 0.01f, 0.5f);
+  }
+  // -0 and 0 are the same position
+  mesh.vertex(0, -0.0f, 0);
+  mesh.color(0, 0, 0);
+  mesh.normal(1, 0, 0);
+  mesh.texCoord(0, 0);
+
+  Mesh expected = legacyCompress(mesh);
+  mesh.compress();
+  REQUIRE(mesh.vertices().size() == 6 * 6 * 6);
+  REQUIRE(sameMesh(mesh, expected));
+}
+
+namespace {
+// Vertices on a sphere with random triangles between them
+Mesh randomIndexedMesh(int vertices, int triangles, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<float> normal;
+  Mesh mesh;
+  for (int i = 0; i < vertices; i++) {
+    Mesh::Vertex v(normal(rng), normal(rng), normal(rng));
+    mesh.vertex(v.normalize());
+  }
+  for (int i = 0; i < 3 * triangles; i++) {
+    mesh.index(rng() % vertices);
+  }
+  return mesh;
+}
+
+bool sameNormals(const Mesh &a, const Mesh &b) {
+  if (a.normals().size() != b.normals().size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.normals().size(); i++) {
+    if ((a.normals()[i] - b.normals()[i]).mag() > 1e-5f) {
+      return false;
+    }
+  }
+  return true;
+}
+} // namespace
+
+TEST_CASE("Mesh::generateNormals is the same on several threads") {
+  for (auto primitive : {Mesh::TRIANGLES, Mesh::TRIANGLE_STRIP}) {
+    for (bool indexed : {true, false}) {
+      for (bool equalWeight : {false, true}) {
+        INFO("primitive " << primitive << " indexed " << indexed
+                          << " equal weight " << equalWeight);
+        Mesh mesh = randomIndexedMesh(2000, 6000, 7);
+        if (!indexed) {
+          mesh.decompress();
+        }
+        mesh.primitive(primitive);
+        Mesh serial = mesh;
+        serial.generateNormals(true, equalWeight, 1);
+        mesh.generateNormals(true, equalWeight, 4);
+        REQUIRE(sameNormals(mesh, serial));
+        // Again with the table kept from the first call
+        mesh.generateNormals(true, equalWeight, 4);
+        REQUIRE(sameNormals(mesh, serial));
+      }
+    }
+  }
+}
+
+TEST_CASE("Mesh::generateNormals rebuilds its table when indices change") {
+  Mesh mesh = randomIndexedMesh(1000, 3000, 8);
+  mesh.generateNormals(true, false, 4);
+
+  // Same number of indices, other values
+  std::mt19937 rng(2);
+  for (int i = 0; i < 500; i++) {
+    mesh.indices()[rng() % mesh.indices().size()] = rng() % 1000;
+  }
+  Mesh serial = mesh;
+  serial.generateNormals(true, false, 1);
+  mesh.generateNormals(true, false, 4);
+  REQUIRE(sameNormals(mesh, serial));
+
+  // More indices
+  mesh.index(0, 1, 2);
+  serial.index(0, 1, 2);
+  serial.generateNormals(true, false, 1);
+  mesh.generateNormals(true, false, 4);
+  REQUIRE(sameNormals(mesh, serial));
+
+  // A copy shares the table, but changing its indices leaves the original
+  Mesh copy = mesh;
+  std::swap(copy.indices()[0], copy.indices()[3]);
+  copy.generateNormals(true, false, 4);
+  mesh.generateNormals(true, false, 4);
+  REQUIRE(sameNormals(mesh, serial));
+  Mesh copySerial = copy;
+  copySerial.generateNormals(true, false, 1);
+  REQUIRE(sameNormals(copy, copySerial));
+}
+
+namespace {
+typedef std::array<float, 7> Corner;    // position and color
+typedef std::array<Corner, 3> Triangle; // in winding order
+
+// Sorted triangles, each starting at its smallest corner so the winding is
+// kept
+std::vector<Triangle> triangleSet(const Mesh &mesh) {
+  std::vector<Triangle> triangles;
+  auto corner = [&](Mesh::Index i) {
+    auto &v = mesh.vertices()[i];
+    auto &c = mesh.colors()[i];
+    return Corner{{v.x, v.y, v.z, c.r, c.g, c.b, c.a}};
+  };
+  auto &I = mesh.indices();
+  for (size_t i = 0; i + 2 < I.size(); i += 3) {
+    Triangle t{{corner(I[i]), corner(I[i + 1]), corner(I[i + 2])}};
+    auto first = std::min_element(t.begin(), t.end()) - t.begin();
+    std::rotate(t.begin(), t.begin() + first, t.end());
+    triangles.push_back(t);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+// Grid of n x n quads with a color per vertex
+Mesh grid(int n) {
+  Mesh mesh(Mesh::TRIANGLES);
+  for (int y = 0; y <= n; y++) {
+    for (int x = 0; x <= n; x++) {
+      mesh.vertex(x, y, 0);
+      mesh.color(float(x) / n, float(y) / n, 0.5f);
+    }
+  }
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      unsigned i = y * (n + 1) + x;
+      mesh.index(i, i + 1, i + n + 2);
+      mesh.index(i, i + n + 2, i + n + 1);
+    }
+  }
+  return mesh;
+}
+
+// Triangles in random order, starting at random corners, and vertices in
+// random order
+Mesh shuffled(const Mesh &mesh, unsigned seed) {
+  std::mt19937 rng(seed);
+  size_t Nv = mesh.vertices().size();
+  std::vector<Mesh::Index> order(Nv);
+  for (size_t i = 0; i < Nv; i++) {
+    order[i] = Mesh::Index(i);
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  std::vector<Mesh::Index> newIndex(Nv);
+  Mesh result(mesh.primitive());
+  for (size_t i = 0; i < Nv; i++) {
+    newIndex[order[i]] = Mesh::Index(i);
+    result.vertex(mesh.vertices()[order[i]]);
+    result.color(mesh.colors()[order[i]]);
+  }
+  auto &I = mesh.indices();
+  std::vector<size_t> triangles(I.size() / 3);
+  for (size_t t = 0; t < triangles.size(); t++) {
+    triangles[t] = t;
+  }
+  std::shuffle(triangles.begin(), triangles.end(), rng);
+  for (size_t t : triangles) {
+    size_t first = rng() % 3;
+    for (size_t k = 0; k < 3; k++) {
+      result.index(newIndex[I[3 * t + (first + k) % 3]]);
+    }
+  }
+  return result;
+}
+} // namespace
+
+TEST_CASE("Mesh::optimize keeps the triangles and lowers the miss ratio") {
+  std::vector<Mesh> meshes;
+  meshes.push_back(grid(60));
+  meshes.push_back(shuffled(grid(60), 1));
+  meshes.push_back(randomIndexedMesh(3000, 6000, 4));
+  for (size_t i = 0; i < meshes[2].vertices().size(); i++) {
+    meshes[2].color(i % 7 / 7.0f, 0, 1);
+  }
+  meshes.push_back(shuffled(meshes[2], 2));
+
+  for (size_t m = 0; m < meshes.size(); m++) {
+    for (float threshold : {0.0f, 1.05f}) {
+      for (int cacheSize : {16, 32}) {
+        INFO("mesh " << m << " overdraw threshold " << threshold
+                     << " cache size " << cacheSize);
+        Mesh mesh = meshes[m];
+        float before = mesh.cacheMissRatio(cacheSize);
+        auto triangles = triangleSet(mesh);
+        mesh.optimize(cacheSize, threshold);
+        REQUIRE(mesh.vertices().size() == meshes[m].vertices().size());
+        REQUIRE(triangleSet(mesh) == triangles);
+        REQUIRE(mesh.cacheMissRatio(cacheSize) <= before);
+      }
+    }
+  }
+
+  // A triangle strip is converted to the same triangles
+  Mesh strip(Mesh::TRIANGLE_STRIP);
+  for (int i = 0; i < 40; i++) {
+    strip.vertex(i / 2, i % 2, 0);
+    strip.color(0, 0, i / 40.0f);
+    strip.index(i);
+  }
+  Mesh triangles = strip;
+  triangles.toTriangles();
+  strip.optimize();
+  REQUIRE(strip.primitive() == Mesh::TRIANGLES);
+  REQUIRE(triangleSet(strip) == triangleSet(triangles));
+}
@@ -0,0 +1,90 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <set>
+#include <tuple>
+
+#include "al/graphics/al_MeshLOD.hpp"
+
+using namespace al;
+
+namespace {
+typedef std::tuple<float, float, float> Position;
+
+// Bumpy open square of n x n quads in [0, 1] x [0, 1]
+Mesh heightField(int n) {
+  Mesh mesh(Mesh::TRIANGLES);
+  for (int y = 0; y <= n; y++) {
+    for (int x = 0; x <= n; x++) {
+      float u = float(x) / n, v = float(y) / n;
+      mesh.vertex(u, v, 0.05f * std::sin(6 * u) * std::cos(5 * v));
+    }
+  }
+  for (int y = 0; y < n; y++) {
+    for (int x = 0; x < n; x++) {
+      unsigned i = y * (n + 1) + x;
+      mesh.index(i, i + 1, i + n + 2);
+      mesh.index(i, i + n + 2, i + n + 1);
+    }
+  }
+  return mesh;
+}
+
+bool onBorder(const Mesh::Vertex &v) {
+  return v.x == 0 || v.x == 1 || v.y == 0 || v.y == 1;
+}
+
+std::set<Position> borderPositions(const Mesh &mesh) {
+  std::set<Position> positions;
+  for (auto &v : mesh.vertices()) {
+    if (onBorder(v)) {
+      positions.insert(Position(v.x, v.y, v.z));
+    }
+  }
+  return positions;
+}
+} // namespace
+
+TEST_CASE("MeshSimplifier reaches the target triangle count") {
+  for (int threads : {1, 4}) {
+    INFO("threads " << threads);
+    Mesh mesh = heightField(40);
+    REQUIRE(mesh.indices().size() / 3 == 3200);
+    MeshSimplifier simplifier;
+    simplifier.targetTriangles(400).threads(threads);
+    float error = simplifier.simplify(mesh);
+    size_t triangles = mesh.indices().size() / 3;
+    REQUIRE(triangles <= 400);
+    REQUIRE(triangles > 300);
+    REQUIRE(error >= 0);
+    REQUIRE(error < 0.05f);
+    for (auto index : mesh.indices()) {
+      REQUIRE(index < mesh.vertices().size());
+    }
+    // Border vertices may slide along the border, but not leave it
+    for (auto &v : mesh.vertices()) {
+      REQUIRE(v.x >= 0);
+      REQUIRE(v.x <= 1);
+      REQUIRE(v.y >= 0);
+      REQUIRE(v.y <= 1);
+    }
+  }
+}
+
+TEST_CASE("MeshSimplifier keeps locked boundary vertices") {
+  Mesh mesh = heightField(40);
+  auto border = borderPositions(mesh);
+  REQUIRE(border.size() == 160);
+
+  MeshSimplifier simplifier;
+  simplifier.targetTriangles(400).lockBoundary(true);
+  simplifier.simplify(mesh);
+  // The border vertices limit how far the mesh can be simplified
+  REQUIRE(mesh.indices().size() / 3 < 1000);
+  REQUIRE(borderPositions(mesh) == border);
+
+  // Without locking, the border is simplified too
+  Mesh unlocked = heightField(40);
+  simplifier.lockBoundary(false).simplify(unlocked);
+  REQUIRE(borderPositions(unlocked).size() < border.size());
+}
@@ -1,7 +1,12 @@
 
 #include "catch.hpp"
 
+#include <mutex>
+#include <string>
+#include <vector>
+
 #include "al/protocol/al_OSC.hpp"
+#include "al/ui/al_ParameterServer.hpp"
 
 using namespace al;
 
@@ -80,3 +85,206 @@ TEST_CASE( "OSC multiple receivers" ) {
 }
 
 // #endif
+
+class CountingHandler : public osc::PacketHandler {
+public:
+  virtual void onMessage(osc::Message &m) override {
+    if (m.addressPattern() == "/value") {
+      m >> lastValue;
+      valueCount++;
+    } else {
+      otherCount++;
+    }
+  }
+
+  float lastValue{0};
+  int valueCount{0};
+  int otherCount{0};
+};
+
+TEST_CASE("OSCNotifier coalesces notifications") {
+  CountingHandler handler;
+  osc::Recv server;
+  server.open(10830, "localhost", 0.0);
+  server.handler(handler);
+  server.start();
+
+  OSCNotifier notifier;
+  // Long enough that the notifier thread never flushes during the test
+  notifier.setNotificationInterval(60.0);
+  notifier.addListener("localhost", 10830);
+  for (int i = 0; i < 500; i++) {
+    notifier.notifyListeners("/value", float(i));
+    notifier.notifyListeners("/other" + std::to_string(i % 2), i);
+  }
+  notifier.flushNotifications();
+
+  al_sleep(0.2);
+
+  REQUIRE(handler.valueCount == 1);
+  REQUIRE(handler.lastValue == 499.0f);
+  REQUIRE(handler.otherCount == 2);
+}
+
+TEST_CASE("OSCNotifier drops notifications past its pool") {
+  CountingHandler handler;
+  osc::Recv server;
+  server.open(10831, "localhost", 0.0);
+  server.handler(handler);
+  server.start();
+
+  OSCNotifier notifier;
+  // Long enough that the notifier thread never flushes during the test
+  notifier.setNotificationInterval(60.0);
+  notifier.addListener("localhost", 10831);
+  // More than the pool holds, the notifications past it are dropped
+  for (int i = 0; i < 3000; i++) {
+    notifier.notifyListeners("/value", float(i));
+  }
+  REQUIRE(notifier.droppedNotifications() == 3000 - 1024);
+  notifier.flushNotifications();
+  al_sleep(0.1);
+  REQUIRE(handler.valueCount == 1);
+  REQUIRE(handler.lastValue == 1023.0f);
+
+  // Flushing returned the nodes to the pool
+  for (int i = 0; i < 1000; i++) {
+    notifier.notifyListeners("/value", float(5000 + i));
+  }
+  notifier.flushNotifications();
+
+  al_sleep(0.2);
+
+  REQUIRE(notifier.droppedNotifications() == 3000 - 1024);
+  REQUIRE(handler.valueCount == 2);
+  REQUIRE(handler.lastValue == 5999.0f);
+}
+
+TEST_CASE("OSC multicast loopback") {
+  Handler handler;
+  osc::Recv server;
+  server.open(10840, "0.0.0.0", 0.0);
+  REQUIRE(server.joinMulticastGroup("239.255.0.77"));
+  server.handler(handler);
+  server.start();
+
+  osc::Send sender;
+  REQUIRE(sender.open(10840, "239.255.0.77"));
+  sender.multicastTTL(0);
+  sender.multicastLoopback(true);
+  sender.send("/multicast", "hello");
+
+  al_sleep(0.2);
+
+  REQUIRE(handler.address == "/multicast");
+  REQUIRE(handler.inString == "hello");
+}
+
+// Records every message as "handler:address:value:timetag"
+class RecordingHandler : public osc::PacketHandler {
+public:
+  RecordingHandler(std::vector<std::string> &log, std::mutex &lock, int index)
+      : mLog(log), mLock(lock), mIndex(index) {}
+
+  virtual void onMessage(osc::Message &m) override {
+    int value = -1;
+    m >> value;
+    std::unique_lock<std::mutex> lk(mLock);
+    mLog.push_back(std::to_string(mIndex) + ":" + m.addressPattern() + ":" +
+                   std::to_string(value) + ":" +
+                   std::to_string(m.timeTag()));
+  }
+
+private:
+  std::vector<std::string> &mLog;
+  std::mutex &mLock;
+  int mIndex;
+};
+
+namespace {
+// A bundle holding a message, a nested bundle of two messages, and another
+// message
+osc::Packet nestedBundle(int first) {
+  osc::Packet p;
+  p.beginBundle(7);
+  p.addMessage("/a", first);
+  p.beginBundle(9);
+  p.addMessage("/b", first + 1);
+  p.addMessage("/b", first + 2);
+  p.endBundle();
+  p.addMessage("/a", first + 3);
+  p.endBundle();
+  return p;
+}
+
+std::vector<std::string> nestedLog(int handler, int first) {
+  std::string h = std::to_string(handler);
+  return {h + ":/a:" + std::to_string(first) + ":7",
+          h + ":/b:" + std::to_string(first + 1) + ":9",
+          h + ":/b:" + std::to_string(first + 2) + ":9",
+          h + ":/a:" + std::to_string(first + 3) + ":7"};
+}
+} // namespace
+
+TEST_CASE("OSC Recv delivers nested bundles in order") {
+  std::vector<std::string> log;
+  std::mutex lock;
+  RecordingHandler handler0(log, lock, 0), handler1(log, lock, 1);
+  osc::Recv server;
+  server.handler(handler0);
+  server.appendHandler(handler1);
+
+  // Parsed in place: each handler gets the whole packet before the next
+  osc::Packet p = nestedBundle(0);
+  server.parse(p.data(), int(p.size()), "localhost");
+  std::vector<std::string> expected = nestedLog(0, 0);
+  auto second = nestedLog(1, 0);
+  expected.insert(expected.end(), second.begin(), second.end());
+  REQUIRE(log == expected);
+  REQUIRE(server.data() == nullptr);
+
+  // Truncated packets are dropped without reading past their end
+  log.clear();
+  std::vector<char> truncated(p.data(), p.data() + p.size() - 4);
+  server.parse(truncated.data(), int(truncated.size()), "localhost");
+  REQUIRE(log.size() <= expected.size());
+}
+
+TEST_CASE("OSC Recv receives bursts of packets in order") {
+  std::vector<std::string> log;
+  std::mutex lock;
+  RecordingHandler handler0(log, lock, 0), handler1(log, lock, 1);
+  osc::Recv server;
+  REQUIRE(server.open(10850, "localhost", 0.0));
+  server.handler(handler0);
+  server.appendHandler(handler1);
+
+  // Queued before the receiving thread starts, so that they are read
+  // several at a time
+  const int packets = 60;
+  osc::Send sender(10850, "localhost");
+  std::vector<std::string> expected;
+  for (int i = 0; i < packets; i++) {
+    osc::Packet p = nestedBundle(4 * i);
+    sender.send(p);
+    for (int handler = 0; handler < 2; handler++) {
+      auto messages = nestedLog(handler, 4 * i);
+      expected.insert(expected.end(), messages.begin(), messages.end());
+    }
+    if (i == packets / 2) {
+      server.start();
+    }
+  }
+
+  for (int i = 0; i < 200; i++) {
+    {
+      std::unique_lock<std::mutex> lk(lock);
+      if (log.size() >= expected.size()) {
+        break;
+      }
+    }
+    al_sleep(0.01);
+  }
+  server.stop();
+  REQUIRE(log == expected);
+}
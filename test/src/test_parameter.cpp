@@ -0,0 +1,183 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "al/ui/al_Parameter.hpp"
+
+using namespace al;
+
+TEST_CASE("ParameterValueSlots concurrent writers and readers") {
+  ParameterValueSlots<Vec4f> slots(Vec4f(0, 0, 0, 0));
+  std::atomic<bool> done{false};
+  std::atomic<int> tornReads{0};
+  std::atomic<int> versionErrors{0};
+  std::atomic<int> successfulLoads{0};
+
+  // Every stored value has four equal elements, so a torn copy is visible
+  std::vector<std::thread> writers;
+  for (int w = 0; w < 5; w++) { // More writers than free slots
+    writers.emplace_back([&, w]() {
+      for (int i = 0; i < 20000; i++) {
+        float v = float(w * 100000 + i);
+        slots.store(Vec4f(v, v, v, v));
+      }
+    });
+  }
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; r++) {
+    readers.emplace_back([&]() {
+      uint64_t lastVersion = 0;
+      while (!done) {
+        Vec4f value;
+        uint64_t version;
+        if (slots.load(value, version)) {
+          successfulLoads++;
+          if (value[0] != value[1] || value[0] != value[2] ||
+              value[0] != value[3]) {
+            tornReads++;
+          }
+          if (version < lastVersion) {
+            versionErrors++;
+          }
+          lastVersion = version;
+        }
+      }
+    });
+  }
+  for (auto &t : writers) {
+    t.join();
+  }
+  done = true;
+  for (auto &t : readers) {
+    t.join();
+  }
+
+  REQUIRE(tornReads == 0);
+  REQUIRE(versionErrors == 0);
+  REQUIRE(successfulLoads > 0);
+  REQUIRE(slots.version() == 5 * 20000);
+  Vec4f last;
+  REQUIRE(slots.load(last));
+  REQUIRE(last[0] == last[3]);
+}
+
+TEST_CASE("ParameterVec4 lock-free set and get") {
+  ParameterVec4 p("vec", "", Vec4f(1, 1, 1, 1));
+  std::atomic<bool> done{false};
+  std::atomic<int> tornReads{0};
+
+  std::thread writer([&]() {
+    for (int i = 0; i < 50000; i++) {
+      float v = float(i);
+      p.set(Vec4f(v, v, v, v));
+    }
+    done = true;
+  });
+  Vec4f snapshot;
+  uint64_t version = 0;
+  while (!done) {
+    Vec4f value = p.get();
+    if (value[0] != value[1] || value[0] != value[2] || value[0] != value[3]) {
+      tornReads++;
+    }
+    if (p.updateSnapshot(snapshot, version) &&
+        (snapshot[0] != snapshot[3] || snapshot[1] != snapshot[2])) {
+      tornReads++;
+    }
+  }
+  writer.join();
+
+  REQUIRE(tornReads == 0);
+  REQUIRE(p.get() == Vec4f(49999, 49999, 49999, 49999));
+  p.updateSnapshot(snapshot, version);
+  REQUIRE(snapshot == Vec4f(49999, 49999, 49999, 49999));
+  REQUIRE_FALSE(p.updateSnapshot(snapshot, version));
+
+  ParameterVec4 copy(p);
+  REQUIRE(copy.get() == Vec4f(49999, 49999, 49999, 49999));
+}
+
+TEST_CASE("Parameter change callbacks can be removed") {
+  ParameterPose pose("pose");
+  int first = 0, second = 0;
+  auto handle = pose.registerChangeCallback([&](Pose) { first++; });
+  pose.registerChangeCallback([&](Pose) { second++; });
+  pose.set(Pose(Vec3d(1, 0, 0)));
+  REQUIRE(first == 1);
+  REQUIRE(second == 1);
+
+  pose.removeChangeCallback(handle);
+  pose.set(Pose(Vec3d(2, 0, 0)));
+  REQUIRE(first == 1);
+  REQUIRE(second == 2);
+
+  // Removing twice does nothing
+  pose.removeChangeCallback(handle);
+  pose.set(Pose(Vec3d(3, 0, 0)));
+  REQUIRE(second == 3);
+}
+
+TEST_CASE("ParameterSmoother exponential mode settles") {
+  const float sampleRate = 48000;
+  for (float target : {1.0f, 20000.0f, -350.0f, 0.001f}) {
+    ParameterSmoother<float> smoother(0.0f);
+    smoother.configure(SmoothingMode::EXPONENTIAL, 0.2f, sampleRate);
+    smoother.setTarget(target);
+    size_t frames = 0;
+    // About 40 time constants is enough for any float target
+    while (!smoother.settled() && frames < size_t(8 * sampleRate)) {
+      smoother.next();
+      frames++;
+    }
+    REQUIRE(smoother.settled());
+    REQUIRE(smoother.current() == target);
+    REQUIRE(frames > size_t(0.2f * sampleRate));
+  }
+
+  // Block processing settles too, and moves monotonically
+  ParameterSmoother<float> smoother(0.0f);
+  smoother.configure(SmoothingMode::EXPONENTIAL, 0.2f, sampleRate);
+  smoother.setTarget(20000.0f);
+  float previous = 0.0f;
+  bool monotonic = true;
+  for (int block = 0; block < 8 * 48000 / 64 && !smoother.settled();
+       block++) {
+    auto ramp = smoother.ramp(64);
+    monotonic &= ramp[63] >= previous;
+    previous = ramp[63];
+  }
+  REQUIRE(monotonic);
+  REQUIRE(smoother.settled());
+  REQUIRE(smoother.current() == 20000.0f);
+
+  ParameterSmoother<Vec3f> vecSmoother(Vec3f(0, 0, 0));
+  vecSmoother.configure(SmoothingMode::EXPONENTIAL, 0.2f, sampleRate);
+  vecSmoother.setTarget(Vec3f(20000, 1, -5));
+  Vec3f buffer[512];
+  for (int block = 0; block < 8 * 48000 / 512 && !vecSmoother.settled();
+       block++) {
+    vecSmoother.process(buffer, 512);
+  }
+  REQUIRE(vecSmoother.settled());
+  REQUIRE(vecSmoother.current() == Vec3f(20000, 1, -5));
+}
+
+TEST_CASE("ParameterSmoother exponential mode retargets mid transition") {
+  ParameterSmoother<float> smoother(0.0f);
+  smoother.configure(SmoothingMode::EXPONENTIAL, 0.01f, 48000);
+  smoother.setTarget(100.0f);
+  for (int i = 0; i < 480; i++) {
+    smoother.next();
+  }
+  float halfway = smoother.current();
+  REQUIRE(halfway > 60.0f);
+  REQUIRE(halfway < 64.0f); // 1 - 1/e of the way
+  smoother.setTarget(0.0f);
+  REQUIRE(smoother.next() < halfway);
+  for (int i = 0; i < 48000 && !smoother.settled(); i++) {
+    smoother.next();
+  }
+  REQUIRE(smoother.current() == 0.0f);
+}
@@ -0,0 +1,158 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "al/app/al_ParameterDispatchDomain.hpp"
+
+using namespace al;
+
+TEST_CASE("ParameterDispatchDomain delivers source callbacks") {
+  ParameterDispatchDomain dispatcher;
+  Parameter p("value", "", 0.0);
+  int calls = 0;
+  int srcCalls = 0;
+  float lastValue = 0;
+  std::string lastIp;
+  p.registerChangeCallback([&](float) { calls++; });
+  p.registerChangeCallback([&](float value, ValueSource *src) {
+    srcCalls++;
+    lastValue = value;
+    lastIp = src ? src->ipAddr : "";
+  });
+  dispatcher.registerParameter(p);
+
+  ValueSource src{"10.0.0.1", 9010};
+  p.set(1.0f);
+  p.set(2.0f, &src);
+  REQUIRE(srcCalls == 0);
+  REQUIRE(dispatcher.dispatch() == 1);
+  REQUIRE(calls == 1);
+  REQUIRE(srcCalls == 1);
+  REQUIRE(lastValue == 2.0f);
+  REQUIRE(lastIp == "10.0.0.1");
+
+  p.set(3.0f);
+  dispatcher.dispatch();
+  REQUIRE(srcCalls == 2);
+  REQUIRE(lastIp == "");
+}
+
+TEST_CASE("ParameterDispatchDomain delivers pending changes on unregister") {
+  ParameterDispatchDomain dispatcher;
+  Parameter p("value", "", 0.0);
+  int calls = 0;
+  int srcCalls = 0;
+  float lastValue = 0;
+  p.registerChangeCallback([&](float value) {
+    calls++;
+    lastValue = value;
+  });
+  p.registerChangeCallback([&](float, ValueSource *) { srcCalls++; });
+  dispatcher.registerParameter(p);
+
+  p.set(5.0f);
+  REQUIRE(calls == 0);
+  dispatcher.unregisterParameter(p);
+  REQUIRE(calls == 1);
+  REQUIRE(srcCalls == 1);
+  REQUIRE(lastValue == 5.0f);
+
+  // Back to synchronous callbacks
+  p.set(6.0f);
+  REQUIRE(calls == 2);
+  REQUIRE(srcCalls == 2);
+  REQUIRE(lastValue == 6.0f);
+  REQUIRE(dispatcher.dispatch() == 0);
+}
+
+TEST_CASE("ParameterDispatchDomain outlives its parameters") {
+  // Parameters that are App members are destroyed before the App's domains
+  auto dispatcher = std::make_unique<ParameterDispatchDomain>();
+  auto p = std::make_unique<Parameter>("value", "", 0.0);
+  auto other = std::make_unique<Parameter>("other", "", 0.0);
+  int calls = 0;
+  p->registerChangeCallback([&](float) { calls++; });
+  other->registerChangeCallback([&](float) { calls++; });
+  dispatcher->registerParameter(*p);
+  dispatcher->registerParameter(*other);
+
+  p->set(1.0f);
+  other->set(1.0f);
+  p.reset(); // Destroyed with a change pending
+  REQUIRE(dispatcher->dispatch() == 2);
+  REQUIRE(calls == 1);
+  REQUIRE(dispatcher->stats().size() == 1);
+
+  dispatcher->unregisterParameter(*other);
+  REQUIRE(dispatcher->stats().size() == 0);
+  dispatcher->registerParameter(*other);
+  other.reset();
+  dispatcher.reset();
+}
+
+TEST_CASE("ParameterDispatchDomain cleanup detaches parameters") {
+  ParameterDispatchDomain dispatcher;
+  Parameter p("value", "", 0.0);
+  int calls = 0;
+  p.registerChangeCallback([&](float) { calls++; });
+  dispatcher.registerParameter(p);
+
+  p.set(1.0f);
+  REQUIRE(calls == 0);
+  dispatcher.cleanup();
+  REQUIRE(calls == 1);
+  REQUIRE(dispatcher.stats().size() == 0);
+
+  // Back to synchronous callbacks
+  p.set(2.0f);
+  REQUIRE(calls == 2);
+  REQUIRE(dispatcher.dispatch() == 0);
+}
+
+TEST_CASE("ParameterDispatchDomain concurrent setters") {
+  ParameterDispatchDomain dispatcher;
+  Parameter p("value", "", 0.0);
+  std::atomic<int> srcCalls{0};
+  std::atomic<int> badSources{0};
+  p.registerChangeCallback([&](float, ValueSource *src) {
+    srcCalls++;
+    if (src && src->ipAddr != "10.0.0.1" && src->ipAddr != "192.168.1.20") {
+      badSources++;
+    }
+  });
+  std::atomic<float> lastDelivered{-1.0f};
+  p.registerChangeCallback([&](float value) { lastDelivered = value; });
+  dispatcher.registerParameter(p);
+
+  std::atomic<bool> done{false};
+  std::thread audio([&]() {
+    for (int i = 0; i < 20000; i++) {
+      p.set(float(i));
+    }
+  });
+  std::thread network([&]() {
+    ValueSource a{"10.0.0.1", 9010};
+    ValueSource b{"192.168.1.20", 9011};
+    for (int i = 0; i < 20000; i++) {
+      p.set(float(-i), i % 2 ? &a : &b);
+    }
+  });
+  std::thread dispatching([&]() {
+    while (!done) {
+      dispatcher.dispatch();
+    }
+  });
+  audio.join();
+  network.join();
+  done = true;
+  dispatching.join();
+  dispatcher.dispatch();
+
+  REQUIRE(srcCalls > 0);
+  REQUIRE(badSources == 0);
+  REQUIRE_FALSE(p.hasChange());
+  // The value stored by whichever setter came last was delivered
+  REQUIRE(lastDelivered == p.get());
+}
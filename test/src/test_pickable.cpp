@@ -0,0 +1,103 @@
+#include "catch.hpp"
+
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "al/graphics/al_Shapes.hpp"
+#include "al/ui/al_PickableManager.hpp"
+
+using namespace al;
+
+namespace {
+Pose randomPose(std::mt19937 &rng) {
+  std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+  Vec3f pos(uniform(rng), uniform(rng), uniform(rng));
+  Quatf quat(uniform(rng), uniform(rng), uniform(rng), uniform(rng));
+  return Pose(pos * 20.0f, quat.normalize());
+}
+
+// Number of rays for which the hierarchy finds a different pickable than
+// testing every pickable
+int mismatches(PickableManager &manager, std::mt19937 &rng, int &hits) {
+  std::normal_distribution<double> normal;
+  int count = 0;
+  for (int i = 0; i < 500; i++) {
+    Rayd r(Vec3d(), Vec3d(normal(rng), normal(rng), normal(rng)).normalize());
+    Hit all = manager.intersectAll(r);
+    Hit bvh = manager.intersect(r);
+    hits += all.hit;
+    if (all.hit != bvh.hit || (all.hit && all.p != bvh.p)) {
+      count++;
+    }
+  }
+  return count;
+}
+} // namespace
+
+TEST_CASE("PickableManager intersect matches intersectAll") {
+  Mesh cube;
+  addCube(cube);
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<float> uniform(0.5f, 2.0f);
+  std::vector<std::unique_ptr<PickableBB>> boxes;
+  PickableManager manager;
+  for (int i = 0; i < 200; i++) {
+    boxes.emplace_back(new PickableBB(cube));
+    boxes.back()->pose = randomPose(rng);
+    manager << boxes.back().get();
+  }
+
+  int hits = 0;
+  REQUIRE(mismatches(manager, rng, hits) == 0);
+  for (int frame = 0; frame < 20; frame++) {
+    INFO("frame " << frame);
+    for (int i = 0; i < 20; i++) {
+      auto &box = boxes[rng() % boxes.size()];
+      if (frame >= 15) {
+        // Not seen by the manager until it is told
+        box->pose.setNoCalls(randomPose(rng));
+      } else if (rng() % 2) {
+        box->pose = randomPose(rng);
+      } else {
+        box->scaleVec = Vec3f(uniform(rng), uniform(rng), uniform(rng));
+      }
+    }
+    if (frame >= 15) {
+      manager.boundsChanged();
+    }
+    REQUIRE(mismatches(manager, rng, hits) == 0);
+  }
+  // The rays hit something often enough for the comparison to mean anything
+  REQUIRE(hits > 1000);
+
+  // Unregistered pickables are no longer hit
+  for (int i = 0; i < 100; i++) {
+    manager.unregisterPickable(*boxes[i]);
+  }
+  REQUIRE(manager.pickables().size() == 100);
+  REQUIRE(mismatches(manager, rng, hits) == 0);
+  std::normal_distribution<double> normal;
+  for (int i = 0; i < 500; i++) {
+    Rayd r(Vec3d(), Vec3d(normal(rng), normal(rng), normal(rng)).normalize());
+    Hit h = manager.intersect(r);
+    for (int j = 0; j < 100; j++) {
+      REQUIRE(h.p != boxes[j].get());
+    }
+  }
+}
+
+TEST_CASE("Pickable transforms between local and world space") {
+  PickableBB box;
+  box.pose = Pose(Vec3d(1, 2, 3), Quatd().fromAxisAngle(M_PI / 2, 0, 0, 1));
+  box.scaleVec = Vec3f(2, 2, 2);
+  Vec3f local(1, 0, 0);
+  Vec3f world = box.transformVecWorld(local);
+  REQUIRE(world.x == Approx(1));
+  REQUIRE(world.y == Approx(4));
+  REQUIRE(world.z == Approx(3));
+  Vec3f back = box.transformVecLocal(world);
+  REQUIRE(back.x == Approx(1));
+  REQUIRE(back.y == Approx(0).margin(1e-6));
+  REQUIRE(back.z == Approx(0).margin(1e-6));
+}
@@ -0,0 +1,243 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "al/spatial/al_SparseHashSpace.hpp"
+
+using namespace al;
+
+namespace {
+// Exposes the hash table, to build collision chains and check its structure
+struct InspectedSpace : public SparseHashSpace {
+  InspectedSpace(double cellSize) : SparseHashSpace(cellSize) {}
+
+  using SparseHashSpace::findCell;
+  using SparseHashSpace::slot;
+
+  uint32_t tableSize() const { return mTable.size(); }
+
+  // Every occupied cell is found from its home slot, and nothing else is
+  // in the table
+  bool consistent() const {
+    uint32_t entries = 0;
+    for (uint32_t cell : mTable) {
+      entries += cell != invalidCell();
+    }
+    if (entries != numCells()) {
+      return false;
+    }
+    for (uint32_t cell = 0; cell < mCells.size(); cell++) {
+      if (mCells[cell].count > 0 && findCell(mCells[cell].coord) != cell) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+// Distances of the nearest objects, by testing every object
+std::vector<double> bruteForce(InspectedSpace &space, const Vec3d &center,
+                               const SparseHashSpace::Object *exclude,
+                               double maxRadius, uint32_t maxResults) {
+  std::vector<double> found;
+  for (uint32_t i = 0; i < space.numObjects(); i++) {
+    auto &o = space.object(i);
+    if (&o == exclude || o.cell == SparseHashSpace::invalidCell()) {
+      continue;
+    }
+    double d2 = (o.pos - center).magSqr();
+    if (d2 <= maxRadius * maxRadius) {
+      found.push_back(d2);
+    }
+  }
+  std::sort(found.begin(), found.end());
+  if (found.size() > maxResults) {
+    found.resize(maxResults);
+  }
+  return found;
+}
+
+bool matchesBruteForce(InspectedSpace &space, std::mt19937 &rng) {
+  std::uniform_real_distribution<double> uniform(-12, 12);
+  std::uniform_real_distribution<double> radius(0, 6);
+  SparseHashSpace::Query query;
+  for (int i = 0; i < 50; i++) {
+    uint32_t maxResults = 1 + rng() % 20;
+    double r = i % 10 ? radius(rng) : HUGE_VAL;
+    query.clear().maxResults(maxResults);
+
+    Vec3d center(uniform(rng), uniform(rng), uniform(rng));
+    query(space, center, r);
+    auto expected = bruteForce(space, center, nullptr, r, maxResults);
+    if (query.size() != expected.size()) {
+      return false;
+    }
+    for (unsigned k = 0; k < query.size(); k++) {
+      if (query.distanceSquared(k) != expected[k]) {
+        return false;
+      }
+    }
+
+    auto *o = &space.object(rng() % space.numObjects());
+    if (o->cell == SparseHashSpace::invalidCell()) {
+      continue;
+    }
+    query.clear();
+    query(space, o, r);
+    expected = bruteForce(space, o->pos, o, r, maxResults);
+    if (query.size() != expected.size()) {
+      return false;
+    }
+    for (unsigned k = 0; k < query.size(); k++) {
+      if (query[k] == o || query.distanceSquared(k) != expected[k]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+} // namespace
+
+TEST_CASE("SparseHashSpace queries match brute force") {
+  std::mt19937 rng(11);
+  std::uniform_real_distribution<double> uniform(-10, 10);
+  std::uniform_real_distribution<double> step(-0.7, 0.7);
+  InspectedSpace space(1.5);
+  space.numObjects(400);
+
+  // Inserting, with clusters so that cells hold several objects
+  for (uint32_t i = 0; i < space.numObjects(); i++) {
+    if (i % 4 == 0) {
+      space.move(i, uniform(rng) * 0.1, uniform(rng) * 0.1, uniform(rng));
+    } else {
+      space.move(i, uniform(rng), uniform(rng), uniform(rng));
+    }
+  }
+  REQUIRE(space.consistent());
+  REQUIRE(matchesBruteForce(space, rng));
+
+  for (int round = 0; round < 20; round++) {
+    INFO("round " << round);
+    for (uint32_t i = 0; i < space.numObjects(); i++) {
+      auto &o = space.object(i);
+      switch (rng() % 4) {
+      case 0:
+        space.remove(i);
+        break;
+      case 1:
+        // Jumps, or reinserts a removed object
+        space.move(i, uniform(rng), uniform(rng), uniform(rng));
+        break;
+      default:
+        if (o.cell != SparseHashSpace::invalidCell()) {
+          space.move(i, o.pos + Vec3d(step(rng), step(rng), step(rng)));
+        }
+        break;
+      }
+    }
+    REQUIRE(space.consistent());
+    REQUIRE(matchesBruteForce(space, rng));
+  }
+
+  // Emptying the space leaves no cells
+  for (uint32_t i = 0; i < space.numObjects(); i++) {
+    space.remove(i);
+  }
+  REQUIRE(space.numCells() == 0);
+  REQUIRE(space.consistent());
+  SparseHashSpace::Query query;
+  REQUIRE(query(space, Vec3d(0, 0, 0)) == 0);
+}
+
+TEST_CASE("SparseHashSpace removes cells from collision chains") {
+  InspectedSpace space(1);
+  space.numObjects(6);
+  const uint32_t tableSize = space.tableSize();
+
+  // Cells with the same home slot, and one in the slot after it, which the
+  // chain runs into
+  std::vector<Vec3i> chain;
+  Vec3i next;
+  uint32_t home = space.slot(Vec3i(0, 0, 0));
+  bool haveNext = false;
+  for (int x = 0; x < 1000 && (chain.size() < 4 || !haveNext); x++) {
+    for (int y = 0; y < 10; y++) {
+      Vec3i coord(x, y, 0);
+      uint32_t s = space.slot(coord);
+      if (s == home && chain.size() < 4) {
+        chain.push_back(coord);
+      } else if (s == ((home + 1) & (tableSize - 1)) && !haveNext) {
+        next = coord;
+        haveNext = true;
+      }
+    }
+  }
+  REQUIRE(chain.size() == 4);
+  REQUIRE(haveNext);
+
+  auto place = [&](uint32_t id, const Vec3i &coord) {
+    space.move(id, coord.x + 0.5, coord.y + 0.5, coord.z + 0.5);
+  };
+  for (int i = 0; i < 3; i++) {
+    place(i, chain[i]);
+  }
+  place(3, next); // lands after the chain
+  place(4, chain[3]);
+  REQUIRE(space.tableSize() == tableSize);
+  REQUIRE(space.consistent());
+
+  // Removing the head shifts back the rest of the chain, but leaves the
+  // cell in its home slot where it is
+  space.remove(0);
+  REQUIRE(space.consistent());
+  for (uint32_t id : {1, 2, 3, 4}) {
+    SparseHashSpace::Query query(1);
+    REQUIRE(query(space, space.object(id).pos, 0.1) == 1);
+    REQUIRE(query[0] == &space.object(id));
+  }
+  // Then the middle and the end of the chain
+  space.remove(2);
+  REQUIRE(space.consistent());
+  space.remove(4);
+  REQUIRE(space.consistent());
+  place(0, chain[0]);
+  REQUIRE(space.consistent());
+  space.remove(1);
+  space.remove(3);
+  REQUIRE(space.consistent());
+  REQUIRE(space.numCells() == 1);
+  REQUIRE(space.findCell(chain[0]) == space.object(0).cell);
+}
+
+TEST_CASE("SparseHashSpace handles positions out of range") {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  InspectedSpace space(1);
+  space.numObjects(4);
+  space.move(0, 0, 0, 0);
+  space.move(1, 1e300, -1e300, 0);
+  space.move(2, HUGE_VAL, 0, 0);
+  space.move(3, 1, nan, 1);
+  // Non-finite positions are not in any cell, huge ones are clamped
+  REQUIRE(space.object(1).cell != SparseHashSpace::invalidCell());
+  REQUIRE(space.object(2).cell == SparseHashSpace::invalidCell());
+  REQUIRE(space.object(3).cell == SparseHashSpace::invalidCell());
+  REQUIRE(space.numCells() == 2);
+  REQUIRE(space.consistent());
+
+  SparseHashSpace::Query query;
+  REQUIRE(query(space, Vec3d(0, 0, 0)) == 2);
+  REQUIRE(query.clear()(space, Vec3d(0, 0, 0), 10) == 1);
+  REQUIRE(query.clear()(space, Vec3d(nan, 0, 0), 10) == 0);
+  REQUIRE(query.clear()(space, Vec3d(0, 0, 0), nan) == 0);
+  REQUIRE(query.clear()(space, Vec3d(1e300, -1e300, 0), 1) == 1);
+
+  // A moved object leaves its cell when its position becomes NaN
+  space.move(0, nan, 0, 0);
+  REQUIRE(space.object(0).cell == SparseHashSpace::invalidCell());
+  REQUIRE(space.numCells() == 1);
+  space.move(0, 2, 2, 2);
+  REQUIRE(query.clear()(space, Vec3d(2, 2, 2), 1) == 1);
+}
@@ -0,0 +1,49 @@
+#include "catch.hpp"
+
+#include "al/app/al_StateDistributionDomain.hpp"
+
+using namespace al;
+
+namespace {
+struct DeltaState {
+  uint32_t count;
+  float values[1000];
+};
+} // namespace
+
+TEST_CASE("StateSendDomain sends a keyframe to a receiver that joins") {
+  StateSendDomain<DeltaState> sender;
+  sender.configure(16350, "delta", "localhost");
+  // No periodic keyframe during the test
+  sender.setDeltaEncoding(true, 100000);
+  sender.setStatePointer(std::make_shared<DeltaState>());
+  *sender.state() = DeltaState{};
+  REQUIRE(sender.init());
+  for (int i = 0; i < 5; i++) {
+    sender.state()->count++;
+    REQUIRE(sender.tick());
+  }
+
+  SynchronousDomain parent;
+  StateReceiveDomain<DeltaState> receiver;
+  receiver.configure(16350, "delta", "localhost");
+  receiver.setStatePointer(std::make_shared<DeltaState>());
+  *receiver.state() = DeltaState{};
+  REQUIRE(receiver.init(&parent));
+
+  // The first delta the receiver gets makes it ask for a keyframe
+  al_sec deadline = al_steady_time() + 2.0;
+  while (receiver.state()->count != sender.state()->count &&
+         al_steady_time() < deadline) {
+    sender.state()->count++;
+    sender.state()->values[sender.state()->count % 1000] = 1.0f;
+    REQUIRE(sender.tick());
+    al_sleep(0.005);
+    receiver.tick();
+  }
+  REQUIRE(receiver.state()->count == sender.state()->count);
+  REQUIRE(receiver.stats().framesReceived > 0);
+
+  receiver.cleanup(&parent);
+  sender.cleanup();
+}
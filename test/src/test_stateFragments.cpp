@@ -0,0 +1,45 @@
+#include "catch.hpp"
+
+#include "al/app/al_StateDistributionDomain.hpp"
+
+using namespace al;
+
+namespace {
+// Adds a frame sent as a single fragment
+bool addFrame(StateFragmentAssembler &assembler, uint32_t session,
+              uint32_t frame) {
+  return assembler.addFragment(session, frame, 0, 1, 0, sizeof(frame), 0,
+                               &frame, sizeof(frame));
+}
+} // namespace
+
+TEST_CASE("StateFragmentAssembler receives a restarted sender at once") {
+  StateFragmentAssembler assembler;
+  for (uint32_t frame = 1; frame <= 600; frame++) {
+    REQUIRE(addFrame(assembler, 7, frame));
+  }
+  // Older frames of the same sender are late
+  REQUIRE_FALSE(addFrame(assembler, 7, 599));
+  REQUIRE(assembler.stats().fragmentsRejected == 1);
+
+  // The restarted sender counts from 1 again in a new session
+  REQUIRE(addFrame(assembler, 9, 1));
+  REQUIRE(assembler.frame() == 1);
+  REQUIRE(addFrame(assembler, 9, 2));
+  REQUIRE(assembler.stats().framesMissed == 0);
+
+  // Fragments of the previous sender still in flight are rejected
+  REQUIRE_FALSE(addFrame(assembler, 7, 601));
+  REQUIRE(assembler.frame() == 2);
+  REQUIRE(assembler.stats().fragmentsRejected == 2);
+  REQUIRE(assembler.stats().framesReceived == 602);
+}
+
+TEST_CASE("StateFragmentSender picks a session") {
+  StateFragmentSender first, second;
+  first.configure("state", 1400);
+  second.configure("state", 1400);
+  REQUIRE(first.session() != 0);
+  REQUIRE(second.session() != 0);
+  REQUIRE(first.session() != second.session());
+}
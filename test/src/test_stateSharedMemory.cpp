@@ -0,0 +1,151 @@
+
+#include "catch.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "al/app/al_StateDistributionDomain.hpp"
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace al;
+
+#ifndef _WIN32
+namespace {
+struct CounterState {
+  uint32_t writer;
+  uint32_t count;
+};
+
+// Publishes states tagged with the writer number, then removes the region
+void runWriter(const std::string &name, uint32_t writer, double duration) {
+  StateSharedMemory shared;
+  if (!shared.create(name, sizeof(CounterState))) {
+    _exit(1);
+  }
+  al_sec end = al_steady_time() + duration;
+  for (uint32_t count = 1; al_steady_time() < end; count++) {
+    CounterState state{writer, count};
+    std::memcpy(shared.back(), &state, sizeof(state));
+    shared.publish(count);
+    al_sleep(0.001);
+  }
+  shared.close();
+  _exit(0);
+}
+
+// Ticks the receiver until it shows a state from the writer
+bool waitForWriter(StateReceiveDomain<CounterState> &receiver,
+                   uint32_t writer) {
+  al_sec deadline = al_steady_time() + 2.0;
+  while (al_steady_time() < deadline) {
+    receiver.tick();
+    if (receiver.state()->writer == writer && receiver.state()->count > 0) {
+      return true;
+    }
+    al_sleep(0.001);
+  }
+  return false;
+}
+} // namespace
+
+TEST_CASE("StateSharedMemory writer restart") {
+  std::string name =
+      StateSharedMemory::regionName("test_restart_" + std::to_string(getpid()));
+  SynchronousDomain parent;
+  StateReceiveDomain<CounterState> receiver;
+  receiver.setSharedMemory(true, name);
+  receiver.setStatePointer(std::make_shared<CounterState>());
+  *receiver.state() = CounterState{0, 0};
+  REQUIRE(receiver.init(&parent));
+
+  // Each writer process removes the region when it exits, the next one
+  // creates a new region under the same name
+  for (uint32_t writer = 1; writer <= 3; writer++) {
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+      runWriter(name, writer, 1.0);
+    }
+    bool received = waitForWriter(receiver, writer);
+    int status;
+    waitpid(pid, &status, 0);
+    INFO("writer " << writer);
+    REQUIRE(received);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+  }
+  receiver.cleanup(&parent);
+}
+
+TEST_CASE("StateReceiveDomain reads states in place") {
+  std::string name =
+      StateSharedMemory::regionName("test_inplace_" + std::to_string(getpid()));
+  StateSharedMemory writer;
+  REQUIRE(writer.create(name, sizeof(CounterState)));
+
+  SynchronousDomain parent;
+  StateReceiveDomain<CounterState> receiver;
+  receiver.setSharedMemory(true, name);
+  receiver.setCopyState(false);
+  REQUIRE(receiver.init(&parent));
+  receiver.tick();
+  REQUIRE(receiver.receivedState() == nullptr);
+
+  for (uint32_t count = 1; count <= 3; count++) {
+    CounterState state{1, count};
+    std::memcpy(writer.back(), &state, sizeof(state));
+    writer.publish(count);
+    receiver.tick();
+    REQUIRE(receiver.receivedState() != nullptr);
+    REQUIRE(receiver.receivedState()->count == count);
+    REQUIRE(receiver.frame() == count);
+  }
+  // Nothing is copied
+  REQUIRE(receiver.state() == nullptr);
+
+  // States of a removed region are not shown
+  writer.close();
+  receiver.tick();
+  REQUIRE(receiver.receivedState() == nullptr);
+  receiver.cleanup(&parent);
+}
+
+TEST_CASE("StateSharedMemory maps while the other side is running") {
+  std::string name =
+      StateSharedMemory::regionName("test_remap_" + std::to_string(getpid()));
+  const size_t size = 4096;
+  StateSharedMemory writer;
+  REQUIRE(writer.create(name, size));
+  std::atomic<bool> running{true};
+  std::thread writing([&]() {
+    for (uint32_t count = 1; running; count++) {
+      std::memset(writer.back(), int(count & 0xff), size);
+      writer.publish(count);
+    }
+  });
+
+  // The buffer a reader maps is never written to until it acquires another
+  StateSharedMemory reader;
+  std::vector<unsigned char> copy(size);
+  int overwritten = 0;
+  for (int i = 0; i < 2000; i++) {
+    REQUIRE(reader.open(name, size));
+    if (i % 2) {
+      reader.acquire();
+    }
+    std::memcpy(copy.data(), reader.front(), size);
+    std::this_thread::yield();
+    overwritten += std::memcmp(copy.data(), reader.front(), size) != 0;
+    reader.close();
+  }
+  running = false;
+  writing.join();
+  REQUIRE(overwritten == 0);
+}
+#endif